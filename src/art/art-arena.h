@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+#include "art/art-node-del.h"
+#include "art/art-node-pool.h"
+#include "art/art-reserve.h"
+#include "common/epoch.h"
+
+namespace art {
+namespace detail {
+
+// Destroy the values of the leaves below |node|, leaving their memory to
+// the arena.
+template <class T>
+static void art_destroy_values(ArtNodeCommon* node) {
+  if (art_is_lazy_leaf(node)) return;
+  switch (node->type) {
+    case ART_NODE_4: {
+      auto n = reinterpret_cast<ArtNode4*>(node);
+      for (uint16_t i = 0; i < n->childNum; i++) {
+        art_destroy_values<T>(n->children[i]);
+      }
+    } break;
+    case ART_NODE_16: {
+      auto n = reinterpret_cast<ArtNode16*>(node);
+      for (uint16_t i = 0; i < n->childNum; i++) {
+        art_destroy_values<T>(n->children[i]);
+      }
+    } break;
+    case ART_NODE_48: {
+      reinterpret_cast<ArtNode48*>(node)->for_each_child(
+          [](uint8_t, ArtNodeCommon* c) { art_destroy_values<T>(c); });
+    } break;
+    case ART_NODE_256: {
+      reinterpret_cast<ArtNode256*>(node)->for_each_child(
+          [](uint8_t, ArtNodeCommon* c) { art_destroy_values<T>(c); });
+    } break;
+    case ART_NODE_LEAF: {
+      reinterpret_cast<ArtLeaf<T>*>(node)->~ArtLeaf<T>();
+    } break;
+    default: {
+      LOG_ERROR("unknown node type");
+    } break;
+  }
+}
+
+}  // namespace detail
+
+// Allocator policies of ArtTree. A policy hands out a Scope that routes the
+// nodes built by the calling thread, and frees whole trees of its nodes.
+
+// Nodes come from the object pools all trees of the process share, see
+// get_pool_usage(). Freed nodes go back to the pools one by one.
+class ArtPoolAlloc {
+ public:
+  class Scope {
+   public:
+    explicit Scope(ArtPoolAlloc&) {}
+  };
+
+  // Fill the pools with |counts| free nodes, split into a share for each of
+  // |threads| threads, see reserve_objects(). Free nodes other trees gave
+  // back count too.
+  void reserve(const detail::ArtNodeCounts& counts, uint32_t threads) {
+    reserve_objects<ArtNode4>(counts.inner[ART_NODE_4 - 1], threads);
+    reserve_objects<ArtNode16>(counts.inner[ART_NODE_16 - 1], threads);
+    reserve_objects<ArtNode48>(counts.inner[ART_NODE_48 - 1], threads);
+    reserve_objects<ArtNode256>(counts.inner[ART_NODE_256 - 1], threads);
+    for (uint8_t cls = 1; cls <= detail::ART_LEAF_SIZE_CLASS_NUM; cls++) {
+      detail::reserve_leaf_pool(cls, counts.leaf[cls], threads);
+    }
+  }
+
+  // Free the nodes below |root| now, no reader may hold them.
+  template <class T>
+  void destroy(ArtNodeCommon* root) {
+    if (root) detail::destroy_node<T>(root);
+  }
+
+  // Free the nodes below |root|, just unlinked from the tree, once no reader
+  // can hold them.
+  template <class T>
+  void retire(ArtNodeCommon* root) {
+    if (!root) return;
+    epoch_retire(root, [](void* p) {
+      detail::destroy_node<T>(static_cast<ArtNodeCommon*>(p));
+    });
+  }
+};
+
+// Nodes come from slabs of the tree alone, see SlabArena. Dropping or
+// clearing the tree gives back whole slabs without visiting a node, and
+// the memory of the tree is known at any time. Writers of the same tree
+// share a lock per node type, so this suits many small, short-lived trees
+// better than one big tree under concurrent writers.
+class ArtArenaAlloc {
+ public:
+  ArtArenaAlloc() : arena_(detail::art_new_arena()) {}
+  ~ArtArenaAlloc() { arena_->close(); }
+
+  ArtArenaAlloc(const ArtArenaAlloc&) = delete;
+  ArtArenaAlloc& operator=(const ArtArenaAlloc&) = delete;
+
+  class Scope {
+   public:
+    explicit Scope(ArtArenaAlloc& alloc) : scope_(alloc.arena_) {}
+
+   private:
+    detail::SlabArena::Scope scope_;
+  };
+
+  // Carve |counts| free nodes from slabs of the arena. Writers share the
+  // arena, so |threads| does not matter.
+  void reserve(const detail::ArtNodeCounts& counts, uint32_t) {
+    for (uint32_t i = 0; i < ART_NODE_256; i++) {
+      arena_->reserve(i, counts.inner[i]);
+    }
+    for (uint8_t cls = 1; cls <= detail::ART_LEAF_SIZE_CLASS_NUM; cls++) {
+      arena_->reserve(cls + detail::ART_ARENA_LEAF_CLASS_BASE,
+                      counts.leaf[cls]);
+    }
+  }
+
+  // All nodes of the tree live in the arena, they go with it. Values that
+  // need it are destroyed first.
+  template <class T>
+  void destroy(ArtNodeCommon* root) {
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      if (root) detail::art_destroy_values<T>(root);
+    }
+  }
+
+  // Start over with a new arena. Writers must be held off, readers may
+  // still be on the old nodes, so the old arena is closed after them.
+  template <class T>
+  void retire(ArtNodeCommon* root) {
+    auto old = arena_;
+    arena_ = detail::art_new_arena();
+    if constexpr (std::is_trivially_destructible_v<T>) {
+      epoch_retire(old, [](void* p) {
+        static_cast<detail::SlabArena*>(p)->close();
+      });
+    } else {
+      epoch_retire(new Retired{old, root}, [](void* p) {
+        auto retired = static_cast<Retired*>(p);
+        if (retired->root) detail::art_destroy_values<T>(retired->root);
+        retired->arena->close();
+        delete retired;
+      });
+    }
+  }
+
+  // Bytes the tree takes from the system, and the part of them in use. The
+  // rest is kept for reuse by the tree.
+  size_t bytes() const { return arena_->bytes(); }
+  size_t used_bytes() const { return arena_->used_bytes(); }
+
+ private:
+  // An old arena with the values still to destroy in it.
+  struct Retired {
+    detail::SlabArena* arena;
+    ArtNodeCommon* root;
+  };
+
+  detail::SlabArena* arena_;
+};
+
+}  // namespace art
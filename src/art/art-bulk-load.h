@@ -0,0 +1,435 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "art/art-key-traits.h"
+#include "art/art-node-pool.h"
+
+namespace art {
+namespace detail {
+
+// Inner node of |type| holding |num| children, |bytes| sorted. |num| must
+// fit the type.
+static inline ArtNodeCommon *art_make_inner_node(ArtNodeType type,
+                                                 const uint8_t *bytes,
+                                                 ArtNodeCommon *const *children,
+                                                 uint32_t num) {
+  ArtNodeCommon *ret = nullptr;
+  switch (type) {
+    case ART_NODE_4: {
+      assert(num <= ArtNodeTrait<ArtNode4>::NODE_CAPASITY);
+      auto node = get_new_art_node<ArtNode4>();
+      std::memcpy(node->keys, bytes, num);
+      std::memcpy(node->children, children, num * sizeof(void *));
+      ret = node;
+    } break;
+    case ART_NODE_16: {
+      assert(num <= ArtNodeTrait<ArtNode16>::NODE_CAPASITY);
+      auto node = get_new_art_node<ArtNode16>();
+      std::memcpy(node->keys, bytes, num);
+      std::memcpy(node->children, children, num * sizeof(void *));
+      ret = node;
+    } break;
+    case ART_NODE_48: {
+      assert(num <= ArtNodeTrait<ArtNode48>::NODE_CAPASITY);
+      auto node = get_new_art_node<ArtNode48>();
+      for (uint32_t i = 0; i < num; i++) {
+        node->index[bytes[i]] = i + 1;
+        node->present.set(bytes[i]);
+      }
+      std::memcpy(node->children, children, num * sizeof(void *));
+      node->used_slots = (1ULL << num) - 1;
+      ret = node;
+    } break;
+    case ART_NODE_256: {
+      auto node = get_new_art_node<ArtNode256>();
+      for (uint32_t i = 0; i < num; i++) {
+        node->set_child(bytes[i], children[i]);
+      }
+      ret = node;
+    } break;
+    default:
+      LOG_ERROR("unknown node type");
+      return nullptr;
+  }
+  ret->childNum = num;
+  return ret;
+}
+
+// Build a tree bottom-up from keys appended in ascending order.
+//
+// With sorted input, the first byte where a key differs from its predecessor
+// is the depth of the inner node they branch at. Open inner nodes are kept on
+// a stack ordered by that depth. A node is closed once a key branches above
+// it: its child count is final then, so it is allocated with the smallest
+// type that fits and never grows. Nothing is locked or published, the caller
+// links the root returned by finish().
+template <class T, class KeyTraits = ArtStringKeyTraits>
+class ArtBulkBuilder {
+ public:
+  ArtBulkBuilder() = default;
+
+  ArtBulkBuilder(const ArtBulkBuilder &) = delete;
+  ArtBulkBuilder &operator=(const ArtBulkBuilder &) = delete;
+
+  // Append a key, a key equal to the last one replaces its value. Returns
+  // false and keeps state unchanged if |key| sorts before the last key, or if
+  // the tree can not tell them apart (|key| is the last key followed by '\0').
+  bool add(const char *key, uint32_t len, T value) {
+    if (unlikely(!has_last_)) {
+      last_key_.assign(key, len);
+      last_value_ = value;
+      has_last_ = true;
+      count_++;
+      return true;
+    }
+
+    const char *prev = last_key_.data();
+    uint32_t prev_len = last_key_.size();
+    uint32_t min_len = std::min(prev_len, len);
+    uint32_t depth = 0;
+    while (depth < min_len && prev[depth] == key[depth]) depth++;
+
+    if (depth == min_len) {
+      if (len == prev_len) {
+        last_value_ = value;
+        return true;
+      }
+      // A shorter key branches with byte 0, which must not be used by the
+      // longer one.
+      if (len < prev_len || key[depth] == 0) return false;
+    } else if ((uint8_t)key[depth] < (uint8_t)prev[depth]) {
+      return false;
+    }
+
+    close_deeper_than(depth, prev, prev_len);
+    last_key_.assign(key, len);
+    last_value_ = value;
+    count_++;
+    return true;
+  }
+
+  // Close all open nodes and return the root, nullptr if nothing was added.
+  // Prefix of the root covers keys from |base_depth| on. The builder is empty
+  // afterwards.
+  ArtNodeCommon *finish(uint32_t base_depth = 0) {
+    if (!has_last_) return nullptr;
+
+    const char *prev = last_key_.data();
+    ArtNodeCommon *pending = make_last_leaf();
+    uint32_t pending_depth = LEAF_DEPTH;
+    while (top_) {
+      Frame &f = frames_[--top_];
+      attach(f, pending, pending_depth, prev, last_key_.size());
+      pending = close(f);
+      pending_depth = f.depth;
+    }
+    if (pending_depth != LEAF_DEPTH) {
+      art_init_prefix(pending, prev + base_depth, pending_depth - base_depth,
+                      KeyTraits::FULL_PREFIX);
+    }
+
+    has_last_ = false;
+    return pending;
+  }
+
+  // Number of distinct keys added.
+  uint64_t count() const { return count_; }
+
+  // Inner node of the smallest type holding |num| children, |bytes| sorted.
+  static ArtNodeCommon *make_node(const uint8_t *bytes,
+                                  ArtNodeCommon *const *children,
+                                  uint32_t num) {
+    assert(num >= 2);
+    ArtNodeType type = ART_NODE_256;
+    if (num <= ArtNodeTrait<ArtNode4>::NODE_CAPASITY) {
+      type = ART_NODE_4;
+    } else if (num <= ArtNodeTrait<ArtNode16>::NODE_CAPASITY) {
+      type = ART_NODE_16;
+    } else if (num <= ArtNodeTrait<ArtNode48>::NODE_CAPASITY) {
+      type = ART_NODE_48;
+    }
+    return art_make_inner_node(type, bytes, children, num);
+  }
+
+  static uint8_t byte_at(const char *key, uint32_t len, uint32_t depth) {
+    return depth < len ? key[depth] : 0;
+  }
+
+ private:
+  static constexpr uint32_t LEAF_DEPTH = UINT32_MAX;
+
+  struct Frame {
+    uint32_t depth;
+    uint32_t num;
+    uint8_t bytes[256];
+    ArtNodeCommon *children[256];
+  };
+
+  // Pop nodes branching below |depth|, then hang the last leaf, or the
+  // subtree it ended up in, on the node branching at |depth|.
+  void close_deeper_than(uint32_t depth, const char *prev,
+                         uint32_t prev_len) {
+    ArtNodeCommon *pending = make_last_leaf();
+    uint32_t pending_depth = LEAF_DEPTH;
+    while (top_ && frames_[top_ - 1].depth > depth) {
+      Frame &f = frames_[--top_];
+      attach(f, pending, pending_depth, prev, prev_len);
+      pending = close(f);
+      pending_depth = f.depth;
+    }
+
+    if (top_ == 0 || frames_[top_ - 1].depth < depth) {
+      if (top_ == frames_.size()) frames_.emplace_back();
+      frames_[top_].depth = depth;
+      frames_[top_].num = 0;
+      top_++;
+    }
+    attach(frames_[top_ - 1], pending, pending_depth, prev, prev_len);
+  }
+
+  // |key| is any key below |child|. Prefix of an inner child is only known
+  // now, as the node it hangs on may have been pushed after it was opened.
+  void attach(Frame &f, ArtNodeCommon *child, uint32_t child_depth,
+              const char *key, uint32_t len) {
+    if (child_depth != LEAF_DEPTH) {
+      art_init_prefix(child, key + f.depth + 1, child_depth - f.depth - 1,
+                      KeyTraits::FULL_PREFIX);
+    }
+    f.bytes[f.num] = byte_at(key, len, f.depth);
+    f.children[f.num] = child;
+    f.num++;
+  }
+
+  // Leaf of the last key, created once its value is final.
+  ArtNodeCommon *make_last_leaf() const {
+    return get_new_leaf<T, KeyTraits::LAZY_LEAF>(
+        last_key_.data(), last_key_.size(), last_value_);
+  }
+
+  static ArtNodeCommon *close(const Frame &f) {
+    return make_node(f.bytes, f.children, f.num);
+  }
+
+  bool has_last_ = false;
+  std::string last_key_;
+  T last_value_{};
+  std::vector<Frame> frames_;
+  uint32_t top_ = 0;
+  uint64_t count_ = 0;
+};
+
+// Parallel form of ArtBulkBuilder over |n| pairs read by index, key_at(i)
+// returns a std::string_view and val_at(i) the value.
+//
+// Sorted input is cut at the byte following the common prefix of a range,
+// and big pieces are cut again the same way, until there are enough pieces
+// to keep |thread_num| workers busy. Each piece is built by its own builder
+// on a worker, allocating from the thread-local pool of that worker, and the
+// pieces are stitched under nodes made for the cuts. Unsorted input is first
+// bucketed by the byte following the global common prefix and the buckets
+// are sorted in parallel.
+template <class T, class KeyTraits, class KeyAt, class ValAt>
+class ArtParallelBuilder {
+ public:
+  ArtParallelBuilder(size_t n, KeyAt key_at, ValAt val_at, uint32_t thread_num)
+      : n_(n),
+        key_at_(std::move(key_at)),
+        val_at_(std::move(val_at)),
+        thread_num_(std::max(thread_num, 1u)) {}
+
+  // Returns the root, nullptr if input is empty. Indexes of pairs a builder
+  // refused, see ArtBulkBuilder::add(), are appended to |rejected|.
+  ArtNodeCommon *build(std::vector<size_t> *rejected) {
+    if (n_ == 0) return nullptr;
+
+    bool sorted = true;
+    for (size_t i = 1; i < n_ && sorted; i++) {
+      sorted = !(key_at_(i) < key_at_(i - 1));
+    }
+    if (!sorted) sort_order();
+
+    grain_ = std::max<size_t>(n_ / (thread_num_ * 8), MIN_GRAIN);
+    plan(0, n_, 0);
+    run_parallel(tasks_.size(), [this](size_t i) { build_piece(tasks_[i]); });
+
+    ArtNodeCommon *root = assemble(0);
+    for (auto &part : parts_) {
+      count_ += part.count;
+      rejected->insert(rejected->end(), part.rejected.begin(),
+                       part.rejected.end());
+    }
+    return root;
+  }
+
+  // Number of distinct keys in the built tree.
+  uint64_t count() const { return count_; }
+
+ private:
+  static constexpr size_t MIN_GRAIN = 4096;
+
+  // A range [lo, hi) of sorted positions starting at depth |base|. A cut
+  // part branches at |depth| into |children|, others are built as a whole.
+  struct Part {
+    size_t lo;
+    size_t hi;
+    uint32_t base;
+    uint32_t depth;
+    std::vector<std::pair<uint8_t, uint32_t>> children;
+    ArtNodeCommon *root = nullptr;
+    uint64_t count = 0;
+    std::vector<size_t> rejected;
+  };
+
+  size_t pos(size_t i) const { return order_.empty() ? i : order_[i]; }
+
+  std::string_view key(size_t i) const { return key_at_(pos(i)); }
+
+  static uint8_t byte_at(std::string_view k, uint32_t depth) {
+    return ArtBulkBuilder<T, KeyTraits>::byte_at(k.data(), k.size(), depth);
+  }
+
+  template <class F>
+  void run_parallel(size_t task_num, F &&fn) {
+    std::atomic<size_t> next{0};
+    // nodes come from wherever the caller's come from
+    SlabArena *arena = SlabArena::current();
+    auto worker = [&]() {
+      SlabArena::Scope scope(arena);
+      for (size_t i = next++; i < task_num; i = next++) fn(i);
+    };
+    std::vector<std::thread> threads;
+    size_t thread_num = std::min<size_t>(thread_num_, task_num);
+    for (size_t i = 1; i < thread_num; i++) threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads) t.join();
+  }
+
+  // Stable, so that the last of duplicate keys still wins.
+  void sort_order() {
+    std::string_view first = key_at_(0);
+    uint32_t common = first.size();
+    for (size_t i = 1; i < n_; i++) {
+      std::string_view k = key_at_(i);
+      uint32_t d = 0;
+      uint32_t max_d = std::min<uint32_t>(common, k.size());
+      while (d < max_d && first[d] == k[d]) d++;
+      common = d;
+    }
+
+    size_t bucket_begin[257] = {0};
+    for (size_t i = 0; i < n_; i++) {
+      bucket_begin[byte_at(key_at_(i), common) + 1]++;
+    }
+    for (int32_t b = 0; b < 256; b++) bucket_begin[b + 1] += bucket_begin[b];
+
+    size_t fill[256];
+    std::copy(bucket_begin, bucket_begin + 256, fill);
+    order_.resize(n_);
+    for (size_t i = 0; i < n_; i++) {
+      order_[fill[byte_at(key_at_(i), common)]++] = i;
+    }
+
+    run_parallel(256, [this, &bucket_begin](size_t b) {
+      auto begin = order_.begin();
+      std::stable_sort(
+          begin + bucket_begin[b], begin + bucket_begin[b + 1],
+          [this](size_t l, size_t r) { return key_at_(l) < key_at_(r); });
+    });
+  }
+
+  uint32_t plan(size_t lo, size_t hi, uint32_t base) {
+    uint32_t idx = parts_.size();
+    parts_.emplace_back();
+    parts_[idx].lo = lo;
+    parts_[idx].hi = hi;
+    parts_[idx].base = base;
+
+    std::string_view first = key(lo);
+    std::string_view last = key(hi - 1);
+    uint32_t depth = base;
+    uint32_t min_len = std::min(first.size(), last.size());
+    while (depth < min_len && first[depth] == last[depth]) depth++;
+
+    if (hi - lo <= grain_ || byte_at(first, depth) == byte_at(last, depth)) {
+      tasks_.push_back(idx);
+      return idx;
+    }
+
+    std::vector<std::pair<uint8_t, uint32_t>> children;
+    for (size_t i = lo; i < hi;) {
+      uint8_t b = byte_at(key(i), depth);
+      size_t j = i + 1;
+      for (size_t step = 1; j < hi && byte_at(key(j), depth) == b; step *= 2) {
+        j = std::min(j + step, hi);
+      }
+      // first position of next byte is in (j - step, j]
+      size_t l = i + 1;
+      size_t r = j;
+      while (l < r) {
+        size_t m = (l + r) / 2;
+        if (byte_at(key(m), depth) == b) {
+          l = m + 1;
+        } else {
+          r = m;
+        }
+      }
+      children.emplace_back(b, plan(i, l, depth + 1));
+      i = l;
+    }
+    parts_[idx].depth = depth;
+    parts_[idx].children = std::move(children);
+    return idx;
+  }
+
+  void build_piece(uint32_t idx) {
+    Part &part = parts_[idx];
+    ArtBulkBuilder<T, KeyTraits> builder;
+    for (size_t i = part.lo; i < part.hi; i++) {
+      std::string_view k = key(i);
+      if (!builder.add(k.data(), k.size(), val_at_(pos(i)))) {
+        part.rejected.push_back(pos(i));
+      }
+    }
+    part.count = builder.count();
+    part.root = builder.finish(part.base);
+  }
+
+  ArtNodeCommon *assemble(uint32_t idx) {
+    Part &part = parts_[idx];
+    if (part.children.empty()) return part.root;
+
+    uint8_t bytes[256];
+    ArtNodeCommon *children[256];
+    uint32_t num = 0;
+    for (auto &child : part.children) {
+      bytes[num] = child.first;
+      children[num] = assemble(child.second);
+      num++;
+    }
+    part.root = ArtBulkBuilder<T, KeyTraits>::make_node(bytes, children, num);
+    art_init_prefix(part.root, key(part.lo).data() + part.base,
+                    part.depth - part.base, KeyTraits::FULL_PREFIX);
+    return part.root;
+  }
+
+  size_t n_;
+  KeyAt key_at_;
+  ValAt val_at_;
+  uint32_t thread_num_;
+  size_t grain_ = MIN_GRAIN;
+  std::vector<size_t> order_;
+  std::vector<Part> parts_;
+  std::vector<uint32_t> tasks_;
+  uint64_t count_ = 0;
+};
+
+}  // namespace detail
+}  // namespace art
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "art/art-node-pool.h"
+#include "art/art-size.h"
+#include "common/epoch.h"
+
+namespace art {
+namespace detail {
+
+// Copy on write support for snapshots.
+//
+// A snapshot marks the root shared. Before a write, the writer copies every
+// shared node on the path of its key, and a copy marks the children of the
+// node it replaces shared in turn. So the write only changes nodes that no
+// snapshot can see, and a snapshot keeps reading the nodes it started with.
+// Replaced nodes are freed once no snapshot taken before the replacement is
+// left.
+
+// Lets snapshot() wait until no write is in flight. Writers count themselves
+// in a per-thread stripe, so an open gate costs them no shared cache line.
+class ArtWriteGate {
+ public:
+  class Pass {
+   public:
+    explicit Pass(ArtWriteGate& gate) : gate_(gate) { gate_.enter(); }
+    ~Pass() { gate_.exit(); }
+
+    Pass(const Pass&) = delete;
+    Pass& operator=(const Pass&) = delete;
+
+   private:
+    ArtWriteGate& gate_;
+  };
+
+  void enter() {
+    auto& cnt = stripes_.local().cnt;
+    while (true) {
+      cnt.fetch_add(1);
+      if (!closed_.load()) return;
+      cnt.fetch_sub(1);
+      while (closed_.load()) std::this_thread::yield();
+    }
+  }
+
+  void exit() { stripes_.local().cnt.fetch_sub(1); }
+
+  // Keep new writers out and wait for the ones inside to leave. Must not be
+  // called from inside a write, e.g. an upsert() callback. A writer that
+  // allocates the stripe array does so before it checks the gate, so the
+  // array is seen here if the writer got in.
+  void close() {
+    mutex_.lock();
+    closed_.store(true);
+    stripes_.for_each([](Stripe& stripe) {
+      while (stripe.cnt.load()) std::this_thread::yield();
+    });
+  }
+
+  void open() {
+    closed_.store(false);
+    mutex_.unlock();
+  }
+
+ private:
+  struct alignas(64) Stripe {
+    std::atomic<uint32_t> cnt = {0};
+  };
+
+  ArtLazyStripes<Stripe> stripes_;
+  std::atomic<bool> closed_ = {false};
+  std::mutex mutex_;
+};
+
+static inline void art_mark_shared(ArtNodeCommon* node) {
+  if (node && !art_is_lazy_leaf(node)) node->set_shared_flag();
+}
+
+template <class N>
+static ArtNodeCommon* art_copy_inner_node(const N* src) {
+  N* dst = get_new_art_node<N>();
+  constexpr size_t HEAD = sizeof(ArtNodeCommon);
+  std::memcpy(reinterpret_cast<char*>(dst) + HEAD,
+              reinterpret_cast<const char*>(src) + HEAD, sizeof(N) - HEAD);
+  dst->childNum = src->childNum;
+  if (src->has_full_prefix()) {
+    // the source keeps its buffer for snapshots
+    auto prefix = src->prefix_view();
+    dst->key.keyPtr = reinterpret_cast<char*>(
+        art_new_prefix_buf(prefix.data(), prefix.size()));
+    dst->keyLen = src->keyLen;
+    dst->set_full_prefix_flag();
+  } else {
+    dst->key = src->key;
+    dst->keyLen = src->keyLen;
+  }
+  return dst;
+}
+
+// Unpublished copy of shared |node|, owned by the caller. Children of the
+// copy are reachable from |node| too, so they are marked shared before the
+// copy can be published.
+template <class T>
+static ArtNodeCommon* art_copy_shared_node(const ArtNodeCommon* node) {
+  assert(node->is_shared());
+  ArtNodeCommon* ret = nullptr;
+  switch (node->type) {
+    case ART_NODE_4: {
+      auto n = reinterpret_cast<const ArtNode4*>(node);
+      for (uint32_t i = 0; i < n->childNum; i++) {
+        art_mark_shared(n->children[i]);
+      }
+      ret = art_copy_inner_node(n);
+    } break;
+    case ART_NODE_16: {
+      auto n = reinterpret_cast<const ArtNode16*>(node);
+      for (uint32_t i = 0; i < n->childNum; i++) {
+        art_mark_shared(n->children[i]);
+      }
+      ret = art_copy_inner_node(n);
+    } break;
+    case ART_NODE_48: {
+      auto n = reinterpret_cast<const ArtNode48*>(node);
+      n->for_each_child([](uint8_t, ArtNodeCommon* c) { art_mark_shared(c); });
+      ret = art_copy_inner_node(n);
+    } break;
+    case ART_NODE_256: {
+      auto n = reinterpret_cast<const ArtNode256*>(node);
+      n->for_each_child([](uint8_t, ArtNodeCommon* c) { art_mark_shared(c); });
+      ret = art_copy_inner_node(n);
+    } break;
+    case ART_NODE_LEAF: {
+      auto n = reinterpret_cast<const ArtLeaf<T>*>(node);
+      ret = get_new_leaf_node<T>(n->get_key(), n->keyLen, n->value);
+    } break;
+    default:
+      LOG_ERROR("unknown node type");
+  }
+  return ret;
+}
+
+// Free a single node now, its children are accounted for on their own.
+template <class T>
+static void art_free_one_node(ArtNodeCommon* node) {
+  switch (node->type) {
+    case ART_NODE_4: {
+      art_release_prefix(node, true);
+      return_art_node(reinterpret_cast<ArtNode4*>(node));
+    } break;
+    case ART_NODE_16: {
+      art_release_prefix(node, true);
+      return_art_node(reinterpret_cast<ArtNode16*>(node));
+    } break;
+    case ART_NODE_48: {
+      art_release_prefix(node, true);
+      return_art_node(reinterpret_cast<ArtNode48*>(node));
+    } break;
+    case ART_NODE_256: {
+      art_release_prefix(node, true);
+      return_art_node(reinterpret_cast<ArtNode256*>(node));
+    } break;
+    case ART_NODE_LEAF: {
+      return_art_node(reinterpret_cast<ArtLeaf<T>*>(node));
+    } break;
+    default:
+      LOG_ERROR("unknown node type");
+  }
+}
+
+template <class T>
+static void art_free_one_node_erased(void* p) {
+  art_free_one_node<T>(static_cast<ArtNodeCommon*>(p));
+}
+
+// Live snapshots of a tree and the nodes kept only for them. A node copied
+// away is tagged with the id of the newest snapshot at that time, it can be
+// seen by that snapshot and older ones only.
+template <class T>
+class ArtSnapshotList {
+ public:
+  ~ArtSnapshotList() { assert(live_.empty() && retired_.empty()); }
+
+  // Register a new snapshot, called with the write gate closed.
+  uint64_t acquire() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    live_.insert(++last_id_);
+    live_cnt_.fetch_add(1);
+    return last_id_;
+  }
+
+  // Drop snapshot |id| and retire the nodes no remaining snapshot can see,
+  // called with the write gate closed.
+  // Readers of the live tree may still hold some of them, so they go to the
+  // epoch manager as one batch, a release can free many thousand nodes.
+  void release(uint64_t id) {
+    auto batch = new std::vector<ArtNodeCommon*>();
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      live_.erase(id);
+      live_cnt_.fetch_sub(1);
+      uint64_t oldest = live_.empty() ? UINT64_MAX : *live_.begin();
+      while (!retired_.empty() && retired_.front().first < oldest) {
+        batch->push_back(retired_.front().second);
+        retired_.pop_front();
+      }
+    }
+    if (batch->empty()) {
+      delete batch;
+      return;
+    }
+    for (auto node : *batch) {
+      if (auto arena = art_node_arena(node)) arena->hold();
+    }
+    epoch_retire(batch, [](void* p) {
+      auto nodes = static_cast<std::vector<ArtNodeCommon*>*>(p);
+      for (auto node : *nodes) {
+        auto arena = art_node_arena(node);
+        art_free_one_node<T>(node);
+        if (arena) arena->unhold();
+      }
+      delete nodes;
+    });
+  }
+
+  // Whether writes have to copy shared nodes. Stable while in the gate, as
+  // acquire() and release() are both called with it closed.
+  bool live() const { return live_cnt_.load() != 0; }
+
+  // Keep |node|, just unlinked from the live tree, for the snapshots.
+  void retire(ArtNodeCommon* node) {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (!live_.empty()) {
+        retired_.emplace_back(last_id_, node);
+        return;
+      }
+    }
+    art_epoch_free<art_free_one_node_erased<T>, art_node_arena>(node);
+  }
+
+  size_t retired_num() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return retired_.size();
+  }
+
+ private:
+  std::mutex mutex_;
+  uint64_t last_id_ = 0;
+  std::set<uint64_t> live_;
+  std::atomic<uint32_t> live_cnt_ = {0};
+  std::deque<std::pair<uint64_t, ArtNodeCommon*>> retired_;
+};
+
+}  // namespace detail
+}  // namespace art
@@ -0,0 +1,576 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "art/art-serialize.h"
+#include "common/logger.h"
+
+namespace art {
+namespace detail {
+
+// Frozen tree image, written by ArtSnapshot::freeze() and served by
+// FrozenArt straight from a read-only mapping.
+//
+// The image is a trie of the same shape as the tree, written bottom up so a
+// node only refers to nodes before it. References are u32 offsets in units
+// of 8 bytes, which keeps the image position independent and up to 32 GiB.
+// Nodes carry no lock, version or pool state, and prefixes are kept whole so
+// lookups never go to a leaf to recover one.
+//
+//   head   "ARTFROZ\0", u32 format version, u32 sizeof(T)
+//   nodes  8 byte aligned, see below
+//   tail   u64 reference of the root (0 if empty), u64 number of keys,
+//          "ARTFROZ\0"
+//
+// Every node starts with a FrozenNodeHead. An inner node follows with its
+// prefix, then by kind:
+//   LIST    up to 16 children: sorted child bytes, u32 references
+//   INDEX   up to 48 children: 256 bytes of slot + 1 by byte, u32 references
+//   DIRECT  256 u32 references by byte, 0 for none
+// A leaf follows with its value, padded to 8 bytes, and the part of its key
+// below its parent.
+static constexpr char FROZEN_ART_MAGIC[8] = {'A', 'R', 'T', 'F',
+                                             'R', 'O', 'Z', '\0'};
+static constexpr uint32_t FROZEN_ART_VERSION = 1;
+static constexpr uint32_t FROZEN_ART_HEAD_SIZE = 16;
+static constexpr uint32_t FROZEN_ART_TAIL_SIZE = 24;
+static constexpr uint64_t FROZEN_ART_MAX_BYTES = (1ULL << 32) * 8;
+
+enum FrozenNodeKind : uint8_t {
+  FROZEN_NODE_LEAF = 1,
+  FROZEN_NODE_LIST,
+  FROZEN_NODE_INDEX,
+  FROZEN_NODE_DIRECT
+};
+
+struct FrozenNodeHead {
+  uint8_t kind;
+  uint8_t pad;
+  // number of children, 0 for a leaf
+  uint16_t num;
+  // prefix length of an inner node, key length of a leaf
+  uint32_t len;
+};
+static_assert(sizeof(FrozenNodeHead) == 8);
+
+static inline uint64_t frozen_align(uint64_t pos, uint64_t a) {
+  return (pos + a - 1) & ~(a - 1);
+}
+
+static constexpr uint32_t frozen_value_size(uint32_t size) {
+  return (size + 7) & ~7u;
+}
+
+// Writes the image of the tree below |root|, which must not change
+// meanwhile, e.g. the root of a snapshot.
+template <class T, class KeyTraits>
+class FrozenArtWriter {
+ public:
+  static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= 8,
+                "frozen values must be trivially copyable, at most 8 aligned");
+
+  explicit FrozenArtWriter(const std::string &path) : out_(path) {}
+
+  bool write(const ArtNodeCommon *root) {
+    out_.put(FROZEN_ART_MAGIC, sizeof(FROZEN_ART_MAGIC));
+    out_.put_pod(FROZEN_ART_VERSION);
+    out_.put_pod<uint32_t>(sizeof(T));
+    pos_ = FROZEN_ART_HEAD_SIZE;
+
+    uint64_t root_ref = root ? put_tree(root) : 0;
+    if (pos_ + FROZEN_ART_TAIL_SIZE > FROZEN_ART_MAX_BYTES) {
+      LOG_WARNING("frozen image over %llu bytes", FROZEN_ART_MAX_BYTES);
+      return false;
+    }
+    out_.put_pod(root_ref);
+    out_.put_pod(count_);
+    out_.put(FROZEN_ART_MAGIC, sizeof(FROZEN_ART_MAGIC));
+    return out_.commit();
+  }
+
+ private:
+  // Key of a leaf, may be built in |buf|.
+  static std::string_view leaf_key(const ArtNodeCommon *node,
+                                   std::string *buf) {
+    if constexpr (KeyTraits::LAZY_LEAF) {
+      if (art_is_lazy_leaf(node)) {
+        return KeyTraits::load_key(art_lazy_leaf_value<T>(node), buf);
+      }
+    }
+    return {node->get_key(), node->keyLen};
+  }
+
+  // Inner node whose children are being written.
+  struct Frame {
+    // depth the node is reached at
+    uint32_t depth;
+    uint32_t prefix_len;
+    uint32_t num;
+    // children before this one are written
+    uint32_t next;
+    uint8_t bytes[256];
+    const ArtNodeCommon *children[256];
+    uint32_t refs[256];
+    // key of the leftmost leaf below
+    std::string first_key;
+  };
+
+  // Write the tree below |root| bottom up, return the reference of root.
+  uint32_t put_tree(const ArtNodeCommon *root) {
+    top_ = 0;
+    const ArtNodeCommon *node = root;
+    uint32_t depth = 0;
+    while (true) {
+      // go down to the leftmost leaf, opening the nodes on the way
+      while (!art_is_lazy_leaf(node) && node->type != ART_NODE_LEAF) {
+        if (top_ == frames_.size()) frames_.emplace_back();
+        Frame &f = frames_[top_];
+        f.num = art_node_children(node, f.bytes, f.children);
+        if (f.num == 0) return 0;
+        f.depth = depth;
+        f.prefix_len = node->keyLen;
+        f.next = 1;
+        top_++;
+        depth += f.prefix_len + 1;
+        node = f.children[0];
+      }
+
+      auto key = leaf_key(node, &key_buf_);
+      T value;
+      if (art_is_lazy_leaf(node)) {
+        value = art_lazy_leaf_value<T>(node);
+      } else {
+        value = reinterpret_cast<const ArtLeaf<T> *>(node)->value;
+      }
+      count_++;
+      uint32_t ref = put_leaf(key, depth, value);
+      // A node may keep only part of its prefix, all of it is in any key
+      // below, so take it from the leftmost one.
+      if (top_ && frames_[top_ - 1].next == 1) {
+        frames_[top_ - 1].first_key.assign(key);
+      }
+
+      // close the nodes this was the last child of
+      while (true) {
+        if (top_ == 0) return ref;
+        Frame &f = frames_[top_ - 1];
+        f.refs[f.next - 1] = ref;
+        if (f.next < f.num) {
+          node = f.children[f.next++];
+          depth = f.depth + f.prefix_len + 1;
+          break;
+        }
+        assert(f.first_key.size() >= f.depth + f.prefix_len);
+        ref = put_inner(f.first_key.data() + f.depth, f.prefix_len, f.bytes,
+                        f.refs, f.num);
+        top_--;
+        if (top_ && frames_[top_ - 1].next == 1) {
+          frames_[top_ - 1].first_key.swap(f.first_key);
+        }
+      }
+    }
+  }
+
+  uint32_t put_leaf(std::string_view key, uint32_t depth, const T &value) {
+    uint32_t ref = begin_node();
+    FrozenNodeHead head{FROZEN_NODE_LEAF, 0, 0,
+                        static_cast<uint32_t>(key.size())};
+    put(&head, sizeof(head));
+    char value_buf[frozen_value_size(sizeof(T))] = {0};
+    std::memcpy(value_buf, &value, sizeof(T));
+    put(value_buf, sizeof(value_buf));
+    uint32_t from = std::min<uint32_t>(depth, key.size());
+    put(key.data() + from, key.size() - from);
+    return ref;
+  }
+
+  uint32_t put_inner(const char *prefix, uint32_t prefix_len,
+                     const uint8_t *bytes, const uint32_t *refs,
+                     uint32_t num) {
+    uint32_t ref = begin_node();
+    FrozenNodeHead head{0, 0, static_cast<uint16_t>(num), prefix_len};
+    if (num <= 16) {
+      head.kind = FROZEN_NODE_LIST;
+      put(&head, sizeof(head));
+      put(prefix, prefix_len);
+      put(bytes, num);
+      pad(4);
+      put(refs, num * sizeof(uint32_t));
+    } else if (num <= 48) {
+      head.kind = FROZEN_NODE_INDEX;
+      put(&head, sizeof(head));
+      put(prefix, prefix_len);
+      uint8_t index[256] = {0};
+      for (uint32_t i = 0; i < num; i++) index[bytes[i]] = i + 1;
+      put(index, sizeof(index));
+      pad(4);
+      put(refs, num * sizeof(uint32_t));
+    } else {
+      head.kind = FROZEN_NODE_DIRECT;
+      put(&head, sizeof(head));
+      put(prefix, prefix_len);
+      pad(4);
+      uint32_t direct[256] = {0};
+      for (uint32_t i = 0; i < num; i++) direct[bytes[i]] = refs[i];
+      put(direct, sizeof(direct));
+    }
+    return ref;
+  }
+
+  // Reference of a node starting at the next 8 byte boundary.
+  uint32_t begin_node() {
+    pad(8);
+    // keep counting past the limit, write() fails on it
+    return static_cast<uint32_t>(pos_ / 8);
+  }
+
+  void pad(uint64_t a) {
+    static const char zeros[8] = {0};
+    put(zeros, frozen_align(pos_, a) - pos_);
+  }
+
+  void put(const void *data, size_t n) {
+    out_.put(data, n);
+    pos_ += n;
+  }
+
+  ArtFileWriter out_;
+  uint64_t pos_ = 0;
+  uint64_t count_ = 0;
+  std::vector<Frame> frames_;
+  uint32_t top_ = 0;
+  std::string key_buf_;
+};
+
+}  // namespace detail
+
+// Read-only tree served from an image written by ArtTree::freeze(). Opening
+// maps the file and checks its head and tail, nothing is read or built
+// beyond that, and pages are shared by every process mapping the image.
+// Queries take no lock and may run from any number of threads.
+template <class T>
+class FrozenArt {
+ public:
+  static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= 8,
+                "frozen values must be trivially copyable, at most 8 aligned");
+
+  FrozenArt() = default;
+  ~FrozenArt() { close(); }
+
+  FrozenArt(const FrozenArt &) = delete;
+  FrozenArt &operator=(const FrozenArt &) = delete;
+
+  FrozenArt(FrozenArt &&o) noexcept { *this = std::move(o); }
+  FrozenArt &operator=(FrozenArt &&o) noexcept {
+    if (this != &o) {
+      close();
+      std::swap(base_, o.base_);
+      std::swap(bytes_, o.bytes_);
+      std::swap(root_, o.root_);
+      std::swap(size_, o.size_);
+    }
+    return *this;
+  }
+
+  // Map the image at |path|. Returns false if it can not be mapped or was
+  // not written for values of type T.
+  bool open(const std::string &path) {
+    using namespace detail;
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      LOG_WARNING("open %s failed, %s", path.c_str(), strerror(errno));
+      return false;
+    }
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 &&
+        st.st_size >= FROZEN_ART_HEAD_SIZE + FROZEN_ART_TAIL_SIZE) {
+      base = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (base == MAP_FAILED) {
+      LOG_WARNING("map %s failed", path.c_str());
+      return false;
+    }
+    base_ = static_cast<const char *>(base);
+    bytes_ = st.st_size;
+
+    uint32_t version = 0;
+    uint32_t value_size = 0;
+    uint64_t root_ref = 0;
+    const char *tail = base_ + bytes_ - FROZEN_ART_TAIL_SIZE;
+    std::memcpy(&version, base_ + 8, sizeof(version));
+    std::memcpy(&value_size, base_ + 12, sizeof(value_size));
+    std::memcpy(&root_ref, tail, sizeof(root_ref));
+    std::memcpy(&size_, tail + 8, sizeof(size_));
+    if (std::memcmp(base_, FROZEN_ART_MAGIC, 8) != 0 ||
+        std::memcmp(tail + 16, FROZEN_ART_MAGIC, 8) != 0 ||
+        version != FROZEN_ART_VERSION || value_size != sizeof(T) ||
+        root_ref * 8 >= bytes_ - FROZEN_ART_TAIL_SIZE ||
+        (root_ref != 0) != (size_ != 0)) {
+      LOG_WARNING("%s is not a frozen tree of this value type", path.c_str());
+      close();
+      return false;
+    }
+    root_ = root_ref;
+    return true;
+  }
+
+  void close() {
+    if (base_) ::munmap(const_cast<char *>(base_), bytes_);
+    base_ = nullptr;
+    bytes_ = 0;
+    root_ = 0;
+    size_ = 0;
+  }
+
+  bool is_open() const { return base_ != nullptr; }
+
+  // Value of |key|, T{} if absent, as ArtTree::get().
+  T get(const std::string &k) const { return get(k.data(), k.size()); }
+  T get(const char *key, uint32_t len) const {
+    uint32_t ref = root_;
+    uint32_t depth = 0;
+    while (ref) {
+      auto head = node_head(ref);
+      const char *body = reinterpret_cast<const char *>(head + 1);
+      if (head->kind == detail::FROZEN_NODE_LEAF) {
+        uint32_t from = std::min(depth, len);
+        if (head->len != len ||
+            std::memcmp(body + VALUE_SIZE, key + from, len - from) != 0) {
+          return T{};
+        }
+        return leaf_value(head);
+      }
+      if (depth + head->len > len ||
+          std::memcmp(body, key + depth, head->len) != 0) {
+        return T{};
+      }
+      depth += head->len;
+      ref = find_child(head, depth < len ? key[depth] : 0);
+      depth++;
+    }
+    return T{};
+  }
+
+  // Visit keys in [start, end) in order, as ArtTree::scan().
+  template <class F>
+  uint64_t scan(const char *start, uint32_t start_len, const char *end,
+                uint32_t end_len, F &&fn) const {
+    uint64_t cnt = 0;
+    std::string_view end_key(end, end_len);
+    std::string key_buf;
+    walk(std::string_view(start, start_len), &key_buf,
+         [&](std::string_view k, const T &v) {
+           if (end_len && k >= end_key) return false;
+           cnt++;
+           return static_cast<bool>(fn(k, v));
+         });
+    return cnt;
+  }
+
+  template <class F>
+  uint64_t scan(const std::string &start, const std::string &end,
+                F &&fn) const {
+    return scan(start.data(), start.size(), end.data(), end.size(),
+                std::forward<F>(fn));
+  }
+
+  // Visit all keys starting with |prefix| in order, as ArtTree::scan_prefix().
+  template <class F>
+  uint64_t scan_prefix(const char *prefix, uint32_t len, F &&fn) const {
+    uint64_t cnt = 0;
+    std::string_view p(prefix, len);
+    std::string key_buf;
+    walk(p, &key_buf, [&](std::string_view k, const T &v) {
+      if (k.substr(0, len) != p) return false;
+      cnt++;
+      return static_cast<bool>(fn(k, v));
+    });
+    return cnt;
+  }
+
+  template <class F>
+  uint64_t scan_prefix(const std::string &prefix, F &&fn) const {
+    return scan_prefix(prefix.data(), prefix.size(), std::forward<F>(fn));
+  }
+
+  // Number of keys.
+  uint64_t size() const { return size_; }
+
+  // Bytes of the mapped image.
+  size_t image_bytes() const { return bytes_; }
+
+ private:
+  static constexpr uint32_t VALUE_SIZE = detail::frozen_value_size(sizeof(T));
+
+  const detail::FrozenNodeHead *node_head(uint32_t ref) const {
+    return reinterpret_cast<const detail::FrozenNodeHead *>(
+        base_ + static_cast<uint64_t>(ref) * 8);
+  }
+
+  static T leaf_value(const detail::FrozenNodeHead *head) {
+    T v;
+    std::memcpy(&v, head + 1, sizeof(T));
+    return v;
+  }
+
+  // Child bytes, slot index or references of an inner node.
+  static const uint8_t *after_prefix(const detail::FrozenNodeHead *head) {
+    return reinterpret_cast<const uint8_t *>(head + 1) + head->len;
+  }
+
+  static const uint32_t *refs_at(const uint8_t *p) {
+    auto pos = reinterpret_cast<uintptr_t>(p);
+    return reinterpret_cast<const uint32_t *>(detail::frozen_align(pos, 4));
+  }
+
+  static uint32_t find_child(const detail::FrozenNodeHead *head, uint8_t b) {
+    const uint8_t *p = after_prefix(head);
+    switch (head->kind) {
+      case detail::FROZEN_NODE_LIST: {
+        for (uint32_t i = 0; i < head->num && p[i] <= b; i++) {
+          if (p[i] == b) return refs_at(p + head->num)[i];
+        }
+        return 0;
+      }
+      case detail::FROZEN_NODE_INDEX: {
+        return p[b] ? refs_at(p + 256)[p[b] - 1] : 0;
+      }
+      default:
+        return refs_at(p)[b];
+    }
+  }
+
+  // First child of an inner node with byte |from| or above. Returns false if
+  // there is none.
+  static bool next_child(const detail::FrozenNodeHead *head, uint32_t from,
+                         uint8_t *byte, uint32_t *ref) {
+    const uint8_t *p = after_prefix(head);
+    switch (head->kind) {
+      case detail::FROZEN_NODE_LIST: {
+        for (uint32_t i = 0; i < head->num; i++) {
+          if (p[i] >= from) {
+            *byte = p[i];
+            *ref = refs_at(p + head->num)[i];
+            return true;
+          }
+        }
+      } break;
+      case detail::FROZEN_NODE_INDEX: {
+        for (uint32_t b = from; b < 256; b++) {
+          if (p[b]) {
+            *byte = b;
+            *ref = refs_at(p + 256)[p[b] - 1];
+            return true;
+          }
+        }
+      } break;
+      default: {
+        auto refs = refs_at(p);
+        for (uint32_t b = from; b < 256; b++) {
+          if (refs[b]) {
+            *byte = b;
+            *ref = refs[b];
+            return true;
+          }
+        }
+      }
+    }
+    return false;
+  }
+
+  // Inner node whose children are being visited.
+  struct WalkFrame {
+    const detail::FrozenNodeHead *head;
+    // depth the node is reached at, and its children are
+    uint32_t depth;
+    uint32_t child_depth;
+    // children below this byte are visited
+    uint32_t next;
+    // the path equals |lb| up to the child at byte |from|
+    bool bounded;
+    uint8_t from;
+  };
+
+  // Visit keys in order. |key_buf| holds the path to the current node. While
+  // bounded, the path equals |lb| so far and keys below |lb| are skipped.
+  // Returns false once fn does.
+  template <class F>
+  bool walk(std::string_view lb, std::string *key_buf, F &&fn) const {
+    std::vector<WalkFrame> frames;
+    uint32_t ref = root_;
+    uint32_t depth = 0;
+    bool bounded = true;
+    while (ref) {
+      auto head = node_head(ref);
+      const char *body = reinterpret_cast<const char *>(head + 1);
+      if (head->kind == detail::FROZEN_NODE_LEAF) {
+        // a key ending at its parent hangs at byte 0, which is not part of it
+        key_buf->resize(std::min<size_t>(depth, head->len));
+        key_buf->append(body + VALUE_SIZE, head->len - key_buf->size());
+        if (!bounded || std::string_view(*key_buf) >= lb) {
+          if (!fn(std::string_view(*key_buf), leaf_value(head))) return false;
+        }
+      } else {
+        key_buf->resize(depth);
+        key_buf->append(body, head->len);
+        WalkFrame f{head, depth, depth + head->len, 0, bounded, 0};
+        bool skip = false;
+        if (bounded) {
+          size_t n = std::min<size_t>(lb.size(), f.child_depth);
+          int cmp = std::string_view(*key_buf).substr(0, n).compare(
+              lb.substr(0, n));
+          if (cmp < 0) {
+            skip = true;
+          } else if (cmp > 0 || f.child_depth >= lb.size()) {
+            f.bounded = false;
+          } else {
+            f.from = static_cast<uint8_t>(lb[f.child_depth]);
+            f.next = f.from;
+          }
+        }
+        if (!skip) frames.push_back(f);
+      }
+
+      // go on with the next child of the innermost node that has one
+      ref = 0;
+      while (!frames.empty()) {
+        WalkFrame &f = frames.back();
+        uint8_t b;
+        if (f.next < 256 && next_child(f.head, f.next, &b, &ref)) {
+          f.next = b + 1u;
+          key_buf->resize(f.child_depth);
+          key_buf->push_back(b);
+          depth = f.child_depth + 1;
+          bounded = f.bounded && b == f.from;
+          break;
+        }
+        frames.pop_back();
+      }
+    }
+    return true;
+  }
+
+  const char *base_ = nullptr;
+  size_t bytes_ = 0;
+  uint32_t root_ = 0;
+  uint64_t size_ = 0;
+};
+
+}  // namespace art
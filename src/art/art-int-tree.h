@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+
+#include "art/art.h"
+
+namespace art {
+
+// ArtTree keyed by uint64_t. Keys are encoded big-endian, so iteration and
+// scans run in numeric order, and the tree is specialized for 8-byte keys.
+template <class T>
+class ArtIntTree {
+ public:
+  using Traits = ArtU64KeyTraits;
+  using Tree = ArtTree<T, Traits>;
+  using Iterator = typename Tree::Iterator;
+
+  static constexpr uint32_t KEY_LEN = Traits::FIXED_LEN;
+
+  ArtIntTree() = default;
+  explicit ArtIntTree(const ArtShrinkPolicy& policy) : tree_(policy) {}
+
+  T set(uint64_t k, T v) {
+    char buf[KEY_LEN];
+    Traits::encode(k, buf);
+    return tree_.set(buf, KEY_LEN, v);
+  }
+
+  T get(uint64_t k) const {
+    char buf[KEY_LEN];
+    Traits::encode(k, buf);
+    return tree_.get(buf, KEY_LEN);
+  }
+
+  T del(uint64_t k) {
+    char buf[KEY_LEN];
+    Traits::encode(k, buf);
+    return tree_.del(buf, KEY_LEN);
+  }
+
+  // See ArtTree::upsert().
+  template <class F>
+  void upsert(uint64_t k, F&& fn) {
+    char buf[KEY_LEN];
+    Traits::encode(k, buf);
+    tree_.upsert(buf, KEY_LEN, std::forward<F>(fn));
+  }
+
+  bool insert_if_absent(uint64_t k, T v, T* current = nullptr) {
+    char buf[KEY_LEN];
+    Traits::encode(k, buf);
+    return tree_.insert_if_absent(buf, KEY_LEN, v, current);
+  }
+
+  bool compare_and_set(uint64_t k, const T& expected, const T& desired) {
+    char buf[KEY_LEN];
+    Traits::encode(k, buf);
+    return tree_.compare_and_set(buf, KEY_LEN, expected, desired);
+  }
+
+  // See ArtTree::multi_get(), keys are encoded a batch at a time.
+  void multi_get(const uint64_t* keys, size_t n, T* out) const {
+    constexpr size_t BATCH = 256;
+    char buf[BATCH][KEY_LEN];
+    const char* ptrs[BATCH];
+    uint32_t lens[BATCH];
+    for (size_t i = 0; i < n; i += BATCH) {
+      size_t cnt = std::min(BATCH, n - i);
+      for (size_t j = 0; j < cnt; j++) {
+        Traits::encode(keys[i + j], buf[j]);
+        ptrs[j] = buf[j];
+        lens[j] = KEY_LEN;
+      }
+      tree_.multi_get(ptrs, lens, cnt, out + i);
+    }
+  }
+
+  // Visit keys in [lo, hi] in numeric order, fn(uint64_t key, const T&)
+  // returns false to stop. Returns number of keys visited.
+  template <class F>
+  uint64_t scan(uint64_t lo, uint64_t hi, F&& fn) const {
+    uint64_t cnt = 0;
+    for (Iterator it = lower_bound(lo); it.valid(); it.next()) {
+      uint64_t k = key_of(it);
+      if (k > hi) break;
+      cnt++;
+      if (!fn(k, it.value())) break;
+    }
+    return cnt;
+  }
+
+  Iterator begin() const { return tree_.begin(); }
+  Iterator end() const { return tree_.end(); }
+
+  // First key >= |k|.
+  Iterator lower_bound(uint64_t k) const {
+    char buf[KEY_LEN];
+    Traits::encode(k, buf);
+    return tree_.lower_bound(buf, KEY_LEN);
+  }
+
+  static uint64_t key_of(const Iterator& it) {
+    return Traits::decode(it.key().data());
+  }
+
+  uint64_t size() const { return tree_.size(); }
+
+  Tree& tree() { return tree_; }
+  const Tree& tree() const { return tree_; }
+
+ private:
+  Tree tree_;
+};
+
+}  // namespace art
@@ -0,0 +1,526 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "art/art-key-traits.h"
+#include "art/art-node.h"
+#include "art/art-olc.h"
+#include "common/epoch.h"
+
+namespace art {
+
+// Ordered cursor over an ArtTree.
+//
+// Nodes on the current root-to-leaf path are remembered together with the
+// version seen when they were read. Stepping validates those versions, and
+// when one changed the iterator seeks again from root with the last returned
+// key. So keys come out in strict order, keys present during the whole scan
+// are all returned, and concurrently inserted/deleted keys may or may not be.
+//
+// Key of current entry is written into a buffer that is reused for every
+// step, it is owned by the iterator unless caller passes its own.
+//
+// An iterator stays in an epoch for its whole lifetime so that remembered
+// nodes are not reclaimed. It must be used and destroyed on the thread that
+// created it, and should not be kept longer than needed.
+template <class T, class KeyTraits = ArtStringKeyTraits>
+class ArtIterator {
+ public:
+  ArtIterator() = default;
+
+  explicit ArtIterator(const ArtNode4* meta, std::string* key_buf = nullptr)
+      : meta_(meta), key_(key_buf ? key_buf : &own_key_) {
+    if (meta_) ::detail::EpochManager::singleton()->enter();
+  }
+
+  ArtIterator(const ArtIterator& o) : own_key_(*o.key_) {
+    copy_position(o);
+    if (meta_) ::detail::EpochManager::singleton()->enter();
+  }
+
+  // Takes over the epoch of |o|, which is left invalid.
+  ArtIterator(ArtIterator&& o) noexcept { move_position(o); }
+
+  ArtIterator& operator=(const ArtIterator& o) {
+    if (this != &o) {
+      if (o.meta_) ::detail::EpochManager::singleton()->enter();
+      if (meta_) ::detail::EpochManager::singleton()->exit();
+      own_key_ = *o.key_;
+      key_ = &own_key_;
+      copy_position(o);
+    }
+    return *this;
+  }
+
+  ArtIterator& operator=(ArtIterator&& o) noexcept {
+    if (this != &o) {
+      if (meta_) ::detail::EpochManager::singleton()->exit();
+      move_position(o);
+    }
+    return *this;
+  }
+
+  ~ArtIterator() {
+    if (meta_) ::detail::EpochManager::singleton()->exit();
+  }
+
+  bool valid() const { return leaf_ != nullptr; }
+
+  std::string_view key() const { return {key_->data(), key_->size()}; }
+
+  const T& value() const { return value_; }
+
+  // Position at the smallest key.
+  void seek_to_first() {
+    prefix_bound_ = false;
+    while (!try_seek_edge<true>()) {
+    }
+  }
+
+  // Position at the largest key.
+  void seek_to_last() {
+    prefix_bound_ = false;
+    while (!try_seek_edge<false>()) {
+    }
+  }
+
+  // Position at the first key >= |k|.
+  void seek(const char* k, uint32_t len) {
+    prefix_bound_ = false;
+    while (!try_seek_key<true>(k, len, true)) {
+    }
+  }
+
+  // Position at the first key > |k|.
+  void seek_after(const char* k, uint32_t len) {
+    prefix_bound_ = false;
+    while (!try_seek_key<true>(k, len, false)) {
+    }
+  }
+
+  // Position at the last key <= |k|.
+  void seek_for_prev(const char* k, uint32_t len) {
+    prefix_bound_ = false;
+    while (!try_seek_key<false>(k, len, true)) {
+    }
+  }
+
+  // Position at the last key < |k|.
+  void seek_before(const char* k, uint32_t len) {
+    prefix_bound_ = false;
+    while (!try_seek_key<false>(k, len, false)) {
+    }
+  }
+
+  // Position at the first key starting with |prefix|, following steps stay
+  // in the subtree of that prefix and end after its last key.
+  void seek_prefix(const char* prefix, uint32_t len) {
+    prefix_key_.assign(prefix, len);
+    prefix_bound_ = true;
+    while (!try_seek_prefix(prefix_key_.data(), len)) {
+    }
+  }
+
+  void next() { step_or_reseek<true>(); }
+
+  void prev() { step_or_reseek<false>(); }
+
+  ArtIterator& operator++() {
+    next();
+    return *this;
+  }
+
+  ArtIterator& operator--() {
+    prev();
+    return *this;
+  }
+
+  std::pair<std::string_view, const T&> operator*() const {
+    return {key(), value_};
+  }
+
+  bool operator==(const ArtIterator& o) const { return leaf_ == o.leaf_; }
+  bool operator!=(const ArtIterator& o) const { return leaf_ != o.leaf_; }
+
+ private:
+  struct Frame {
+    const ArtNodeCommon* node;
+    uint64_t version;
+    int32_t byte;  // key byte of the child we are in
+  };
+
+  // Everything but the key, which copies go on with in a buffer of their
+  // own.
+  void copy_position(const ArtIterator& o) {
+    meta_ = o.meta_;
+    leaf_ = o.leaf_;
+    value_ = o.value_;
+    stack_ = o.stack_;
+    floor_ = o.floor_;
+    prefix_bound_ = o.prefix_bound_;
+    prefix_key_ = o.prefix_key_;
+    root_version_ = o.root_version_;
+  }
+
+  // A caller key buffer moves along with the position.
+  void move_position(ArtIterator& o) {
+    meta_ = o.meta_;
+    leaf_ = o.leaf_;
+    value_ = std::move(o.value_);
+    stack_ = std::move(o.stack_);
+    floor_ = o.floor_;
+    prefix_bound_ = o.prefix_bound_;
+    prefix_key_ = std::move(o.prefix_key_);
+    root_version_ = o.root_version_;
+    if (o.key_ == &o.own_key_) {
+      own_key_ = std::move(o.own_key_);
+      key_ = &own_key_;
+    } else {
+      key_ = o.key_;
+    }
+    o.meta_ = nullptr;
+    o.reset();
+  }
+
+  void reset() {
+    stack_.clear();
+    floor_ = 0;
+    leaf_ = nullptr;
+  }
+
+  bool key_has_prefix() const {
+    return key_->size() >= prefix_key_.size() &&
+           std::memcmp(key_->data(), prefix_key_.data(), prefix_key_.size()) ==
+               0;
+  }
+
+  static int compare_key(const char* k1, uint32_t l1, const char* k2,
+                         uint32_t l2) {
+    int ret = std::memcmp(k1, k2, std::min(l1, l2));
+    if (ret == 0) ret = (l1 < l2) ? -1 : (l1 > l2 ? 1 : 0);
+    return ret;
+  }
+
+  template <bool kForward>
+  void step_or_reseek() {
+    if (!leaf_) return;
+    if (!try_step<kForward>()) {
+      // Path changed under us, restart from the last returned key.
+      last_key_.assign(key_->data(), key_->size());
+      while (!try_seek_key<kForward>(last_key_.data(), last_key_.size(),
+                                     false)) {
+      }
+    }
+    // Subtree floor is lost after a seek from root, check keys instead.
+    if (leaf_ && prefix_bound_ && floor_ == 0 && !key_has_prefix()) {
+      leaf_ = nullptr;
+    }
+  }
+
+  static bool is_lazy_leaf(const ArtNodeCommon* node) {
+    if constexpr (KeyTraits::LAZY_LEAF) {
+      return detail::art_is_lazy_leaf(node);
+    } else {
+      return false;
+    }
+  }
+
+  static bool is_leaf(const ArtNodeCommon* node) {
+    return is_lazy_leaf(node) || node->type == ArtNodeType::ART_NODE_LEAF;
+  }
+
+  // A lazy leaf has no version, its slot was validated with the parent. The
+  // current key is kept when the leaf changed, reseeks start after it.
+  bool load_leaf(const ArtNodeCommon* node, uint64_t version) {
+    if constexpr (KeyTraits::LAZY_LEAF) {
+      if (detail::art_is_lazy_leaf(node)) {
+        value_ = detail::art_lazy_leaf_value<T>(node);
+        std::string_view k = KeyTraits::load_key(value_, &lazy_key_buf_);
+        key_->assign(k.data(), k.size());
+        leaf_ = node;
+        return true;
+      }
+    }
+
+    auto leaf = reinterpret_cast<const ArtLeaf<T>*>(node);
+    leaf_key_buf_.assign(leaf->get_key(), leaf->keyLen);
+    T value = leaf->value;
+    if (node->version.load() != version) return false;
+    key_->swap(leaf_key_buf_);
+    value_ = std::move(value);
+    leaf_ = node;
+    return true;
+  }
+
+  // Lock coupling for seeks that compare prefixes at a depth: the node we
+  // just read a version of still hangs below the stack top, or the root.
+  bool parent_unchanged() const {
+    if (stack_.empty()) return meta_->version.load() == root_version_;
+    return stack_.back().node->version.load() == stack_.back().version;
+  }
+
+  // Go to leftmost(forward) or rightmost leaf below |node|.
+  template <bool kForward>
+  bool descend_edge(const ArtNodeCommon* node) {
+    while (true) {
+      if (is_lazy_leaf(node)) return load_leaf(node, 0);
+      uint64_t v = detail::art_spin_on_locked_node(node);
+      if (ART_IS_OBSOLETE(v)) return false;
+      if (node->type == ArtNodeType::ART_NODE_LEAF) {
+        return load_leaf(node, v);
+      }
+
+      uint8_t b = 0;
+      const ArtNodeCommon* child =
+          kForward ? detail::art_first_child_ge(node, 0, &b)
+                   : detail::art_last_child_le(node, 255, &b);
+      if (node->version.load() != v || child == nullptr) return false;
+      stack_.push_back({node, v, b});
+      node = child;
+    }
+  }
+
+  // Move to the neighbour leaf of the child recorded in stack top. Returns
+  // false if a remembered node was changed.
+  template <bool kForward>
+  bool try_step() {
+    leaf_ = nullptr;
+    while (stack_.size() > floor_) {
+      Frame& f = stack_.back();
+      int32_t from = kForward ? f.byte + 1 : f.byte - 1;
+      uint8_t b = 0;
+      const ArtNodeCommon* child = nullptr;
+      if (from >= 0 && from <= 255) {
+        child = kForward ? detail::art_first_child_ge(f.node, from, &b)
+                         : detail::art_last_child_le(f.node, from, &b);
+      }
+      if (f.node->version.load() != f.version) return false;
+      if (child) {
+        f.byte = b;
+        return descend_edge<kForward>(child);
+      }
+      stack_.pop_back();
+    }
+    return true;
+  }
+
+  template <bool kForward>
+  bool try_seek_edge() {
+    reset();
+    uint64_t v = detail::art_spin_on_locked_node(meta_);
+    const ArtNodeCommon* node = meta_->children[0];
+    if (meta_->version.load() != v) return false;
+    if (node == nullptr) return true;
+    root_version_ = v;
+    return descend_edge<kForward>(node);
+  }
+
+  // The subtree below |node| holds all keys with the prefix, as far as the
+  // stored part of prefixes tells. Stream it from its first leaf, whose key
+  // also verifies the part of prefixes not stored in nodes.
+  bool enter_prefix_subtree(const ArtNodeCommon* node) {
+    floor_ = stack_.size();
+    if (!descend_edge<true>(node)) return false;
+    if (!key_has_prefix()) reset();
+    return true;
+  }
+
+  bool try_seek_prefix(const char* prefix, uint32_t len) {
+    reset();
+    uint64_t v = detail::art_spin_on_locked_node(meta_);
+    const ArtNodeCommon* node = meta_->children[0];
+    if (meta_->version.load() != v) return false;
+    if (node == nullptr) return true;
+    root_version_ = v;
+
+    uint32_t depth = 0;
+    while (true) {
+      if (depth >= len || is_lazy_leaf(node) ||
+          node->type == ArtNodeType::ART_NODE_LEAF) {
+        return enter_prefix_subtree(node);
+      }
+
+      v = detail::art_spin_on_locked_node(node);
+      if (ART_IS_OBSOLETE(v) || !parent_unchanged()) return false;
+
+      uint32_t remain = len - depth;
+      if (remain <= node->keyLen) {
+        // prefix ends inside compressed path of node
+        auto node_prefix = node->prefix_view();
+        auto stored = std::min(remain, (uint32_t)node_prefix.size());
+        bool match =
+            std::memcmp(node_prefix.data(), prefix + depth, stored) == 0;
+        if (node->version.load() != v) return false;
+        if (!match) return true;
+        return enter_prefix_subtree(node);
+      }
+
+      bool inner_match =
+          detail::art_inner_prefix_match(node, prefix, len, depth);
+      if (!inner_match) {
+        return node->version.load() == v;
+      }
+
+      depth += node->keyLen;
+      uint8_t b = prefix[depth];
+      auto child = detail::art_find_child(const_cast<ArtNodeCommon*>(node), b);
+      const ArtNodeCommon* child_ptr = child ? *child : nullptr;
+      if (node->version.load() != v) return false;
+      if (child_ptr == nullptr) return true;
+
+      stack_.push_back({node, v, b});
+      node = child_ptr;
+      depth++;
+    }
+  }
+
+  // Full key of the leftmost leaf below |node|, used to recover the part of
+  // a prefix not stored in the node.
+  bool load_min_leaf_key(const ArtNodeCommon* node, std::string* buf) {
+    while (true) {
+      if (is_lazy_leaf(node)) {
+        if (!load_leaf(node, 0)) return false;
+        buf->assign(key_->data(), key_->size());
+        return true;
+      }
+      uint64_t v = detail::art_spin_on_locked_node(node);
+      if (ART_IS_OBSOLETE(v)) return false;
+      if (node->type == ArtNodeType::ART_NODE_LEAF) {
+        buf->assign(node->get_key(), node->keyLen);
+        return node->version.load() == v;
+      }
+      uint8_t b = 0;
+      const ArtNodeCommon* child = detail::art_first_child_ge(node, 0, &b);
+      if (node->version.load() != v || child == nullptr) return false;
+      node = child;
+    }
+  }
+
+  // Compare prefix of inner |node| with key[depth...]. |cmp| is < 0 when all
+  // keys below node are smaller than key, > 0 when all are greater.
+  bool compare_prefix(const ArtNodeCommon* node, uint64_t version,
+                      const char* key, uint32_t len, uint32_t depth,
+                      int* cmp) {
+    uint32_t prefix_len = node->keyLen;
+    auto node_prefix = node->prefix_view();
+    uint32_t stored = node_prefix.size();
+    assert(depth <= len);
+    uint32_t remain = len - depth;
+    const char* prefix = node_prefix.data();
+    *cmp = 0;
+
+    uint32_t i = 0;
+    for (; i < std::min(stored, remain); i++) {
+      if (prefix[i] != key[depth + i]) {
+        *cmp = (uint8_t)prefix[i] < (uint8_t)key[depth + i] ? -1 : 1;
+        break;
+      }
+    }
+    if (*cmp == 0 && remain < stored) *cmp = 1;
+    if (node->version.load() != version) return false;
+
+    if (*cmp == 0 && prefix_len > stored) {
+      if (!load_min_leaf_key(node, &prefix_buf_)) return false;
+      if (prefix_buf_.size() < depth + prefix_len) return false;
+      const char* full = prefix_buf_.data() + depth;
+      for (; i < std::min(prefix_len, remain); i++) {
+        if (full[i] != key[depth + i]) {
+          *cmp = (uint8_t)full[i] < (uint8_t)key[depth + i] ? -1 : 1;
+          break;
+        }
+      }
+      if (*cmp == 0 && remain < prefix_len) *cmp = 1;
+    }
+    return true;
+  }
+
+  // Forward: first key > |key| (>= if inclusive). Backward: last key < |key|
+  // (<= if inclusive).
+  template <bool kForward>
+  bool try_seek_key(const char* key, uint32_t len, bool inclusive) {
+    reset();
+    uint64_t v = detail::art_spin_on_locked_node(meta_);
+    const ArtNodeCommon* node = meta_->children[0];
+    if (meta_->version.load() != v) return false;
+    if (node == nullptr) return true;
+    root_version_ = v;
+
+    uint32_t depth = 0;
+    while (true) {
+      bool lazy = is_lazy_leaf(node);
+      if (!lazy) {
+        v = detail::art_spin_on_locked_node(node);
+        if (ART_IS_OBSOLETE(v) || !parent_unchanged()) return false;
+      }
+
+      if (lazy || node->type == ArtNodeType::ART_NODE_LEAF) {
+        if (!load_leaf(node, v)) return false;
+        int cmp = compare_key(key_->data(), key_->size(), key, len);
+        if (kForward ? (cmp > 0 || (cmp == 0 && inclusive))
+                     : (cmp < 0 || (cmp == 0 && inclusive))) {
+          return true;
+        }
+        return try_step<kForward>();
+      }
+
+      int cmp = 0;
+      if (!compare_prefix(node, v, key, len, depth, &cmp)) return false;
+      if (cmp != 0) {
+        // whole subtree is on one side of key
+        if ((cmp > 0) == kForward) return descend_edge<kForward>(node);
+        return try_step<kForward>();
+      }
+
+      depth += node->keyLen;
+      uint8_t b = depth < len ? key[depth] : 0;
+      auto exact = detail::art_find_child(const_cast<ArtNodeCommon*>(node), b);
+      const ArtNodeCommon* child = exact ? *exact : nullptr;
+      // key ends at node, keys below are longer and so greater, but for a
+      // leaf of key itself at byte 0
+      bool ends_here = depth == len && !(child && is_leaf(child));
+      uint8_t nb = b;
+      if (child == nullptr) {
+        int32_t from = kForward ? b + 1 : b - 1;
+        if (from >= 0 && from <= 255) {
+          child = kForward ? detail::art_first_child_ge(node, from, &nb)
+                           : detail::art_last_child_le(node, from, &nb);
+        }
+      }
+      if (node->version.load() != v) return false;
+      if (ends_here) {
+        if (kForward) return descend_edge<kForward>(node);
+        return try_step<kForward>();
+      }
+      if (child == nullptr) return try_step<kForward>();
+
+      stack_.push_back({node, v, nb});
+      if (nb != b) return descend_edge<kForward>(child);
+      node = child;
+      depth++;
+    }
+  }
+
+  const ArtNode4* meta_ = nullptr;
+  const ArtNodeCommon* leaf_ = nullptr;
+  T value_{};
+  std::vector<Frame> stack_;
+  // try_step does not pop frames below this, used to stay in a subtree
+  size_t floor_ = 0;
+  bool prefix_bound_ = false;
+  std::string prefix_key_;
+  std::string own_key_;
+  std::string* key_ = &own_key_;
+  std::string last_key_;
+  uint64_t root_version_ = 0;
+  std::string prefix_buf_;
+  std::string lazy_key_buf_;
+  std::string leaf_key_buf_;
+};
+
+}  // namespace art
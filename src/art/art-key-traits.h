@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace art {
+
+// Key traits tell ArtTree what its keys look like. FIXED_LEN is the length
+// of every key in bytes, or 0 if keys have any length.
+//
+// LAZY_LEAF opts in to lazy leaves: instead of a leaf node holding key and
+// value, the value itself is stored in the child slot of its parent, tagged
+// in bit 0. The value must be an integer or pointer that fits in 63 bits:
+// signed values in [-2^62, 2^62), unsigned ones below 2^63, pointers of user
+// space. Any other value is kept in a regular leaf node. The traits must
+// also provide
+//   static std::string_view load_key(const T& value, std::string* buf);
+// returning the key a value is stored under, e.g. from the record a pointer
+// value refers to. The key may be built in |buf|. load_key can be called on
+// a value that was just replaced or deleted, so whatever it reads must stay
+// valid while concurrent readers may still see the value, and snapshots see
+// it until they are released. A value must keep its key: upsert() can
+// replace it only by a value with the same key.
+//
+// FULL_PREFIX picks how much of a compressed path an inner node stores.
+// By default only the first ART_MAX_PREFIX_LEN bytes are kept in the node,
+// and the rest is recovered from the leftmost leaf below it when an insert
+// or seek needs it. With FULL_PREFIX a longer prefix is kept whole in a
+// separate allocation, so every prefix is checked in place at the cost of
+// that allocation. It pays off for keys sharing long paths, like URLs.
+struct ArtStringKeyTraits {
+  static constexpr uint32_t FIXED_LEN = 0;
+  static constexpr bool LAZY_LEAF = false;
+  static constexpr bool FULL_PREFIX = false;
+};
+
+// String keys with full-length prefixes, see FULL_PREFIX above.
+struct ArtFullPrefixKeyTraits : ArtStringKeyTraits {
+  static constexpr bool FULL_PREFIX = true;
+};
+
+// uint64_t keys stored big-endian, so byte order of encoded keys is numeric
+// order and the tree iterates them sorted. Every key is 8 bytes: it always
+// fits inline in a leaf and no inner node prefix is longer than what a node
+// stores, so a leaf is checked with one 8-byte compare.
+struct ArtU64KeyTraits {
+  static constexpr uint32_t FIXED_LEN = sizeof(uint64_t);
+  static constexpr bool LAZY_LEAF = false;
+  static constexpr bool FULL_PREFIX = false;
+
+  static inline void encode(uint64_t k, char *buf) {
+    k = __builtin_bswap64(k);
+    std::memcpy(buf, &k, sizeof(uint64_t));
+  }
+
+  static inline uint64_t decode(const char *buf) {
+    uint64_t k;
+    std::memcpy(&k, buf, sizeof(uint64_t));
+    return __builtin_bswap64(k);
+  }
+};
+
+}  // namespace art
@@ -7,6 +7,23 @@
 namespace art {
 namespace detail {
 
+// Insert into the sorted keys/children arrays of a Node4/Node16 holding |cnt|
+// children. Position comes from the SIMD lower_bound, the tail is shifted
+// with one memmove per array.
+static inline void art_insert_sorted(uint8_t *keys, ArtNodeCommon **children,
+                                     uint32_t cnt, uint8_t keyByte,
+                                     ArtNodeCommon *child) {
+  uint32_t idx = art_simd_lower_bound(keys, cnt, keyByte);
+  uint32_t diff = cnt - idx;
+  if (diff) {
+    std::memmove(keys + idx + 1, keys + idx, diff);
+    std::memmove(children + idx + 1, children + idx,
+                 diff * sizeof(ArtNodeCommon *));
+  }
+  keys[idx] = keyByte;
+  children[idx] = child;
+}
+
 static inline void art_add_child_to_n256(ArtNodeCommon **node, uint8_t keyByte,
                                          ArtNodeCommon *child) {
   assert(*node);
@@ -14,7 +31,7 @@ static inline void art_add_child_to_n256(ArtNodeCommon **node, uint8_t keyByte,
   assert(nodePtr->type = ArtNodeTrait<ArtNode256>::NODE_TYPE);
   assert(nodePtr->childNum <= ArtNodeTrait<ArtNode256>::NODE_CAPASITY);
 
-  nodePtr->children[keyByte] = child;
+  nodePtr->set_child(keyByte, child);
   nodePtr->childNum++;
 }
 
@@ -26,25 +43,17 @@ static inline void art_add_child_to_n48(ArtNodeCommon **node, uint8_t keyByte,
   assert(nodePtr->childNum <= ArtNodeTrait<ArtNode48>::NODE_CAPASITY);
 
   if (nodePtr->childNum < ArtNodeTrait<ArtNode48>::NODE_CAPASITY) {
-    int32_t pos = nodePtr->childNum;
-    while (nodePtr->children[pos]) {
-      pos++;
-      pos = pos % ArtNodeTrait<ArtNode48>::NODE_CAPASITY;
-    }
-    nodePtr->index[keyByte] = pos + 1;
-    nodePtr->children[pos] = child;
+    nodePtr->set_child(keyByte, child);
     nodePtr->childNum++;
   } else {
     auto newNode256 = get_new_art_node<ArtNode256>();
-
-    for (int32_t i = 0; i < 256; i++) {
-      if (nodePtr->index[i]) {
-        newNode256->children[i] = nodePtr->children[nodePtr->index[i] - 1];
-      }
-    }
+    nodePtr->for_each_child([&](uint8_t b, ArtNodeCommon *c) {
+      newNode256->children[b] = c;
+    });
+    newNode256->present = nodePtr->present;
     newNode256->childNum = nodePtr->childNum;
     newNode256->get_key_from_another(nodePtr);
-    return_art_node(nodePtr);
+    retire_art_node(nodePtr);
     *node = reinterpret_cast<ArtNodeCommon *>(newNode256);
     art_add_child_to_n256(node, keyByte, child);
   }
@@ -58,19 +67,8 @@ static inline void art_add_child_to_n16(ArtNodeCommon **node, uint8_t keyByte,
   assert(nodePtr->childNum <= ArtNodeTrait<ArtNode16>::NODE_CAPASITY);
 
   if (nodePtr->childNum < ArtNodeTrait<ArtNode16>::NODE_CAPASITY) {
-    int32_t idx = 0;
-    for (; idx < nodePtr->childNum; idx++) {
-      if (keyByte < nodePtr->keys[idx]) break;
-    }
-
-    // move keys and child pointers
-    for (int32_t j = nodePtr->childNum; j > idx; j--) {
-      nodePtr->keys[j] = nodePtr->keys[j - 1];
-      nodePtr->children[j] = nodePtr->children[j - 1];
-    }
-
-    nodePtr->keys[idx] = keyByte;
-    nodePtr->children[idx] = child;
+    art_insert_sorted(nodePtr->keys, nodePtr->children, nodePtr->childNum,
+                      keyByte, child);
     nodePtr->childNum++;
   } else {
     auto newNode48 = get_new_art_node<ArtNode48>();
@@ -80,11 +78,14 @@ static inline void art_add_child_to_n16(ArtNodeCommon **node, uint8_t keyByte,
         ArtNodeTrait<ArtNode16>::NODE_CAPASITY * sizeof(ArtNodeCommon *));
     for (int32_t i = 0; i < ArtNodeTrait<ArtNode16>::NODE_CAPASITY; i++) {
       newNode48->index[nodePtr->keys[i]] = i + 1;
+      newNode48->present.set(nodePtr->keys[i]);
     }
+    newNode48->used_slots =
+        (1ULL << ArtNodeTrait<ArtNode16>::NODE_CAPASITY) - 1;
 
     newNode48->childNum = nodePtr->childNum;
     newNode48->get_key_from_another(nodePtr);
-    return_art_node(nodePtr);
+    retire_art_node(nodePtr);
 
     *node = reinterpret_cast<ArtNodeCommon *>(newNode48);
     art_add_child_to_n48(node, keyByte, child);
@@ -99,19 +100,8 @@ static inline void art_add_child_to_n4(ArtNodeCommon **node, uint8_t keyByte,
   assert(nodePtr->childNum <= ArtNodeTrait<ArtNode4>::NODE_CAPASITY);
 
   if (nodePtr->childNum < ArtNodeTrait<ArtNode4>::NODE_CAPASITY) {
-    int32_t idx = 0;
-    for (; idx < nodePtr->childNum; idx++) {
-      if (keyByte < nodePtr->keys[idx]) break;
-    }
-
-    // move keys and child pointers
-    for (int32_t i = nodePtr->childNum; i > idx; i--) {
-      nodePtr->keys[i] = nodePtr->keys[i - 1];
-      nodePtr->children[i] = nodePtr->children[i - 1];
-    }
-
-    nodePtr->keys[idx] = keyByte;
-    nodePtr->children[idx] = child;
+    art_insert_sorted(nodePtr->keys, nodePtr->children, nodePtr->childNum,
+                      keyByte, child);
     nodePtr->childNum++;
   } else {
     auto newNode16 = get_new_art_node<ArtNode16>();
@@ -123,7 +113,7 @@ static inline void art_add_child_to_n4(ArtNodeCommon **node, uint8_t keyByte,
         ArtNodeTrait<ArtNode4>::NODE_CAPASITY * sizeof(ArtNodeCommon *));
     newNode16->childNum = nodePtr->childNum;
     newNode16->get_key_from_another(nodePtr);
-    return_art_node(nodePtr);
+    retire_art_node(nodePtr);
 
     *node = reinterpret_cast<ArtNodeCommon *>(newNode16);
     art_add_child_to_n16(node, keyByte, child);
@@ -1,23 +1,33 @@
 #pragma once
 
 #include "art/art-node-pool.h"
+#include "art/art-olc.h"
 
 namespace art {
 namespace detail {
 
-static inline void art_delete_from_n4(ArtNodeCommon** node, uint8_t keyByte) {
+// Remove entry |idx| from the sorted keys/children arrays of a Node4/Node16
+// holding |cnt| children, shifting the tail with one memmove per array.
+static inline void art_erase_sorted(uint8_t* keys, ArtNodeCommon** children,
+                                    uint32_t cnt, uint32_t idx) {
+  uint32_t diff = cnt - idx - 1;
+  if (diff) {
+    std::memmove(keys + idx, keys + idx + 1, diff);
+    std::memmove(children + idx, children + idx + 1,
+                 diff * sizeof(ArtNodeCommon*));
+  }
+}
+
+// |full_prefix| keeps a merged prefix longer than ART_MAX_PREFIX_LEN out of
+// line, see ArtNodeCommon::has_full_prefix().
+static inline void art_delete_from_n4(ArtNodeCommon** node, uint8_t keyByte,
+                                      bool full_prefix) {
   assert(*node != nullptr);
   auto nodePtr = reinterpret_cast<ArtNode4*>(*node);
-  int32_t idx = 0;
-  for (; idx < nodePtr->childNum; idx++) {
-    if (keyByte == nodePtr->keys[idx]) break;
-  }
-  assert(idx < nodePtr->childNum);
+  int32_t idx = art_simd_find_n4(nodePtr->keys, nodePtr->childNum, keyByte);
+  assert(idx >= 0 && idx < nodePtr->childNum);
 
-  for (int32_t i = idx; i < nodePtr->childNum - 1; i++) {
-    nodePtr->keys[i] = nodePtr->keys[i + 1];
-    nodePtr->children[i] = nodePtr->children[i + 1];
-  }
+  art_erase_sorted(nodePtr->keys, nodePtr->children, nodePtr->childNum, idx);
   nodePtr->childNum--;
   nodePtr->keys[nodePtr->childNum] = 0;
   nodePtr->children[nodePtr->childNum] = nullptr;
@@ -25,140 +35,138 @@ static inline void art_delete_from_n4(ArtNodeCommon** node, uint8_t keyByte) {
   if (nodePtr->childNum < 2) {
     assert(nodePtr->childNum == 1);
     ArtNodeCommon* child = nodePtr->children[0];
-    if (child->type != ArtNodeType::ART_NODE_LEAF) {
-      // path compression
-
-      ArtNodeKey key = nodePtr->key;
-      uint32_t new_key_len = nodePtr->keyLen;
-      if (nodePtr->keyLen < ART_MAX_PREFIX_LEN) {
-        key.shortKey[new_key_len++] = nodePtr->keys[0];
+    if (!art_is_lazy_leaf(child) && child->type != ArtNodeType::ART_NODE_LEAF) {
+      // path compression. Readers that passed this node before see the
+      // child's new prefix at their old depth, the version bump makes them
+      // restart.
+      art_write_lock_node(child);
+      uint32_t merged_len = nodePtr->keyLen + 1 + child->keyLen;
+      if (child->has_full_prefix() ||
+          (full_prefix && merged_len > ART_MAX_PREFIX_LEN)) {
+        std::string merged(nodePtr->prefix_view());
+        merged.push_back(nodePtr->keys[0]);
+        merged.append(child->prefix_view());
+        assert(merged.size() == merged_len);
+        art_replace_full_prefix(child, merged.data(), merged.size());
+      } else {
+        ArtNodeKey key = nodePtr->key;
+        uint32_t new_key_len = nodePtr->keyLen;
+        if (nodePtr->keyLen < ART_MAX_PREFIX_LEN) {
+          key.shortKey[new_key_len++] = nodePtr->keys[0];
+        }
+
+        if (new_key_len < ART_MAX_PREFIX_LEN) {
+          uint32_t sub_prefix = std::min(
+              child->keyLen, (uint32_t)ART_MAX_PREFIX_LEN - new_key_len);
+          memcpy(key.shortKey + new_key_len, child->key.shortKey, sub_prefix);
+          new_key_len += sub_prefix;
+        }
+
+        child->key = key;
+        child->keyLen = merged_len;
       }
-
-      if (new_key_len < ART_MAX_PREFIX_LEN) {
-        uint32_t sub_prefix =
-            std::min(child->keyLen, (uint32_t)ART_MAX_PREFIX_LEN - new_key_len);
-        memcpy(key.shortKey + new_key_len, child->key.shortKey, sub_prefix);
-        new_key_len += sub_prefix;
-      }
-
-      child->key = key;
-      child->keyLen += nodePtr->keyLen + 1;
+      ART_MACRO_WRITE_UNLOCK(child);
     }
     *node = child;
-    return_art_node(nodePtr);
+    art_release_prefix(nodePtr, false);
+    retire_art_node(nodePtr);
   }
 }
 
-static inline void art_delete_from_n16(ArtNodeCommon** node, uint8_t keyByte) {
+static inline void art_delete_from_n16(ArtNodeCommon** node, uint8_t keyByte,
+                                       uint32_t shrink_at) {
   assert(*node != nullptr);
   auto nodePtr = reinterpret_cast<ArtNode16*>(*node);
-  int32_t idx = 0;
-#if defined(__i386__) || defined(__amd64__)
-  int bitfield =
-      _mm_movemask_epi8(_mm_cmpeq_epi8(
-          _mm_set1_epi8(keyByte), _mm_loadu_si128((__m128i*)nodePtr->keys))) &
-      ((1 << nodePtr->childNum) - 1);
-  idx = __builtin_ctz(bitfield);
-#else
-  for (; idx < nodePtr->childNum; idx++) {
-    if (keyByte == nodePtr->keys[idx]) break;
-  }
-#endif
-
-  assert(idx < nodePtr->childNum);
+  int32_t idx = art_simd_find_n16(nodePtr->keys, nodePtr->childNum, keyByte);
+  assert(idx >= 0 && idx < nodePtr->childNum);
 
-  // move keys and child pointers
-  size_t diff = nodePtr->childNum - idx - 1;
-  if (diff) {
-    std::memmove(&(nodePtr->keys[idx]), &(nodePtr->keys[idx + 1]), diff);
-    std::memmove(&(nodePtr->children[idx]), &(nodePtr->children[idx + 1]),
-                 diff * sizeof(ArtNodeCommon*));
-  }
+  art_erase_sorted(nodePtr->keys, nodePtr->children, nodePtr->childNum, idx);
 
   nodePtr->childNum--;
   nodePtr->keys[nodePtr->childNum] = 0;
   nodePtr->children[nodePtr->childNum] = nullptr;
-  assert(nodePtr->childNum >= 4);
-  if (nodePtr->childNum == 4) {
+  if (nodePtr->childNum <= shrink_at) {
+    assert(nodePtr->childNum <= ArtNodeTrait<ArtNode4>::NODE_CAPASITY);
     auto newNode4 = get_new_art_node<ArtNode4>();
-    std::memcpy(newNode4->keys, nodePtr->keys, 4 * sizeof(uint8_t));
+    std::memcpy(newNode4->keys, nodePtr->keys, nodePtr->childNum);
     std::memcpy(newNode4->children, nodePtr->children,
-                4 * sizeof(ArtNodeCommon*));
+                nodePtr->childNum * sizeof(ArtNodeCommon*));
     newNode4->childNum = nodePtr->childNum;
-    std::swap(newNode4->keyLen, nodePtr->keyLen);
-    std::swap(newNode4->key.keyPtr, nodePtr->key.keyPtr);
+    newNode4->get_key_from_another(nodePtr);
     *node = reinterpret_cast<ArtNodeCommon*>(newNode4);
-    return_art_node(nodePtr);
+    retire_art_node(nodePtr);
   }
 }
 
-static inline void art_delete_from_n48(ArtNodeCommon** node, uint8_t keyByte) {
+static inline void art_delete_from_n48(ArtNodeCommon** node, uint8_t keyByte,
+                                       uint32_t shrink_at) {
   assert(*node != nullptr);
   auto nodePtr = reinterpret_cast<ArtNode48*>(*node);
   assert(nodePtr->index[keyByte] != 0);
-  uint8_t childIdx = nodePtr->index[keyByte] - 1;
-  nodePtr->children[childIdx] = nullptr;
-  nodePtr->index[keyByte] = 0;
+  nodePtr->remove_child(keyByte);
   nodePtr->childNum--;
-  if (nodePtr->childNum == 16) {
+  if (nodePtr->childNum <= shrink_at) {
+    assert(nodePtr->childNum <= ArtNodeTrait<ArtNode16>::NODE_CAPASITY);
     auto newNode16 = get_new_art_node<ArtNode16>();
     int32_t idx = 0;
-    for (uint16_t i = 0; i <= 255; i++) {
-      if (nodePtr->index[i]) {
-        newNode16->keys[idx] = i;
-        newNode16->children[idx] = nodePtr->children[nodePtr->index[i] - 1];
-        idx++;
-      }
-    }
-    assert(idx == 16);
+    nodePtr->for_each_child([&](uint8_t b, ArtNodeCommon* c) {
+      newNode16->keys[idx] = b;
+      newNode16->children[idx] = c;
+      idx++;
+    });
+    assert(idx == nodePtr->childNum);
     newNode16->childNum = nodePtr->childNum;
-    std::swap(newNode16->keyLen, nodePtr->keyLen);
-    std::swap(newNode16->key.keyPtr, nodePtr->key.keyPtr);
+    newNode16->get_key_from_another(nodePtr);
     *node = reinterpret_cast<ArtNodeCommon*>(newNode16);
-    return_art_node(nodePtr);
+    retire_art_node(nodePtr);
   }
 }
 
-static inline void art_delete_from_n256(ArtNodeCommon** node, uint8_t keyByte) {
+static inline void art_delete_from_n256(ArtNodeCommon** node,
+                                        uint8_t keyByte, uint32_t shrink_at) {
   assert(*node != nullptr);
   auto nodePtr = reinterpret_cast<ArtNode256*>(*node);
   assert(nodePtr->children[keyByte] != nullptr);
-  nodePtr->children[keyByte] = nullptr;
+  nodePtr->remove_child(keyByte);
   nodePtr->childNum--;
-  if (nodePtr->childNum == 48) {
+  if (nodePtr->childNum <= shrink_at) {
+    assert(nodePtr->childNum <= ArtNodeTrait<ArtNode48>::NODE_CAPASITY);
     auto newNode48 = get_new_art_node<ArtNode48>();
     int32_t idx = 0;
-    for (uint16_t i = 0; i <= 255; i++) {
-      if (nodePtr->children[i]) {
-        newNode48->children[idx] = nodePtr->children[i];
-        newNode48->index[i] = idx + 1;
-        idx++;
-      }
-    }
-    assert(idx == 48);
+    nodePtr->for_each_child([&](uint8_t b, ArtNodeCommon* c) {
+      newNode48->children[idx] = c;
+      newNode48->index[b] = idx + 1;
+      idx++;
+    });
+    assert(idx == nodePtr->childNum);
+    newNode48->present = nodePtr->present;
+    newNode48->used_slots = (1ULL << idx) - 1;
     newNode48->childNum = nodePtr->childNum;
-    std::swap(newNode48->keyLen, nodePtr->keyLen);
-    std::swap(newNode48->key.keyPtr, nodePtr->key.keyPtr);
+    newNode48->get_key_from_another(nodePtr);
     *node = reinterpret_cast<ArtNodeCommon*>(newNode48);
-    return_art_node(nodePtr);
+    retire_art_node(nodePtr);
   }
 }
 
-static void art_delete_from_node(ArtNodeCommon** node, uint8_t key_byte) {
+// A Node16/48/256 shrinks by |policy|, callers must have checked
+// need_adjust_after_delete() with the same policy.
+static void art_delete_from_node(
+    ArtNodeCommon** node, uint8_t key_byte, bool full_prefix = false,
+    const ArtShrinkPolicy& policy = ArtShrinkPolicy{}) {
   auto node_p = *node;
   assert(node_p != nullptr);
   switch (node_p->type) {
     case ART_NODE_4: {
-      art_delete_from_n4(node, key_byte);
+      art_delete_from_n4(node, key_byte, full_prefix);
     } break;
     case ART_NODE_16: {
-      art_delete_from_n16(node, key_byte);
+      art_delete_from_n16(node, key_byte, policy.n16_to_n4);
     } break;
     case ART_NODE_48: {
-      art_delete_from_n48(node, key_byte);
+      art_delete_from_n48(node, key_byte, policy.n48_to_n16);
     } break;
     case ART_NODE_256: {
-      art_delete_from_n256(node, key_byte);
+      art_delete_from_n256(node, key_byte, policy.n256_to_n48);
     } break;
     default: {
       LOG_ERROR("unknown node type");
@@ -178,12 +186,14 @@ static void art_delete_from_node(ArtNodeCommon** parNode, ArtNodeCommon** node,
 
 template <class T>
 static void destroy_node(ArtNodeCommon* node) {
+  if (art_is_lazy_leaf(node)) return;
   switch (node->type) {
     case ART_NODE_4: {
       auto delNode = reinterpret_cast<ArtNode4*>(node);
       for (uint16_t i = 0; i < delNode->childNum; i++) {
         destroy_node<T>(delNode->children[i]);
       }
+      art_release_prefix(delNode, true);
       return_art_node(delNode);
     } break;
     case ART_NODE_16: {
@@ -191,21 +201,21 @@ static void destroy_node(ArtNodeCommon* node) {
       for (uint16_t i = 0; i < delNode->childNum; i++) {
         destroy_node<T>(delNode->children[i]);
       }
+      art_release_prefix(delNode, true);
       return_art_node(delNode);
     } break;
     case ART_NODE_48: {
       auto delNode = reinterpret_cast<ArtNode48*>(node);
-      for (uint16_t i = 0; i < 255; i++) {
-        if (delNode->index[i])
-          destroy_node<T>(delNode->children[delNode->index[i] - 1]);
-      }
+      delNode->for_each_child(
+          [](uint8_t, ArtNodeCommon* c) { destroy_node<T>(c); });
+      art_release_prefix(delNode, true);
       return_art_node(delNode);
     } break;
     case ART_NODE_256: {
       auto delNode = reinterpret_cast<ArtNode256*>(node);
-      for (uint16_t i = 0; i < 255; i++) {
-        if (delNode->children[i]) destroy_node<T>(delNode->children[i]);
-      }
+      delNode->for_each_child(
+          [](uint8_t, ArtNodeCommon* c) { destroy_node<T>(c); });
+      art_release_prefix(delNode, true);
       return_art_node(delNode);
     } break;
     case ART_NODE_LEAF: {
@@ -1,7 +1,98 @@
 #pragma once
 
+#include <cstdlib>
+#include <new>
+
 #include "art/art-node.h"
+#include "common/epoch.h"
 #include "common/object-pool.h"
+#include "common/slab-arena.h"
+
+namespace art {
+namespace detail {
+
+using ::detail::SlabArena;
+
+// Nodes built under a SlabArena::Scope come from that arena. Its classes
+// are the inner node types in ArtNodeType order, then the leaf size classes.
+static constexpr uint32_t ART_ARENA_LEAF_CLASS_BASE = ART_NODE_256 - 1;
+
+template <class T>
+static constexpr uint32_t art_arena_class() {
+  return ArtNodeTrait<T>::NODE_TYPE - 1;
+}
+
+// Leaves are carved from per size class pools, one ArtLeafStorage<N> each.
+// Sizes are multiples of 16 so any leaf fits the alignment of its class.
+template <size_t N>
+struct ArtLeafStorage {
+  alignas(16) char data[N];
+};
+
+static constexpr uint32_t ART_LEAF_SIZE_CLASS[] = {32,  48,  64,  80,  96,
+                                                   112, 128, 160, 192, 256};
+static constexpr uint8_t ART_LEAF_SIZE_CLASS_NUM =
+    sizeof(ART_LEAF_SIZE_CLASS) / sizeof(ART_LEAF_SIZE_CLASS[0]);
+
+// Smallest class holding |bytes|, 1-based, 0 if it needs malloc.
+static inline uint8_t art_leaf_size_class(size_t bytes) {
+  for (uint8_t i = 0; i < ART_LEAF_SIZE_CLASS_NUM; i++) {
+    if (bytes <= ART_LEAF_SIZE_CLASS[i]) return i + 1;
+  }
+  return 0;
+}
+
+static inline SlabArena *art_new_arena() {
+  uint32_t sizes[ART_ARENA_LEAF_CLASS_BASE + 1 + ART_LEAF_SIZE_CLASS_NUM] = {
+      sizeof(ArtNode4), sizeof(ArtNode16), sizeof(ArtNode48),
+      sizeof(ArtNode256)};
+  for (uint8_t i = 0; i < ART_LEAF_SIZE_CLASS_NUM; i++) {
+    sizes[ART_ARENA_LEAF_CLASS_BASE + 1 + i] = ART_LEAF_SIZE_CLASS[i];
+  }
+  return new SlabArena(sizes, sizeof(sizes) / sizeof(sizes[0]));
+}
+
+// Leaf or prefix buffer memory of |bytes| from |arena|, its leaf size class
+// is stored to |cls|, 0 if it is a large item.
+static inline void *art_arena_alloc_bytes(SlabArena *arena, size_t bytes,
+                                          uint8_t *cls) {
+  *cls = art_leaf_size_class(bytes);
+  if (*cls) return arena->alloc(*cls + ART_ARENA_LEAF_CLASS_BASE);
+  return arena->alloc_large(bytes);
+}
+
+static inline void art_arena_free_bytes(uint8_t cls, void *p) {
+  if (cls) {
+    SlabArena::of(p)->free(cls + ART_ARENA_LEAF_CLASS_BASE, p);
+  } else {
+    SlabArena::of_large(p)->free_large(p);
+  }
+}
+
+}  // namespace detail
+}  // namespace art
+
+namespace detail {
+
+// Nodes got from a pool are zero filled before use, see get_new_art_node().
+template <>
+struct ObjectPoolTrimmable<art::ArtNode4> {
+  static constexpr bool value = true;
+};
+template <>
+struct ObjectPoolTrimmable<art::ArtNode16> {
+  static constexpr bool value = true;
+};
+template <>
+struct ObjectPoolTrimmable<art::ArtNode48> {
+  static constexpr bool value = true;
+};
+template <>
+struct ObjectPoolTrimmable<art::ArtNode256> {
+  static constexpr bool value = true;
+};
+
+}  // namespace detail
 
 namespace art {
 namespace detail {
@@ -10,6 +101,13 @@ template <class T, bool all_new = false>
 static T *get_new_art_node() {
   T *p = nullptr;
   if constexpr (!all_new) {
+    if (auto arena = SlabArena::current()) {
+      void *mem = arena->alloc(art_arena_class<T>());
+      memset(mem, 0, sizeof(T));
+      p = new (mem) T;
+      p->set_from_arena();
+      return p;
+    }
     p = get_object<T>();
   }
 
@@ -24,31 +122,227 @@ static T *get_new_art_node() {
   return p;
 }
 
+// ArtPrefixBuf::arena_cls of a buffer from malloc, and of a large arena item.
+// Others are 1 + leaf size class of an arena item.
+static constexpr uint32_t ART_PREFIX_BUF_MALLOC = 0;
+static constexpr uint32_t ART_PREFIX_BUF_LARGE = UINT32_MAX;
+
+static inline ArtPrefixBuf *art_new_prefix_buf(const char *k, uint32_t l) {
+  size_t bytes = sizeof(ArtPrefixBuf) + l;
+  ArtPrefixBuf *buf = nullptr;
+  uint32_t arena_cls = ART_PREFIX_BUF_MALLOC;
+  if (auto arena = SlabArena::current()) {
+    uint8_t cls = 0;
+    buf = static_cast<ArtPrefixBuf *>(
+        art_arena_alloc_bytes(arena, bytes, &cls));
+    arena_cls = cls ? cls : ART_PREFIX_BUF_LARGE;
+  } else {
+    buf = static_cast<ArtPrefixBuf *>(malloc(bytes));
+  }
+  assert(buf);
+  buf->len = l;
+  buf->arena_cls = arena_cls;
+  std::memcpy(buf->data(), k, l);
+  return buf;
+}
+
+static inline SlabArena *art_prefix_buf_arena(const void *p) {
+  auto buf = static_cast<const ArtPrefixBuf *>(p);
+  if (buf->arena_cls == ART_PREFIX_BUF_MALLOC) return nullptr;
+  if (buf->arena_cls == ART_PREFIX_BUF_LARGE) return SlabArena::of_large(p);
+  return SlabArena::of(p);
+}
+
+static inline void art_free_prefix_buf(void *p) {
+  auto buf = static_cast<ArtPrefixBuf *>(p);
+  if (buf->arena_cls == ART_PREFIX_BUF_MALLOC) {
+    free(buf);
+  } else {
+    art_arena_free_bytes(
+        buf->arena_cls == ART_PREFIX_BUF_LARGE ? 0 : buf->arena_cls, buf);
+  }
+}
+
+// Free |p| once no reader can see it. An arena it belongs to is held until
+// then, see SlabArena::hold().
+template <void (*Free)(void *), SlabArena *(*Arena)(const void *)>
+static void art_epoch_free(void *p) {
+  if (auto arena = Arena(p)) arena->hold();
+  epoch_retire(p, [](void *q) {
+    auto arena = Arena(q);
+    Free(q);
+    if (arena) arena->unhold();
+  });
+}
+
+// Set prefix of an inner node no other thread can see yet. With |full| a
+// prefix longer than ART_MAX_PREFIX_LEN is kept whole out of line.
+static inline void art_init_prefix(ArtNodeCommon *node, const char *k,
+                                   uint32_t l, bool full) {
+  assert(!node->has_full_prefix());
+  if (full && l > ART_MAX_PREFIX_LEN) {
+    node->key.keyPtr = reinterpret_cast<char *>(art_new_prefix_buf(k, l));
+    node->keyLen = l;
+    node->set_full_prefix_flag();
+  } else {
+    node->set_prefix_key(k, l);
+  }
+}
+
+// Move a live inner node to a new out of line prefix, under its write lock.
+// The old buffer is retired as readers may still compare against it.
+static inline void art_replace_full_prefix(ArtNodeCommon *node, const char *k,
+                                           uint32_t l) {
+  char *old = node->has_full_prefix() ? node->key.keyPtr : nullptr;
+  auto buf = reinterpret_cast<char *>(art_new_prefix_buf(k, l));
+  __atomic_store_n(&node->key.keyPtr, buf, __ATOMIC_RELEASE);
+  node->keyLen = l;
+  node->set_full_prefix_flag();
+  if (old) art_epoch_free<art_free_prefix_buf, art_prefix_buf_arena>(old);
+}
+
+// Free the out of line prefix of an inner node leaving the tree, right away
+// if no reader can reach the node any more.
+static inline void art_release_prefix(ArtNodeCommon *node, bool now) {
+  if (!node->has_full_prefix()) return;
+  if (now) {
+    art_free_prefix_buf(node->key.keyPtr);
+  } else {
+    art_epoch_free<art_free_prefix_buf, art_prefix_buf_arena>(
+        node->key.keyPtr);
+  }
+}
+
+template <uint8_t I = 0>
+static void *get_leaf_storage(uint8_t cls) {
+  if constexpr (I < ART_LEAF_SIZE_CLASS_NUM) {
+    if (cls == I + 1) {
+      return get_object<ArtLeafStorage<ART_LEAF_SIZE_CLASS[I]>>();
+    }
+    return get_leaf_storage<I + 1>(cls);
+  } else {
+    return nullptr;
+  }
+}
+
+template <uint8_t I = 0>
+static void return_leaf_storage(uint8_t cls, void *p) {
+  if constexpr (I < ART_LEAF_SIZE_CLASS_NUM) {
+    using S = ArtLeafStorage<ART_LEAF_SIZE_CLASS[I]>;
+    if (cls == I + 1) {
+      return_object<S>(static_cast<S *>(p));
+      return;
+    }
+    return_leaf_storage<I + 1>(cls, p);
+  }
+}
+
+// Bytes of leaf storage handed out by the pools, used and free.
+template <uint8_t I = 0>
+static size_t leaf_pool_bytes() {
+  if constexpr (I < ART_LEAF_SIZE_CLASS_NUM) {
+    constexpr uint32_t N = ART_LEAF_SIZE_CLASS[I];
+    return describe_objects<ArtLeafStorage<N>>().item_num * N +
+           leaf_pool_bytes<I + 1>();
+  } else {
+    return 0;
+  }
+}
+
+// Bytes the leaf pools give back to the system, see trim_objects().
+template <uint8_t I = 0>
+static size_t trim_leaf_pools() {
+  if constexpr (I < ART_LEAF_SIZE_CLASS_NUM) {
+    constexpr uint32_t N = ART_LEAF_SIZE_CLASS[I];
+    return trim_objects<ArtLeafStorage<N>>() + trim_leaf_pools<I + 1>();
+  } else {
+    return 0;
+  }
+}
+
+// Make sure |n| leaves of size class |cls| come from the pool without new
+// blocks, see reserve_objects().
+template <uint8_t I = 0>
+static void reserve_leaf_pool(uint8_t cls, size_t n, size_t nthread) {
+  if constexpr (I < ART_LEAF_SIZE_CLASS_NUM) {
+    if (cls == I + 1) {
+      reserve_objects<ArtLeafStorage<ART_LEAF_SIZE_CLASS[I]>>(n, nthread);
+      return;
+    }
+    reserve_leaf_pool<I + 1>(cls, n, nthread);
+  }
+}
+
+template <uint8_t I = 0>
+static void set_leaf_pool_huge_pages(bool enable, bool prefault) {
+  if constexpr (I < ART_LEAF_SIZE_CLASS_NUM) {
+    constexpr uint32_t N = ART_LEAF_SIZE_CLASS[I];
+    set_huge_page_blocks<ArtLeafStorage<N>>(enable, prefault);
+    set_leaf_pool_huge_pages<I + 1>(enable, prefault);
+  }
+}
+
 template <class T, bool all_new = false>
 static ArtLeaf<T> *get_new_leaf_node(const char *k, uint32_t l, T v) {
-  ArtLeaf<T> *p = nullptr;
+  static_assert(alignof(ArtLeaf<T>) <= 16, "leaf storage is 16 aligned");
+  size_t bytes = ArtLeaf<T>::alloc_size(l);
+  uint8_t cls = 0;
+  void *mem = nullptr;
+  bool from_arena = false;
   if constexpr (!all_new) {
-    p = get_object<ArtLeaf<T>>();
+    if (auto arena = SlabArena::current()) {
+      mem = art_arena_alloc_bytes(arena, bytes, &cls);
+      from_arena = true;
+    } else {
+      cls = art_leaf_size_class(bytes);
+      if (cls) mem = get_leaf_storage(cls);
+    }
   }
 
-  if (p) {
-    p->type = ArtNodeTrait<ArtLeaf<T>>::NODE_TYPE;
-    p->set_leaf_key_val(k, l, v);
+  ArtLeaf<T> *p = nullptr;
+  if (mem) {
+    p = new (mem) ArtLeaf<T>;
+    p->set_size_class(cls);
+    if (from_arena) p->set_from_arena();
   } else {
-    p = new ArtLeaf<T>;
+    mem = malloc(bytes);
+    assert(mem);
+    p = new (mem) ArtLeaf<T>;
     p->set_from_new();
-    p->set_leaf_key_val(k, l, v);
   }
+  p->set_leaf_key_val(k, l, v);
 
   return p;
 }
 
+// Leaf of key |k| holding |v|. With |lazy| it is a lazy leaf, unless |v|
+// would not come back unchanged from one, then a regular leaf keeps it.
+template <class T, bool lazy>
+static ArtNodeCommon *get_new_leaf(const char *k, uint32_t l, T v) {
+  if constexpr (lazy) {
+    if (likely(art_lazy_leaf_fits(v))) return art_lazy_leaf_bits(v);
+  }
+  return get_new_leaf_node<T>(k, l, v);
+}
+
+// Arena |node| comes from, nullptr if none.
+static inline SlabArena *art_node_arena(const void *p) {
+  auto node = static_cast<const ArtNodeCommon *>(p);
+  if (!node->is_from_arena()) return nullptr;
+  if (node->type == ART_NODE_LEAF && node->size_class() == 0) {
+    return SlabArena::of_large(node);
+  }
+  return SlabArena::of(node);
+}
+
+// Give node back immediately. Only safe when no other thread can reach it,
+// e.g. tree destruction or a node never published.
 template <class T>
 static void return_art_node(T *ptr) {
-  // todo(zzh). epoch based node memory reclaim
-  return;
   assert(ptr);
-  if (ptr->is_from_new()) {
+  if (ptr->is_from_arena()) {
+    SlabArena::of(ptr)->free(art_arena_class<T>(), ptr);
+  } else if (ptr->is_from_new()) {
     delete ptr;
   } else {
     ptr->reset();
@@ -56,5 +350,34 @@ static void return_art_node(T *ptr) {
   }
 }
 
+template <class T>
+static void return_art_node(ArtLeaf<T> *ptr) {
+  assert(ptr);
+  bool from_new = ptr->is_from_new();
+  bool from_arena = ptr->is_from_arena();
+  uint8_t cls = ptr->size_class();
+  ptr->~ArtLeaf<T>();
+  if (from_arena) {
+    art_arena_free_bytes(cls, ptr);
+  } else if (from_new) {
+    free(ptr);
+  } else {
+    return_leaf_storage(cls, ptr);
+  }
+}
+
+// Give back a node that was unlinked from a live tree. Concurrent readers
+// may still hold it, so it is freed after they leave their epoch.
+template <class T>
+static void return_art_node_erased(void *p) {
+  return_art_node(static_cast<T *>(p));
+}
+
+template <class T>
+static void retire_art_node(T *ptr) {
+  assert(ptr);
+  art_epoch_free<return_art_node_erased<T>, art_node_arena>(ptr);
+}
+
 }  // namespace detail
 }  // namespace art
@@ -6,14 +6,13 @@
 #include <cstdint>
 #include <cstring>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
+#include "art/art-simd.h"
 #include "common/logger.h"
 #include "common/macros.h"
 
-#if defined(__i386__) || defined(__amd64__)
-#include <emmintrin.h>
-#endif
-
 namespace art {
 
 enum ArtNodeType : uint8_t {
@@ -30,6 +29,23 @@ union ArtNodeKey {
   char *keyPtr;
 };
 
+// Whole prefix of an inner node kept out of line, see
+// ArtNodeCommon::has_full_prefix(). |len| bytes follow the header.
+struct ArtPrefixBuf {
+  uint32_t len;
+  // Where the buffer comes from, see art_new_prefix_buf().
+  uint32_t arena_cls;
+
+  char *data() { return reinterpret_cast<char *>(this + 1); }
+  const char *data() const { return reinterpret_cast<const char *>(this + 1); }
+};
+
+// Bits of ArtNodeCommon::flag, the high four hold the leaf size class.
+static constexpr uint8_t ART_NODE_FLAG_FROM_NEW = 1;
+static constexpr uint8_t ART_NODE_FLAG_FULL_PREFIX = 2;
+static constexpr uint8_t ART_NODE_FLAG_SHARED = 4;
+static constexpr uint8_t ART_NODE_FLAG_FROM_ARENA = 8;
+
 class ArtNode4;
 class ArtNode16;
 class ArtNode48;
@@ -73,7 +89,32 @@ struct ArtNodeTrait<ArtLeaf<T>> {
   static constexpr uint32_t NODE_CAPASITY = 0;
 };
 
-struct alignas(64) ArtNodeCommon {
+// When inner nodes change type. A node grows into the next type when an
+// insert finds it full, and shrinks into the previous one once a delete
+// leaves it with at most the shrink threshold of children. Keeping the
+// thresholds below the smaller type's capacity leaves a gap between grow
+// and shrink, so keys going back and forth across a boundary do not copy
+// the node on every insert and delete. A Node4 always collapses into its
+// child when one child is left.
+struct ArtShrinkPolicy {
+  uint8_t n16_to_n4 = 3;
+  uint8_t n48_to_n16 = 12;
+  uint8_t n256_to_n48 = 37;
+
+  // Shrink as soon as the children fit the smaller type.
+  static constexpr ArtShrinkPolicy eager() { return {4, 16, 48}; }
+
+  // Every threshold must fit the smaller type and leave at least two
+  // children, so a shrunk node is still a proper inner node.
+  constexpr bool valid() const {
+    return n16_to_n4 >= 2 && n16_to_n4 <= 4 && n48_to_n16 >= 2 &&
+           n48_to_n16 <= 16 && n256_to_n48 >= 2 && n256_to_n48 <= 48;
+  }
+};
+
+// Inner nodes are cache line aligned, leaves only need 8 bytes and are
+// packed into size classes together with their key, see ArtLeaf.
+struct ArtNodeCommon {
   std::atomic<uint64_t> version = {0};
   ArtNodeKey key = {.keyPtr = nullptr};
   uint32_t keyLen = 0;
@@ -81,9 +122,41 @@ struct alignas(64) ArtNodeCommon {
   ArtNodeType type = ART_NODE_INVALID;
   uint16_t childNum = 0;
 
-  void set_from_new() { flag = 1; }
+  void set_from_new() { flag |= ART_NODE_FLAG_FROM_NEW; }
+
+  bool is_from_new() const { return flag & ART_NODE_FLAG_FROM_NEW; }
+
+  // Memory comes from the arena of a tree, see ArtArenaAlloc.
+  void set_from_arena() { flag |= ART_NODE_FLAG_FROM_ARENA; }
+
+  bool is_from_arena() const { return flag & ART_NODE_FLAG_FROM_ARENA; }
+
+  // Inner node keeps its whole prefix in an ArtPrefixBuf at keyPtr. Once set
+  // the bit stays while the node is in the tree and keyPtr always points to
+  // a live buffer, so optimistic readers seeing it can follow the pointer.
+  bool has_full_prefix() const {
+    return __atomic_load_n(&flag, __ATOMIC_ACQUIRE) & ART_NODE_FLAG_FULL_PREFIX;
+  }
+
+  void set_full_prefix_flag() {
+    __atomic_or_fetch(&flag, ART_NODE_FLAG_FULL_PREFIX, __ATOMIC_RELEASE);
+  }
+
+  // Node may be reachable from a snapshot, writers copy it instead of
+  // changing it, see ArtTree::snapshot(). The bit is set before any writer
+  // can reach the node through a node it owns, and is never cleared.
+  bool is_shared() const {
+    return __atomic_load_n(&flag, __ATOMIC_ACQUIRE) & ART_NODE_FLAG_SHARED;
+  }
 
-  bool is_from_new() const { return flag & 1; }
+  void set_shared_flag() {
+    __atomic_or_fetch(&flag, ART_NODE_FLAG_SHARED, __ATOMIC_RELEASE);
+  }
+
+  // Leaf storage size class, 0 means none. Kept in the high flag bits.
+  void set_size_class(uint8_t c) { flag = (flag & 0x0f) | (c << 4); }
+
+  uint8_t size_class() const { return flag >> 4; }
 
   void reset() {
     reset_key();
@@ -93,11 +166,13 @@ struct alignas(64) ArtNodeCommon {
     childNum = 0;
   }
 
+  // Take over the prefix of |node| that this node replaces. An out of line
+  // prefix moves with it, |node| keeps pointing to the buffer for readers
+  // still on it.
   void get_key_from_another(ArtNodeCommon *node) {
     key.keyPtr = node->key.keyPtr;
     keyLen = node->keyLen;
-    node->key.keyPtr = nullptr;
-    node->keyLen = 0;
+    flag |= node->flag & ART_NODE_FLAG_FULL_PREFIX;
   }
 
   void copy_key_to(char *buf) {
@@ -105,29 +180,16 @@ struct alignas(64) ArtNodeCommon {
     std::memcpy(buf, ptr, keyLen);
   }
 
+  // Inner nodes keep at most ART_MAX_PREFIX_LEN bytes of prefix. Leaves set
+  // their full key with ArtLeaf::set_leaf_key_val().
   void set_key(const char *k, uint32_t l) {
+    assert(type != ArtNodeType::ART_NODE_LEAF || l <= ART_MAX_PREFIX_LEN);
     reset_key();
-    if (type == ArtNodeType::ART_NODE_LEAF) {
-      if (l <= ART_MAX_PREFIX_LEN) {
-        std::memcpy(key.shortKey, k, std::min((uint32_t)ART_MAX_PREFIX_LEN, l));
-      } else {
-        char *tmp = (char *)malloc(l);
-        std::memcpy(tmp, k, l);
-        key.keyPtr = tmp;
-      }
-    } else {
-      std::memcpy(key.shortKey, k, std::min((uint32_t)ART_MAX_PREFIX_LEN, l));
-    }
+    std::memcpy(key.shortKey, k, std::min((uint32_t)ART_MAX_PREFIX_LEN, l));
     keyLen = l;
   }
 
   void reset_key() {
-    if (type == ArtNodeType::ART_NODE_LEAF) {
-      if (keyLen > ART_MAX_PREFIX_LEN) {
-        free(key.keyPtr);
-      }
-    }
-
     key.keyPtr = nullptr;
     keyLen = 0;
   }
@@ -139,15 +201,21 @@ struct alignas(64) ArtNodeCommon {
   }
 
   std::string to_string() const {
-    const char *ptr = get_key();
-    uint32_t len = 0;
-    if (type == ArtNodeType::ART_NODE_LEAF) {
-      len = keyLen;
-    } else {
-      len = std::min(keyLen, (uint32_t)ART_MAX_PREFIX_LEN);
-    }
+    if (type == ArtNodeType::ART_NODE_LEAF) return {get_key(), keyLen};
+    return std::string(prefix_view());
+  }
 
-    return {ptr, len};
+  // Stored part of an inner node prefix: all keyLen bytes when kept out of
+  // line, otherwise at most the first ART_MAX_PREFIX_LEN. Bounded by the
+  // buffer, so a racing writer can only make it shorter than keyLen.
+  std::string_view prefix_view() const {
+    uint32_t len = keyLen;
+    if (has_full_prefix()) {
+      auto buf = reinterpret_cast<const ArtPrefixBuf *>(
+          __atomic_load_n(&key.keyPtr, __ATOMIC_ACQUIRE));
+      return {buf->data(), std::min(len, buf->len)};
+    }
+    return {key.shortKey, std::min(len, (uint32_t)ART_MAX_PREFIX_LEN)};
   }
 
   inline const char *get_key() const {
@@ -190,20 +258,23 @@ struct alignas(64) ArtNodeCommon {
     return childNum == full_cnt;
   }
 
-  bool need_adjust_after_delete() const {
-    uint32_t lower_bound_cnt = 0;
+  // Whether deleting one child replaces this node, by a smaller type or by
+  // its last child. The slot pointing to the node is written then, so the
+  // caller has to lock the parent too.
+  bool need_adjust_after_delete(const ArtShrinkPolicy &policy) const {
+    uint32_t shrink_at = 0;
     switch (type) {
       case ArtNodeType::ART_NODE_4: {
-        lower_bound_cnt = 2;
+        shrink_at = 1;
       } break;
       case ArtNodeType::ART_NODE_16: {
-        lower_bound_cnt = 4;
+        shrink_at = policy.n16_to_n4;
       } break;
       case ArtNodeType::ART_NODE_48: {
-        lower_bound_cnt = 16;
+        shrink_at = policy.n48_to_n16;
       } break;
       case ArtNodeType::ART_NODE_256: {
-        lower_bound_cnt = 48;
+        shrink_at = policy.n256_to_n48;
       } break;
 
       default: {
@@ -211,11 +282,11 @@ struct alignas(64) ArtNodeCommon {
       }
     }
 
-    return childNum <= lower_bound_cnt;
+    return childNum <= shrink_at + 1;
   }
 };
 
-struct ArtNode4 : public ArtNodeCommon {
+struct alignas(64) ArtNode4 : public ArtNodeCommon {
   uint8_t keys[4] = {0};
   uint32_t alignNoUse = 0;
   ArtNodeCommon *children[4] = {nullptr};
@@ -223,14 +294,8 @@ struct ArtNode4 : public ArtNodeCommon {
   ArtNode4() { type = ArtNodeType::ART_NODE_4; }
 
   ArtNodeCommon **find_child(uint8_t keyByte) {
-    ArtNodeCommon **ret = nullptr;
-    for (int32_t i = 0; i < childNum; i++) {
-      if (keys[i] == keyByte) {
-        ret = &children[i];
-        break;
-      }
-    }
-    return ret;
+    int32_t idx = detail::art_simd_find_n4(keys, childNum, keyByte);
+    return idx >= 0 ? &children[idx] : nullptr;
   }
 
   void init_with_leaf(uint8_t c1, ArtNodeCommon *l1, uint8_t c2,
@@ -249,41 +314,44 @@ struct ArtNode4 : public ArtNodeCommon {
   }
 };
 
-struct ArtNode16 : public ArtNodeCommon {
+struct alignas(64) ArtNode16 : public ArtNodeCommon {
   uint8_t keys[16] = {0};
   ArtNodeCommon *children[16] = {nullptr};
 
   ArtNode16() { type = ArtNodeType::ART_NODE_16; }
 
   ArtNodeCommon **find_child(uint8_t keyByte) {
-#if defined(__i386__) || defined(__amd64__)
-    int bitfield =
-        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(keyByte),
-                                         _mm_loadu_si128((__m128i *)keys))) &
-        ((1 << childNum) - 1);
-    return (bool)bitfield ? &children[__builtin_ctz(bitfield)] : nullptr;
-#else
-    int lo, mid, hi;
-    lo = 0;
-    hi = childNum;
-    while (lo < hi) {
-      mid = (lo + hi) / 2;
-      if (keyByte < keys[mid]) {
-        hi = mid;
-      } else if (keyByte > keys[mid]) {
-        lo = mid + 1;
-      } else {
-        return &children[mid];
+    int32_t idx = detail::art_simd_find_n16(keys, childNum, keyByte);
+    return idx >= 0 ? &children[idx] : nullptr;
+  }
+};
+
+// Set of key bytes, lets writers visit the children of a Node48/Node256 in
+// O(children) instead of scanning all 256 entries.
+struct ArtByteBitmap {
+  uint64_t words[4] = {0};
+
+  void set(uint8_t b) { words[b >> 6] |= 1ULL << (b & 63); }
+  void clear(uint8_t b) { words[b >> 6] &= ~(1ULL << (b & 63)); }
+  bool test(uint8_t b) const { return words[b >> 6] >> (b & 63) & 1; }
+
+  // fn(uint8_t byte) for every set byte, in ascending order.
+  template <class F>
+  void for_each(F &&fn) const {
+    for (uint32_t w = 0; w < 4; w++) {
+      for (uint64_t bits = words[w]; bits; bits &= bits - 1) {
+        fn(static_cast<uint8_t>(w * 64 + __builtin_ctzll(bits)));
       }
     }
-    return nullptr;
-#endif
   }
 };
 
-struct ArtNode48 : public ArtNodeCommon {
+struct alignas(64) ArtNode48 : public ArtNodeCommon {
   uint8_t index[256] = {0};
   ArtNodeCommon *children[48] = {nullptr};
+  // Kept by writers only, readers go through index.
+  ArtByteBitmap present;
+  uint64_t used_slots = 0;
 
   ArtNode48() { type = ArtNodeType::ART_NODE_48; }
 
@@ -294,24 +362,84 @@ struct ArtNode48 : public ArtNodeCommon {
     }
     return ret;
   }
+
+  // Takes the lowest free slot, childNum is left to the caller. The child is
+  // stored before index so readers never follow an index to an empty slot.
+  void set_child(uint8_t keyByte, ArtNodeCommon *child) {
+    assert(!index[keyByte] && used_slots != (1ULL << 48) - 1);
+    uint32_t slot = __builtin_ctzll(~used_slots);
+    children[slot] = child;
+    index[keyByte] = slot + 1;
+    used_slots |= 1ULL << slot;
+    present.set(keyByte);
+  }
+
+  void remove_child(uint8_t keyByte) {
+    assert(index[keyByte]);
+    uint32_t slot = index[keyByte] - 1;
+    index[keyByte] = 0;
+    children[slot] = nullptr;
+    used_slots &= ~(1ULL << slot);
+    present.clear(keyByte);
+  }
+
+  // fn(uint8_t byte, ArtNodeCommon *child) in key byte order.
+  template <class F>
+  void for_each_child(F &&fn) const {
+    present.for_each([&](uint8_t b) { fn(b, children[index[b] - 1]); });
+  }
 };
 
-struct ArtNode256 : public ArtNodeCommon {
+struct alignas(64) ArtNode256 : public ArtNodeCommon {
   ArtNodeCommon *children[256] = {nullptr};
+  // Kept by writers only, readers go through children.
+  ArtByteBitmap present;
 
   ArtNode256() { type = ArtNodeType::ART_NODE_256; }
 
   ArtNodeCommon **find_child(uint8_t keyByte) {
     return children[keyByte] != nullptr ? &children[keyByte] : nullptr;
   }
+
+  void set_child(uint8_t keyByte, ArtNodeCommon *child) {
+    children[keyByte] = child;
+    present.set(keyByte);
+  }
+
+  void remove_child(uint8_t keyByte) {
+    children[keyByte] = nullptr;
+    present.clear(keyByte);
+  }
+
+  // fn(uint8_t byte, ArtNodeCommon *child) in key byte order.
+  template <class F>
+  void for_each_child(F &&fn) const {
+    present.for_each([&](uint8_t b) { fn(b, children[b]); });
+  }
 };
 
+// A leaf and its key share one allocation: the header and value, then the
+// key bytes when they do not fit in shortKey. keyPtr points just past the
+// leaf, so readers go through get_key() as before.
 template <class T>
 struct ArtLeaf : public ArtNodeCommon {
   ArtLeaf() { type = ArtNodeType::ART_NODE_LEAF; }
 
+  // Bytes needed for a leaf with a |l| bytes key.
+  static constexpr size_t alloc_size(uint32_t l) {
+    return sizeof(ArtLeaf) + (l > ART_MAX_PREFIX_LEN ? l : 0);
+  }
+
+  // Must only be called on a leaf allocated with alloc_size(l) bytes.
   void set_leaf_key_val(const char *k, uint32_t l, T v) {
-    set_key(k, l);
+    if (l > ART_MAX_PREFIX_LEN) {
+      char *inline_key = reinterpret_cast<char *>(this + 1);
+      std::memcpy(inline_key, k, l);
+      key.keyPtr = inline_key;
+    } else {
+      std::memcpy(key.shortKey, k, l);
+    }
+    keyLen = l;
     value = v;
   }
 
@@ -348,27 +476,72 @@ static_assert(ArtNodeTrait<ArtNode256>::NODE_CAPASITY == 256,
 static_assert(ArtNodeTrait<ArtLeaf<int>>::NODE_CAPASITY == 0,
               "should be equal");
 
+static_assert(sizeof(ArtNodeCommon) == 24, "leaf header should stay packed");
+static_assert(alignof(ArtNode4) == 64 && alignof(ArtNode256) == 64,
+              "inner nodes should be cache line aligned");
+static_assert(sizeof(ArtNode48) == 704 && sizeof(ArtNode256) == 2112,
+              "bitmaps should fit in the alignment padding");
+
 namespace detail {
 
+// Lazy leaves. A child slot with bit 0 set holds a value instead of a node
+// pointer, nodes are at least 8-byte aligned so a real child never has it.
+// Value is shifted left by one, so it must fit in 63 bits, or the process
+// aborts when it is stored.
+static inline bool art_is_lazy_leaf(const ArtNodeCommon *node) {
+  return reinterpret_cast<uintptr_t>(node) & 1;
+}
+
+template <class T>
+static inline T art_lazy_leaf_value(const ArtNodeCommon *node) {
+  uint64_t bits = reinterpret_cast<uintptr_t>(node);
+  if constexpr (std::is_pointer_v<T>) {
+    return reinterpret_cast<T>(bits >> 1);
+  } else if constexpr (std::is_signed_v<T>) {
+    return static_cast<T>((int64_t)bits >> 1);
+  } else {
+    return static_cast<T>(bits >> 1);
+  }
+}
+
+template <class T>
+static inline ArtNodeCommon *art_lazy_leaf_bits(T v) {
+  static_assert(sizeof(T) <= sizeof(uint64_t) &&
+                    (std::is_integral_v<T> || std::is_pointer_v<T>),
+                "lazy leaf value must be an integer or pointer");
+  uint64_t bits;
+  if constexpr (std::is_pointer_v<T>) {
+    bits = reinterpret_cast<uintptr_t>(v);
+  } else {
+    bits = static_cast<uint64_t>(v);
+  }
+  return reinterpret_cast<ArtNodeCommon *>((bits << 1) | 1);
+}
+
+// Whether |v| comes back unchanged from a lazy leaf.
+template <class T>
+static inline bool art_lazy_leaf_fits(T v) {
+  return art_lazy_leaf_value<T>(art_lazy_leaf_bits(v)) == v;
+}
+
 struct PrefixDiffResult {
   int32_t prefix_len;
   uint8_t c1;
   uint8_t c2;
 };
 
-static PrefixDiffResult get_prefix_len_and_diff_char(const ArtNodeCommon *leaf1,
-                                                     const ArtNodeCommon *leaf2,
+static PrefixDiffResult get_prefix_len_and_diff_char(const char *key1,
+                                                     uint32_t len1,
+                                                     const char *key2,
+                                                     uint32_t len2,
                                                      int32_t depth) {
-  assert(leaf1->type == ArtNodeType::ART_NODE_LEAF);
-  assert(leaf2->type == ArtNodeType::ART_NODE_LEAF);
-
-  int32_t maxCmp = std::min(leaf1->keyLen, leaf2->keyLen) - depth;
+  int32_t maxCmp = std::min(len1, len2) - depth;
   int idx = 0;
   uint8_t c1 = 0;
   uint8_t c2 = 0;
 
-  auto key1 = leaf1->get_key() + depth;
-  auto key2 = leaf2->get_key() + depth;
+  key1 += depth;
+  key2 += depth;
 
   for (; idx < maxCmp; idx++) {
     if (key1[idx] != key2[idx]) {
@@ -380,7 +553,7 @@ static PrefixDiffResult get_prefix_len_and_diff_char(const ArtNodeCommon *leaf1,
 
   // It a problem that how to support predix contain: str2 = str1 + xxx
   if (unlikely(idx == maxCmp)) {
-    if (leaf1->keyLen > leaf2->keyLen) {
+    if (len1 > len2) {
       c1 = key1[idx];
     } else {
       c2 = key2[idx];
@@ -406,26 +579,12 @@ static inline ArtNodeKey funGetNewPrefix(const char *ptr, uint32_t depth,
 
 static bool art_inner_prefix_match(const ArtNodeCommon *node, const char *key,
                                    uint32_t len, uint32_t depth) {
-  auto store_inner_prefix_len =
-      std::min(node->keyLen, (uint32_t)ART_MAX_PREFIX_LEN);
+  auto prefix = node->prefix_view();
   uint32_t remain_key_len = len - depth;
 
-  bool ret = false;
   // if remain key len less than inner prefix, mismatch
-  if (remain_key_len >= store_inner_prefix_len) {
-    ret = true;
-
-    int32_t idx = 0;
-    auto prefix = node->get_key();
-    for (; idx < store_inner_prefix_len; idx++) {
-      if (prefix[idx] != key[depth + idx]) {
-        ret = false;
-        break;
-      }
-    }
-  }
-
-  return ret;
+  if (remain_key_len < prefix.size()) return false;
+  return std::memcmp(prefix.data(), key + depth, prefix.size()) == 0;
 }
 
 static inline ArtNodeCommon **art_find_child(ArtNodeCommon *node,
@@ -451,6 +610,110 @@ static inline ArtNodeCommon **art_find_child(ArtNodeCommon *node,
   return ret;
 }
 
+// Ordered child lookup used by iterators. Returns first child whose key byte
+// >= |from|, or nullptr. |from| can be 256, which matches nothing. Called
+// under optimistic lock, so childNum is clamped and result must be validated.
+static inline ArtNodeCommon *art_first_child_ge(const ArtNodeCommon *node,
+                                                int32_t from,
+                                                uint8_t *out_byte) {
+  if (from > 255) return nullptr;
+  switch (node->type) {
+    case ART_NODE_4: {
+      auto n = reinterpret_cast<const ArtNode4 *>(node);
+      uint32_t cnt = std::min<uint32_t>(n->childNum, 4);
+      uint32_t i = art_simd_lower_bound(n->keys, cnt, from);
+      if (i < cnt) {
+        *out_byte = n->keys[i];
+        return n->children[i];
+      }
+    } break;
+    case ART_NODE_16: {
+      auto n = reinterpret_cast<const ArtNode16 *>(node);
+      uint32_t cnt = std::min<uint32_t>(n->childNum, 16);
+      uint32_t i = art_simd_lower_bound(n->keys, cnt, from);
+      if (i < cnt) {
+        *out_byte = n->keys[i];
+        return n->children[i];
+      }
+    } break;
+    case ART_NODE_48: {
+      auto n = reinterpret_cast<const ArtNode48 *>(node);
+      int32_t i = art_simd_n48_first_ge(n->index, from);
+      uint8_t idx = i >= 0 ? n->index[i] : 0;
+      if (idx && idx <= 48) {
+        *out_byte = i;
+        return n->children[idx - 1];
+      }
+    } break;
+    case ART_NODE_256: {
+      auto n = reinterpret_cast<const ArtNode256 *>(node);
+      int32_t i = art_simd_n256_first_ge(n->children, from);
+      if (i >= 0) {
+        *out_byte = i;
+        return n->children[i];
+      }
+    } break;
+    default:
+      break;
+  }
+  return nullptr;
+}
+
+// Returns last child whose key byte <= |from|, or nullptr. |from| can be -1.
+static inline ArtNodeCommon *art_last_child_le(const ArtNodeCommon *node,
+                                               int32_t from,
+                                               uint8_t *out_byte) {
+  if (from < 0) return nullptr;
+  switch (node->type) {
+    case ART_NODE_4: {
+      auto n = reinterpret_cast<const ArtNode4 *>(node);
+      uint32_t cnt = std::min<uint32_t>(n->childNum, 4);
+      uint32_t i =
+          from >= 255 ? cnt : art_simd_lower_bound(n->keys, cnt, from + 1);
+      if (i > 0) {
+        *out_byte = n->keys[i - 1];
+        return n->children[i - 1];
+      }
+    } break;
+    case ART_NODE_16: {
+      auto n = reinterpret_cast<const ArtNode16 *>(node);
+      uint32_t cnt = std::min<uint32_t>(n->childNum, 16);
+      uint32_t i =
+          from >= 255 ? cnt : art_simd_lower_bound(n->keys, cnt, from + 1);
+      if (i > 0) {
+        *out_byte = n->keys[i - 1];
+        return n->children[i - 1];
+      }
+    } break;
+    case ART_NODE_48: {
+      auto n = reinterpret_cast<const ArtNode48 *>(node);
+      int32_t i = art_simd_n48_last_le(n->index, from);
+      uint8_t idx = i >= 0 ? n->index[i] : 0;
+      if (idx && idx <= 48) {
+        *out_byte = i;
+        return n->children[idx - 1];
+      }
+    } break;
+    case ART_NODE_256: {
+      auto n = reinterpret_cast<const ArtNode256 *>(node);
+      int32_t i = art_simd_n256_last_le(n->children, from);
+      if (i >= 0) {
+        *out_byte = i;
+        return n->children[i];
+      }
+    } break;
+    default:
+      break;
+  }
+  return nullptr;
+}
+
+// Header and the line after it hold type, prefix and most of the keys/index.
+static inline void art_prefetch_node(const ArtNodeCommon *node) {
+  __builtin_prefetch(node);
+  __builtin_prefetch(reinterpret_cast<const char *>(node) + 64);
+}
+
 static inline std::string node_type_string(const ArtNodeCommon *node) {
   std::string ret;
   switch (node->type) {
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+
+#include "art/art-node.h"
+
+// Optimistic lock coupling, see "The ART of Practical Synchronization".
+// Version of a node: bit 0 is obsolete flag, bit 1 is lock flag, the others
+// are a counter bumped by each write.
+#define ART_SET_LOCK_BIT(v) ((v) + 2)
+#define ART_IS_OBSOLETE(v) ((v)&1)
+#define ART_IS_LOCKED(v) ((v)&2)
+
+namespace art {
+namespace detail {
+
+static inline uint64_t art_spin_on_locked_node(const ArtNodeCommon* node) {
+  uint64_t version = node->version.load();
+  while (ART_IS_LOCKED(version)) {
+    __builtin_ia32_pause();
+    version = node->version.load();
+  }
+  return version;
+}
+
+// Wait for and take the write lock of |node|. Only for a node whose parent
+// we hold write locked, so it can not become obsolete meanwhile.
+static inline void art_write_lock_node(ArtNodeCommon* node) {
+  while (true) {
+    uint64_t version = art_spin_on_locked_node(node);
+    if (node->version.compare_exchange_weak(version,
+                                            ART_SET_LOCK_BIT(version))) {
+      return;
+    }
+  }
+}
+
+}  // namespace detail
+}  // namespace art
+
+#define ART_MACRO_READ_LOCK_OR_RESTART(node, version_varname, restart_label) \
+  version_varname = art::detail::art_spin_on_locked_node(node);              \
+  if (ART_IS_OBSOLETE(version_varname)) goto restart_label
+
+#define ART_MACRO_READ_UNLOCK_OR_RESTART(node, version_varname, restart_label) \
+  if ((version_varname) != (node)->version.load()) goto restart_label
+
+#define ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(node, version_varname, \
+                                              restart_label)         \
+  if (!(node)->version.compare_exchange_strong(                      \
+          version_varname, ART_SET_LOCK_BIT(version_varname)))       \
+  goto restart_label
+
+#define ART_MACRO_WRITE_UNLOCK(node) (node)->version.fetch_add(2)
+
+#define ART_MACRO_WRITE_UNLOCK_OBSOLETE(node) (node)->version.fetch_add(3)
+
+// Node may be replaced by a grown/shrunk copy while locked, in that case it
+// is retired and readers still holding it must restart.
+#define ART_MACRO_WRITE_UNLOCK_IF_REPLACED(node, node_pp) \
+  do {                                                    \
+    if (*(node_pp) != (node)) {                           \
+      ART_MACRO_WRITE_UNLOCK_OBSOLETE(node);              \
+    } else {                                              \
+      ART_MACRO_WRITE_UNLOCK(node);                       \
+    }                                                     \
+  } while (0)
+
+#define ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART_AND_RELEASE(         \
+    node, version_varname, lockNode, restart_label)                \
+  do {                                                             \
+    if (!(node)->version.compare_exchange_strong(                  \
+            version_varname, ART_SET_LOCK_BIT(version_varname))) { \
+      ART_MACRO_WRITE_UNLOCK(lockNode);                            \
+      goto restart_label;                                          \
+    }                                                              \
+  } while (0)
+
+#define ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART_AND_RELEASE_TWO(     \
+    node, version_varname, lockNode_p, lockNode_pp, restart_label) \
+  do {                                                             \
+    if (!(node)->version.compare_exchange_strong(                  \
+            version_varname, ART_SET_LOCK_BIT(version_varname))) { \
+      ART_MACRO_WRITE_UNLOCK(lockNode_p);                          \
+      ART_MACRO_WRITE_UNLOCK(lockNode_pp);                         \
+      goto restart_label;                                          \
+    }                                                              \
+  } while (0)
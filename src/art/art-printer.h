@@ -28,6 +28,11 @@ static void art_node_to_string(std::string &out, const ArtNodeCommon *node,
     if (!recusive) return;
   }
 
+  if (art_is_lazy_leaf(node)) {
+    out += "type:LazyLeaf\n";
+    return;
+  }
+
   out += "type:" + node_type_string(node);
   if (node->childNum) {
     out += ", prefix:" + node->to_string() +
@@ -53,22 +58,15 @@ static void art_node_to_string(std::string &out, const ArtNodeCommon *node,
     } break;
     case ART_NODE_48: {
       auto node48 = reinterpret_cast<const ArtNode48 *>(node);
-      for (uint16_t i = 0; i <= 255; i++) {
-        if (node48->index[i]) {
-          art_node_to_string(out, node48->children[node48->index[i] - 1],
-                             depth + node->keyLen + 1, node48->index[i],
-                             recusive);
-        }
-      }
+      node48->for_each_child([&](uint8_t b, const ArtNodeCommon *c) {
+        art_node_to_string(out, c, depth + node->keyLen + 1, b, recusive);
+      });
     } break;
     case ART_NODE_256: {
       auto node256 = reinterpret_cast<const ArtNode256 *>(node);
-      for (uint16_t i = 0; i <= 255; i++) {
-        if (node256->children[i]) {
-          art_node_to_string(out, node256->children[i],
-                             depth + node->keyLen + 1, i, recusive);
-        }
-      }
+      node256->for_each_child([&](uint8_t b, const ArtNodeCommon *c) {
+        art_node_to_string(out, c, depth + node->keyLen + 1, b, recusive);
+      });
     } break;
     default: {
     } break;
@@ -92,6 +90,16 @@ inline std::ostream &operator<<(std::ostream &os, const ArtNodeCommon &node) {
   return os << art_node_to_string_unsafe(&node);
 }
 
+template <uint8_t I = 0>
+void leaf_pool_usage(std::ostream &os) {
+  if constexpr (I < detail::ART_LEAF_SIZE_CLASS_NUM) {
+    constexpr uint32_t N = detail::ART_LEAF_SIZE_CLASS[I];
+    os << "Leaf" << N << ":\n"
+       << describe_objects<detail::ArtLeafStorage<N>>() << "\n";
+    leaf_pool_usage<I + 1>(os);
+  }
+}
+
 template <class T>
 std::string get_pool_usage() {
   std::stringstream os;
@@ -100,10 +108,32 @@ std::string get_pool_usage() {
      << describe_objects<ArtNode4>() << "\nNode16:\n"
      << describe_objects<ArtNode16>() << "\nNode48:\n"
      << describe_objects<ArtNode48>() << "\nNode256:\n"
-     << describe_objects<ArtNode256>() << "\nLeaf:\n"
-     << describe_objects<ArtLeaf<T>>() << "\n";
+     << describe_objects<ArtNode256>() << "\n";
+  leaf_pool_usage(os);
 
   return os.str();
 }
 
+// Give memory of the node pools no tree uses any more back to the system,
+// e.g. after a burst of writes, see trim_objects(). Nodes freed by deletes
+// reach the pools after readers, see epoch_reclaim(). Call it now and then
+// or from an ObjectPoolTrimmer. Returns number of bytes released.
+inline size_t trim_pools() {
+  return trim_objects<ArtNode4>() + trim_objects<ArtNode16>() +
+         trim_objects<ArtNode48>() + trim_objects<ArtNode256>() +
+         detail::trim_leaf_pools();
+}
+
+// Take node pool memory from now on from 2 MiB regions backed by
+// transparent huge pages, see set_huge_page_blocks(). Lookups in a large
+// tree then miss the TLB less often. |prefault| maps each region in when
+// it is taken. Nodes allocated before keep their place.
+inline void set_pool_huge_pages(bool enable, bool prefault = false) {
+  set_huge_page_blocks<ArtNode4>(enable, prefault);
+  set_huge_page_blocks<ArtNode16>(enable, prefault);
+  set_huge_page_blocks<ArtNode48>(enable, prefault);
+  set_huge_page_blocks<ArtNode256>(enable, prefault);
+  detail::set_leaf_pool_huge_pages(enable, prefault);
+}
+
 }  // namespace art
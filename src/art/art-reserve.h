@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "art/art-node-pool.h"
+#include "art/art-node.h"
+
+namespace art {
+
+// What the keys of a tree look like, to size ArtTree::reserve().
+struct ArtKeyProfile {
+  // Typical key length in bytes, it decides the leaf size class.
+  uint32_t key_len = 16;
+  // Number of values a key byte takes, e.g. 10 for decimal strings. Bytes
+  // are taken as random, which decides how many children nodes have.
+  uint32_t alphabet = 256;
+  // Keys cover their space without gaps, e.g. sequential ids, so nodes
+  // have a child for every value of the alphabet.
+  bool dense = false;
+  // Threads that will insert, the reserved nodes are shared out among them.
+  uint32_t threads = 1;
+};
+
+namespace detail {
+
+// Nodes to reserve, inner nodes in ArtNodeType order, leaves by size
+// class, leaf[0] are leaves too large for any class.
+struct ArtNodeCounts {
+  size_t inner[ART_NODE_256] = {};
+  size_t leaf[ART_LEAF_SIZE_CLASS_NUM + 1] = {};
+};
+
+// Index into ArtNodeCounts::inner of the smallest node with |children|.
+static inline uint32_t art_inner_index(uint32_t children) {
+  if (children <= 4) return ART_NODE_4 - 1;
+  if (children <= 16) return ART_NODE_16 - 1;
+  if (children <= 48) return ART_NODE_48 - 1;
+  return ART_NODE_256 - 1;
+}
+
+// Expected inner nodes of |keys| random keys. The keys sharing d leading
+// bytes fall into one of alphabet^d buckets, a Poisson number of them each,
+// and so does every next byte value within a bucket independently. A
+// bucket has a node of c children if its keys take c >= 2 next byte values,
+// c being binomial over the alphabet; with fewer the path is compressed.
+// Dense keys fill every bucket instead.
+static inline void art_estimate_inner(uint64_t keys,
+                                      const ArtKeyProfile &profile,
+                                      ArtNodeCounts *counts) {
+  const uint32_t a = std::min(std::max(profile.alphabet, 2u), 256u);
+  if (profile.dense) {
+    // full nodes, each level a times fewer than the one below, but the
+    // last of a level, and a single child is no node of its own
+    for (uint64_t n = keys; n > 1; n = (n + a - 1) / a) {
+      counts->inner[art_inner_index(a)] += n / a;
+      if (n % a > 1) counts->inner[art_inner_index(n % a)]++;
+    }
+    return;
+  }
+  double dist[ART_NODE_256] = {};
+  double buckets = 1;
+  for (uint32_t d = 0; d < std::max(profile.key_len, 1u); d++) {
+    // keys per next byte value of a bucket
+    double mean = keys / buckets / a;
+    double log_p = std::log(-std::expm1(-mean));
+    double nodes = 0;
+    for (uint32_t c = 2; c <= a; c++) {
+      double log_pmf = std::lgamma(a + 1.0) - std::lgamma(c + 1.0) -
+                       std::lgamma(a - c + 1.0) + c * log_p - (a - c) * mean;
+      double n = buckets * std::exp(log_pmf);
+      dist[art_inner_index(c)] += n;
+      nodes += n;
+    }
+    // deeper buckets hold fewer nodes still
+    if (nodes < 0.5 && mean < 1) break;
+    buckets *= a;
+  }
+  for (uint32_t i = 0; i < ART_NODE_256; i++) {
+    counts->inner[i] = static_cast<size_t>(std::ceil(dist[i]));
+  }
+}
+
+// Nodes |keys| keys like |profile| take in a tree of ArtLeaf<T> leaves, or
+// of lazy leaves with |lazy_leaf|. A node outgrown by an insert waits for
+// readers before it can be reused, so every larger node is counted once
+// more in each smaller type, and 1/16 is added to cover the estimate.
+template <class T>
+static ArtNodeCounts art_estimate_nodes(uint64_t keys,
+                                        const ArtKeyProfile &profile,
+                                        bool lazy_leaf) {
+  ArtNodeCounts counts;
+  art_estimate_inner(keys, profile, &counts);
+  size_t larger = 0;
+  for (uint32_t i = ART_NODE_256; i-- > 0;) {
+    size_t n = counts.inner[i];
+    counts.inner[i] += larger;
+    counts.inner[i] += counts.inner[i] / 16;
+    larger += n;
+  }
+  if (!lazy_leaf) {
+    uint8_t cls =
+        art_leaf_size_class(ArtLeaf<T>::alloc_size(profile.key_len));
+    counts.leaf[cls] = keys + keys / 16;
+  }
+  return counts;
+}
+
+}  // namespace detail
+}  // namespace art
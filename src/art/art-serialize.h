@@ -0,0 +1,556 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "art/art-bulk-load.h"
+#include "art/art-node-del.h"
+#include "common/logger.h"
+
+namespace art {
+namespace detail {
+
+// File form of a tree, written by ArtSnapshot::save() and read back by
+// ArtTree::load(). Integers are fixed width in host byte order.
+//
+//   header   "ARTSAVE\0", u32 format version, u32 sizeof(T),
+//            u32 KeyTraits::FIXED_LEN, u32 flags
+//   records  the root and all nodes below it in pre-order, none if empty
+//   trailer  u8 ART_RECORD_END, u64 number of keys
+//
+// A record starts with a u8 tag. An inner node is tagged with its
+// ArtNodeType and holds u16 child count, u32 prefix length, u32 stored
+// prefix length, the stored prefix bytes and the key bytes of its children
+// in ascending order. The records of the children follow in the same order.
+// Only the part of a prefix kept in the node is stored, the rest is found
+// from the leftmost leaf as in the live tree. A leaf is tagged ART_NODE_LEAF
+// and holds u32 key length, the key and the value. A lazy leaf holds the
+// value only, a value a lazy leaf can not hold is kept in a regular leaf.
+//
+// A tree is as deep as its longest key, so the walks over a tree or a file
+// keep their open nodes on a stack of their own instead of recursing.
+static constexpr char ART_SAVE_MAGIC[8] = {'A', 'R', 'T', 'S',
+                                           'A', 'V', 'E', '\0'};
+static constexpr uint32_t ART_SAVE_VERSION = 1;
+static constexpr uint32_t ART_SAVE_FLAG_LAZY_LEAF = 1;
+static constexpr uint8_t ART_RECORD_LAZY_LEAF = 0x10;
+static constexpr uint8_t ART_RECORD_END = 0xff;
+
+static constexpr size_t ART_SAVE_BUF_SIZE = 4 << 20;
+
+// Buffered sequential writer. The file is written under a temporary name and
+// renamed over |path| by commit(), so a failed save leaves an older file as
+// it was. Errors are sticky and reported by commit().
+class ArtFileWriter {
+ public:
+  explicit ArtFileWriter(const std::string &path)
+      : path_(path), tmp_path_(path + ".tmp") {
+    fd_ = ::open(tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 0644);
+    if (fd_ < 0) {
+      LOG_WARNING("open %s failed, %s", tmp_path_.c_str(), strerror(errno));
+      ok_ = false;
+    }
+    buf_.resize(ART_SAVE_BUF_SIZE);
+  }
+
+  ~ArtFileWriter() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      ::unlink(tmp_path_.c_str());
+    }
+  }
+
+  ArtFileWriter(const ArtFileWriter &) = delete;
+  ArtFileWriter &operator=(const ArtFileWriter &) = delete;
+
+  void put(const void *data, size_t n) {
+    if (unlikely(used_ + n > buf_.size())) {
+      flush();
+      if (n > buf_.size()) {
+        write_all(data, n);
+        return;
+      }
+    }
+    std::memcpy(buf_.data() + used_, data, n);
+    used_ += n;
+  }
+
+  template <class V>
+  void put_pod(const V &v) {
+    static_assert(std::is_trivially_copyable_v<V>);
+    put(&v, sizeof(V));
+  }
+
+  // Flush, sync and move the file in place. Returns false on any error.
+  bool commit() {
+    flush();
+    if (ok_ && ::fsync(fd_) != 0) fail("fsync");
+    if (fd_ >= 0 && ::close(fd_) != 0) fail("close");
+    fd_ = -1;
+    if (ok_ && ::rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+      fail("rename");
+    }
+    if (!ok_) ::unlink(tmp_path_.c_str());
+    return ok_;
+  }
+
+ private:
+  void flush() {
+    write_all(buf_.data(), used_);
+    used_ = 0;
+  }
+
+  void write_all(const void *data, size_t n) {
+    auto p = static_cast<const char *>(data);
+    while (ok_ && n) {
+      ssize_t ret = ::write(fd_, p, n);
+      if (ret < 0) {
+        if (errno == EINTR) continue;
+        fail("write");
+        return;
+      }
+      p += ret;
+      n -= ret;
+    }
+  }
+
+  void fail(const char *what) {
+    LOG_WARNING("%s %s failed, %s", what, tmp_path_.c_str(), strerror(errno));
+    ok_ = false;
+  }
+
+  std::string path_;
+  std::string tmp_path_;
+  int fd_ = -1;
+  bool ok_ = true;
+  std::vector<char> buf_;
+  size_t used_ = 0;
+};
+
+// Buffered sequential reader, get() fails on a short read.
+class ArtFileReader {
+ public:
+  explicit ArtFileReader(const std::string &path) : path_(path) {
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+      LOG_WARNING("open %s failed, %s", path.c_str(), strerror(errno));
+      return;
+    }
+    ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    buf_.resize(ART_SAVE_BUF_SIZE);
+  }
+
+  ~ArtFileReader() {
+    if (fd_ >= 0) ::close(fd_);
+  }
+
+  ArtFileReader(const ArtFileReader &) = delete;
+  ArtFileReader &operator=(const ArtFileReader &) = delete;
+
+  bool is_open() const { return fd_ >= 0; }
+
+  bool get(void *data, size_t n) {
+    auto p = static_cast<char *>(data);
+    while (n) {
+      if (pos_ == end_ && !fill()) return false;
+      size_t cnt = std::min(n, end_ - pos_);
+      std::memcpy(p, buf_.data() + pos_, cnt);
+      pos_ += cnt;
+      p += cnt;
+      n -= cnt;
+    }
+    return true;
+  }
+
+  template <class V>
+  bool get_pod(V *v) {
+    static_assert(std::is_trivially_copyable_v<V>);
+    return get(v, sizeof(V));
+  }
+
+  // Whether all of the file has been read.
+  bool at_end() { return pos_ == end_ && !fill(); }
+
+ private:
+  bool fill() {
+    while (true) {
+      ssize_t ret = ::read(fd_, buf_.data(), buf_.size());
+      if (ret < 0 && errno == EINTR) continue;
+      if (ret < 0) {
+        LOG_WARNING("read %s failed, %s", path_.c_str(), strerror(errno));
+      }
+      pos_ = 0;
+      end_ = ret > 0 ? ret : 0;
+      return ret > 0;
+    }
+  }
+
+  std::string path_;
+  int fd_ = -1;
+  std::vector<char> buf_;
+  size_t pos_ = 0;
+  size_t end_ = 0;
+};
+
+template <class KeyTraits>
+static uint32_t art_save_flags() {
+  return KeyTraits::LAZY_LEAF ? ART_SAVE_FLAG_LAZY_LEAF : 0;
+}
+
+// Child bytes of inner |node| in ascending order and the children under
+// them, returns the number of children, 0 for an unknown node type.
+static inline uint32_t art_node_children(const ArtNodeCommon *node,
+                                         uint8_t *bytes,
+                                         const ArtNodeCommon **children) {
+  uint32_t num = 0;
+  switch (node->type) {
+    case ART_NODE_4: {
+      auto n = reinterpret_cast<const ArtNode4 *>(node);
+      for (; num < n->childNum; num++) {
+        bytes[num] = n->keys[num];
+        children[num] = n->children[num];
+      }
+    } break;
+    case ART_NODE_16: {
+      auto n = reinterpret_cast<const ArtNode16 *>(node);
+      for (; num < n->childNum; num++) {
+        bytes[num] = n->keys[num];
+        children[num] = n->children[num];
+      }
+    } break;
+    case ART_NODE_48: {
+      reinterpret_cast<const ArtNode48 *>(node)->for_each_child(
+          [&](uint8_t b, ArtNodeCommon *c) {
+            bytes[num] = b;
+            children[num++] = c;
+          });
+    } break;
+    case ART_NODE_256: {
+      reinterpret_cast<const ArtNode256 *>(node)->for_each_child(
+          [&](uint8_t b, ArtNodeCommon *c) {
+            bytes[num] = b;
+            children[num++] = c;
+          });
+    } break;
+    default:
+      LOG_ERROR("unknown node type");
+  }
+  return num;
+}
+
+// Writes the tree below |root|, which must not change meanwhile, e.g. the
+// root of a snapshot.
+template <class T, class KeyTraits>
+class ArtTreeSaver {
+ public:
+  static_assert(std::is_trivially_copyable_v<T>,
+                "saved values must be trivially copyable");
+
+  explicit ArtTreeSaver(const std::string &path) : out_(path) {}
+
+  bool save(const ArtNodeCommon *root) {
+    out_.put(ART_SAVE_MAGIC, sizeof(ART_SAVE_MAGIC));
+    out_.put_pod(ART_SAVE_VERSION);
+    out_.put_pod<uint32_t>(sizeof(T));
+    out_.put_pod<uint32_t>(KeyTraits::FIXED_LEN);
+    out_.put_pod<uint32_t>(art_save_flags<KeyTraits>());
+    if (root) put_tree(root);
+    out_.put_pod(ART_RECORD_END);
+    out_.put_pod(count_);
+    return out_.commit();
+  }
+
+  // Number of keys written.
+  uint64_t count() const { return count_; }
+
+ private:
+  // Pre-order walk, see the file form above for the stack.
+  void put_tree(const ArtNodeCommon *root) {
+    std::vector<const ArtNodeCommon *> pending{root};
+    while (!pending.empty()) {
+      auto node = pending.back();
+      pending.pop_back();
+      put_node(node, &pending);
+    }
+  }
+
+  // Write the record of |node| and push its children, the last one first.
+  void put_node(const ArtNodeCommon *node,
+                std::vector<const ArtNodeCommon *> *pending) {
+    if constexpr (KeyTraits::LAZY_LEAF) {
+      if (art_is_lazy_leaf(node)) {
+        out_.put_pod(ART_RECORD_LAZY_LEAF);
+        out_.put_pod(art_lazy_leaf_value<T>(node));
+        count_++;
+        return;
+      }
+    }
+
+    if (node->type == ART_NODE_LEAF) {
+      auto leaf = reinterpret_cast<const ArtLeaf<T> *>(node);
+      out_.put_pod<uint8_t>(ART_NODE_LEAF);
+      out_.put_pod<uint32_t>(leaf->keyLen);
+      out_.put(leaf->get_key(), leaf->keyLen);
+      out_.put_pod(leaf->value);
+      count_++;
+      return;
+    }
+
+    uint8_t bytes[256];
+    const ArtNodeCommon *children[256];
+    uint32_t num = art_node_children(node, bytes, children);
+    if (num == 0) return;
+
+    auto prefix = node->prefix_view();
+    out_.put_pod<uint8_t>(node->type);
+    out_.put_pod<uint16_t>(num);
+    out_.put_pod<uint32_t>(node->keyLen);
+    out_.put_pod<uint32_t>(prefix.size());
+    out_.put(prefix.data(), prefix.size());
+    out_.put(bytes, num);
+    for (uint32_t i = num; i > 0; i--) pending->push_back(children[i - 1]);
+  }
+
+  ArtFileWriter out_;
+  uint64_t count_ = 0;
+};
+
+// Builds a tree from a saved file, each node directly with its saved type.
+// Nothing is locked or published, the caller links the root.
+template <class T, class KeyTraits>
+class ArtTreeLoader {
+ public:
+  static_assert(std::is_trivially_copyable_v<T>,
+                "saved values must be trivially copyable");
+
+  explicit ArtTreeLoader(const std::string &path)
+      : path_(path), in_(path) {}
+
+  // Returns false if the file can not be read or was not saved by a tree
+  // of the same value and key types.
+  bool load(ArtNodeCommon **root, uint64_t *count) {
+    *root = nullptr;
+    if (!in_.is_open() || !check_header()) return false;
+
+    uint8_t tag = 0;
+    if (!in_.get_pod(&tag)) return corrupt();
+    ArtNodeCommon *node = nullptr;
+    if (tag != ART_RECORD_END) {
+      node = get_tree(tag);
+      if (!node) return false;
+      if (!in_.get_pod(&tag) || tag != ART_RECORD_END) {
+        destroy_node<T>(node);
+        return corrupt();
+      }
+    }
+
+    uint64_t saved_count = 0;
+    if (!in_.get_pod(&saved_count) || saved_count != count_ ||
+        !in_.at_end()) {
+      if (node) destroy_node<T>(node);
+      return corrupt();
+    }
+    *root = node;
+    *count = count_;
+    return true;
+  }
+
+ private:
+  bool check_header() {
+    char magic[sizeof(ART_SAVE_MAGIC)];
+    uint32_t version = 0;
+    uint32_t value_size = 0;
+    uint32_t fixed_len = 0;
+    uint32_t flags = 0;
+    if (!in_.get(magic, sizeof(magic)) ||
+        std::memcmp(magic, ART_SAVE_MAGIC, sizeof(magic)) != 0 ||
+        !in_.get_pod(&version)) {
+      LOG_WARNING("%s is not a saved tree", path_.c_str());
+      return false;
+    }
+    if (version != ART_SAVE_VERSION) {
+      LOG_WARNING("%s has unknown version %u", path_.c_str(), version);
+      return false;
+    }
+    if (!in_.get_pod(&value_size) || !in_.get_pod(&fixed_len) ||
+        !in_.get_pod(&flags)) {
+      return corrupt();
+    }
+    if (value_size != sizeof(T) || fixed_len != KeyTraits::FIXED_LEN ||
+        flags != art_save_flags<KeyTraits>()) {
+      LOG_WARNING("%s was saved by a tree of other value or key type",
+                path_.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  bool corrupt() {
+    LOG_WARNING("%s is truncated or corrupt", path_.c_str());
+    return false;
+  }
+
+  static uint32_t capacity(uint8_t type) {
+    switch (type) {
+      case ART_NODE_4:
+        return ArtNodeTrait<ArtNode4>::NODE_CAPASITY;
+      case ART_NODE_16:
+        return ArtNodeTrait<ArtNode16>::NODE_CAPASITY;
+      case ART_NODE_48:
+        return ArtNodeTrait<ArtNode48>::NODE_CAPASITY;
+      case ART_NODE_256:
+        return ArtNodeTrait<ArtNode256>::NODE_CAPASITY;
+      default:
+        return 0;
+    }
+  }
+
+  // Inner node whose record was read, waiting for the records of its
+  // children.
+  struct Frame {
+    uint8_t type;
+    uint32_t num;
+    uint32_t got;
+    uint32_t prefix_len;
+    bool whole_prefix;
+    std::string prefix;
+    uint8_t bytes[256];
+    ArtNodeCommon *children[256];
+  };
+
+  // Node of the record tagged |tag| with all nodes below it, nullptr if the
+  // file is bad.
+  ArtNodeCommon *get_tree(uint8_t tag) {
+    top_ = 0;
+    while (true) {
+      ArtNodeCommon *node = nullptr;
+      if (tag == ART_RECORD_LAZY_LEAF || tag == ART_NODE_LEAF) {
+        node = get_leaf(tag);
+        if (!node) return drop_frames();
+      } else {
+        if (top_ == frames_.size()) frames_.emplace_back();
+        if (!get_inner(tag, &frames_[top_])) return drop_frames();
+        top_++;
+      }
+
+      // hang the node on its parent, and the parent on its own once full
+      while (node) {
+        if (top_ == 0) return node;
+        Frame &f = frames_[top_ - 1];
+        f.children[f.got++] = node;
+        node = nullptr;
+        if (f.got == f.num) {
+          node = close(f);
+          top_--;
+        }
+      }
+      if (!in_.get_pod(&tag)) {
+        bad_node();
+        return drop_frames();
+      }
+    }
+  }
+
+  ArtNodeCommon *get_leaf(uint8_t tag) {
+    if (tag == ART_RECORD_LAZY_LEAF) {
+      if constexpr (KeyTraits::LAZY_LEAF) {
+        T value;
+        if (!in_.get_pod(&value)) return bad_node();
+        count_++;
+        if (art_lazy_leaf_fits(value)) return art_lazy_leaf_bits(value);
+        auto key = KeyTraits::load_key(value, &key_buf_);
+        return get_new_leaf_node<T>(key.data(), key.size(), value);
+      }
+      return bad_node();
+    }
+
+    uint32_t len = 0;
+    T value;
+    if (!in_.get_pod(&len) ||
+        (KeyTraits::FIXED_LEN && len != KeyTraits::FIXED_LEN)) {
+      return bad_node();
+    }
+    key_buf_.resize(len);
+    if (!in_.get(key_buf_.data(), len) || !in_.get_pod(&value)) {
+      return bad_node();
+    }
+    count_++;
+    return get_new_leaf<T, KeyTraits::LAZY_LEAF>(key_buf_.data(), len, value);
+  }
+
+  // Read the record of an inner node tagged |tag| into |f|.
+  bool get_inner(uint8_t tag, Frame *f) {
+    uint32_t cap = capacity(tag);
+    uint16_t num = 0;
+    uint32_t prefix_len = 0;
+    uint32_t stored_len = 0;
+    if (cap == 0 || !in_.get_pod(&num) || num < 2 || num > cap ||
+        !in_.get_pod(&prefix_len) || !in_.get_pod(&stored_len) ||
+        stored_len > prefix_len ||
+        stored_len < std::min<uint32_t>(prefix_len, ART_MAX_PREFIX_LEN)) {
+      bad_node();
+      return false;
+    }
+    f->prefix.resize(stored_len);
+    if (!in_.get(f->prefix.data(), stored_len) || !in_.get(f->bytes, num)) {
+      bad_node();
+      return false;
+    }
+    for (uint32_t i = 1; i < num; i++) {
+      if (f->bytes[i] <= f->bytes[i - 1]) {
+        bad_node();
+        return false;
+      }
+    }
+    f->type = tag;
+    f->num = num;
+    f->got = 0;
+    f->prefix_len = prefix_len;
+    // a prefix stored whole stays whole, a cut one is recovered from leaves
+    f->whole_prefix = KeyTraits::FULL_PREFIX && stored_len == prefix_len;
+    return true;
+  }
+
+  static ArtNodeCommon *close(const Frame &f) {
+    auto node = art_make_inner_node(static_cast<ArtNodeType>(f.type),
+                                    f.bytes, f.children, f.num);
+    art_init_prefix(node, f.prefix.data(), f.prefix_len, f.whole_prefix);
+    return node;
+  }
+
+  // Free the children read so far of all open nodes.
+  ArtNodeCommon *drop_frames() {
+    while (top_) {
+      Frame &f = frames_[--top_];
+      for (uint32_t i = 0; i < f.got; i++) destroy_node<T>(f.children[i]);
+    }
+    return nullptr;
+  }
+
+  ArtNodeCommon *bad_node() {
+    if (!bad_) corrupt();
+    bad_ = true;
+    return nullptr;
+  }
+
+  std::string path_;
+  ArtFileReader in_;
+  std::string key_buf_;
+  std::vector<Frame> frames_;
+  uint32_t top_ = 0;
+  uint64_t count_ = 0;
+  bool bad_ = false;
+};
+
+}  // namespace detail
+}  // namespace art
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "art/art.h"
+
+namespace art {
+
+// How ShardedArtTree routes a key to its shard.
+enum class ArtShardBy {
+  // Consecutive key ranges split at boundary keys. Ordered access walks the
+  // shards in turn, so scans stay cheap, but skewed keys load shards
+  // unevenly unless the boundaries follow them, see split_keys().
+  RANGE,
+  // Hash of the key. Any keys spread evenly, ordered access merges all
+  // shards. Suits point reads and writes.
+  HASH,
+};
+
+// Front-end of independent ArtTrees, each with its own root, locks and key
+// count on cache lines of its own. Writers of different shards never touch
+// the same memory, where writers of one tree all start at its root and
+// update one counter.
+template <class T, class KeyTraits = ArtStringKeyTraits,
+          class Alloc = ArtPoolAlloc>
+class ShardedArtTree {
+ public:
+  using Tree = ArtTree<T, KeyTraits, Alloc>;
+  class Iterator;
+
+  // |shard_num| shards split by |by|. Ranges split the first key byte
+  // evenly, or the first two bytes for more than 256 shards, which suits
+  // keys of random bytes.
+  explicit ShardedArtTree(uint32_t shard_num,
+                          ArtShardBy by = ArtShardBy::HASH,
+                          const ArtShrinkPolicy& policy = {})
+      : by_(by) {
+    assert(shard_num > 0);
+    if (by_ == ArtShardBy::RANGE) {
+      assert(shard_num <= 65536);
+      uint32_t width = shard_num <= 256 ? 1 : 2;
+      uint64_t space = 1ull << (8 * width);
+      for (uint32_t i = 1; i < shard_num; i++) {
+        uint64_t at = i * space / shard_num;
+        std::string bound(width, '\0');
+        for (uint32_t b = width; b-- > 0; at >>= 8) {
+          bound[b] = static_cast<char>(at & 0xff);
+        }
+        bounds_.push_back(std::move(bound));
+      }
+    }
+    init_shards(shard_num, policy);
+  }
+
+  // Range shards, shard i holding the keys in [bounds[i - 1], bounds[i]).
+  // |bounds| must be sorted and unique.
+  explicit ShardedArtTree(std::vector<std::string> bounds,
+                          const ArtShrinkPolicy& policy = {})
+      : by_(ArtShardBy::RANGE), bounds_(std::move(bounds)) {
+    assert(std::is_sorted(bounds_.begin(), bounds_.end()));
+    init_shards(bounds_.size() + 1, policy);
+  }
+
+  // Boundaries splitting |sample|, keys like the ones to come, into
+  // |shard_num| ranges of about the same number of keys.
+  static std::vector<std::string> split_keys(std::vector<std::string> sample,
+                                             uint32_t shard_num) {
+    std::sort(sample.begin(), sample.end());
+    sample.erase(std::unique(sample.begin(), sample.end()), sample.end());
+    std::vector<std::string> bounds;
+    for (uint32_t i = 1; i < shard_num; i++) {
+      size_t at = sample.size() * i / shard_num;
+      if (at == 0 || at >= sample.size()) continue;
+      if (bounds.empty() || bounds.back() < sample[at]) {
+        bounds.push_back(sample[at]);
+      }
+    }
+    return bounds;
+  }
+
+  T set(const std::string& k, T v) { return set(k.data(), k.size(), v); }
+  T set(const char* key, uint32_t len, T v) {
+    return tree_of(key, len).set(key, len, v);
+  }
+
+  T get(const std::string& k) const { return get(k.data(), k.size()); }
+  T get(const char* key, uint32_t len) const {
+    return tree_of(key, len).get(key, len);
+  }
+
+  T del(const std::string& k) { return del(k.data(), k.size()); }
+  T del(const char* key, uint32_t len) {
+    return tree_of(key, len).del(key, len);
+  }
+
+  // See ArtTree::upsert().
+  template <class F>
+  void upsert(const char* key, uint32_t len, F&& fn) {
+    tree_of(key, len).upsert(key, len, std::forward<F>(fn));
+  }
+
+  template <class F>
+  void upsert(const std::string& k, F&& fn) {
+    upsert(k.data(), k.size(), std::forward<F>(fn));
+  }
+
+  bool insert_if_absent(const std::string& k, T v, T* current = nullptr) {
+    return tree_of(k.data(), k.size()).insert_if_absent(k, v, current);
+  }
+
+  bool compare_and_set(const std::string& k, const T& expected,
+                       const T& desired) {
+    return tree_of(k.data(), k.size()).compare_and_set(k, expected, desired);
+  }
+
+  // Sum of the shards, each read at a different time.
+  uint64_t size() const {
+    uint64_t n = 0;
+    for (auto& s : shards_) n += s->tree.size();
+    return n;
+  }
+
+  ArtShardBy shard_by() const { return by_; }
+  uint32_t shard_num() const { return shards_.size(); }
+  const Tree& shard(uint32_t i) const { return shards_[i]->tree; }
+
+  uint32_t shard_of(const char* key, uint32_t len) const {
+    if (by_ == ArtShardBy::HASH) {
+      return std::hash<std::string_view>()(std::string_view(key, len)) %
+             shards_.size();
+    }
+    return std::upper_bound(bounds_.begin(), bounds_.end(),
+                            std::string_view(key, len)) -
+           bounds_.begin();
+  }
+
+  // Ordered access over all shards, see Iterator.
+  Iterator begin() const { return lower_bound(nullptr, 0); }
+
+  // First key >= |key|.
+  Iterator lower_bound(const char* key, uint32_t len) const {
+    return Iterator(this, key, len);
+  }
+
+  Iterator lower_bound(const std::string& k) const {
+    return lower_bound(k.data(), k.size());
+  }
+
+  // See ArtTree::scan().
+  template <class F>
+  uint64_t scan(const std::string& start, const std::string& end,
+                F&& fn) const {
+    uint64_t cnt = 0;
+    for (Iterator it = lower_bound(start); it.valid(); it.next()) {
+      if (!end.empty() && it.key() >= end) break;
+      cnt++;
+      if (!fn(it.key(), it.value())) break;
+    }
+    return cnt;
+  }
+
+  // Keys of all shards in order, with the guarantees of ArtIterator within
+  // each shard. Range shards are opened one after another as the previous
+  // one runs out. Hash shards are all open at once and merged on a heap
+  // keyed by their current keys. Same thread rules as ArtIterator.
+  class Iterator {
+   public:
+    bool valid() const { return cur_ < its_.size(); }
+
+    std::string_view key() const { return its_[cur_].key(); }
+
+    const T& value() const { return its_[cur_].value(); }
+
+    void next() {
+      if (owner_->by_ == ArtShardBy::RANGE) {
+        its_[cur_].next();
+        if (!its_[cur_].valid()) open_range(cur_ + 1);
+        return;
+      }
+      std::pop_heap(heap_.begin(), heap_.end(), greater());
+      its_[heap_.back()].next();
+      if (its_[heap_.back()].valid()) {
+        std::push_heap(heap_.begin(), heap_.end(), greater());
+      } else {
+        heap_.pop_back();
+      }
+      cur_ = heap_.empty() ? its_.size() : heap_.front();
+    }
+
+   private:
+    friend ShardedArtTree;
+
+    Iterator(const ShardedArtTree* owner, const char* key, uint32_t len)
+        : owner_(owner) {
+      uint32_t n = owner_->shards_.size();
+      its_.reserve(n);
+      if (owner_->by_ == ArtShardBy::RANGE) {
+        its_.resize(n);
+        cur_ = key ? owner_->shard_of(key, len) : 0;
+        its_[cur_] = seek(cur_, key, len);
+        if (!its_[cur_].valid()) open_range(cur_ + 1);
+        return;
+      }
+      for (uint32_t i = 0; i < n; i++) {
+        its_.push_back(seek(i, key, len));
+        if (its_.back().valid()) heap_.push_back(i);
+      }
+      std::make_heap(heap_.begin(), heap_.end(), greater());
+      cur_ = heap_.empty() ? n : heap_.front();
+    }
+
+    // First key >= |key| of shard |i|, its first key without |key|.
+    typename Tree::Iterator seek(uint32_t i, const char* key,
+                                 uint32_t len) const {
+      auto& tree = owner_->shards_[i]->tree;
+      return key ? tree.lower_bound(key, len) : tree.begin();
+    }
+
+    // Position at the first key of shard |from| or a later one.
+    void open_range(uint32_t from) {
+      for (cur_ = from; cur_ < its_.size(); cur_++) {
+        its_[cur_] = owner_->shards_[cur_]->tree.begin();
+        if (its_[cur_].valid()) return;
+      }
+    }
+
+    // Orders the heap of shard indexes smallest key first.
+    auto greater() const {
+      return [this](uint32_t a, uint32_t b) {
+        return its_[a].key() > its_[b].key();
+      };
+    }
+
+    const ShardedArtTree* owner_;
+    std::vector<typename Tree::Iterator> its_;
+    std::vector<uint32_t> heap_;
+    uint32_t cur_ = 0;
+  };
+
+ private:
+  struct alignas(64) Shard {
+    explicit Shard(const ArtShrinkPolicy& policy) : tree(policy) {}
+    Tree tree;
+  };
+
+  void init_shards(uint32_t shard_num, const ArtShrinkPolicy& policy) {
+    for (uint32_t i = 0; i < shard_num; i++) {
+      shards_.emplace_back(new Shard(policy));
+    }
+  }
+
+  Tree& tree_of(const char* key, uint32_t len) const {
+    return shards_[shard_of(key, len)]->tree;
+  }
+
+  const ArtShardBy by_;
+  std::vector<std::string> bounds_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}  // namespace art
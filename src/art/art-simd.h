@@ -0,0 +1,354 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__i386__) || defined(__amd64__)
+#include <immintrin.h>
+#define ART_SIMD_X86 1
+#else
+#define ART_SIMD_X86 0
+#endif
+
+namespace art {
+
+struct ArtNodeCommon;
+
+namespace detail {
+
+// Search kernels of inner nodes. Every kernel has a scalar version, and on
+// x86 SSE2 and AVX2 ones where the wider vector helps. The art_simd_*
+// functions pick the best one the CPU supports.
+//
+//   find_byte:    index of |b| in the first |n| sorted keys, or -1.
+//   lower_bound:  index of the first of |n| sorted keys >= |b|, or n.
+//   n48_first_ge: first byte >= |from| with a non-zero Node48 index slot,
+//                 or -1. |from| is in [0, 256].
+//   n48_last_le:  last byte <= |from| with a non-zero slot, or -1. |from| is
+//                 in [-1, 255].
+//   n256_first_ge, n256_last_le: same over the non-null Node256 children.
+//
+// The vector find_byte and lower_bound load 16 bytes from |keys|, which node
+// layouts allow for Node4 as well.
+
+enum ArtSimdLevel : uint8_t { ART_SIMD_SCALAR, ART_SIMD_SSE2, ART_SIMD_AVX2 };
+
+static inline ArtSimdLevel art_detect_simd_level() {
+#if ART_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return ART_SIMD_AVX2;
+  return ART_SIMD_SSE2;
+#else
+  return ART_SIMD_SCALAR;
+#endif
+}
+
+// Decided once at startup. Anything running before it is initialized sees
+// ART_SIMD_SCALAR, which is always safe.
+inline ArtSimdLevel g_art_simd_level = art_detect_simd_level();
+
+static inline const char *art_simd_level_name(ArtSimdLevel level) {
+  switch (level) {
+    case ART_SIMD_SSE2:
+      return "sse2";
+    case ART_SIMD_AVX2:
+      return "avx2";
+    default:
+      return "scalar";
+  }
+}
+
+namespace scalar {
+
+static inline int32_t find_byte(const uint8_t *keys, uint32_t n, uint8_t b) {
+  for (uint32_t i = 0; i < n; i++) {
+    if (keys[i] == b) return i;
+  }
+  return -1;
+}
+
+static inline uint32_t lower_bound(const uint8_t *keys, uint32_t n,
+                                   uint8_t b) {
+  uint32_t i = 0;
+  while (i < n && keys[i] < b) i++;
+  return i;
+}
+
+static inline int32_t n48_first_ge(const uint8_t *index, int32_t from) {
+  for (int32_t i = from; i <= 255; i++) {
+    if (index[i]) return i;
+  }
+  return -1;
+}
+
+static inline int32_t n48_last_le(const uint8_t *index, int32_t from) {
+  for (int32_t i = from; i >= 0; i--) {
+    if (index[i]) return i;
+  }
+  return -1;
+}
+
+static inline int32_t n256_first_ge(ArtNodeCommon *const *children,
+                                    int32_t from) {
+  for (int32_t i = from; i <= 255; i++) {
+    if (children[i]) return i;
+  }
+  return -1;
+}
+
+static inline int32_t n256_last_le(ArtNodeCommon *const *children,
+                                   int32_t from) {
+  for (int32_t i = from; i >= 0; i--) {
+    if (children[i]) return i;
+  }
+  return -1;
+}
+
+}  // namespace scalar
+
+// Node4 keys compared in one 32-bit word, no vector unit needed. Lowest byte
+// flagged by the zero-byte test is always a real match.
+static inline int32_t art_n4_find_swar(const uint8_t *keys, uint32_t n,
+                                       uint8_t b) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint32_t v;
+  std::memcpy(&v, keys, sizeof(v));
+  uint32_t x = v ^ (0x01010101u * b);
+  uint32_t z = (x - 0x01010101u) & ~x & 0x80808080u;
+  if (z == 0) return -1;
+  uint32_t i = __builtin_ctz(z) >> 3;
+  return i < n ? (int32_t)i : -1;
+#else
+  return scalar::find_byte(keys, n, b);
+#endif
+}
+
+#if ART_SIMD_X86
+
+namespace sse2 {
+
+static inline int32_t find_byte(const uint8_t *keys, uint32_t n, uint8_t b) {
+  int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                 _mm_set1_epi8(b), _mm_loadu_si128((const __m128i *)keys))) &
+             ((1 << n) - 1);
+  return mask ? __builtin_ctz(mask) : -1;
+}
+
+// Keys are sorted, so the number of keys < b is the answer. Bytes are
+// compared unsigned by flipping their sign bits.
+static inline uint32_t lower_bound(const uint8_t *keys, uint32_t n,
+                                   uint8_t b) {
+  const __m128i bias = _mm_set1_epi8((char)0x80);
+  __m128i k = _mm_xor_si128(_mm_loadu_si128((const __m128i *)keys), bias);
+  __m128i v = _mm_xor_si128(_mm_set1_epi8(b), bias);
+  int mask = _mm_movemask_epi8(_mm_cmplt_epi8(k, v)) & ((1 << n) - 1);
+  return __builtin_popcount(mask);
+}
+
+// Bit i set if index[base + i] is not zero.
+static inline uint32_t n48_mask(const uint8_t *index, int32_t base) {
+  __m128i v = _mm_loadu_si128((const __m128i *)(index + base));
+  return ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) & 0xffff;
+}
+
+static inline int32_t n48_first_ge(const uint8_t *index, int32_t from) {
+  for (int32_t base = from & ~15; base <= 255; base += 16) {
+    uint32_t mask = n48_mask(index, base);
+    if (base < from) mask &= 0xffffu << (from - base);
+    if (mask) return base + __builtin_ctz(mask);
+  }
+  return -1;
+}
+
+static inline int32_t n48_last_le(const uint8_t *index, int32_t from) {
+  if (from < 0) return -1;
+  for (int32_t base = from & ~15; base >= 0; base -= 16) {
+    uint32_t mask = n48_mask(index, base);
+    if (base + 15 > from) mask &= 0xffffu >> (base + 15 - from);
+    if (mask) return base + 31 - __builtin_clz(mask);
+  }
+  return -1;
+}
+
+// Bit i set if children[base + i] is not null, 8 children.
+static inline uint32_t n256_mask(ArtNodeCommon *const *children,
+                                 int32_t base) {
+  uint32_t null_mask = 0;
+  for (int32_t i = 0; i < 8; i += 2) {
+    __m128i v = _mm_cmpeq_epi32(
+        _mm_loadu_si128((const __m128i *)(children + base + i)),
+        _mm_setzero_si128());
+    // a pointer is null when both of its halves are
+    v = _mm_and_si128(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    null_mask |= _mm_movemask_pd(_mm_castsi128_pd(v)) << i;
+  }
+  return ~null_mask & 0xff;
+}
+
+static inline int32_t n256_first_ge(ArtNodeCommon *const *children,
+                                    int32_t from) {
+  for (int32_t base = from & ~7; base <= 255; base += 8) {
+    uint32_t mask = n256_mask(children, base);
+    if (base < from) mask &= 0xffu << (from - base);
+    if (mask) return base + __builtin_ctz(mask);
+  }
+  return -1;
+}
+
+static inline int32_t n256_last_le(ArtNodeCommon *const *children,
+                                   int32_t from) {
+  if (from < 0) return -1;
+  for (int32_t base = from & ~7; base >= 0; base -= 8) {
+    uint32_t mask = n256_mask(children, base);
+    if (base + 7 > from) mask &= 0xffu >> (base + 7 - from);
+    if (mask) return base + 31 - __builtin_clz(mask);
+  }
+  return -1;
+}
+
+}  // namespace sse2
+
+// Wider scans of the 256-byte Node48 index and 2KB Node256 child array.
+// Node4 and Node16 keys fit in one SSE2 register, so they have no AVX2
+// version.
+namespace avx2 {
+
+__attribute__((target("avx2"))) static inline uint32_t n48_mask(
+    const uint8_t *index, int32_t base) {
+  __m256i v = _mm256_loadu_si256((const __m256i *)(index + base));
+  return ~(uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+}
+
+__attribute__((target("avx2"))) static int32_t n48_first_ge(
+    const uint8_t *index, int32_t from) {
+  for (int32_t base = from & ~31; base <= 255; base += 32) {
+    uint32_t mask = n48_mask(index, base);
+    if (base < from) mask &= 0xffffffffu << (from - base);
+    if (mask) return base + __builtin_ctz(mask);
+  }
+  return -1;
+}
+
+__attribute__((target("avx2"))) static int32_t n48_last_le(
+    const uint8_t *index, int32_t from) {
+  if (from < 0) return -1;
+  for (int32_t base = from & ~31; base >= 0; base -= 32) {
+    uint32_t mask = n48_mask(index, base);
+    if (base + 31 > from) mask &= 0xffffffffu >> (base + 31 - from);
+    if (mask) return base + 31 - __builtin_clz(mask);
+  }
+  return -1;
+}
+
+// Bit i set if children[base + i] is not null, 8 children.
+__attribute__((target("avx2"))) static inline uint32_t n256_mask(
+    ArtNodeCommon *const *children, int32_t base) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i lo = _mm256_cmpeq_epi64(
+      _mm256_loadu_si256((const __m256i *)(children + base)), zero);
+  __m256i hi = _mm256_cmpeq_epi64(
+      _mm256_loadu_si256((const __m256i *)(children + base + 4)), zero);
+  uint32_t null_mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo)) |
+                       (_mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4);
+  return ~null_mask & 0xff;
+}
+
+__attribute__((target("avx2"))) static int32_t n256_first_ge(
+    ArtNodeCommon *const *children, int32_t from) {
+  for (int32_t base = from & ~7; base <= 255; base += 8) {
+    uint32_t mask = n256_mask(children, base);
+    if (base < from) mask &= 0xffu << (from - base);
+    if (mask) return base + __builtin_ctz(mask);
+  }
+  return -1;
+}
+
+__attribute__((target("avx2"))) static int32_t n256_last_le(
+    ArtNodeCommon *const *children, int32_t from) {
+  if (from < 0) return -1;
+  for (int32_t base = from & ~7; base >= 0; base -= 8) {
+    uint32_t mask = n256_mask(children, base);
+    if (base + 7 > from) mask &= 0xffu >> (base + 7 - from);
+    if (mask) return base + 31 - __builtin_clz(mask);
+  }
+  return -1;
+}
+
+}  // namespace avx2
+
+#endif  // ART_SIMD_X86
+
+static inline int32_t art_simd_find_n4(const uint8_t *keys, uint32_t n,
+                                       uint8_t b) {
+  return art_n4_find_swar(keys, n, b);
+}
+
+static inline int32_t art_simd_find_n16(const uint8_t *keys, uint32_t n,
+                                        uint8_t b) {
+#if ART_SIMD_X86
+  return sse2::find_byte(keys, n, b);
+#else
+  return scalar::find_byte(keys, n, b);
+#endif
+}
+
+static inline uint32_t art_simd_lower_bound(const uint8_t *keys, uint32_t n,
+                                            uint8_t b) {
+#if ART_SIMD_X86
+  return sse2::lower_bound(keys, n, b);
+#else
+  return scalar::lower_bound(keys, n, b);
+#endif
+}
+
+static inline int32_t art_simd_n48_first_ge(const uint8_t *index,
+                                            int32_t from) {
+#if ART_SIMD_X86
+  if (g_art_simd_level == ART_SIMD_AVX2) {
+    return avx2::n48_first_ge(index, from);
+  }
+  return sse2::n48_first_ge(index, from);
+#else
+  return scalar::n48_first_ge(index, from);
+#endif
+}
+
+static inline int32_t art_simd_n48_last_le(const uint8_t *index,
+                                           int32_t from) {
+#if ART_SIMD_X86
+  if (g_art_simd_level == ART_SIMD_AVX2) {
+    return avx2::n48_last_le(index, from);
+  }
+  return sse2::n48_last_le(index, from);
+#else
+  return scalar::n48_last_le(index, from);
+#endif
+}
+
+static inline int32_t art_simd_n256_first_ge(ArtNodeCommon *const *children,
+                                             int32_t from) {
+#if ART_SIMD_X86
+  if (g_art_simd_level == ART_SIMD_AVX2) {
+    return avx2::n256_first_ge(children, from);
+  }
+  return sse2::n256_first_ge(children, from);
+#else
+  return scalar::n256_first_ge(children, from);
+#endif
+}
+
+static inline int32_t art_simd_n256_last_le(ArtNodeCommon *const *children,
+                                            int32_t from) {
+#if ART_SIMD_X86
+  if (g_art_simd_level == ART_SIMD_AVX2) {
+    return avx2::n256_last_le(children, from);
+  }
+  return sse2::n256_last_le(children, from);
+#else
+  return scalar::n256_last_le(children, from);
+#endif
+}
+
+}  // namespace detail
+}  // namespace art
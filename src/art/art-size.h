@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace art {
+
+// How ArtTree counts its keys.
+enum class ArtSizeMode {
+  // Writers count in a stripe of their thread, size() sums the stripes. Its
+  // result is exact once writers are done, under concurrent writes it may
+  // mix moments. Writers share no counter cache line.
+  STRIPED,
+  // One counter all writers update, size() reads a value the tree had.
+  EXACT,
+};
+
+namespace detail {
+
+// Number of per-thread stripes, a power of two no less than the hardware
+// threads. Up to that many threads each write a stripe of their own.
+inline uint32_t art_stripe_num() {
+  static const uint32_t n = [] {
+    uint32_t num = 16;
+    while (num < std::thread::hardware_concurrency()) num *= 2;
+    return num;
+  }();
+  return n;
+}
+
+// Stripe of the calling thread, the same for all its writes. Threads are
+// handed stripes in turn on first use, so art_stripe_num() threads in a row
+// never share one; hashed thread ids would.
+inline uint32_t art_thread_stripe() {
+  static std::atomic<uint32_t> next = {0};
+  static thread_local uint32_t s =
+      next.fetch_add(1, std::memory_order_relaxed) & (art_stripe_num() - 1);
+  return s;
+}
+
+// Per-thread stripes of a tree. The first thread to use them gets a stripe
+// inline and the array of art_stripe_num() stripes is only allocated once
+// another thread comes, so a tree written by a single thread, like most small
+// arena trees, costs no allocation.
+template <class S>
+class ArtLazyStripes {
+ public:
+  ArtLazyStripes() = default;
+  ~ArtLazyStripes() { delete[] stripes_.load(); }
+
+  ArtLazyStripes(const ArtLazyStripes&) = delete;
+  ArtLazyStripes& operator=(const ArtLazyStripes&) = delete;
+
+  // The inline stripe.
+  S& first() { return first_; }
+
+  // Stripe of the calling thread, the same for all its calls.
+  S& local() {
+    uint32_t s = art_thread_stripe();
+    uint32_t owner = owner_.load(std::memory_order_relaxed);
+    if (owner == NO_OWNER &&
+        owner_.compare_exchange_strong(owner, s, std::memory_order_relaxed)) {
+      owner = s;
+    }
+    if (owner == s) return first_;
+    S* stripes = stripes_.load();
+    if (stripes == nullptr) {
+      S* fresh = new S[art_stripe_num()]();
+      if (stripes_.compare_exchange_strong(stripes, fresh)) {
+        stripes = fresh;
+      } else {
+        delete[] fresh;
+      }
+    }
+    return stripes[s];
+  }
+
+  // Call fn on every stripe a thread may have used.
+  template <class F>
+  void for_each(F&& fn) {
+    fn(first_);
+    if (S* stripes = stripes_.load()) {
+      for (uint32_t i = 0; i < art_stripe_num(); i++) fn(stripes[i]);
+    }
+  }
+
+  template <class F>
+  void for_each(F&& fn) const {
+    fn(first_);
+    if (const S* stripes = stripes_.load()) {
+      for (uint32_t i = 0; i < art_stripe_num(); i++) fn(stripes[i]);
+    }
+  }
+
+ private:
+  static constexpr uint32_t NO_OWNER = UINT32_MAX;
+
+  S first_{};
+  std::atomic<uint32_t> owner_ = {NO_OWNER};
+  std::atomic<S*> stripes_ = {nullptr};
+};
+
+// Key count of a tree, see ArtSizeMode.
+class ArtSizeCounter {
+ public:
+  explicit ArtSizeCounter(ArtSizeMode mode) : mode_(mode) {}
+
+  ArtSizeMode mode() const { return mode_; }
+
+  void add(int64_t delta) {
+    auto& stripe =
+        mode_ == ArtSizeMode::EXACT ? stripes_.first() : stripes_.local();
+    stripe.cnt.fetch_add(delta, std::memory_order_relaxed);
+  }
+
+  // A key inserted on one thread and deleted on another leaves its stripes
+  // off by one each, only the sum counts.
+  uint64_t load() const {
+    int64_t sum = 0;
+    stripes_.for_each([&](const Stripe& stripe) {
+      sum += stripe.cnt.load(std::memory_order_relaxed);
+    });
+    return sum < 0 ? 0 : sum;
+  }
+
+  // Writers must be held off.
+  void reset() {
+    stripes_.for_each([](Stripe& stripe) {
+      stripe.cnt.store(0, std::memory_order_relaxed);
+    });
+  }
+
+ private:
+  struct alignas(64) Stripe {
+    std::atomic<int64_t> cnt = {0};
+  };
+
+  const ArtSizeMode mode_;
+  ArtLazyStripes<Stripe> stripes_;
+};
+
+}  // namespace detail
+}  // namespace art
@@ -0,0 +1,549 @@
+#pragma once
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "art/art.h"
+#include "common/logger.h"
+
+namespace art {
+
+// When a write to ArtDurableTree counts as done.
+enum class ArtWalSync {
+  // Its record is on disk. Writers that wait together share one fdatasync.
+  SYNC,
+  // Its record is in the file, and a background thread syncs the file every
+  // sync_interval_ms. A crash of the process loses nothing, a crash of the
+  // machine up to the last interval.
+  PERIODIC,
+  // Its record is in the file, syncing is left to the OS.
+  NONE,
+};
+
+struct ArtWalOptions {
+  ArtWalSync sync = ArtWalSync::SYNC;
+  uint32_t sync_interval_ms = 10;
+};
+
+namespace detail {
+
+// Log segment of ArtDurableTree, all integers in host byte order.
+//
+//   header   "ARTWAL\0\0", u32 format version, u32 sizeof(T)
+//   records  u32 crc32 of the rest of the record, u8 op, u32 key length,
+//            the key and, for ART_WAL_SET only, the value
+//
+// A crash can leave the last records of a segment torn, replay stops at the
+// first record that is cut short or fails its crc.
+static constexpr char ART_WAL_MAGIC[8] = {'A', 'R', 'T', 'W',
+                                          'A', 'L', '\0', '\0'};
+static constexpr uint32_t ART_WAL_VERSION = 1;
+static constexpr uint8_t ART_WAL_SET = 1;
+static constexpr uint8_t ART_WAL_DEL = 2;
+static constexpr uint32_t ART_WAL_MAX_KEY_LEN = 1 << 30;
+
+static inline uint32_t art_crc32(const void *data, size_t n,
+                                 uint32_t crc = 0) {
+  static const auto table = []() {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int32_t k = 0; k < 8; k++) {
+        c = (c >> 1) ^ (0xedb88320 & (0 - (c & 1)));
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+  auto p = static_cast<const uint8_t *>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < n; i++) crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static inline bool art_fsync_dir(const std::string &dir) {
+  int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return false;
+  bool ok = ::fsync(fd) == 0;
+  ::close(fd);
+  return ok;
+}
+
+// Appends records of concurrent writers to the current segment.
+//
+// append() only copies the record into a buffer. commit() makes a writer the
+// leader if no write is in flight: it takes the whole buffer, appends of
+// other writers included, writes it out of the lock and syncs it once for
+// all of them, while later appends fill the other buffer. Writers whose
+// records went with it just wait for the leader. The periodic sync runs
+// beside leaders, only rotate() and close() wait for it as they replace the
+// segment.
+template <class T>
+class ArtWal {
+ public:
+  ArtWal() = default;
+  ~ArtWal() { close(); }
+
+  ArtWal(const ArtWal &) = delete;
+  ArtWal &operator=(const ArtWal &) = delete;
+
+  static std::string segment_path(const std::string &dir, uint64_t seq) {
+    return dir + "/wal-" + std::to_string(seq) + ".log";
+  }
+
+  bool open(const std::string &dir, uint64_t seq,
+            const ArtWalOptions &options) {
+    options_ = options;
+    dir_ = dir;
+    fd_ = create_segment(seq);
+    if (fd_ < 0) return false;
+    if (options_.sync == ArtWalSync::PERIODIC) {
+      syncer_ = std::thread([this]() { sync_loop(); });
+    }
+    return true;
+  }
+
+  // Flush and sync all appended records, then close the segment.
+  void close() {
+    if (fd_ < 0) return;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    if (syncer_.joinable()) syncer_.join();
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return !flushing_ && !syncing_; });
+    flush_locked(true);
+    ::close(fd_);
+    fd_ = -1;
+  }
+
+  // Queue a record and return its lsn for commit().
+  uint64_t append(uint8_t op, const char *key, uint32_t len, const T *value) {
+    uint8_t head[9];
+    uint32_t body = sizeof(uint8_t) + sizeof(uint32_t) + len +
+                    (op == ART_WAL_SET ? sizeof(T) : 0);
+    head[4] = op;
+    std::memcpy(head + 5, &len, sizeof(len));
+    uint32_t crc = art_crc32(head + 4, 5);
+    crc = art_crc32(key, len, crc);
+    if (op == ART_WAL_SET) crc = art_crc32(value, sizeof(T), crc);
+    std::memcpy(head, &crc, sizeof(crc));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    buf_.append(reinterpret_cast<const char *>(head), sizeof(head));
+    buf_.append(key, len);
+    if (op == ART_WAL_SET) {
+      buf_.append(reinterpret_cast<const char *>(value), sizeof(T));
+    }
+    appended_ += sizeof(uint32_t) + body;
+    return appended_;
+  }
+
+  // Wait until the record of |lsn| is done as options.sync says.
+  void commit(uint64_t lsn) {
+    bool sync = options_.sync == ArtWalSync::SYNC;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while ((sync ? synced_ : written_) < lsn) {
+      if (flushing_) {
+        cv_.wait(lock);
+        continue;
+      }
+      flushing_ = true;
+      std::string out;
+      out.swap(buf_);
+      buf_.swap(spare_);
+      uint64_t end = appended_;
+      lock.unlock();
+      write_all(out);
+      if (sync) sync_fd();
+      out.clear();
+      lock.lock();
+      spare_.swap(out);
+      written_ = end;
+      if (sync) synced_ = end;
+      flushing_ = false;
+      cv_.notify_all();
+    }
+  }
+
+  // Sync all appended records into the current segment and go on in a new
+  // one. Appends must be held off meanwhile.
+  bool rotate(uint64_t seq) {
+    int fd = create_segment(seq);
+    if (fd < 0) return false;
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return !flushing_ && !syncing_; });
+    flush_locked(true);
+    ::close(fd_);
+    fd_ = fd;
+    return true;
+  }
+
+  // Number of syncs of a segment so far, each covering one group.
+  uint64_t sync_num() const { return sync_num_.load(); }
+
+ private:
+  int create_segment(uint64_t seq) {
+    auto path = segment_path(dir_, seq);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (fd < 0) {
+      LOG_WARNING("open %s failed, %s", path.c_str(), strerror(errno));
+      return -1;
+    }
+    std::string head(ART_WAL_MAGIC, sizeof(ART_WAL_MAGIC));
+    uint32_t version = ART_WAL_VERSION;
+    uint32_t value_size = sizeof(T);
+    head.append(reinterpret_cast<const char *>(&version), sizeof(version));
+    head.append(reinterpret_cast<const char *>(&value_size),
+                sizeof(value_size));
+    if (::write(fd, head.data(), head.size()) !=
+            static_cast<ssize_t>(head.size()) ||
+        ::fsync(fd) != 0 || !art_fsync_dir(dir_)) {
+      LOG_WARNING("create %s failed, %s", path.c_str(), strerror(errno));
+      ::close(fd);
+      ::unlink(path.c_str());
+      return -1;
+    }
+    return fd;
+  }
+
+  // A lost record can not be reported to a writer whose write is already
+  // visible in the tree, so I/O errors past open() are fatal.
+  void write_all(const std::string &data) {
+    const char *p = data.data();
+    size_t n = data.size();
+    while (n) {
+      ssize_t ret = ::write(fd_, p, n);
+      if (ret < 0) {
+        if (errno == EINTR) continue;
+        LOG_ERROR("write wal failed, %s", strerror(errno));
+      }
+      p += ret;
+      n -= ret;
+    }
+  }
+
+  void sync_fd() {
+    if (::fdatasync(fd_) != 0) {
+      LOG_ERROR("fdatasync wal failed, %s", strerror(errno));
+    }
+    sync_num_.fetch_add(1);
+  }
+
+  // Called with the lock held, no leader and no periodic sync.
+  void flush_locked(bool sync) {
+    write_all(buf_);
+    buf_.clear();
+    written_ = appended_;
+    if (sync && synced_ < written_) {
+      sync_fd();
+      synced_ = written_;
+    }
+    cv_.notify_all();
+  }
+
+  void sync_loop() {
+    auto interval = std::chrono::milliseconds(options_.sync_interval_ms);
+    auto next = std::chrono::steady_clock::now() + interval;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      if (cv_.wait_until(lock, next, [this]() { return stop_; })) break;
+      next += interval;
+      if (synced_ == written_) continue;
+      // Written records only, pending ones are their writers' to flush. A
+      // leader may write on meanwhile, fd_ stays as rotate() waits for us.
+      syncing_ = true;
+      uint64_t end = written_;
+      lock.unlock();
+      sync_fd();
+      lock.lock();
+      synced_ = std::max(synced_, end);
+      syncing_ = false;
+      cv_.notify_all();
+    }
+  }
+
+  ArtWalOptions options_;
+  std::string dir_;
+  int fd_ = -1;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::string buf_;
+  std::string spare_;
+  // Byte counts of records appended, written to and synced in the segments.
+  uint64_t appended_ = 0;
+  uint64_t written_ = 0;
+  uint64_t synced_ = 0;
+  // A leader is writing, see commit().
+  bool flushing_ = false;
+  // The background thread is syncing, see sync_loop().
+  bool syncing_ = false;
+  bool stop_ = false;
+  std::thread syncer_;
+  std::atomic<uint64_t> sync_num_ = {0};
+};
+
+}  // namespace detail
+
+// ArtTree whose writes survive a crash. Each set() and del() appends a record
+// to a write-ahead log in |dir| before it returns, see ArtWalSync for when
+// that is. checkpoint() saves the tree and drops the log before it, and
+// open() loads the newest checkpoint and replays the log after it.
+//
+// A write is visible to readers as soon as it is in the tree, which may be a
+// moment before its record is durable. Writes to the same key are logged in
+// the order they are applied. T must be trivially copyable.
+template <class T, class KeyTraits = ArtStringKeyTraits>
+class ArtDurableTree {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  using Tree = ArtTree<T, KeyTraits>;
+
+  ArtDurableTree() = default;
+  ~ArtDurableTree() { close(); }
+
+  ArtDurableTree(const ArtDurableTree &) = delete;
+  ArtDurableTree &operator=(const ArtDurableTree &) = delete;
+
+  // Recover the tree from |dir|, created if missing, and start logging.
+  // Returns false if the directory or a new log segment can not be written.
+  bool open(const std::string &dir,
+            const ArtWalOptions &options = ArtWalOptions()) {
+    if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+      LOG_WARNING("mkdir %s failed, %s", dir.c_str(), strerror(errno));
+      return false;
+    }
+    dir_ = dir;
+    std::vector<uint64_t> checkpoints;
+    std::vector<uint64_t> segments;
+    if (!list_dir(&checkpoints, &segments)) return false;
+
+    // a checkpoint holds the writes of all segments before its own
+    uint64_t base = 0;
+    for (auto it = checkpoints.rbegin(); it != checkpoints.rend(); ++it) {
+      if (tree_.load(checkpoint_path(*it))) {
+        base = *it;
+        break;
+      }
+    }
+    uint64_t seq = base;
+    for (uint64_t s : segments) {
+      if (s >= base) replay(s);
+      seq = std::max(seq, s);
+    }
+    if (!checkpoints.empty()) seq = std::max(seq, checkpoints.back());
+    seq_ = seq + 1;
+    if (!wal_.open(dir_, seq_, options)) return false;
+    remove_before(base, checkpoints, segments);
+    return true;
+  }
+
+  // Sync the log and stop logging, further writes are not allowed.
+  void close() { wal_.close(); }
+
+  T set(const std::string &k, T v) { return set(k.data(), k.size(), v); }
+
+  // Returns the old value or T{}.
+  T set(const char *key, uint32_t len, T v) {
+    T old{};
+    uint64_t lsn = 0;
+    {
+      detail::ArtWriteGate::Pass pass(gate_);
+      tree_.upsert(key, len, [&](T &value, bool exists) {
+        lsn = wal_.append(detail::ART_WAL_SET, key, len, &v);
+        if (exists) old = value;
+        value = v;
+        return true;
+      });
+    }
+    wal_.commit(lsn);
+    return old;
+  }
+
+  T del(const std::string &k) { return del(k.data(), k.size()); }
+
+  // Returns the deleted value, or T{} without logging if the key is missing.
+  T del(const char *key, uint32_t len) {
+    uint64_t lsn = 0;
+    T old{};
+    {
+      detail::ArtWriteGate::Pass pass(gate_);
+      old = tree_.del(key, len, [&](const T &) {
+        lsn = wal_.append(detail::ART_WAL_DEL, key, len, nullptr);
+      });
+    }
+    if (lsn) wal_.commit(lsn);
+    return old;
+  }
+
+  T get(const std::string &k) const { return tree_.get(k); }
+  T get(const char *key, uint32_t len) const { return tree_.get(key, len); }
+
+  uint64_t size() const { return tree_.size(); }
+
+  // For reads, iteration and snapshots. Writes through it are not logged.
+  const Tree &tree() const { return tree_; }
+  Tree &tree() { return tree_; }
+
+  // Save the tree as of now and drop the log before it. Writers wait only
+  // while the log moves to a new segment, not for the save. Returns false
+  // if the save fails, the log is kept then.
+  bool checkpoint() {
+    std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+    uint64_t seq = seq_ + 1;
+    gate_.close();
+    bool rotated = wal_.rotate(seq);
+    // holds exactly the writes logged before |seq|
+    std::optional<typename Tree::Snapshot> snap;
+    if (rotated) snap.emplace(tree_.snapshot());
+    gate_.open();
+    if (!rotated) return false;
+    seq_ = seq;
+    if (!snap->save(checkpoint_path(seq)) || !detail::art_fsync_dir(dir_)) {
+      return false;
+    }
+    std::vector<uint64_t> checkpoints;
+    std::vector<uint64_t> segments;
+    if (list_dir(&checkpoints, &segments)) {
+      remove_before(seq, checkpoints, segments);
+    }
+    return true;
+  }
+
+  // Log syncs so far, for tests and benchmarks.
+  uint64_t wal_sync_num() const { return wal_.sync_num(); }
+
+ private:
+  std::string checkpoint_path(uint64_t seq) const {
+    return dir_ + "/checkpoint-" + std::to_string(seq);
+  }
+
+  // Sequence numbers of checkpoints and segments in |dir_|, ascending.
+  bool list_dir(std::vector<uint64_t> *checkpoints,
+                std::vector<uint64_t> *segments) const {
+    DIR *d = ::opendir(dir_.c_str());
+    if (!d) {
+      LOG_WARNING("opendir %s failed, %s", dir_.c_str(), strerror(errno));
+      return false;
+    }
+    while (auto entry = ::readdir(d)) {
+      unsigned long long seq = 0;
+      int pos = 0;
+      if (std::sscanf(entry->d_name, "checkpoint-%llu%n", &seq, &pos) == 1 &&
+          entry->d_name[pos] == '\0') {
+        checkpoints->push_back(seq);
+      } else if (std::sscanf(entry->d_name, "wal-%llu.log%n", &seq, &pos) ==
+                     1 &&
+                 pos > 0 && entry->d_name[pos] == '\0') {
+        segments->push_back(seq);
+      }
+    }
+    ::closedir(d);
+    std::sort(checkpoints->begin(), checkpoints->end());
+    std::sort(segments->begin(), segments->end());
+    return true;
+  }
+
+  void remove_before(uint64_t seq, const std::vector<uint64_t> &checkpoints,
+                     const std::vector<uint64_t> &segments) {
+    for (uint64_t s : segments) {
+      if (s < seq) {
+        ::unlink(detail::ArtWal<T>::segment_path(dir_, s).c_str());
+      }
+    }
+    for (uint64_t s : checkpoints) {
+      if (s < seq) ::unlink(checkpoint_path(s).c_str());
+    }
+  }
+
+  void replay(uint64_t seq) {
+    auto path = detail::ArtWal<T>::segment_path(dir_, seq);
+    detail::ArtFileReader reader(path);
+    char magic[sizeof(detail::ART_WAL_MAGIC)];
+    uint32_t version = 0;
+    uint32_t value_size = 0;
+    if (!reader.get(magic, sizeof(magic)) ||
+        std::memcmp(magic, detail::ART_WAL_MAGIC, sizeof(magic)) != 0 ||
+        !reader.get_pod(&version) || version != detail::ART_WAL_VERSION ||
+        !reader.get_pod(&value_size) || value_size != sizeof(T)) {
+      LOG_WARNING("skip %s, bad header", path.c_str());
+      return;
+    }
+
+    std::string key;
+    uint64_t cnt = 0;
+    bool torn = true;
+    while (true) {
+      if (reader.at_end()) {
+        torn = false;
+        break;
+      }
+      uint32_t crc = 0;
+      uint8_t op = 0;
+      uint32_t len = 0;
+      T value{};
+      if (!reader.get_pod(&crc) || !reader.get_pod(&op) ||
+          !reader.get_pod(&len) || len > detail::ART_WAL_MAX_KEY_LEN ||
+          (op != detail::ART_WAL_SET && op != detail::ART_WAL_DEL)) {
+        break;
+      }
+      key.resize(len);
+      if (!reader.get(key.data(), len) ||
+          (op == detail::ART_WAL_SET && !reader.get_pod(&value))) {
+        break;
+      }
+      uint32_t check = detail::art_crc32(&op, sizeof(op));
+      check = detail::art_crc32(&len, sizeof(len), check);
+      check = detail::art_crc32(key.data(), len, check);
+      if (op == detail::ART_WAL_SET) {
+        check = detail::art_crc32(&value, sizeof(T), check);
+      }
+      if (check != crc) break;
+
+      if (op == detail::ART_WAL_SET) {
+        tree_.set(key, value);
+      } else {
+        tree_.del(key);
+      }
+      cnt++;
+    }
+    if (torn) {
+      LOG_WARNING("%s ends with a torn record after %llu records",
+                  path.c_str(), (unsigned long long)cnt);
+    }
+  }
+
+  Tree tree_;
+  detail::ArtWal<T> wal_;
+  // Lets checkpoint() move the log to a new segment between two writes.
+  detail::ArtWriteGate gate_;
+  std::mutex checkpoint_mutex_;
+  std::string dir_;
+  // Sequence number of the current segment.
+  uint64_t seq_ = 0;
+};
+
+}  // namespace art
@@ -2,25 +2,56 @@
 
 #include <atomic>
 #include <cstdint>
+#include <memory>
 #include <string>
-
+#include <string_view>
+#include <vector>
+
+#include "art/art-arena.h"
+#include "art/art-bulk-load.h"
+#include "art/art-cow.h"
+#include "art/art-frozen.h"
+#include "art/art-iterator.h"
+#include "art/art-serialize.h"
+#include "art/art-key-traits.h"
 #include "art/art-node-add.h"
 #include "art/art-node-del.h"
+#include "art/art-olc.h"
 #include "art/art-printer.h"
+#include "art/art-reserve.h"
+#include "art/art-size.h"
 
 namespace art {
 
-template <class T>
+template <class T, class KeyTraits, class Alloc>
+class ArtSnapshot;
+
+// |KeyTraits| describes keys, see art-key-traits.h. |Alloc| is where nodes
+// come from, ArtPoolAlloc or ArtArenaAlloc, see art-arena.h.
+template <class T, class KeyTraits = ArtStringKeyTraits,
+          class Alloc = ArtPoolAlloc>
 class ArtTree {
  public:
+  using Iterator = ArtIterator<T, KeyTraits>;
+  using Snapshot = ArtSnapshot<T, KeyTraits, Alloc>;
+
   ArtTree() = default;
 
+  // |policy| decides when inner nodes shrink after deletes, see
+  // ArtShrinkPolicy. |size_mode| decides how keys are counted, see
+  // ArtSizeMode.
+  explicit ArtTree(const ArtShrinkPolicy& policy,
+                   ArtSizeMode size_mode = ArtSizeMode::STRIPED)
+      : size_(size_mode), shrink_policy_(policy) {
+    assert(policy.valid());
+  }
+
+  explicit ArtTree(ArtSizeMode size_mode) : size_(size_mode) {}
+
+  // Snapshots must be released before their tree.
   ~ArtTree() {
-    auto root = this->get_root_unsafe();
-    if (likely(root)) {
-      detail::destroy_node<T>(root);
-      root = nullptr;
-    }
+    assert(!snapshots_.live());
+    alloc_.template destroy<T>(get_root_unsafe());
   }
 
   T set(const std::string& k, T v) { return insertInt(k.data(), k.size(), v); }
@@ -29,71 +60,512 @@ class ArtTree {
     return insertInt(key, len, value);
   }
 
-  T get(const std::string& k) const { return findInt(k.data(), k.size()); }
-  T get(const char* key, uint32_t len) const { return findInt(key, len); }
+  // Load pairs sorted by key, it->first is the key (anything convertible to
+  // std::string_view) and it->second the value. A later duplicate wins.
+  // On an empty tree nodes are built bottom-up with their final type and
+  // published at once, other threads wait on the root meanwhile. Keys that
+  // can not be appended that way (unsorted tail, non-empty tree) go through
+  // set(). Returns number of pairs consumed.
+  template <class It>
+  uint64_t bulk_load(It first, It last) {
+    uint64_t cnt = 0;
+    uint64_t version = 0;
+
+    {
+      // keeps clear() from changing the allocator under the build
+      detail::ArtWriteGate::Pass pass(gate_);
+    label_bulk_load_retry:
+      ART_MACRO_READ_LOCK_OR_RESTART(&meta_to_root_, version,
+                                     label_bulk_load_retry);
+      if (get_root_unsafe() == nullptr) {
+        ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(&meta_to_root_, version,
+                                              label_bulk_load_retry);
+        typename Alloc::Scope scope(alloc_);
+        detail::ArtBulkBuilder<T, KeyTraits> builder;
+        for (; first != last; ++first, ++cnt) {
+          std::string_view k(first->first);
+          if (!builder.add(k.data(), k.size(), first->second)) break;
+        }
+        meta_to_root_.children[0] = builder.finish();
+        size_.add(builder.count());
+        ART_MACRO_WRITE_UNLOCK(&meta_to_root_);
+      }
+    }
+
+    for (; first != last; ++first, ++cnt) {
+      std::string_view k(first->first);
+      insertInt(k.data(), k.size(), first->second);
+    }
+    return cnt;
+  }
+
+  // Same as above with the input cut into pieces by leading key bytes, and
+  // the pieces built on |thread_num| threads. Input must be random access
+  // and may be unsorted, in which case it is sorted in parallel first.
+  template <class It>
+  uint64_t bulk_load(It first, It last, uint32_t thread_num) {
+    size_t n = last - first;
+    uint64_t version = 0;
+    std::vector<size_t> rejected;
+    bool built = false;
+
+    {
+      // keeps clear() from changing the allocator under the build
+      detail::ArtWriteGate::Pass pass(gate_);
+    label_parallel_load_retry:
+      ART_MACRO_READ_LOCK_OR_RESTART(&meta_to_root_, version,
+                                     label_parallel_load_retry);
+      if (get_root_unsafe() == nullptr) {
+        ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(&meta_to_root_, version,
+                                              label_parallel_load_retry);
+        auto key_at = [first](size_t i) {
+          return std::string_view((first + i)->first);
+        };
+        auto val_at = [first](size_t i) { return (first + i)->second; };
+        typename Alloc::Scope scope(alloc_);
+        detail::ArtParallelBuilder<T, KeyTraits, decltype(key_at),
+                                   decltype(val_at)>
+            builder(n, key_at, val_at, thread_num);
+        meta_to_root_.children[0] = builder.build(&rejected);
+        size_.add(builder.count());
+        ART_MACRO_WRITE_UNLOCK(&meta_to_root_);
+        built = true;
+      }
+    }
+
+    if (!built) {
+      for (It it = first; it != last; ++it) {
+        std::string_view k(it->first);
+        insertInt(k.data(), k.size(), it->second);
+      }
+      return n;
+    }
+
+    for (size_t i : rejected) {
+      std::string_view k((first + i)->first);
+      insertInt(k.data(), k.size(), (first + i)->second);
+    }
+    return n;
+  }
+
+  // Read-modify-write in one traversal. fn(T& value, bool exists) runs under
+  // the write lock covering the key, so concurrent calls on a key serialize.
+  // For a missing key |value| starts as T{} and the key is inserted only if
+  // fn returns true; for an existing key the return value is ignored.
+  template <class F>
+  void upsert(const char* key, uint32_t len, F&& fn) {
+    upsertInt(key, len, std::forward<F>(fn));
+  }
+
+  template <class F>
+  void upsert(const std::string& k, F&& fn) {
+    upsertInt(k.data(), k.size(), std::forward<F>(fn));
+  }
 
-  T del(const std::string& k) const { return deleteInt(k.data(), k.size()); }
-  T del(const char* key, uint32_t len) { return deleteInt(key, len); }
+  // Insert |v| if the key is missing and return true. Otherwise return false
+  // and store current value to |current| if given.
+  bool insert_if_absent(const char* key, uint32_t len, T v,
+                        T* current = nullptr) {
+    bool inserted = false;
+    upsertInt(key, len, [&](T& value, bool exists) {
+      if (exists) {
+        if (current) *current = value;
+        return false;
+      }
+      value = v;
+      inserted = true;
+      return true;
+    });
+    return inserted;
+  }
+
+  bool insert_if_absent(const std::string& k, T v, T* current = nullptr) {
+    return insert_if_absent(k.data(), k.size(), v, current);
+  }
+
+  // Replace value with |desired| if the key exists and its value equals
+  // |expected|. Returns whether the value was replaced.
+  bool compare_and_set(const char* key, uint32_t len, const T& expected,
+                       const T& desired) {
+    bool swapped = false;
+    upsertInt(key, len, [&](T& value, bool exists) {
+      if (exists && value == expected) {
+        value = desired;
+        swapped = true;
+      }
+      return false;
+    });
+    return swapped;
+  }
+
+  bool compare_and_set(const std::string& k, const T& expected,
+                       const T& desired) {
+    return compare_and_set(k.data(), k.size(), expected, desired);
+  }
+
+  T get(const std::string& k) const {
+    return findInt(&meta_to_root_, k.data(), k.size());
+  }
+  T get(const char* key, uint32_t len) const {
+    return findInt(&meta_to_root_, key, len);
+  }
+
+  // Look up |n| keys, out[i] gets the value of keys[i] or T{}. Lookups of a
+  // group advance one level per round and prefetch the next node, so cache
+  // misses of different keys overlap instead of being paid one by one.
+  void multi_get(const std::string* keys, size_t n, T* out) const {
+    multiFindInt(
+        [keys](size_t i) {
+          return std::string_view(keys[i].data(), keys[i].size());
+        },
+        n, out);
+  }
+
+  void multi_get(const char* const* keys, const uint32_t* lens, size_t n,
+                 T* out) const {
+    multiFindInt(
+        [keys, lens](size_t i) { return std::string_view(keys[i], lens[i]); },
+        n, out);
+  }
+
+  T del(const std::string& k) { return del(k.data(), k.size()); }
+  T del(const char* key, uint32_t len) {
+    return deleteInt(key, len, [](const T&) {});
+  }
+
+  // Same as above, calling fn(const T& value) under the write lock covering
+  // the key right before it goes, so fn orders with concurrent writes of the
+  // key as upsert() callbacks do. Not called for a missing key.
+  template <class F>
+  T del(const char* key, uint32_t len, F&& fn) {
+    return deleteInt(key, len, std::forward<F>(fn));
+  }
+
+  // Ordered access, see ArtIterator for the guarantees under concurrent
+  // writers. |key_buf| receives keys of the iterator if given.
+  Iterator begin(std::string* key_buf = nullptr) const {
+    return min(key_buf);
+  }
+
+  Iterator end() const { return Iterator(); }
+
+  Iterator min(std::string* key_buf = nullptr) const {
+    Iterator it(&meta_to_root_, key_buf);
+    it.seek_to_first();
+    return it;
+  }
+
+  Iterator max(std::string* key_buf = nullptr) const {
+    Iterator it(&meta_to_root_, key_buf);
+    it.seek_to_last();
+    return it;
+  }
+
+  // First key >= |key|.
+  Iterator lower_bound(const char* key, uint32_t len,
+                       std::string* key_buf = nullptr) const {
+    Iterator it(&meta_to_root_, key_buf);
+    it.seek(key, len);
+    return it;
+  }
+
+  Iterator lower_bound(const std::string& k) const {
+    return lower_bound(k.data(), k.size());
+  }
+
+  // First key > |key|.
+  Iterator upper_bound(const char* key, uint32_t len,
+                       std::string* key_buf = nullptr) const {
+    Iterator it(&meta_to_root_, key_buf);
+    it.seek_after(key, len);
+    return it;
+  }
+
+  Iterator upper_bound(const std::string& k) const {
+    return upper_bound(k.data(), k.size());
+  }
+
+  // Visit keys in [start, end) in order, an empty |end| means no upper bound.
+  // |fn| is called as fn(std::string_view key, const T& value) and returns
+  // false to stop. Returns number of keys visited.
+  template <class F>
+  uint64_t scan(const char* start, uint32_t start_len, const char* end,
+                uint32_t end_len, F&& fn,
+                std::string* key_buf = nullptr) const {
+    uint64_t cnt = 0;
+    std::string_view end_key(end, end_len);
+    for (Iterator it = lower_bound(start, start_len, key_buf); it.valid();
+         it.next()) {
+      if (end_len && it.key() >= end_key) break;
+      cnt++;
+      if (!fn(it.key(), it.value())) break;
+    }
+    return cnt;
+  }
+
+  template <class F>
+  uint64_t scan(const std::string& start, const std::string& end,
+                F&& fn) const {
+    return scan(start.data(), start.size(), end.data(), end.size(),
+                std::forward<F>(fn));
+  }
+
+  // Visit all keys starting with |prefix| in order. Only the path to the
+  // subtree of the prefix and the subtree itself are touched. |fn| has the
+  // same signature as in scan(). Returns number of keys visited.
+  template <class F>
+  uint64_t scan_prefix(const char* prefix, uint32_t len, F&& fn,
+                       std::string* key_buf = nullptr) const {
+    uint64_t cnt = 0;
+    Iterator it(&meta_to_root_, key_buf);
+    for (it.seek_prefix(prefix, len); it.valid(); it.next()) {
+      cnt++;
+      if (!fn(it.key(), it.value())) break;
+    }
+    return cnt;
+  }
+
+  template <class F>
+  uint64_t scan_prefix(const std::string& prefix, F&& fn) const {
+    return scan_prefix(prefix.data(), prefix.size(), std::forward<F>(fn));
+  }
+
+  // Read-only view of the tree as of now, see ArtSnapshot. Taking it waits
+  // for writes in flight and is O(1) otherwise. While snapshots are alive,
+  // writers copy the nodes on their path that a snapshot can still see, and
+  // those copies are freed with the last snapshot old enough to see them.
+  // Must not be called from inside an upsert() callback, and neither must the
+  // last copy of a snapshot be dropped there.
+  Snapshot snapshot() {
+    gate_.close();
+    uint64_t version = 0;
+    ArtNodeCommon* root = const_cast<ArtNodeCommon*>(load_root(&version));
+    detail::art_mark_shared(root);
+    uint64_t id = snapshots_.acquire();
+    uint64_t size = size_.load();
+    gate_.open();
+    return Snapshot(this, id, root, size);
+  }
+
+  // Nodes unlinked from the tree and kept for live snapshots.
+  size_t snapshot_retired_num() { return snapshots_.retired_num(); }
+
+  // Write the tree as of now to |path|, see ArtSnapshot::save(). Writers
+  // carry on meanwhile.
+  bool save(const std::string& path) { return snapshot().save(path); }
+
+  // Write an image of the tree as of now to |path| for FrozenArt, see
+  // ArtSnapshot::freeze().
+  bool freeze(const std::string& path) { return snapshot().freeze(path); }
+
+  // Build the tree from a file written by save(), each node directly with
+  // its saved type. The tree must be empty. Returns false and leaves the
+  // tree unchanged if it is not, or if the file can not be loaded.
+  bool load(const std::string& path) {
+    ArtNodeCommon* root = nullptr;
+    uint64_t cnt = 0;
+    detail::ArtWriteGate::Pass pass(gate_);
+    {
+      typename Alloc::Scope scope(alloc_);
+      detail::ArtTreeLoader<T, KeyTraits> loader(path);
+      if (!loader.load(&root, &cnt)) return false;
+    }
+
+    uint64_t version = 0;
+  label_load_retry:
+    ART_MACRO_READ_LOCK_OR_RESTART(&meta_to_root_, version, label_load_retry);
+    if (get_root_unsafe() != nullptr) {
+      if (root) detail::destroy_node<T>(root);
+      LOG_WARNING("load %s into a non-empty tree", path.c_str());
+      return false;
+    }
+    ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(&meta_to_root_, version,
+                                          label_load_retry);
+    meta_to_root_.children[0] = root;
+    size_.add(cnt);
+    ART_MACRO_WRITE_UNLOCK(&meta_to_root_);
+    return true;
+  }
+
+  // Get ready for |expected_keys| inserts of keys like |profile|. The nodes
+  // they are estimated to take are allocated now and their memory touched,
+  // so the inserts neither take memory from the system nor fault pages in,
+  // see ArtKeyProfile. Leaves larger than any size class and out of line
+  // prefixes are still malloc'ed.
+  void reserve(uint64_t expected_keys, const ArtKeyProfile& profile = {}) {
+    // keeps clear() from changing the allocator meanwhile
+    detail::ArtWriteGate::Pass pass(gate_);
+    alloc_.reserve(detail::art_estimate_nodes<T>(expected_keys, profile,
+                                                 KeyTraits::LAZY_LEAF),
+                   profile.threads);
+  }
 
   // for debug
   ArtNodeCommon* get_root_unsafe() const { return meta_to_root_.children[0]; }
 
-  uint64_t size() const { return size_; }
+  // Number of keys, see ArtSizeMode.
+  uint64_t size() const { return size_.load(); }
+
+  ArtSizeMode size_mode() const { return size_.mode(); }
+
+  const ArtShrinkPolicy& shrink_policy() const { return shrink_policy_; }
+
+  // Node memory of the tree, e.g. allocator().bytes() of an ArtArenaAlloc
+  // tree.
+  const Alloc& allocator() const { return alloc_; }
+
+  // Remove all keys. Waits for writes in flight, concurrent reads may go on
+  // and the nodes are freed after them. No snapshot may be alive. Must not
+  // be called from inside an upsert() callback.
+  void clear() {
+    gate_.close();
+    assert(!snapshots_.live());
+    uint64_t version = 0;
+  label_clear_retry:
+    ART_MACRO_READ_LOCK_OR_RESTART(&meta_to_root_, version, label_clear_retry);
+    ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(&meta_to_root_, version,
+                                          label_clear_retry);
+    ArtNodeCommon* root = meta_to_root_.children[0];
+    meta_to_root_.children[0] = nullptr;
+    size_.reset();
+    ART_MACRO_WRITE_UNLOCK(&meta_to_root_);
+    alloc_.template retire<T>(root);
+    gate_.open();
+  }
 
  private:
-#define ART_SET_LOCK_BIT(v) ((v) + 2)
-#define ART_IS_OBSOLETE(v) ((v)&1)
-#define ART_IS_LOCKED(v) ((v)&2)
-
-  static uint64_t _art_spin_on_locked_node(const ArtNodeCommon* node) {
-    uint64_t version = node->version.load();
-    while (ART_IS_LOCKED(version)) {
-      __builtin_ia32_pause();
-      version = node->version.load();
+  friend Snapshot;
+
+  // Writers decide once whether to copy shared nodes, so the last snapshot
+  // only goes away with no write in flight. Otherwise a writer still copying
+  // a node could race with a new one changing it in place.
+  void release_snapshot(uint64_t id) {
+    gate_.close();
+    snapshots_.release(id);
+    gate_.open();
+  }
+
+  static bool is_lazy_leaf(const ArtNodeCommon* node) {
+    if constexpr (KeyTraits::LAZY_LEAF) {
+      return detail::art_is_lazy_leaf(node);
+    } else {
+      return false;
+    }
+  }
+
+  // |value| gets the value of lazy leaf |node|, returns whether its key is
+  // |key|.
+  static bool lazy_leaf_matches(const ArtNodeCommon* node, const char* key,
+                                uint32_t len, T* value) {
+    if constexpr (KeyTraits::LAZY_LEAF) {
+      std::string buf;
+      *value = detail::art_lazy_leaf_value<T>(node);
+      return KeyTraits::load_key(*value, &buf) == std::string_view(key, len);
+    } else {
+      return false;
     }
-    return version;
-  }
-
-#define ART_MACRO_READ_LOCK_OR_RESTART(node, version_varname, restart_label) \
-  version_varname = _art_spin_on_locked_node(node);                          \
-  if (ART_IS_OBSOLETE(version_varname)) goto restart_label
-
-#define ART_MACRO_READ_UNLOCK_OR_RESTART(node, version_varname, restart_label) \
-  if ((version_varname) != (node)->version.load()) goto restart_label
-
-#define ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(node, version_varname, \
-                                              restart_label)         \
-  if (!(node)->version.compare_exchange_strong(                      \
-          version_varname, ART_SET_LOCK_BIT(version_varname)))       \
-  goto restart_label
-
-#define ART_MACRO_WRITE_UNLOCK(node) (node)->version.fetch_add(2)
-
-#define ART_MACRO_WRITE_UNLOCK_OBSOLETE(node) (node)->version.fetch_add(3)
-
-#define ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART_AND_RELEASE(         \
-    node, version_varname, lockNode, restart_label)                \
-  do {                                                             \
-    if (!(node)->version.compare_exchange_strong(                  \
-            version_varname, ART_SET_LOCK_BIT(version_varname))) { \
-      ART_MACRO_WRITE_UNLOCK(lockNode);                            \
-      goto restart_label;                                          \
-    }                                                              \
-  } while (0)
-
-#define ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART_AND_RELEASE_TWO(     \
-    node, version_varname, lockNode_p, lockNode_pp, restart_label) \
-  do {                                                             \
-    if (!(node)->version.compare_exchange_strong(                  \
-            version_varname, ART_SET_LOCK_BIT(version_varname))) { \
-      ART_MACRO_WRITE_UNLOCK(lockNode_p);                          \
-      ART_MACRO_WRITE_UNLOCK(lockNode_pp);                         \
-      goto restart_label;                                          \
-    }                                                              \
-  } while (0)
+  }
 
- private:
-  T deleteInt(const char* key, uint32_t len) {
+  // Full key of a leaf, lazy or not.
+  static std::string_view leaf_key(const ArtNodeCommon* node,
+                                   std::string* buf) {
+    if constexpr (KeyTraits::LAZY_LEAF) {
+      if (detail::art_is_lazy_leaf(node)) {
+        return KeyTraits::load_key(detail::art_lazy_leaf_value<T>(node), buf);
+      }
+    }
+    return {node->get_key(), node->keyLen};
+  }
+
+  static ArtNodeCommon* new_leaf(const char* key, uint32_t len, T value) {
+    return detail::get_new_leaf<T, KeyTraits::LAZY_LEAF>(key, len, value);
+  }
+
+  // Prefix of an inner node being created, see KeyTraits::FULL_PREFIX.
+  static void set_prefix(ArtNodeCommon* node, const char* key, uint32_t len) {
+    detail::art_init_prefix(node, key, len, KeyTraits::FULL_PREFIX);
+  }
+
+  static bool leaf_matches(const ArtLeaf<T>* leaf, const char* key,
+                           uint32_t len, uint32_t depth) {
+    if constexpr (KeyTraits::FIXED_LEN != 0) {
+      static_assert(KeyTraits::FIXED_LEN <= ART_MAX_PREFIX_LEN,
+                    "fixed length key must be stored inline");
+      assert(len == KeyTraits::FIXED_LEN);
+      return std::memcmp(leaf->key.shortKey, key, KeyTraits::FIXED_LEN) == 0;
+    } else {
+      return leaf->leaf_matches(key, len, depth);
+    }
+  }
+
+  // Copy the shared nodes on the path of |key|, top down, so the write that
+  // follows only changes nodes no snapshot can see. Nodes created or copied
+  // meanwhile are owned by the live tree, so the path stays unshared until
+  // the write leaves the gate.
+  void unshare_path(const char* key, uint32_t len) {
+    uint64_t version = 0;
+    uint64_t parent_version = 0;
+
+  label_unshare_retry:
+    ArtNodeCommon* node = &meta_to_root_;
+    ArtNodeCommon* parent = nullptr;
+    uint32_t depth = 0;
+    while (true) {
+      ART_MACRO_READ_LOCK_OR_RESTART(node, version, label_unshare_retry);
+      // lock coupling, a node copied away is left unchanged but its parent
+      // is bumped, so we never write into a node a snapshot can see
+      if (parent) {
+        ART_MACRO_READ_UNLOCK_OR_RESTART(parent, parent_version,
+                                         label_unshare_retry);
+      }
+      ArtNodeCommon** slot = nullptr;
+      if (node == &meta_to_root_) {
+        slot = &meta_to_root_.children[0];
+      } else if (node->type != ArtNodeType::ART_NODE_LEAF) {
+        depth += node->keyLen;
+        slot = detail::art_find_child(node, depth < len ? key[depth] : 0);
+        depth++;
+      }
+      ArtNodeCommon* child = slot ? *slot : nullptr;
+      if (child == nullptr || is_lazy_leaf(child)) {
+        ART_MACRO_READ_UNLOCK_OR_RESTART(node, version, label_unshare_retry);
+        return;
+      }
+      if (child->is_shared()) {
+        ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(node, version,
+                                              label_unshare_retry);
+        ArtNodeCommon* copy = detail::art_copy_shared_node<T>(child);
+        *slot = copy;
+        // couple the next step on the version our unlock leaves
+        version = ART_MACRO_WRITE_UNLOCK(node) + 2;
+        snapshots_.retire(child);
+        child = copy;
+      } else {
+        ART_MACRO_READ_UNLOCK_OR_RESTART(node, version, label_unshare_retry);
+      }
+      parent = node;
+      parent_version = version;
+      node = child;
+    }
+  }
+
+  // Deleting |key_byte| from write locked |node| may collapse a Node4 into
+  // its other child and change that child's prefix, copy it first if shared.
+  void unshare_collapsing_child(ArtNodeCommon* node, uint8_t key_byte) {
+    if (node->type != ArtNodeType::ART_NODE_4 || node->childNum != 2) return;
+    auto n4 = reinterpret_cast<ArtNode4*>(node);
+    ArtNodeCommon** slot = &n4->children[n4->keys[0] == key_byte ? 1 : 0];
+    ArtNodeCommon* child = *slot;
+    if (is_lazy_leaf(child) || child->type == ArtNodeType::ART_NODE_LEAF ||
+        !child->is_shared()) {
+      return;
+    }
+    *slot = detail::art_copy_shared_node<T>(child);
+    snapshots_.retire(child);
+  }
+
+  template <class F>
+  T deleteInt(const char* key, uint32_t len, F&& on_delete) {
     uint64_t version_parent_parent = 0;
     uint64_t version_parent = 0;
     uint64_t version_current = 0;
@@ -108,7 +580,13 @@ class ArtTree {
      *              leaf
      */
 
+    EpochGuard guard;
+    detail::ArtWriteGate::Pass pass(gate_);
+    typename Alloc::Scope scope(alloc_);
+    bool cow = snapshots_.live();
+
   label_delete_retry:
+    if (cow) unshare_path(key, len);
     ArtNodeCommon* parent_parent_p = nullptr;
     ArtNodeCommon** parent_pp = nullptr;
     ArtNodeCommon* parent_p = nullptr;
@@ -125,10 +603,23 @@ class ArtTree {
                                      label_delete_retry);
 
     if (current_p == nullptr) return T{};
+    if (is_lazy_leaf(current_p)) {
+      T v{};
+      if (!lazy_leaf_matches(current_p, key, len, &v)) return T{};
+      ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(parent_p, version_parent,
+                                            label_delete_retry);
+      on_delete(v);
+      *current_pp = nullptr;
+      size_.add(-1);
+      ART_MACRO_WRITE_UNLOCK(parent_p);
+      return v;
+    }
     if (current_p->type == ArtNodeType::ART_NODE_LEAF) {
+      ART_MACRO_READ_LOCK_OR_RESTART(current_p, version_current,
+                                     label_delete_retry);
       auto leaf = reinterpret_cast<ArtLeaf<T>*>(current_p);
       T v = leaf->value;
-      bool b_leaf_match = leaf->leaf_matches(key, len, depth);
+      bool b_leaf_match = leaf_matches(leaf, key, len, depth);
       ART_MACRO_READ_UNLOCK_OR_RESTART(current_p, version_current,
                                        label_delete_retry);
       if (!b_leaf_match) {
@@ -139,30 +630,63 @@ class ArtTree {
         ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART_AND_RELEASE(
             current_p, version_current, parent_p, label_delete_retry);
 
-        detail::return_art_node(leaf);
+        on_delete(v);
         *current_pp = nullptr;
+        size_.add(-1);
 
         ART_MACRO_WRITE_UNLOCK(parent_p);
-        ART_MACRO_WRITE_UNLOCK(current_p);
+        ART_MACRO_WRITE_UNLOCK_OBSOLETE(current_p);
+        detail::retire_art_node(leaf);
 
         return v;
       }
     }
 
     while (current_pp) {
+      if (is_lazy_leaf(current_p)) {
+        T v{};
+        if (!lazy_leaf_matches(current_p, key, len, &v)) return T{};
+        if (parent_p->need_adjust_after_delete(shrink_policy_)) {
+          ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(
+              parent_parent_p, version_parent_parent, label_delete_retry);
+          ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART_AND_RELEASE(
+              parent_p, version_parent, parent_parent_p, label_delete_retry);
+          on_delete(v);
+          if (cow) unshare_collapsing_child(parent_p, key[depth - 1]);
+          detail::art_delete_from_node(parent_pp, key[depth - 1],
+                                       KeyTraits::FULL_PREFIX, shrink_policy_);
+          ART_MACRO_WRITE_UNLOCK(parent_parent_p);
+          ART_MACRO_WRITE_UNLOCK_IF_REPLACED(parent_p, parent_pp);
+        } else {
+          ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(parent_p, version_parent,
+                                                label_delete_retry);
+          on_delete(v);
+          // see the leaf case below
+          auto node = parent_p;
+          detail::art_delete_from_node(&node, key[depth - 1],
+                                       KeyTraits::FULL_PREFIX, shrink_policy_);
+          ART_MACRO_WRITE_UNLOCK(parent_p);
+        }
+        size_.add(-1);
+        return v;
+      }
+
       ART_MACRO_READ_LOCK_OR_RESTART(current_p, version_current,
                                      label_delete_retry);
+      // lock coupling, see findInt()
+      ART_MACRO_READ_UNLOCK_OR_RESTART(parent_p, version_parent,
+                                       label_delete_retry);
       if (current_p->type == ArtNodeType::ART_NODE_LEAF) {
         auto leaf = reinterpret_cast<ArtLeaf<T>*>(current_p);
         T v = leaf->value;
-        bool b_leaf_match = leaf->leaf_matches(key, len, depth);
+        bool b_leaf_match = leaf_matches(leaf, key, len, depth);
         ART_MACRO_READ_UNLOCK_OR_RESTART(current_p, version_current,
                                          label_delete_retry);
 
         if (!b_leaf_match) {
           return T{};
         } else {
-          if (parent_p->need_adjust_after_delete()) {
+          if (parent_p->need_adjust_after_delete(shrink_policy_)) {
             ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(
                 parent_parent_p, version_parent_parent, label_delete_retry);
             ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART_AND_RELEASE(
@@ -171,24 +695,34 @@ class ArtTree {
                 current_p, version_current, parent_p, parent_parent_p,
                 label_delete_retry);
 
-            detail::art_delete_from_node(parent_pp, key[depth - 1]);
+            on_delete(v);
+            if (cow) unshare_collapsing_child(parent_p, key[depth - 1]);
+            detail::art_delete_from_node(parent_pp, key[depth - 1],
+                                         KeyTraits::FULL_PREFIX,
+                                         shrink_policy_);
 
             ART_MACRO_WRITE_UNLOCK(parent_parent_p);
-            ART_MACRO_WRITE_UNLOCK(parent_p);
-            ART_MACRO_WRITE_UNLOCK(current_p);
+            ART_MACRO_WRITE_UNLOCK_IF_REPLACED(parent_p, parent_pp);
+            ART_MACRO_WRITE_UNLOCK_OBSOLETE(current_p);
           } else {
             ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(parent_p, version_parent,
                                                   label_delete_retry);
             ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART_AND_RELEASE(
                 current_p, version_current, parent_p, label_delete_retry);
 
-            detail::art_delete_from_node(parent_pp, key[depth - 1]);
+            on_delete(v);
+            // |parent_pp| is not stable without the grandparent lock, and the
+            // parent is not replaced
+            auto node = parent_p;
+            detail::art_delete_from_node(&node, key[depth - 1],
+                                         KeyTraits::FULL_PREFIX,
+                                         shrink_policy_);
 
             ART_MACRO_WRITE_UNLOCK(parent_p);
-            ART_MACRO_WRITE_UNLOCK(current_p);
+            ART_MACRO_WRITE_UNLOCK_OBSOLETE(current_p);
           }
-          size_--;
-          detail::return_art_node(leaf);
+          size_.add(-1);
+          detail::retire_art_node(leaf);
           return v;
         }
       }
@@ -225,10 +759,28 @@ class ArtTree {
   }
 
   T insertInt(const char* key, uint32_t len, T value) {
+    T old{};
+    upsertInt(key, len, [&old, &value](T& v, bool) {
+      old = v;
+      v = value;
+      return true;
+    });
+    return old;
+  }
+
+  // Single traversal behind set() and the conditional writes. |fn| runs with
+  // the leaf, or for a missing key the node the leaf goes to, write locked.
+  template <class F>
+  void upsertInt(const char* key, uint32_t len, F&& fn) {
     uint64_t version_parent = 0;
     uint64_t version_current = 0;
+    EpochGuard guard;
+    detail::ArtWriteGate::Pass pass(gate_);
+    typename Alloc::Scope scope(alloc_);
+    bool cow = snapshots_.live();
 
   label_insert_retry:
+    if (cow) unshare_path(key, len);
     ArtNodeCommon** current_pp = nullptr;
     ArtNodeCommon* parent_p = nullptr;
     ArtNodeCommon* current_p = nullptr;
@@ -246,24 +798,61 @@ class ArtTree {
     if (current_p == nullptr) {
       ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(&meta_to_root_, version_parent,
                                             label_insert_retry);
-      *current_pp = detail::get_new_leaf_node<T>(key, len, value);
-      size_++;
+      T value{};
+      if (fn(value, false)) {
+        *current_pp = new_leaf(key, len, value);
+        size_.add(1);
+      }
       ART_MACRO_WRITE_UNLOCK(&meta_to_root_);
-      return T{};
+      return;
     }
 
     while (current_pp) {
+      if (is_lazy_leaf(current_p)) {
+        // Value lives in the parent's slot, so the parent lock covers it.
+        T old{};
+        bool match = lazy_leaf_matches(current_p, key, len, &old);
+        ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(parent_p, version_parent,
+                                              label_insert_retry);
+        if (match) {
+          fn(old, true);
+          *current_pp = new_leaf(key, len, old);
+          ART_MACRO_WRITE_UNLOCK(parent_p);
+          return;
+        }
+
+        T value{};
+        if (!fn(value, false)) {
+          ART_MACRO_WRITE_UNLOCK(parent_p);
+          return;
+        }
+        std::string buf;
+        std::string_view old_key = leaf_key(current_p, &buf);
+        auto newInner4 = detail::get_new_art_node<ArtNode4>();
+        auto [prefixLen, c1, c2] = detail::get_prefix_len_and_diff_char(
+            old_key.data(), old_key.size(), key, len, depth);
+        set_prefix(newInner4, key + depth, prefixLen);
+        newInner4->init_with_leaf(c1, current_p, c2,
+                                  new_leaf(key, len, value));
+        *current_pp = newInner4;
+        size_.add(1);
+        ART_MACRO_WRITE_UNLOCK(parent_p);
+        return;
+      }
+
       ART_MACRO_READ_LOCK_OR_RESTART(current_p, version_current,
                                      label_insert_retry);
+      // lock coupling, see findInt()
+      ART_MACRO_READ_UNLOCK_OR_RESTART(parent_p, version_parent,
+                                       label_insert_retry);
       if (current_p->type == ArtNodeType::ART_NODE_LEAF) {
         auto leaf = reinterpret_cast<ArtLeaf<T>*>(current_p);
-        if (leaf->leaf_matches(key, len, depth)) {
+        if (leaf_matches(leaf, key, len, depth)) {
           ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(current_p, version_current,
                                                 label_insert_retry);
-          auto OldV = leaf->value;
-          leaf->value = value;
+          fn(leaf->value, true);
           ART_MACRO_WRITE_UNLOCK(current_p);
-          return OldV;
+          return;
         }
 
         // since we will change parent's pointer to a new ArtNode4
@@ -271,50 +860,61 @@ class ArtTree {
                                               label_insert_retry);
         ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART_AND_RELEASE(
             current_p, version_current, parent_p, label_insert_retry);
+        T value{};
+        if (!fn(value, false)) {
+          ART_MACRO_WRITE_UNLOCK(parent_p);
+          ART_MACRO_WRITE_UNLOCK(current_p);
+          return;
+        }
         auto newInner4 = detail::get_new_art_node<ArtNode4>();
-        auto newLeaf = detail::get_new_leaf_node<T>(key, len, value);
-        auto [prefixLen, c1, c2] =
-            detail::get_prefix_len_and_diff_char(current_p, newLeaf, depth);
-        newInner4->set_prefix_key(key + depth, prefixLen);
+        auto newLeaf = new_leaf(key, len, value);
+        auto [prefixLen, c1, c2] = detail::get_prefix_len_and_diff_char(
+            leaf->get_key(), leaf->keyLen, key, len, depth);
+        set_prefix(newInner4, key + depth, prefixLen);
         newInner4->init_with_leaf(c1, leaf, c2, newLeaf);
 
         *current_pp = newInner4;
-        size_++;
+        size_.add(1);
 
         ART_MACRO_WRITE_UNLOCK(parent_p);
         ART_MACRO_WRITE_UNLOCK(current_p);
-
-        return T{};
+        return;
       }
 
-      int32_t p = 0;
+      uint32_t p = 0;
       uint8_t c1 = 0;
       uint8_t c2 = 0;
       ArtNodeKey new_prefix = {.keyPtr = nullptr};
-      auto max_cmp = std::min(current_p->keyLen, len - depth);
-      if (current_p->keyLen <= ART_MAX_PREFIX_LEN) {
-        auto prefix = current_p->get_key();
+      // Split point in |prefix| for a node keeping its prefix out of line.
+      const char* full_prefix = nullptr;
+      uint32_t prefix_len = current_p->keyLen;
+      auto max_cmp = std::min(prefix_len, len - depth);
+      std::string_view stored = current_p->prefix_view();
+      if (stored.size() == prefix_len) {
+        auto prefix = stored.data();
         for (; p < max_cmp; p++) {
           if (prefix[p] != key[depth + p]) {
             c1 = prefix[p];
             c2 = key[depth + p];
-            new_prefix = detail::funGetNewPrefix(prefix, (uint32_t)0,
-                                                 current_p->keyLen, p);
             break;
           }
         }
 
-        if (len - depth < current_p->keyLen) {
-          c1 = prefix[p];
-          new_prefix = detail::funGetNewPrefix(prefix, (uint32_t)0,
-                                               current_p->keyLen, p);
+        if (p == max_cmp && len - depth < prefix_len) c1 = prefix[p];
+        if (p < prefix_len) {
+          if (current_p->has_full_prefix()) {
+            full_prefix = prefix;
+          } else {
+            new_prefix =
+                detail::funGetNewPrefix(prefix, (uint32_t)0, prefix_len, p);
+          }
         }
       } else {
         // We need get a leaf for entire prefix.
         // All child have same prefix, wo get leftmost.
         uint64_t find_leaf_v;
         auto l = current_p;
-        while (l->type != ArtNodeType::ART_NODE_LEAF) {
+        while (!is_lazy_leaf(l) && l->type != ArtNodeType::ART_NODE_LEAF) {
           ART_MACRO_READ_LOCK_OR_RESTART(l, find_leaf_v, label_insert_retry);
           ArtNodeCommon* find_leaf_tmp = nullptr;
           switch (l->type) {
@@ -325,18 +925,10 @@ class ArtTree {
               find_leaf_tmp =
                   reinterpret_cast<const ArtNode16*>(l)->children[0];
             } break;
-            case ArtNodeType::ART_NODE_48: {
-              int32_t idx = 0;
-              auto tmp = reinterpret_cast<const ArtNode48*>(l);
-              while (!tmp->index[idx]) idx++;
-              idx = tmp->index[idx] - 1;
-              find_leaf_tmp = tmp->children[idx];
-            } break;
+            case ArtNodeType::ART_NODE_48:
             case ArtNodeType::ART_NODE_256: {
-              int32_t idx = 0;
-              auto tmp = reinterpret_cast<const ArtNode256*>(l);
-              while (!tmp->children[idx]) idx++;
-              find_leaf_tmp = tmp->children[idx];
+              uint8_t first_byte;
+              find_leaf_tmp = detail::art_first_child_ge(l, 0, &first_byte);
             } break;
           }
           // to make sure pointer is valid
@@ -344,71 +936,93 @@ class ArtTree {
           l = find_leaf_tmp;
         }
 
+        std::string buf;
+        std::string_view l_key_view = leaf_key(l, &buf);
+        if (l_key_view.size() < depth + prefix_len) goto label_insert_retry;
+        const char* l_key = l_key_view.data();
         for (; p < max_cmp; p++) {
-          if (l->get_key()[depth + p] != key[depth + p]) {
-            c1 = l->get_key()[depth + p];
+          if (l_key[depth + p] != key[depth + p]) {
+            c1 = l_key[depth + p];
             c2 = key[depth + p];
-            new_prefix = detail::funGetNewPrefix(l->get_key(), depth,
-                                                 current_p->keyLen, p);
+            new_prefix = detail::funGetNewPrefix(l_key, depth, prefix_len, p);
             break;
           }
         }
 
-        if (len - depth < current_p->keyLen) {
-          c1 = l->get_key()[depth + p];
-          new_prefix = detail::funGetNewPrefix(l->get_key(), depth,
-                                               current_p->keyLen, p);
+        if (len - depth < prefix_len) {
+          c1 = l_key[depth + p];
+          new_prefix = detail::funGetNewPrefix(l_key, depth, prefix_len, p);
         }
       }
 
-      if (p < current_p->keyLen) {  // new leaf at this node
-        auto newInner4 = detail::get_new_art_node<ArtNode4>();
-        auto newLeaf = detail::get_new_leaf_node<T>(key, len, value);
-        newInner4->set_prefix_key(key + depth, p);
-
+      if (p < prefix_len) {  // new leaf at this node
         ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(parent_p, version_parent,
                                               label_insert_retry);
         ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART_AND_RELEASE(
             current_p, version_current, parent_p, label_insert_retry);
+        T value{};
+        if (!fn(value, false)) {
+          ART_MACRO_WRITE_UNLOCK(parent_p);
+          ART_MACRO_WRITE_UNLOCK(current_p);
+          return;
+        }
+
+        auto newInner4 = detail::get_new_art_node<ArtNode4>();
+        auto newLeaf = new_leaf(key, len, value);
+        set_prefix(newInner4, key + depth, p);
 
-        current_p->reset_prefix(new_prefix, p + 1);
+        if (full_prefix) {
+          detail::art_replace_full_prefix(current_p, full_prefix + p + 1,
+                                          prefix_len - p - 1);
+        } else {
+          current_p->reset_prefix(new_prefix, p + 1);
+        }
         newInner4->init_with_leaf(c1, current_p, c2, newLeaf);
         *current_pp = newInner4;
-        size_++;
+        size_.add(1);
 
         ART_MACRO_WRITE_UNLOCK(parent_p);
         ART_MACRO_WRITE_UNLOCK(current_p);
-
-        return T{};
+        return;
       }
 
       depth += p;
       uint8_t child_key = depth < len ? key[depth] : 0;
       auto next = detail::art_find_child(current_p, child_key);
       auto child_ptr_tmp = next ? *next : nullptr;
-      ART_MACRO_READ_LOCK_OR_RESTART(current_p, version_current,
-                                     label_insert_retry);
+      ART_MACRO_READ_UNLOCK_OR_RESTART(current_p, version_current,
+                                       label_insert_retry);
 
       if (child_ptr_tmp == nullptr) {
-        auto newLeaf = detail::get_new_leaf_node<T>(key, len, value);
-
         if (current_p->is_full()) {
           ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(parent_p, version_parent,
                                                 label_insert_retry);
           ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART_AND_RELEASE(
               current_p, version_current, parent_p, label_insert_retry);
-          detail::art_add_child_to_node(current_pp, child_key, newLeaf);
+          T value{};
+          if (fn(value, false)) {
+            auto newLeaf = new_leaf(key, len, value);
+            detail::art_add_child_to_node(current_pp, child_key, newLeaf);
+            size_.add(1);
+          }
 
           ART_MACRO_WRITE_UNLOCK(parent_p);
-          ART_MACRO_WRITE_UNLOCK(current_p);
+          ART_MACRO_WRITE_UNLOCK_IF_REPLACED(current_p, current_pp);
         } else {
-          ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART_AND_RELEASE(
-              current_p, version_current, parent_p, label_insert_retry);
-          detail::art_add_child_to_node(current_pp, child_key, newLeaf);
+          ART_MACRO_UPGRADE_TO_WRITE_OR_RESTART(current_p, version_current,
+                                                label_insert_retry);
+          T value{};
+          if (fn(value, false)) {
+            // The parent is not locked, a sibling insert into it can move
+            // the slot |current_pp| points to. The node is not replaced.
+            auto node = current_p;
+            detail::art_add_child_to_node(&node, child_key,
+                                          new_leaf(key, len, value));
+            size_.add(1);
+          }
           ART_MACRO_WRITE_UNLOCK(current_p);
         }
-        size_++;
-        return T{};
+        return;
       } else {
         version_parent = version_current;
         parent_p = current_p;
@@ -420,27 +1034,144 @@ class ArtTree {
     }
 
     LOG_ERROR("Should not go here");
-    return T{};
   }
 
-  T findInt(const char* key, uint32_t len) const {
+  const ArtNodeCommon* load_root(uint64_t* version) const {
+    while (true) {
+      uint64_t v = detail::art_spin_on_locked_node(&meta_to_root_);
+      const ArtNodeCommon* root = meta_to_root_.children[0];
+      if (v == meta_to_root_.version.load()) {
+        *version = v;
+        return root;
+      }
+    }
+  }
+
+  template <class KeyAt>
+  void multiFindInt(KeyAt&& key_at, size_t n, T* out) const {
+    struct State {
+      const ArtNodeCommon* node;
+      uint32_t depth;
+      size_t idx;
+      const ArtNodeCommon* parent;
+      uint64_t parent_version;
+
+      void start(const ArtTree* tree, size_t i) {
+        node = tree->load_root(&parent_version);
+        depth = 0;
+        idx = i;
+        parent = &tree->meta_to_root_;
+      }
+    };
+
+    EpochGuard guard;
+    State states[ART_MULTI_GET_GROUP];
+    uint32_t active = 0;
+    size_t next_idx = 0;
+    for (; active < ART_MULTI_GET_GROUP && next_idx < n; active++) {
+      states[active].start(this, next_idx++);
+      if (states[active].node) detail::art_prefetch_node(states[active].node);
+    }
+
+    uint32_t i = 0;
+    while (active) {
+      State& s = states[i];
+      std::string_view k = key_at(s.idx);
+      const char* key = k.data();
+      uint32_t len = k.size();
+      const ArtNodeCommon* cur = s.node;
+      bool finished = true;
+      bool restart = false;
+      T ret{};
+
+      if (is_lazy_leaf(cur)) {
+        if (!lazy_leaf_matches(cur, key, len, &ret)) ret = T{};
+      } else if (cur) {
+        uint64_t v = detail::art_spin_on_locked_node(cur);
+        // lock coupling, see findInt()
+        if (ART_IS_OBSOLETE(v) ||
+            s.parent->version.load() != s.parent_version) {
+          restart = true;
+        } else if (cur->type == ArtNodeType::ART_NODE_LEAF) {
+          auto leaf = reinterpret_cast<const ArtLeaf<T>*>(cur);
+          ret = leaf->value;
+          bool b_leaf_match = leaf_matches(leaf, key, len, s.depth);
+          restart = v != cur->version.load();
+          if (!b_leaf_match) ret = T{};
+        } else if (!detail::art_inner_prefix_match(cur, key, len, s.depth)) {
+          restart = v != cur->version.load();
+        } else {
+          uint32_t depth = s.depth + cur->keyLen;
+          uint8_t child_key = depth < len ? key[depth] : 0;
+          auto child = detail::art_find_child(const_cast<ArtNodeCommon*>(cur),
+                                              child_key);
+          auto child_ptr_tmp = child ? *child : nullptr;
+          if (v != cur->version.load()) {
+            restart = true;
+          } else if (child_ptr_tmp) {
+            s.parent = cur;
+            s.parent_version = v;
+            s.node = child_ptr_tmp;
+            s.depth = depth + 1;
+            detail::art_prefetch_node(child_ptr_tmp);
+            finished = false;
+          }
+        }
+      }
+
+      if (restart) {
+        s.start(this, s.idx);
+        finished = false;
+      }
+
+      if (finished) {
+        out[s.idx] = ret;
+        if (next_idx < n) {
+          s.start(this, next_idx++);
+          if (s.node) detail::art_prefetch_node(s.node);
+        } else {
+          // move last state here and serve it in this slot
+          s = states[--active];
+          if (i < active) continue;
+        }
+      }
+
+      i = (i + 1 < active) ? i + 1 : 0;
+    }
+  }
+
+  // Look up |key| below |meta|, the live tree or a snapshot.
+  static T findInt(const ArtNode4* meta, const char* key, uint32_t len) {
     uint64_t version = 0;
+    EpochGuard guard;
 
   label_find_retry:
-    ART_MACRO_READ_LOCK_OR_RESTART(&meta_to_root_, version, label_find_retry);
-    auto root_ptr = this->get_root_unsafe();
-    ART_MACRO_READ_UNLOCK_OR_RESTART(&meta_to_root_, version, label_find_retry);
+    ART_MACRO_READ_LOCK_OR_RESTART(meta, version, label_find_retry);
+    auto root_ptr = meta->children[0];
+    ART_MACRO_READ_UNLOCK_OR_RESTART(meta, version, label_find_retry);
 
     ArtNodeCommon** child;
     const ArtNodeCommon* cur = root_ptr;
+    const ArtNodeCommon* parent = meta;
+    uint64_t parent_version = version;
     uint32_t depth = 0;
 
     while (cur) {
+      if (is_lazy_leaf(cur)) {
+        T ret{};
+        return lazy_leaf_matches(cur, key, len, &ret) ? ret : T{};
+      }
+
       ART_MACRO_READ_LOCK_OR_RESTART(cur, version, label_find_retry);
+      // Lock coupling: parent is unchanged since we took the pointer to cur,
+      // so cur still hangs at |depth|. A split or Node4 collapse above cur
+      // changes where its prefix starts and bumps that parent.
+      ART_MACRO_READ_UNLOCK_OR_RESTART(parent, parent_version,
+                                       label_find_retry);
       if (cur->type == ArtNodeType::ART_NODE_LEAF) {
         auto leaf = reinterpret_cast<const ArtLeaf<T>*>(cur);
         auto ret = leaf->value;
-        bool b_leaf_match = leaf->leaf_matches(key, len, depth);
+        bool b_leaf_match = leaf_matches(leaf, key, len, depth);
         ART_MACRO_READ_UNLOCK_OR_RESTART(cur, version, label_find_retry);
 
         if (b_leaf_match) {
@@ -463,6 +1194,8 @@ class ArtTree {
           detail::art_find_child(const_cast<ArtNodeCommon*>(cur), child_key);
       auto child_ptr_tmp = (child) ? *child : nullptr;
       ART_MACRO_READ_UNLOCK_OR_RESTART(cur, version, label_find_retry);
+      parent = cur;
+      parent_version = version;
       cur = child_ptr_tmp;
       depth++;
     }
@@ -471,13 +1204,160 @@ class ArtTree {
   }
 
  private:
+  // first in, last out, nodes of the members below may come from it
+  Alloc alloc_;
   ArtNode4 meta_to_root_;
-  std::atomic<uint64_t> size_ = 0;
+  detail::ArtSizeCounter size_{ArtSizeMode::STRIPED};
+  const ArtShrinkPolicy shrink_policy_;
+  detail::ArtWriteGate gate_;
+  detail::ArtSnapshotList<T> snapshots_;
+};
+
+// Point in time, read-only view of an ArtTree, from ArtTree::snapshot().
+// Copies share the view, which is released with the last of them. Reads
+// never restart because of writers, the nodes of a snapshot do not change.
+// Iterators must not outlive the snapshot they come from, and all snapshots
+// must be gone before their tree is destroyed.
+template <class T, class KeyTraits, class Alloc>
+class ArtSnapshot {
+ public:
+  using Tree = ArtTree<T, KeyTraits, Alloc>;
+  using Iterator = typename Tree::Iterator;
+
+  T get(const std::string& k) const { return get(k.data(), k.size()); }
+  T get(const char* key, uint32_t len) const {
+    return Tree::findInt(&state_->meta, key, len);
+  }
+
+  // Same as the ordered access of ArtTree.
+  Iterator begin(std::string* key_buf = nullptr) const {
+    return min(key_buf);
+  }
+
+  Iterator end() const { return Iterator(); }
+
+  Iterator min(std::string* key_buf = nullptr) const {
+    Iterator it(&state_->meta, key_buf);
+    it.seek_to_first();
+    return it;
+  }
+
+  Iterator max(std::string* key_buf = nullptr) const {
+    Iterator it(&state_->meta, key_buf);
+    it.seek_to_last();
+    return it;
+  }
+
+  Iterator lower_bound(const char* key, uint32_t len,
+                       std::string* key_buf = nullptr) const {
+    Iterator it(&state_->meta, key_buf);
+    it.seek(key, len);
+    return it;
+  }
+
+  Iterator lower_bound(const std::string& k) const {
+    return lower_bound(k.data(), k.size());
+  }
+
+  Iterator upper_bound(const char* key, uint32_t len,
+                       std::string* key_buf = nullptr) const {
+    Iterator it(&state_->meta, key_buf);
+    it.seek_after(key, len);
+    return it;
+  }
+
+  Iterator upper_bound(const std::string& k) const {
+    return upper_bound(k.data(), k.size());
+  }
+
+  // See ArtTree::scan().
+  template <class F>
+  uint64_t scan(const char* start, uint32_t start_len, const char* end,
+                uint32_t end_len, F&& fn,
+                std::string* key_buf = nullptr) const {
+    uint64_t cnt = 0;
+    std::string_view end_key(end, end_len);
+    for (Iterator it = lower_bound(start, start_len, key_buf); it.valid();
+         it.next()) {
+      if (end_len && it.key() >= end_key) break;
+      cnt++;
+      if (!fn(it.key(), it.value())) break;
+    }
+    return cnt;
+  }
+
+  template <class F>
+  uint64_t scan(const std::string& start, const std::string& end,
+                F&& fn) const {
+    return scan(start.data(), start.size(), end.data(), end.size(),
+                std::forward<F>(fn));
+  }
+
+  // See ArtTree::scan_prefix().
+  template <class F>
+  uint64_t scan_prefix(const char* prefix, uint32_t len, F&& fn,
+                       std::string* key_buf = nullptr) const {
+    uint64_t cnt = 0;
+    Iterator it(&state_->meta, key_buf);
+    for (it.seek_prefix(prefix, len); it.valid(); it.next()) {
+      cnt++;
+      if (!fn(it.key(), it.value())) break;
+    }
+    return cnt;
+  }
+
+  template <class F>
+  uint64_t scan_prefix(const std::string& prefix, F&& fn) const {
+    return scan_prefix(prefix.data(), prefix.size(), std::forward<F>(fn));
+  }
+
+  // Number of keys when the snapshot was taken.
+  uint64_t size() const { return state_->size; }
+
+  // Write the snapshot to |path| for ArtTree::load(), in a pre-order walk
+  // streamed through a large buffer, see art-serialize.h for the format.
+  // Values are saved bytewise. Returns false on an I/O error.
+  bool save(const std::string& path) const {
+    detail::ArtTreeSaver<T, KeyTraits> saver(path);
+    return saver.save(state_->meta.children[0]);
+  }
+
+  // Write a read-only image of the snapshot to |path| to be served by
+  // FrozenArt, see art-frozen.h for the layout. Returns false on an I/O
+  // error or an image over 32 GiB.
+  bool freeze(const std::string& path) const {
+    detail::FrozenArtWriter<T, KeyTraits> writer(path);
+    return writer.write(state_->meta.children[0]);
+  }
+
+ private:
+  friend Tree;
+
+  struct State {
+    State(Tree* t, uint64_t i, ArtNodeCommon* root, uint64_t s)
+        : tree(t), id(i), size(s) {
+      meta.children[0] = root;
+      meta.childNum = 1;
+    }
+    ~State() { tree->release_snapshot(id); }
+
+    Tree* tree;
+    uint64_t id;
+    uint64_t size;
+    // stands for the root of the tree, so reads of the tree work on it
+    ArtNode4 meta;
+  };
+
+  ArtSnapshot(Tree* tree, uint64_t id, ArtNodeCommon* root, uint64_t size)
+      : state_(std::make_shared<const State>(tree, id, root, size)) {}
+
+  std::shared_ptr<const State> state_;
 };
 
 }  // namespace art
 
-template <class T>
-inline std::ostream& operator<<(std::ostream& os, const art::ArtTree<T>& tree) {
+template <class T, class K, class A>
+inline std::ostream& operator<<(std::ostream& os,
+                                const art::ArtTree<T, K, A>& tree) {
   return os << art::art_node_to_string_unsafe(tree.get_root_unsafe());
 }
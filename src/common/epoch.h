@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "macros.h"
+
+namespace detail {
+
+// Epoch based reclamation(EBR).
+//
+// Readers enter an epoch before touching shared nodes and leave it after.
+// Writers retire unlinked nodes instead of freeing them: a retired node is
+// stamped with the global epoch and stays in a per-thread limbo list until
+// every thread that is currently inside a critical section entered after that
+// stamp. From then on nobody can hold a pointer to it, and the deleter runs.
+struct EpochRetired {
+  void *ptr;
+  void (*deleter)(void *);
+  uint64_t epoch;
+};
+
+class EpochManager {
+ public:
+  static constexpr uint64_t QUIESCENT = UINT64_MAX;
+  // Advance the global epoch and try to reclaim once a limbo list holds this
+  // many nodes.
+  static constexpr size_t RECLAIM_THRESHOLD = 128;
+
+  // One record per thread. Records are never freed, the record of an exited
+  // thread is reused by the next new thread.
+  struct alignas(64) ThreadRecord {
+    std::atomic<uint64_t> local_epoch = {QUIESCENT};
+    std::atomic<bool> in_use = {false};
+    uint32_t nest = 0;
+    ThreadRecord *next = nullptr;
+    std::vector<EpochRetired> limbo;
+  };
+
+  static inline EpochManager *singleton() {
+    static EpochManager _m;
+    return &_m;
+  }
+
+  inline void enter() {
+    ThreadRecord *r = get_or_new_record();
+    if (r->nest++ == 0) {
+      r->local_epoch.store(_global_epoch.load(std::memory_order_relaxed),
+                           std::memory_order_relaxed);
+      // Publish local epoch before any shared pointer is loaded.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+  }
+
+  inline void exit() {
+    ThreadRecord *r = _local_record;
+    if (--r->nest == 0) {
+      r->local_epoch.store(QUIESCENT, std::memory_order_release);
+    }
+  }
+
+  void retire(void *ptr, void (*deleter)(void *)) {
+    ThreadRecord *r = get_or_new_record();
+    // The unlink of |ptr| must be visible before the epoch is sampled.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    r->limbo.push_back(
+        {ptr, deleter, _global_epoch.load(std::memory_order_relaxed)});
+    if (r->limbo.size() >= RECLAIM_THRESHOLD) {
+      _global_epoch.fetch_add(1, std::memory_order_acq_rel);
+      reclaim_record(r);
+    }
+  }
+
+  // Reclaim what is safe in the limbo list of calling thread and in the
+  // orphan list. Returns number of nodes freed.
+  size_t reclaim() {
+    ThreadRecord *r = get_or_new_record();
+    _global_epoch.fetch_add(1, std::memory_order_acq_rel);
+    return reclaim_record(r);
+  }
+
+  // Number of nodes waiting for reclaim in calling thread and orphan list.
+  size_t pending() {
+    ThreadRecord *r = get_or_new_record();
+    std::lock_guard<std::mutex> guard(_orphan_mutex);
+    return r->limbo.size() + _orphans.size();
+  }
+
+  uint64_t global_epoch() const {
+    return _global_epoch.load(std::memory_order_acquire);
+  }
+
+ private:
+  EpochManager() = default;
+
+  struct RecordHolder {
+    ThreadRecord *record = nullptr;
+
+    ~RecordHolder() {
+      if (record) EpochManager::singleton()->release_record(record);
+    }
+  };
+
+  inline ThreadRecord *get_or_new_record() {
+    ThreadRecord *r = _local_record;
+    if (likely(r != nullptr)) {
+      return r;
+    }
+
+    for (r = _records.load(std::memory_order_acquire); r; r = r->next) {
+      bool expect = false;
+      if (!r->in_use.load(std::memory_order_relaxed) &&
+          r->in_use.compare_exchange_strong(expect, true)) {
+        break;
+      }
+    }
+
+    if (r == nullptr) {
+      r = new ThreadRecord;
+      r->in_use.store(true, std::memory_order_relaxed);
+      ThreadRecord *head = _records.load(std::memory_order_relaxed);
+      do {
+        r->next = head;
+      } while (!_records.compare_exchange_weak(head, r,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed));
+    }
+
+    _local_record = r;
+    _holder.record = r;
+    return r;
+  }
+
+  // Called when thread exits. Other thread-local pools may already be gone,
+  // so nothing is freed here, pending nodes are handed over to the orphan
+  // list and freed by a later reclaim of any thread.
+  void release_record(ThreadRecord *r) {
+    r->nest = 0;
+    r->local_epoch.store(QUIESCENT, std::memory_order_release);
+    if (!r->limbo.empty()) {
+      std::lock_guard<std::mutex> guard(_orphan_mutex);
+      _orphans.insert(_orphans.end(), r->limbo.begin(), r->limbo.end());
+      _norphan.store(_orphans.size(), std::memory_order_relaxed);
+    }
+    r->limbo.clear();
+    r->limbo.shrink_to_fit();
+    _local_record = nullptr;
+    r->in_use.store(false, std::memory_order_release);
+  }
+
+  uint64_t min_active_epoch() const {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t ret = QUIESCENT;
+    for (ThreadRecord *r = _records.load(std::memory_order_acquire); r;
+         r = r->next) {
+      ret = std::min(ret, r->local_epoch.load(std::memory_order_acquire));
+    }
+    return ret;
+  }
+
+  static size_t free_before(std::vector<EpochRetired> &list, uint64_t epoch) {
+    // Epochs in a list are non-decreasing except for the orphan list, which
+    // is a concatenation of sorted lists. So do a stable partition.
+    size_t n = 0;
+    auto it = std::stable_partition(
+        list.begin(), list.end(),
+        [epoch](const EpochRetired &i) { return i.epoch >= epoch; });
+    for (auto free_it = it; free_it != list.end(); ++free_it) {
+      free_it->deleter(free_it->ptr);
+      n++;
+    }
+    list.erase(it, list.end());
+    return n;
+  }
+
+  size_t reclaim_record(ThreadRecord *r) {
+    uint64_t safe = min_active_epoch();
+    size_t n = free_before(r->limbo, safe);
+
+    if (_norphan.load(std::memory_order_relaxed)) {
+      std::unique_lock<std::mutex> lock(_orphan_mutex, std::try_to_lock);
+      if (lock.owns_lock()) {
+        n += free_before(_orphans, safe);
+        _norphan.store(_orphans.size(), std::memory_order_relaxed);
+      }
+    }
+    return n;
+  }
+
+  static thread_local ThreadRecord *_local_record;
+  static thread_local RecordHolder _holder;
+
+  std::atomic<uint64_t> _global_epoch{1};
+  std::atomic<ThreadRecord *> _records{nullptr};
+
+  std::mutex _orphan_mutex;
+  std::atomic<size_t> _norphan{0};
+  std::vector<EpochRetired> _orphans;
+};
+
+inline thread_local EpochManager::ThreadRecord *EpochManager::_local_record =
+    nullptr;
+inline thread_local EpochManager::RecordHolder EpochManager::_holder{};
+
+}  // namespace detail
+
+// RAII critical section. Pointers loaded from shared structures stay valid
+// until the guard is destroyed. Guards nest and are bound to the thread that
+// creates them.
+class EpochGuard {
+ public:
+  EpochGuard() { detail::EpochManager::singleton()->enter(); }
+  ~EpochGuard() { detail::EpochManager::singleton()->exit(); }
+
+  EpochGuard(const EpochGuard &) = delete;
+  EpochGuard &operator=(const EpochGuard &) = delete;
+};
+
+// Defer |deleter(ptr)| until no reader can still see |ptr|. Caller must have
+// unlinked |ptr| from shared structures already.
+inline void epoch_retire(void *ptr, void (*deleter)(void *)) {
+  detail::EpochManager::singleton()->retire(ptr, deleter);
+}
+
+// Free whatever is safe to free now. Returns number of freed objects.
+inline size_t epoch_reclaim() {
+  return detail::EpochManager::singleton()->reclaim();
+}
+
+// Number of retired objects not freed yet, seen from calling thread.
+inline size_t epoch_pending() {
+  return detail::EpochManager::singleton()->pending();
+}
@@ -9,3 +9,6 @@
 #endif
 
 #define ART_MAX_PREFIX_LEN (8)
+
+// Number of lookups interleaved by ArtTree::multi_get.
+#define ART_MULTI_GET_GROUP (16)
@@ -1,10 +1,20 @@
 #pragma once
 
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 #include "macros.h"
@@ -36,7 +46,100 @@ struct ObjectPoolFreeChunk<T, 0> {
 static const size_t OP_MAX_BLOCK_NGROUP = 65536;
 static const size_t OP_GROUP_NBLOCK_NBIT = 16;
 static const size_t OP_GROUP_NBLOCK = (1UL << OP_GROUP_NBLOCK_NBIT);
-static const size_t OP_INITIAL_FREE_LIST_SIZE = 1024;
+static const size_t OP_HUGE_PAGE_REGION = (2UL << 20);
+
+// Map OP_HUGE_PAGE_REGION bytes aligned to their size and ask the kernel
+// to back them with a transparent huge page. With |prefault| the pages are
+// touched now, so the huge page is in place before the first object.
+inline char *object_pool_map_huge_page_region(bool prefault) {
+  const size_t len = 2 * OP_HUGE_PAGE_REGION;
+  char *p = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == p) {
+    return NULL;
+  }
+  char *region = (char *)(((uintptr_t)p + OP_HUGE_PAGE_REGION - 1) &
+                          ~(OP_HUGE_PAGE_REGION - 1));
+  if (region > p) {
+    munmap(p, region - p);
+  }
+  if (p + len > region + OP_HUGE_PAGE_REGION) {
+    munmap(region + OP_HUGE_PAGE_REGION,
+           p + len - region - OP_HUGE_PAGE_REGION);
+  }
+  // Without THP the region is still fine, only with small pages.
+  madvise(region, OP_HUGE_PAGE_REGION, MADV_HUGEPAGE);
+  if (prefault) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    for (size_t off = 0; off < OP_HUGE_PAGE_REGION; off += page) {
+      ((volatile char *)region)[off] = 0;
+    }
+  }
+  return region;
+}
+
+// Lock-free stack of nodes with a |next| link. Nodes pushed are never
+// freed, so a pop may still read the link of a node another thread popped
+// meanwhile. The head carries a tag in its upper bits, bumped on every
+// change, so such a pop fails instead of installing a stale link (ABA).
+template <typename Node>
+class ObjectPoolStack {
+ public:
+  void push(Node *node) { push_list(node, node); }
+
+  // Push nodes linked from |first| to |last|.
+  void push_list(Node *first, Node *last) {
+    uint64_t head = _head.load(std::memory_order_relaxed);
+    do {
+      last->next.store(node_of(head), std::memory_order_relaxed);
+    } while (!_head.compare_exchange_weak(head, pack(first, head),
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+  }
+
+  Node *pop() {
+    uint64_t head = _head.load(std::memory_order_acquire);
+    while (node_of(head)) {
+      Node *next = node_of(head)->next.load(std::memory_order_relaxed);
+      if (_head.compare_exchange_weak(head, pack(next, head),
+                                      std::memory_order_acquire,
+                                      std::memory_order_acquire)) {
+        return node_of(head);
+      }
+    }
+    return NULL;
+  }
+
+  // Take all nodes at once, linked from the one returned.
+  Node *pop_all() {
+    uint64_t head = _head.load(std::memory_order_acquire);
+    while (node_of(head) &&
+           !_head.compare_exchange_weak(head, pack(NULL, head),
+                                        std::memory_order_acquire,
+                                        std::memory_order_acquire)) {
+    }
+    return node_of(head);
+  }
+
+  bool empty() const {
+    return node_of(_head.load(std::memory_order_relaxed)) == NULL;
+  }
+
+ private:
+  // User space addresses of x86-64 and aarch64 fit in 48 bits.
+  static const int PTR_BITS = 48;
+  static const uint64_t PTR_MASK = (1UL << PTR_BITS) - 1;
+
+  static Node *node_of(uint64_t head) { return (Node *)(head & PTR_MASK); }
+
+  // |node| as the new head after |old|.
+  static uint64_t pack(Node *node, uint64_t old) {
+    assert(((uint64_t)node & ~PTR_MASK) == 0);
+    return (((old >> PTR_BITS) + 1) << PTR_BITS) | (uint64_t)node;
+  }
+
+  std::atomic<uint64_t> _head{0};
+};
 
 // Memory is allocated in blocks, memory size of a block will not exceed:
 //   min(ObjectPoolBlockMaxSize<T>::value,
@@ -80,6 +183,17 @@ struct ObjectPoolValidator {
   static bool validate(const T *) { return true; }
 };
 
+// trim() gives the pages of free objects back to the system. They come
+// back zero filled, and get_object() hands them out again without running
+// the constructor. So only types whose zero bytes are a valid object can be
+// trimmed, unless every user of the pool initializes each object it gets.
+// Specialize to true for such types.
+template <typename T>
+struct ObjectPoolTrimmable {
+  static constexpr bool value =
+      std::is_trivially_default_constructible<T>::value;
+};
+
 template <typename T>
 class alignas(64) ObjectPool {
  public:
@@ -87,16 +201,22 @@ class alignas(64) ObjectPool {
   static const size_t FREE_CHUNK_NITEM = BLOCK_NITEM;
 
   // Free objects are batched in a FreeChunk before they're added to
-  // global list(_free_chunks).
+  // global list(_free_chunks). Chunks are swapped, not copied, between a
+  // thread and the global list, and recycled through _empty_chunks.
   typedef ObjectPoolFreeChunk<T, FREE_CHUNK_NITEM> FreeChunk;
-  typedef ObjectPoolFreeChunk<T, 0> DynamicFreeChunk;
+
+  struct ChunkNode : FreeChunk {
+    std::atomic<ChunkNode *> next{NULL};
+  };
 
   // When a thread needs memory, it allocates a Block. To improve locality,
   // items in the Block are only used by the thread.
   // To support cache-aligned objects, align Block.items by cacheline.
   struct alignas(64) Block {
     char items[sizeof(T) * BLOCK_NITEM];
-    size_t nitem;
+    // Only the thread owning the block adds items, trim() and
+    // describe_objects() read it meanwhile.
+    std::atomic<size_t> nitem;
 
     Block() : nitem(0) {}
   };
@@ -112,15 +232,19 @@ class alignas(64) ObjectPool {
   // Each thread has an instance of this class.
   class alignas(64) LocalPool {
    public:
-    explicit LocalPool(ObjectPool *pool)
-        : _pool(pool), _cur_block(NULL), _cur_block_index(0) {
-      _cur_free.nfree = 0;
+    LocalPool(ObjectPool *pool, ChunkNode *free)
+        : _pool(pool), _cur_block(NULL), _cur_block_index(0), _cur_free(free) {
+      _cur_free->nfree = 0;
     }
 
     ~LocalPool() {
       // Add to global _free if there're some free objects
-      if (_cur_free.nfree) {
-        _pool->push_free_chunk(_cur_free);
+      if (_cur_free->nfree) {
+        _pool->_free_item_num.fetch_add(_cur_free->nfree,
+                                        std::memory_order_relaxed);
+        _pool->_free_chunks.push(_cur_free);
+      } else {
+        _pool->_empty_chunks.push(_cur_free);
       }
 
       _pool->clear_from_destructor_of_local_pool();
@@ -129,55 +253,55 @@ class alignas(64) ObjectPool {
     static void delete_local_pool(void *arg) { delete (LocalPool *)arg; }
 
     inline T *get() {
-      if (_cur_free.nfree) {
-        return _cur_free.ptrs[--_cur_free.nfree];
+      if (_cur_free->nfree) {
+        return _cur_free->ptrs[--_cur_free->nfree];
       }
-      if (_pool->pop_free_chunk(_cur_free)) {
-        return _cur_free.ptrs[--_cur_free.nfree];
+      if (_pool->pop_free_chunk(&_cur_free)) {
+        return _cur_free->ptrs[--_cur_free->nfree];
       }
-      if (_cur_block && _cur_block->nitem < BLOCK_NITEM) {
-        T *obj = new ((T *)_cur_block->items + _cur_block->nitem) T;
-        if (!ObjectPoolValidator<T>::validate(obj)) {
-          obj->~T();
-          return nullptr;
-        }
-        ++_cur_block->nitem;
-        return obj;
+      if (_cur_block &&
+          _cur_block->nitem.load(std::memory_order_relaxed) < BLOCK_NITEM) {
+        return add_to_block();
       }
       _cur_block = _pool->add_block(&_cur_block_index);
       if (_cur_block != __null) {
-        T *obj = new ((T *)_cur_block->items + _cur_block->nitem) T;
-        if (!ObjectPoolValidator<T>::validate(obj)) {
-          obj->~T();
-          return nullptr;
-        }
-        ++_cur_block->nitem;
-        return obj;
+        return add_to_block();
       }
       return nullptr;
     }
 
     inline int return_object(T *ptr) {
       // Return to local free list
-      if (_cur_free.nfree < ObjectPool::free_chunk_nitem()) {
-        _cur_free.ptrs[_cur_free.nfree++] = ptr;
+      if (_cur_free->nfree < ObjectPool::free_chunk_nitem()) {
+        _cur_free->ptrs[_cur_free->nfree++] = ptr;
         return 0;
       }
       // Local free list is full, return it to global.
-      // For copying issue, check comment in upper get()
-      if (_pool->push_free_chunk(_cur_free)) {
-        _cur_free.nfree = 1;
-        _cur_free.ptrs[0] = ptr;
+      if (_pool->push_free_chunk(&_cur_free)) {
+        _cur_free->nfree = 1;
+        _cur_free->ptrs[0] = ptr;
         return 0;
       }
       return -1;
     }
 
    private:
+    // Construct the next object of the current block.
+    inline T *add_to_block() {
+      const size_t n = _cur_block->nitem.load(std::memory_order_relaxed);
+      T *obj = new ((T *)_cur_block->items + n) T;
+      if (!ObjectPoolValidator<T>::validate(obj)) {
+        obj->~T();
+        return nullptr;
+      }
+      _cur_block->nitem.store(n + 1, std::memory_order_relaxed);
+      return obj;
+    }
+
     ObjectPool *_pool;
     Block *_cur_block;
     size_t _cur_block_index;
-    FreeChunk _cur_free;
+    ChunkNode *_cur_free;
   };
 
   struct ThreadExiter {
@@ -242,7 +366,7 @@ class alignas(64) ObjectPool {
       for (size_t j = 0; j < nblock; ++j) {
         Block *b = bg->blocks[j].load(std::memory_order_consume);
         if (NULL != b) {
-          info.item_num += b->nitem;
+          info.item_num += b->nitem.load(std::memory_order_relaxed);
         }
       }
     }
@@ -250,17 +374,187 @@ class alignas(64) ObjectPool {
     return info;
   }
 
+  // Give the pages of full blocks whose objects are all in the global free
+  // list back to the system. The objects stay in the list and their pages
+  // come back zero filled on reuse. Objects cached by threads keep their
+  // blocks. Returns number of bytes released, pages already released by an
+  // earlier trim are not counted again.
+  size_t trim() {
+    static_assert(ObjectPoolTrimmable<T>::value,
+                  "trimmed objects come back zero filled, not constructed");
+    // Work on the free list taken out, threads needing objects meanwhile
+    // take new blocks instead of waiting on the syscalls below.
+    ChunkNode *chunks = _free_chunks.pop_all();
+    if (NULL == chunks) {
+      return 0;
+    }
+
+    // A thread only ever adds objects to a block that is not full.
+    std::vector<Block *> blocks;
+    const size_t ngroup = _ngroup.load(std::memory_order_acquire);
+    for (size_t i = 0; i < ngroup; ++i) {
+      BlockGroup *bg = _block_groups[i].load(std::memory_order_consume);
+      size_t nblock =
+          std::min(bg->nblock.load(std::memory_order_relaxed), OP_GROUP_NBLOCK);
+      for (size_t j = 0; j < nblock; ++j) {
+        Block *b = bg->blocks[j].load(std::memory_order_consume);
+        if (NULL != b &&
+            b->nitem.load(std::memory_order_relaxed) == BLOCK_NITEM) {
+          blocks.push_back(b);
+        }
+      }
+    }
+    std::sort(blocks.begin(), blocks.end());
+
+    std::vector<size_t> nfree(blocks.size(), 0);
+    ChunkNode *last = NULL;
+    for (ChunkNode *c = chunks; c; c = c->next.load()) {
+      last = c;
+      for (size_t i = 0; i < c->nfree; ++i) {
+        auto it = std::upper_bound(blocks.begin(), blocks.end(),
+                                   (Block *)c->ptrs[i]);
+        if (it == blocks.begin()) {
+          continue;
+        }
+        --it;
+        if ((char *)c->ptrs[i] < (*it)->items + sizeof((*it)->items)) {
+          ++nfree[it - blocks.begin()];
+        }
+      }
+    }
+
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    size_t released = 0;
+    std::vector<unsigned char> resident;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      if (nfree[i] != BLOCK_NITEM) {
+        continue;
+      }
+      // Pages entirely inside items, Block::nitem is still read.
+      uintptr_t begin = ((uintptr_t)blocks[i]->items + page - 1) & ~(page - 1);
+      uintptr_t end = ((uintptr_t)blocks[i]->items + sizeof(blocks[i]->items)) &
+                      ~(page - 1);
+      if (begin >= end) {
+        continue;
+      }
+      resident.resize((end - begin) / page);
+      if (mincore((void *)begin, end - begin, resident.data()) != 0) {
+        continue;
+      }
+      size_t npage = 0;
+      for (unsigned char r : resident) {
+        npage += (r & 1);
+      }
+      if (npage && madvise((void *)begin, end - begin, MADV_DONTNEED) == 0) {
+        released += npage * page;
+      }
+    }
+
+    _free_chunks.push_list(chunks, last);
+    return released;
+  }
+
+  // Make sure at least |n| free objects wait in the global list, so that
+  // getting them takes no new block. Missing objects are constructed in new
+  // blocks now, which faults their pages in. Chunks hold at most
+  // n / (8 * |nthread|) of them, so |nthread| threads share them out evenly
+  // a few chunks each, and little is left in the cache of a thread that
+  // took more than it needs. Objects cached by threads are not counted.
+  // Returns number of objects added.
+  size_t reserve(size_t n, size_t nthread) {
+    const size_t nfree = _free_item_num.load(std::memory_order_relaxed);
+    if (n <= nfree) {
+      return 0;
+    }
+    n -= nfree;
+    const size_t nchunk = 8 * std::max<size_t>(nthread, 1);
+    const size_t chunk_nitem =
+        std::min(free_chunk_nitem(), (n + nchunk - 1) / nchunk);
+
+    // No thread owns the new blocks, so all of their items are taken.
+    ChunkNode *first = NULL;
+    ChunkNode *last = NULL;
+    size_t added = 0;
+    bool failed = false;
+    while (added < n && !failed) {
+      size_t index = 0;
+      Block *b = add_block(&index);
+      if (NULL == b) {
+        break;
+      }
+      memset(b->items, 0, sizeof(b->items));
+      for (size_t i = 0; i < BLOCK_NITEM; ++i) {
+        T *obj = new ((T *)b->items + i) T;
+        if (!ObjectPoolValidator<T>::validate(obj)) {
+          obj->~T();
+          failed = true;
+          break;
+        }
+        b->nitem.store(i + 1, std::memory_order_relaxed);
+        if (NULL == first || first->nfree == chunk_nitem) {
+          ChunkNode *c = get_empty_chunk();
+          if (NULL == c) {
+            failed = true;
+            break;
+          }
+          c->nfree = 0;
+          c->next.store(first, std::memory_order_relaxed);
+          if (NULL == last) {
+            last = c;
+          }
+          first = c;
+        }
+        first->ptrs[first->nfree++] = obj;
+        ++added;
+      }
+    }
+    if (NULL != first) {
+      _free_item_num.fetch_add(added, std::memory_order_relaxed);
+      _free_chunks.push_list(first, last);
+    }
+    return added;
+  }
+
+  // Carve blocks taken from now on from huge page backed regions, so fewer
+  // TLB entries cover the objects, see object_pool_map_huge_page_region().
+  // Blocks taken before stay where they are. Regions are never unmapped,
+  // as blocks are never freed.
+  void set_huge_page_blocks(bool enable, bool prefault) {
+    _huge_page_prefault.store(prefault, std::memory_order_relaxed);
+    _huge_page.store(enable, std::memory_order_relaxed);
+  }
+
   static inline ObjectPool *singleton() {
     static ObjectPool _p;
     return &_p;
   }
 
  private:
-  ObjectPool() { _free_chunks.reserve(OP_INITIAL_FREE_LIST_SIZE); }
+  ObjectPool() = default;
+
+  // Next block of the current huge page region, falls back to the heap
+  // if no region can be mapped.
+  Block *new_huge_page_block() {
+    std::lock_guard<std::mutex> guard(_region_mutex);
+    if ((size_t)(_region_end - _region_next) < sizeof(Block)) {
+      char *region = object_pool_map_huge_page_region(
+          _huge_page_prefault.load(std::memory_order_relaxed));
+      if (NULL == region) {
+        return new (std::nothrow) Block;
+      }
+      _region_next = region;
+      _region_end = region + OP_HUGE_PAGE_REGION;
+    }
+    Block *b = new (_region_next) Block;
+    _region_next += sizeof(Block);
+    return b;
+  }
 
   // Create a Block and append it to right-most BlockGroup.
   Block *add_block(size_t *index) {
-    Block *const new_block = new (std::nothrow) Block;
+    const bool huge = _huge_page.load(std::memory_order_relaxed);
+    Block *const new_block =
+        huge ? new_huge_page_block() : new (std::nothrow) Block;
     if (NULL == new_block) {
       return NULL;
     }
@@ -281,8 +575,11 @@ class alignas(64) ObjectPool {
       }
     } while (add_block_group(ngroup));
 
-    // Fail to add_block_group.
-    delete new_block;
+    // Fail to add_block_group. A block of a region is left there, this
+    // only happens once all groups are full.
+    if (!huge) {
+      delete new_block;
+    }
     return NULL;
   }
 
@@ -314,8 +611,13 @@ class alignas(64) ObjectPool {
     if (likely(lp != NULL)) {
       return lp;
     }
-    lp = new (std::nothrow) LocalPool(this);
+    ChunkNode *free = get_empty_chunk();
+    if (NULL == free) {
+      return NULL;
+    }
+    lp = new (std::nothrow) LocalPool(this, free);
     if (NULL == lp) {
+      _empty_chunks.push(free);
       return NULL;
     }
 
@@ -352,36 +654,42 @@ class alignas(64) ObjectPool {
     _exiter.arg = nullptr;
   }
 
-  bool pop_free_chunk(FreeChunk &c) {
+  // Chunks are only allocated while more of them are in use than ever
+  // before, and never freed.
+  ChunkNode *get_empty_chunk() {
+    ChunkNode *c = _empty_chunks.pop();
+    if (NULL == c) {
+      c = new (std::nothrow) ChunkNode;
+    }
+    return c;
+  }
+
+  // Swap the empty chunk |*c| of a thread for a full one.
+  bool pop_free_chunk(ChunkNode **c) {
     // Critical for the case that most return_object are called in
     // different threads of get_object.
     if (_free_chunks.empty()) {
       return false;
     }
-    std::unique_lock<std::mutex> uniqueLock(_free_chunks_mutex);
-    if (_free_chunks.empty()) {
+    ChunkNode *full = _free_chunks.pop();
+    if (NULL == full) {
       return false;
     }
-    DynamicFreeChunk *p = _free_chunks.back();
-    _free_chunks.pop_back();
-    uniqueLock.unlock();
-
-    c.nfree = p->nfree;
-    memcpy(c.ptrs, p->ptrs, sizeof(*p->ptrs) * p->nfree);
-    free(p);
+    _free_item_num.fetch_sub(full->nfree, std::memory_order_relaxed);
+    _empty_chunks.push(*c);
+    *c = full;
     return true;
   }
 
-  bool push_free_chunk(const FreeChunk &c) {
-    DynamicFreeChunk *p = (DynamicFreeChunk *)malloc(
-        offsetof(DynamicFreeChunk, ptrs) + sizeof(*c.ptrs) * c.nfree);
-    if (!p) {
+  // Swap the full chunk |*c| of a thread for an empty one.
+  bool push_free_chunk(ChunkNode **c) {
+    ChunkNode *empty = get_empty_chunk();
+    if (NULL == empty) {
       return false;
     }
-    p->nfree = c.nfree;
-    memcpy(p->ptrs, c.ptrs, sizeof(*c.ptrs) * c.nfree);
-    std::unique_lock<std::mutex> uniqueLock(_free_chunks_mutex);
-    _free_chunks.push_back(p);
+    _free_item_num.fetch_add((*c)->nfree, std::memory_order_relaxed);
+    _free_chunks.push(*c);
+    *c = empty;
     return true;
   }
 
@@ -396,8 +704,16 @@ class alignas(64) ObjectPool {
   std::mutex _change_thread_mutex;
   std::atomic<BlockGroup *> _block_groups[OP_MAX_BLOCK_NGROUP];
 
-  std::vector<DynamicFreeChunk *> _free_chunks;
-  std::mutex _free_chunks_mutex;
+  ObjectPoolStack<ChunkNode> _free_chunks;
+  ObjectPoolStack<ChunkNode> _empty_chunks;
+  // objects in _free_chunks, roughly while chunks move
+  std::atomic<size_t> _free_item_num{0};
+
+  std::atomic<bool> _huge_page{false};
+  std::atomic<bool> _huge_page_prefault{false};
+  std::mutex _region_mutex;
+  char *_region_next = NULL;
+  char *_region_end = NULL;
 };
 
 template <typename T>
@@ -451,3 +767,82 @@ template <typename T>
 ObjectPoolInfo describe_objects() {
   return detail::ObjectPool<T>::singleton()->describe_objects();
 }
+
+// Return memory of free objects typed T to the system, e.g. after a spike
+// of allocations. Only blocks whose objects are all returned and merged to
+// the global list can be released. Returns number of bytes released.
+// Like describe_objects(), this iterates internal structures.
+template <typename T>
+size_t trim_objects() {
+  return detail::ObjectPool<T>::singleton()->trim();
+}
+
+// Make sure |n| objects typed T can be got without taking new blocks, e.g.
+// before a burst of allocations, spread for |nthread| threads. See reserve()
+// of ObjectPool. Returns number of objects added.
+template <typename T>
+size_t reserve_objects(size_t n, size_t nthread = 1) {
+  return detail::ObjectPool<T>::singleton()->reserve(n, nthread);
+}
+
+// Take new blocks of objects typed T from huge page backed regions or,
+// with |enable| false, from the heap again. See set_huge_page_blocks() of
+// ObjectPool.
+template <typename T>
+void set_huge_page_blocks(bool enable, bool prefault = false) {
+  detail::ObjectPool<T>::singleton()->set_huge_page_blocks(enable, prefault);
+}
+
+// Calls |trim|, e.g. a function calling trim_objects() for the types of a
+// program, every |interval_ms| on a thread of its own until destroyed.
+class ObjectPoolTrimmer {
+ public:
+  ObjectPoolTrimmer(std::function<size_t()> trim, uint32_t interval_ms)
+      : _trim(std::move(trim)), _interval(interval_ms) {
+    _thread = std::thread([this]() { run(); });
+  }
+
+  ~ObjectPoolTrimmer() {
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      _stop = true;
+    }
+    _cond.notify_all();
+    _thread.join();
+  }
+
+  ObjectPoolTrimmer(const ObjectPoolTrimmer &) = delete;
+  ObjectPoolTrimmer &operator=(const ObjectPoolTrimmer &) = delete;
+
+  // Bytes released by all trims so far.
+  size_t released_bytes() const {
+    return _released.load(std::memory_order_relaxed);
+  }
+
+  size_t trim_num() const { return _trim_num.load(std::memory_order_relaxed); }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop) {
+      auto deadline = std::chrono::steady_clock::now() + _interval;
+      _cond.wait_until(lock, deadline, [this]() { return _stop; });
+      if (_stop) {
+        break;
+      }
+      lock.unlock();
+      _released.fetch_add(_trim(), std::memory_order_relaxed);
+      _trim_num.fetch_add(1, std::memory_order_relaxed);
+      lock.lock();
+    }
+  }
+
+  std::function<size_t()> _trim;
+  std::chrono::milliseconds _interval;
+  std::mutex _mutex;
+  std::condition_variable _cond;
+  bool _stop = false;
+  std::atomic<size_t> _released{0};
+  std::atomic<size_t> _trim_num{0};
+  std::thread _thread;
+};
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include "common/logger.h"
+
+namespace detail {
+
+// Memory of one owner, e.g. a tree, see ArtArenaAlloc.
+//
+// Items of a size class are carved from slabs aligned to SLAB_SIZE, the
+// slab head names the arena, so a freed item finds its arena from its
+// address alone. Items larger than any class are malloc'ed behind a head
+// linking them into the arena. Freed items are kept for reuse by the arena,
+// and all memory goes back to the system at once when the arena dies.
+//
+// The owner holds a reference, and so does every item waiting to be freed
+// into the arena, e.g. in the epoch limbo, see hold(). An arena closed by
+// its owner lives on until the last of those items is freed into it.
+class SlabArena {
+ public:
+  static constexpr size_t SLAB_SIZE = 64 << 10;
+  static constexpr size_t SLAB_HEAD = 64;
+  static constexpr uint32_t MAX_CLASS = 16;
+  // free slabs kept for new arenas, short-lived arenas then reuse memory
+  // already faulted in instead of going to the system for each slab
+  static constexpr size_t CACHED_SLAB_NUM = 512;
+
+  // |sizes| of |num| classes, each a multiple of the alignment its items
+  // need, which must not exceed SLAB_HEAD.
+  SlabArena(const uint32_t* sizes, uint32_t num) : class_num_(num) {
+    assert(num <= MAX_CLASS);
+    for (uint32_t i = 0; i < num; i++) {
+      assert(sizes[i] >= sizeof(void*) && sizes[i] <= SLAB_SIZE - SLAB_HEAD);
+      classes_[i].size = sizes[i];
+    }
+  }
+
+  SlabArena(const SlabArena&) = delete;
+  SlabArena& operator=(const SlabArena&) = delete;
+
+  void* alloc(uint32_t cls) {
+    assert(cls < class_num_);
+    auto& c = classes_[cls];
+    void* p = nullptr;
+    {
+      std::lock_guard<ClassLock> guard(c.lock);
+      if (c.free) {
+        p = c.free;
+        c.free = *static_cast<void**>(p);
+        c.free_num--;
+      } else {
+        if (c.end - c.next < c.size) new_slab(c);
+        p = c.next;
+        c.next += c.size;
+      }
+      add(c.used, c.size);
+    }
+    return p;
+  }
+
+  // Arena of an item from alloc().
+  static SlabArena* of(const void* p) {
+    auto slab = reinterpret_cast<const Slab*>(reinterpret_cast<uintptr_t>(p) &
+                                              ~(SLAB_SIZE - 1));
+    return slab->arena;
+  }
+
+  void free(uint32_t cls, void* p) {
+    assert(of(p) == this);
+    auto& c = classes_[cls];
+    {
+      std::lock_guard<ClassLock> guard(c.lock);
+      *static_cast<void**>(p) = c.free;
+      c.free = p;
+      c.free_num++;
+      add(c.used, -static_cast<size_t>(c.size));
+    }
+  }
+
+  // Make sure at least |n| items of class |cls| are free, carving missing
+  // ones from new slabs now and touching their memory, so allocations up
+  // to then neither take a slab nor fault a page in.
+  void reserve(uint32_t cls, size_t n) {
+    assert(cls < class_num_);
+    auto& c = classes_[cls];
+    std::lock_guard<ClassLock> guard(c.lock);
+    while (c.free_num < n) {
+      if (c.end - c.next < c.size) new_slab(c);
+      void* p = c.next;
+      c.next += c.size;
+      memset(p, 0, c.size);
+      *static_cast<void**>(p) = c.free;
+      c.free = p;
+      c.free_num++;
+    }
+  }
+
+  // 16 byte aligned, for items no class holds.
+  void* alloc_large(size_t bytes) {
+    auto head = static_cast<LargeHead*>(malloc(sizeof(LargeHead) + bytes));
+    if (!head) LOG_ERROR("malloc %lu failed", (unsigned long)bytes);
+    head->arena = this;
+    head->bytes = bytes;
+    head->prev = nullptr;
+    {
+      std::lock_guard<std::mutex> guard(large_mutex_);
+      head->next = large_;
+      if (large_) large_->prev = head;
+      large_ = head;
+      add(large_bytes_, bytes);
+    }
+    return head + 1;
+  }
+
+  // Arena of an item from alloc_large().
+  static SlabArena* of_large(const void* p) {
+    return (static_cast<const LargeHead*>(p) - 1)->arena;
+  }
+
+  void free_large(void* p) {
+    auto head = static_cast<LargeHead*>(p) - 1;
+    assert(head->arena == this);
+    {
+      std::lock_guard<std::mutex> guard(large_mutex_);
+      if (head->prev) head->prev->next = head->next;
+      if (head->next) head->next->prev = head->prev;
+      if (large_ == head) large_ = head->next;
+      add(large_bytes_, -head->bytes);
+    }
+    ::free(head);
+  }
+
+  // Keep the arena alive for an item about to be retired, until unhold()
+  // after the item is freed.
+  void hold() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+  void unhold() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+  }
+
+  // Drop the reference of the owner, who must not use the arena after.
+  void close() { unhold(); }
+
+  // Bytes taken from the system, and the part of them handed out.
+  size_t bytes() const {
+    size_t ret = large_bytes_.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < class_num_; i++) {
+      ret += classes_[i].slab_num.load(std::memory_order_relaxed) * SLAB_SIZE;
+    }
+    return ret;
+  }
+
+  size_t used_bytes() const {
+    size_t ret = large_bytes_.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < class_num_; i++) {
+      ret += classes_[i].used.load(std::memory_order_relaxed);
+    }
+    return ret;
+  }
+
+  // Arena the calling thread allocates from, nullptr for the shared object
+  // pools. Set by Scope.
+  static SlabArena* current() { return _current; }
+
+  class Scope {
+   public:
+    explicit Scope(SlabArena* arena) : prev_(_current) { _current = arena; }
+    ~Scope() { _current = prev_; }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    SlabArena* prev_;
+  };
+
+ private:
+  struct alignas(SLAB_HEAD) Slab {
+    SlabArena* arena;
+    Slab* next;
+  };
+
+  struct alignas(16) LargeHead {
+    SlabArena* arena;
+    LargeHead* prev;
+    LargeHead* next;
+    size_t bytes;
+  };
+
+  // Items are handed out under a short critical section, mostly by one
+  // thread, where a flag takes fewer locked instructions than a mutex.
+  class ClassLock {
+   public:
+    void lock() {
+      while (locked_.exchange(true, std::memory_order_acquire)) {
+        while (locked_.load(std::memory_order_relaxed)) {
+          std::this_thread::yield();
+        }
+      }
+    }
+
+    void unlock() { locked_.store(false, std::memory_order_release); }
+
+   private:
+    std::atomic<bool> locked_ = {false};
+  };
+
+  struct alignas(64) SizeClass {
+    ClassLock lock;
+    uint32_t size = 0;
+    void* free = nullptr;
+    char* next = nullptr;
+    char* end = nullptr;
+    Slab* slabs = nullptr;
+    size_t free_num = 0;
+    // written under |lock| only, see add()
+    std::atomic<size_t> used = {0};
+    std::atomic<size_t> slab_num = {0};
+  };
+
+  // Counters have a single writer at a time, they only need to be read
+  // without the lock, which a plain load and store allow without a locked
+  // instruction on the allocation path.
+  static void add(std::atomic<size_t>& cnt, size_t delta) {
+    cnt.store(cnt.load(std::memory_order_relaxed) + delta,
+              std::memory_order_relaxed);
+  }
+
+  // Process-wide, never destroyed, arenas may die at exit after statics.
+  struct SlabCache {
+    std::mutex mutex;
+    Slab* head = nullptr;
+    size_t num = 0;
+  };
+
+  static SlabCache* slab_cache() {
+    static SlabCache* cache = new SlabCache;
+    return cache;
+  }
+
+  ~SlabArena() {
+    auto cache = slab_cache();
+    for (uint32_t i = 0; i < class_num_; i++) {
+      for (Slab* s = classes_[i].slabs; s;) {
+        Slab* next = s->next;
+        {
+          std::lock_guard<std::mutex> guard(cache->mutex);
+          if (cache->num < CACHED_SLAB_NUM) {
+            s->next = cache->head;
+            cache->head = s;
+            cache->num++;
+            s = nullptr;
+          }
+        }
+        if (s) ::free(s);
+        s = next;
+      }
+    }
+    for (LargeHead* h = large_; h;) {
+      LargeHead* next = h->next;
+      ::free(h);
+      h = next;
+    }
+  }
+
+  void new_slab(SizeClass& c) {
+    Slab* slab = nullptr;
+    auto cache = slab_cache();
+    {
+      std::lock_guard<std::mutex> guard(cache->mutex);
+      if (cache->head) {
+        slab = cache->head;
+        cache->head = slab->next;
+        cache->num--;
+      }
+    }
+    if (!slab) slab = static_cast<Slab*>(aligned_alloc(SLAB_SIZE, SLAB_SIZE));
+    if (!slab) LOG_ERROR("aligned_alloc %lu failed", (unsigned long)SLAB_SIZE);
+    slab->arena = this;
+    slab->next = c.slabs;
+    c.slabs = slab;
+    c.next = reinterpret_cast<char*>(slab) + SLAB_HEAD;
+    c.end = reinterpret_cast<char*>(slab) + SLAB_SIZE;
+    add(c.slab_num, 1);
+  }
+
+  static thread_local SlabArena* _current;
+
+  SizeClass classes_[MAX_CLASS];
+  uint32_t class_num_;
+  std::mutex large_mutex_;
+  LargeHead* large_ = nullptr;
+  std::atomic<uint64_t> refs_ = {1};
+  std::atomic<size_t> large_bytes_ = {0};
+};
+
+inline thread_local SlabArena* SlabArena::_current = nullptr;
+
+}  // namespace detail
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <unistd.h>
+
+#include <cstdio>
 #include <string>
 
 #include "common/logger.h"
@@ -13,6 +16,21 @@ class TimeUtils {
   }
 };
 
+class MemUtils {
+ public:
+  // Resident set size of current process in bytes, 0 if unknown.
+  static uint64_t currentRss() {
+    uint64_t pages = 0;
+    uint64_t rss = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f) {
+      if (fscanf(f, "%lu %lu", &pages, &rss) != 2) rss = 0;
+      fclose(f);
+    }
+    return rss * sysconf(_SC_PAGESIZE);
+  }
+};
+
 class Timer {
  public:
   Timer(const std::string& event) : event_(event) {
@@ -0,0 +1,122 @@
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "art/art.h"
+#include "common/epoch.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+namespace art {
+
+static std::atomic<int64_t> g_freed{0};
+
+static void count_deleter(void *p) {
+  g_freed++;
+  delete static_cast<int64_t *>(p);
+}
+
+TEST(ArtEpochTest, retire_is_deferred_by_reader) {
+  epoch_reclaim();
+  g_freed = 0;
+
+  std::atomic<int32_t> step{0};
+  std::thread reader([&]() {
+    EpochGuard guard;
+    step = 1;
+    while (step.load() != 2) std::this_thread::yield();
+  });
+  while (step.load() != 1) std::this_thread::yield();
+
+  for (int32_t i = 0; i < 10; i++) {
+    epoch_retire(new int64_t(i), count_deleter);
+  }
+  epoch_reclaim();
+  EXPECT_EQ(g_freed.load(), 0);
+
+  step = 2;
+  reader.join();
+  epoch_reclaim();
+  EXPECT_EQ(g_freed.load(), 10);
+}
+
+TEST(ArtEpochTest, nested_guard) {
+  epoch_reclaim();
+  g_freed = 0;
+  {
+    EpochGuard g1;
+    {
+      EpochGuard g2;
+    }
+    epoch_retire(new int64_t(0), count_deleter);
+    epoch_reclaim();
+    // Retired inside our own epoch.
+    EXPECT_EQ(g_freed.load(), 0);
+  }
+  epoch_reclaim();
+  EXPECT_EQ(g_freed.load(), 1);
+}
+
+TEST(ArtEpochTest, exited_thread_limbo_is_adopted) {
+  epoch_reclaim();
+  g_freed = 0;
+  std::thread t([]() { epoch_retire(new int64_t(0), count_deleter); });
+  t.join();
+  epoch_reclaim();
+  EXPECT_EQ(g_freed.load(), 1);
+}
+
+TEST(ArtEpochTest, concurrent_churn) {
+  const int32_t writer_num = 4;
+  const int32_t key_per_writer = 2000;
+  const int32_t round = 20;
+  ArtTree<int64_t> tree;
+  std::atomic<bool> stop{false};
+
+  auto key_of = [](int32_t w, int32_t i) {
+    return "w" + std::to_string(w) + "-key-" + std::to_string(i);
+  };
+
+  std::vector<std::thread> writers;
+  for (int32_t w = 0; w < writer_num; w++) {
+    writers.emplace_back([&, w]() {
+      for (int32_t r = 0; r < round; r++) {
+        for (int32_t i = 0; i < key_per_writer; i++) {
+          auto k = key_of(w, i);
+          tree.set(k, i + 1);
+        }
+        for (int32_t i = 0; i < key_per_writer; i++) {
+          auto k = key_of(w, i);
+          ASSERT_EQ(tree.get(k), i + 1);
+          if (r + 1 < round || i % 2) {
+            ASSERT_EQ(tree.del(k), i + 1);
+          }
+        }
+      }
+    });
+  }
+
+  std::thread reader([&]() {
+    std::mt19937 rng(0);
+    while (!stop.load()) {
+      int32_t w = rng() % writer_num;
+      int32_t i = rng() % key_per_writer;
+      auto v = tree.get(key_of(w, i));
+      ASSERT_TRUE(v == 0 || v == i + 1);
+    }
+  });
+
+  for (auto &t : writers) t.join();
+  stop = true;
+  reader.join();
+
+  for (int32_t w = 0; w < writer_num; w++) {
+    for (int32_t i = 0; i < key_per_writer; i++) {
+      EXPECT_EQ(tree.get(key_of(w, i)), i % 2 ? 0 : i + 1);
+    }
+  }
+  EXPECT_EQ(tree.size(), writer_num * key_per_writer / 2);
+}
+
+}  // namespace art
@@ -0,0 +1,219 @@
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "art/art-frozen.h"
+#include "art/art.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+namespace art {
+
+class ArtFrozenTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    path = ::testing::TempDir() + "art-frozen-" + std::to_string(getpid());
+  }
+
+  void TearDown() override { std::remove(path.c_str()); }
+
+  void set(const std::string &key, int64_t val) {
+    verify_map[key] = val;
+    tree.set(key, val);
+  }
+
+  FrozenArt<int64_t> freeze() {
+    FrozenArt<int64_t> frozen;
+    EXPECT_TRUE(tree.freeze(path));
+    EXPECT_TRUE(frozen.open(path));
+    return frozen;
+  }
+
+  // Keys of |frozen| from |start| on, up to |limit| of them.
+  static std::vector<std::string> scan(const FrozenArt<int64_t> &frozen,
+                                       const std::string &start,
+                                       size_t limit) {
+    std::vector<std::string> ret;
+    frozen.scan(start, "", [&](std::string_view k, int64_t) {
+      ret.emplace_back(k);
+      return ret.size() < limit;
+    });
+    return ret;
+  }
+
+  std::vector<std::string> expect_scan(const std::string &start,
+                                       size_t limit) {
+    std::vector<std::string> ret;
+    for (auto it = verify_map.lower_bound(start);
+         it != verify_map.end() && ret.size() < limit; ++it) {
+      ret.push_back(it->first);
+    }
+    return ret;
+  }
+
+  std::string path;
+  std::map<std::string, int64_t> verify_map;
+  ArtTree<int64_t> tree;
+};
+
+TEST_F(ArtFrozenTest, empty_and_single) {
+  auto frozen = freeze();
+  EXPECT_EQ(frozen.size(), 0);
+  EXPECT_EQ(frozen.get("a"), 0);
+  EXPECT_TRUE(scan(frozen, "", 10).empty());
+
+  set("only", 3);
+  frozen = freeze();
+  EXPECT_EQ(frozen.size(), 1);
+  EXPECT_EQ(frozen.get("only"), 3);
+  EXPECT_EQ(frozen.get("onl"), 0);
+  EXPECT_EQ(frozen.get("only1"), 0);
+  EXPECT_EQ(scan(frozen, "", 10), expect_scan("", 10));
+}
+
+TEST_F(ArtFrozenTest, keys_ending_inside) {
+  // keys that are prefixes of others hang at byte 0 of their parent
+  for (auto k : {"a", "ab", "abc", "abcdefghijklmnopqrstu", "abd", "b",
+                 "abcdefghijklmnopqrstuvwxyz", "abcdefghijklmnopqrstuvwxy"}) {
+    set(k, verify_map.size() + 1);
+  }
+  auto frozen = freeze();
+  for (auto &iter : verify_map) {
+    EXPECT_EQ(frozen.get(iter.first), iter.second) << iter.first;
+  }
+  for (auto k : {"", "abcd", "abcdefghijklmnopqrst", "abcdefghijklmnopqrstuv",
+                 "ac", "bb", "abcdefghijklmnopqrstuvwxyz0"}) {
+    EXPECT_EQ(frozen.get(k), 0) << k;
+  }
+  for (auto &start : {"", "a", "aa", "ab", "abc", "abcd", "abcdefghijklmz",
+                      "abcdefghijklmnopqrstuv", "abe", "b", "c"}) {
+    EXPECT_EQ(scan(frozen, start, 100), expect_scan(start, 100)) << start;
+  }
+}
+
+TEST_F(ArtFrozenTest, random_keys) {
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 100000; i++) {
+    // all fanouts: dense digits, sparse bytes and long shared prefixes
+    std::string k = std::to_string(rng() % 1000000);
+    if (i % 3 == 0) k = "tenant/" + std::to_string(rng() % 40) + "/" + k;
+    if (i % 5 == 0) k.push_back(static_cast<char>(rng() % 255 + 1));
+    set(k, i + 1);
+  }
+  auto frozen = freeze();
+  EXPECT_EQ(frozen.size(), verify_map.size());
+  for (auto &iter : verify_map) {
+    ASSERT_EQ(frozen.get(iter.first), iter.second) << iter.first;
+  }
+  for (int32_t i = 0; i < 10000; i++) {
+    auto k = std::to_string(rng() % 1000000);
+    auto it = verify_map.find(k);
+    EXPECT_EQ(frozen.get(k), it == verify_map.end() ? 0 : it->second);
+  }
+
+  EXPECT_EQ(scan(frozen, "", SIZE_MAX), expect_scan("", SIZE_MAX));
+  for (int32_t i = 0; i < 2000; i++) {
+    std::string start = std::to_string(rng() % 1000000);
+    if (i % 2) start = "tenant/" + std::to_string(rng() % 50) + "/" + start;
+    start.resize(rng() % (start.size() + 1));
+    ASSERT_EQ(scan(frozen, start, 20), expect_scan(start, 20)) << start;
+  }
+
+  for (auto prefix : {"tenant/1", "tenant/17/", "99", "tenant/7/5"}) {
+    uint64_t expect = 0;
+    for (auto it = verify_map.lower_bound(prefix);
+         it != verify_map.end() && it->first.rfind(prefix, 0) == 0; ++it) {
+      expect++;
+    }
+    uint64_t cnt =
+        frozen.scan_prefix(prefix, [&](std::string_view k, int64_t v) {
+          EXPECT_EQ(verify_map[std::string(k)], v);
+          return true;
+        });
+    EXPECT_EQ(cnt, expect) << prefix;
+  }
+  uint64_t cnt = frozen.scan("1", "2", [](std::string_view, int64_t) {
+    return true;
+  });
+  EXPECT_EQ(cnt, std::distance(verify_map.lower_bound("1"),
+                               verify_map.lower_bound("2")));
+}
+
+TEST_F(ArtFrozenTest, from_partial_prefixes) {
+  // the tree keeps only the head of long prefixes, the image all of them
+  std::string base(100, 'p');
+  for (int32_t i = 0; i < 1000; i++) set(base + std::to_string(i), i + 1);
+  auto frozen = freeze();
+  for (auto &iter : verify_map) {
+    EXPECT_EQ(frozen.get(iter.first), iter.second);
+  }
+  std::string other = base;
+  other[60] = 'q';
+  EXPECT_EQ(frozen.get(other + "1"), 0);
+  EXPECT_EQ(scan(frozen, other, 5), expect_scan(other, 5));
+}
+
+TEST_F(ArtFrozenTest, deep_tree) {
+  // "b", "ab", "aab", ... hang one inner node per key below each other
+  for (int32_t i = 0; i < 5000; i++) set(std::string(i, 'a') + "b", i + 1);
+  auto frozen = freeze();
+  EXPECT_EQ(frozen.size(), verify_map.size());
+  for (auto &iter : verify_map) {
+    EXPECT_EQ(frozen.get(iter.first), iter.second);
+  }
+  // scans keep no stack frame per level either
+  EXPECT_EQ(scan(frozen, "", SIZE_MAX), expect_scan("", SIZE_MAX));
+  std::string mid = std::string(2500, 'a') + "c";
+  EXPECT_EQ(scan(frozen, mid, SIZE_MAX), expect_scan(mid, SIZE_MAX));
+  EXPECT_EQ(frozen.scan_prefix(std::string(4000, 'a'),
+                               [](std::string_view, int64_t) { return true; }),
+            1000);
+}
+
+TEST_F(ArtFrozenTest, shared_and_moved) {
+  for (int32_t i = 0; i < 1000; i++) set(std::to_string(i * 7), i);
+  ASSERT_TRUE(tree.freeze(path));
+  FrozenArt<int64_t> a;
+  FrozenArt<int64_t> b;
+  ASSERT_TRUE(a.open(path));
+  ASSERT_TRUE(b.open(path));
+  // the mapping does not depend on the tree or the other mapping
+  tree.set("7", -1);
+  b.close();
+  EXPECT_EQ(a.get("7"), 1);
+  FrozenArt<int64_t> c(std::move(a));
+  EXPECT_FALSE(a.is_open());
+  EXPECT_EQ(c.get("70"), 10);
+  EXPECT_GT(c.image_bytes(), 0);
+}
+
+TEST_F(ArtFrozenTest, bad_images) {
+  for (int32_t i = 0; i < 100; i++) set(std::to_string(i), i);
+  FrozenArt<int64_t> frozen;
+  EXPECT_FALSE(frozen.open(path + ".missing"));
+
+  ASSERT_TRUE(tree.save(path));
+  EXPECT_FALSE(frozen.open(path));
+
+  ASSERT_TRUE(tree.freeze(path));
+  FrozenArt<int32_t> narrow;
+  EXPECT_FALSE(narrow.open(path));
+  std::string data;
+  {
+    std::ifstream in(path, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(in), {});
+  }
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size() - 1);
+  }
+  EXPECT_FALSE(frozen.open(path));
+  EXPECT_FALSE(frozen.is_open());
+}
+
+}  // namespace art
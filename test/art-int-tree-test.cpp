@@ -0,0 +1,101 @@
+#include <map>
+#include <random>
+#include <vector>
+
+#include "art/art-int-tree.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+namespace art {
+
+class ArtIntTreeTest : public ::testing::Test {
+ public:
+  void TearDown() override {
+    EXPECT_EQ(tree.size(), verify_map.size());
+    for (auto &iter : verify_map) {
+      EXPECT_EQ(tree.get(iter.first), iter.second) << iter.first;
+    }
+    auto expect = verify_map.begin();
+    for (auto it = tree.begin(); it.valid(); it.next()) {
+      ASSERT_NE(expect, verify_map.end());
+      EXPECT_EQ(ArtIntTree<int64_t>::key_of(it), expect->first);
+      EXPECT_EQ(it.value(), expect->second);
+      ++expect;
+    }
+    EXPECT_EQ(expect, verify_map.end());
+  }
+
+  void set(uint64_t k, int64_t v) {
+    verify_map[k] = v;
+    tree.set(k, v);
+  }
+
+  void del(uint64_t k) {
+    EXPECT_EQ(tree.del(k), verify_map[k]);
+    verify_map.erase(k);
+  }
+
+  std::map<uint64_t, int64_t> verify_map;
+  ArtIntTree<int64_t> tree;
+};
+
+TEST_F(ArtIntTreeTest, numeric_order) {
+  std::vector<uint64_t> keys = {0,          1,          255,
+                                256,        65535,      1ULL << 32,
+                                UINT64_MAX - 1, UINT64_MAX};
+  for (uint64_t k : keys) {
+    set(k, k % 1000 + 1);
+  }
+  EXPECT_EQ(tree.get(2), 0);
+  del(256);
+}
+
+TEST_F(ArtIntTreeTest, random) {
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 50000; i++) {
+    // dense low keys and sparse high keys
+    set(i % 2 ? rng() : rng() % 100000, i + 1);
+  }
+  for (int32_t i = 0; i < 20000; i++) {
+    uint64_t k = rng() % 100000;
+    if (verify_map.count(k)) del(k);
+  }
+
+  std::vector<uint64_t> keys;
+  for (int32_t i = 0; i < 1000; i++) keys.push_back(rng() % 100000);
+  std::vector<int64_t> out(keys.size());
+  tree.multi_get(keys.data(), keys.size(), out.data());
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto iter = verify_map.find(keys[i]);
+    EXPECT_EQ(out[i], iter == verify_map.end() ? 0 : iter->second);
+  }
+
+  for (int32_t i = 0; i < 100; i++) {
+    uint64_t lo = rng() % 100000;
+    uint64_t hi = lo + rng() % 1000;
+    std::vector<uint64_t> got;
+    tree.scan(lo, hi, [&](uint64_t k, int64_t) {
+      got.push_back(k);
+      return true;
+    });
+    std::vector<uint64_t> expect;
+    for (auto it = verify_map.lower_bound(lo);
+         it != verify_map.end() && it->first <= hi; ++it) {
+      expect.push_back(it->first);
+    }
+    EXPECT_EQ(got, expect);
+  }
+}
+
+TEST_F(ArtIntTreeTest, conditional_write) {
+  EXPECT_TRUE(tree.insert_if_absent(7, 1));
+  EXPECT_FALSE(tree.insert_if_absent(7, 2));
+  EXPECT_TRUE(tree.compare_and_set(7, 1, 3));
+  tree.upsert(8, [](int64_t &v, bool) {
+    v += 5;
+    return true;
+  });
+  verify_map = {{7, 3}, {8, 5}};
+}
+
+}  // namespace art
@@ -1,5 +1,6 @@
 #include <map>
 #include <random>
+#include <vector>
 
 #include "art/art-node-add.h"
 #include "art/art-node-del.h"
@@ -49,12 +50,23 @@ void verify_node<ArtNode48>(ArtNodeCommon* node,
                             const std::map<uint64_t, ArtLeaf<int64_t>*>& mp) {
   EXPECT_EQ(node->type, ArtNodeTrait<ArtNode48>::NODE_TYPE);
   auto node48 = reinterpret_cast<ArtNode48*>(node);
+  uint64_t slots = 0;
   for (auto& iter : mp) {
     EXPECT_NE(node48->index[iter.first], 0);
     EXPECT_EQ(node48->children[node48->index[iter.first] - 1], iter.second);
     auto children = art_find_child(node, iter.first);
     EXPECT_EQ(*children, iter.second);
+    slots |= 1ULL << (node48->index[iter.first] - 1);
   }
+  EXPECT_EQ(node48->used_slots, slots);
+  auto expect = mp.begin();
+  node48->for_each_child([&](uint8_t b, ArtNodeCommon* c) {
+    ASSERT_NE(expect, mp.end());
+    EXPECT_EQ(b, expect->first);
+    EXPECT_EQ(c, expect->second);
+    ++expect;
+  });
+  EXPECT_EQ(expect, mp.end());
 }
 
 template <>
@@ -67,6 +79,14 @@ void verify_node<ArtNode256>(ArtNodeCommon* node,
     auto children = art_find_child(node, iter.first);
     EXPECT_EQ(*children, iter.second);
   }
+  auto expect = mp.begin();
+  node256->for_each_child([&](uint8_t b, ArtNodeCommon* c) {
+    ASSERT_NE(expect, mp.end());
+    EXPECT_EQ(b, expect->first);
+    EXPECT_EQ(c, expect->second);
+    ++expect;
+  });
+  EXPECT_EQ(expect, mp.end());
 }
 
 template <class BeforeT, class OverFlowT>
@@ -113,7 +133,7 @@ void test_fun() {
   auto iter = child_map.begin();
   for (int32_t t = 0; t < idx; t++) iter++;
   uint8_t key_byte = iter->first;
-  art_delete_from_node(&common_n, key_byte);
+  art_delete_from_node(&common_n, key_byte, false, ArtShrinkPolicy::eager());
   child_map.erase(key_byte);
   verify_node<BeforeT>(common_n, child_map);
 
@@ -121,7 +141,7 @@ void test_fun() {
   iter = child_map.begin();
   for (int32_t t = 0; t < idx; t++) iter++;
   key_byte = iter->first;
-  art_delete_from_node(&common_n, key_byte);
+  art_delete_from_node(&common_n, key_byte, false, ArtShrinkPolicy::eager());
   child_map.erase(key_byte);
   verify_node<BeforeT>(common_n, child_map);
 
@@ -148,6 +168,105 @@ TEST_F(ArtNodeAddAndDelTest, test_add_to_n256) {
   test_fun<ArtNode256, ArtNode256>();
 }
 
+TEST_F(ArtNodeAddAndDelTest, grow_and_shrink_churn) {
+  // Walk one node up to Node256 and back down to Node4 a few times, freed
+  // Node48 slots must be reused and bitmaps must follow every change.
+  std::mt19937 g(0);
+  std::map<uint64_t, ArtLeaf<int64_t>*> child_map;
+  std::vector<ArtLeaf<int64_t>*> leaves;
+  for (int32_t i = 0; i < 256; i++) {
+    std::string key = "test" + std::to_string(i);
+    leaves.push_back(get_new_leaf_node<int64_t>(key.data(), key.size(), i));
+  }
+  auto common_n =
+      reinterpret_cast<ArtNodeCommon*>(get_new_art_node<ArtNode4>());
+  auto verify = [&]() {
+    switch (common_n->type) {
+      case ART_NODE_4: verify_node<ArtNode4>(common_n, child_map); break;
+      case ART_NODE_16: verify_node<ArtNode16>(common_n, child_map); break;
+      case ART_NODE_48: verify_node<ArtNode48>(common_n, child_map); break;
+      default: verify_node<ArtNode256>(common_n, child_map); break;
+    }
+  };
+
+  for (int32_t round = 0; round < 3; round++) {
+    while (child_map.size() < 256) {
+      uint8_t b = g();
+      if (child_map.count(b)) continue;
+      art_add_child_to_node(&common_n, b, leaves[b]);
+      child_map[b] = leaves[b];
+      verify();
+    }
+    while (child_map.size() > 3) {
+      auto iter = child_map.begin();
+      std::advance(iter, g() % child_map.size());
+      art_delete_from_node(&common_n, iter->first);
+      child_map.erase(iter);
+      verify();
+    }
+  }
+  EXPECT_EQ(common_n->type, ART_NODE_4);
+
+  return_art_node(reinterpret_cast<ArtNode4*>(common_n));
+  for (auto leaf : leaves) return_art_node(leaf);
+}
+
+TEST_F(ArtNodeAddAndDelTest, shrink_hysteresis) {
+  ArtShrinkPolicy policy{3, 12, 37};
+  std::vector<ArtLeaf<int64_t>*> leaves;
+  for (int32_t i = 0; i < 49; i++) {
+    leaves.push_back(get_new_leaf_node<int64_t>("k", 1, i));
+  }
+  auto common_n =
+      reinterpret_cast<ArtNodeCommon*>(get_new_art_node<ArtNode4>());
+  auto grow_to = [&](int32_t cnt) {
+    while (common_n->childNum < cnt) {
+      art_add_child_to_node(&common_n, common_n->childNum,
+                            leaves[common_n->childNum]);
+    }
+  };
+  auto shrink_to = [&](int32_t cnt) {
+    while (common_n->childNum > cnt) {
+      uint32_t shrink_at = common_n->type == ART_NODE_16   ? 3
+                           : common_n->type == ART_NODE_48 ? 12
+                                                           : 37;
+      EXPECT_EQ(common_n->need_adjust_after_delete(policy),
+                common_n->childNum - 1u <= shrink_at);
+      art_delete_from_node(&common_n, common_n->childNum - 1, false, policy);
+    }
+  };
+
+  // crossing a grow boundary back and forth keeps the bigger node
+  for (int32_t i = 0; i < 3; i++) {
+    grow_to(49);
+    EXPECT_EQ(common_n->type, ART_NODE_256);
+    shrink_to(48);
+    EXPECT_EQ(common_n->type, ART_NODE_256);
+  }
+  shrink_to(37);
+  EXPECT_EQ(common_n->type, ART_NODE_48);
+  for (int32_t i = 0; i < 3; i++) {
+    shrink_to(16);
+    EXPECT_EQ(common_n->type, ART_NODE_48);
+    grow_to(17);
+  }
+  shrink_to(12);
+  EXPECT_EQ(common_n->type, ART_NODE_16);
+  for (int32_t i = 0; i < 3; i++) {
+    shrink_to(4);
+    EXPECT_EQ(common_n->type, ART_NODE_16);
+    grow_to(5);
+  }
+  shrink_to(3);
+  EXPECT_EQ(common_n->type, ART_NODE_4);
+  for (int32_t i = 0; i < 3; i++) {
+    EXPECT_EQ(*art_find_child(common_n, i), leaves[i]);
+  }
+
+  return_art_node(reinterpret_cast<ArtNode4*>(common_n));
+  for (auto leaf : leaves) return_art_node(leaf);
+}
+
 TEST_F(ArtNodeAddAndDelTest, path_compress_n4_to_leaf) {
   auto node = reinterpret_cast<ArtNodeCommon*>(get_new_art_node<ArtNode4>());
   auto leaf1 = get_new_leaf_node<int64_t>("ahello", 6, 1);
@@ -160,8 +279,8 @@ TEST_F(ArtNodeAddAndDelTest, path_compress_n4_to_leaf) {
 
   EXPECT_EQ(node, leaf2);
 
+  // node4 is retired by delete, node itself is leaf2 now.
   return_art_node(leaf2);
-  return_art_node(node);
 }
 
 }  // namespace detail
@@ -1,6 +1,15 @@
 #include "art/art-node-pool.h"
 
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "common/logger.h"
+#include "common/utils.h"
 #include "gtest/gtest.h"
 
 namespace art {
@@ -65,5 +74,221 @@ TEST_F(ArtNodePoolTest, get_and_return_pool) { get_and_return<false>(); }
 
 TEST_F(ArtNodePoolTest, get_and_return_direct) { get_and_return<true>(); }
 
+TEST_F(ArtNodePoolTest, leaf_size_class) {
+  EXPECT_EQ(sizeof(ArtLeaf<int64_t>), 32);
+  EXPECT_EQ(art_leaf_size_class(1), 1);
+  EXPECT_EQ(art_leaf_size_class(32), 1);
+  EXPECT_EQ(art_leaf_size_class(33), 2);
+  EXPECT_EQ(art_leaf_size_class(256), ART_LEAF_SIZE_CLASS_NUM);
+  EXPECT_EQ(art_leaf_size_class(257), 0);
+
+  // uuid key, 32 + 36 bytes fit the 80 bytes class.
+  std::string uuid = "0b8e7ba1-3c5e-4b2e-9f0d-6d1c8a2f3e44";
+  auto leaf = get_new_leaf_node<int64_t>(uuid.data(), uuid.size(), 1);
+  EXPECT_FALSE(leaf->is_from_new());
+  EXPECT_EQ(ART_LEAF_SIZE_CLASS[leaf->size_class() - 1], 80);
+  EXPECT_EQ(leaf->get_key(), reinterpret_cast<char *>(leaf + 1));
+  EXPECT_EQ(leaf->to_string(), uuid);
+  EXPECT_TRUE(leaf->leaf_matches(uuid.data(), uuid.size(), 0));
+  return_art_node(leaf);
+
+  // Short keys stay in the header.
+  leaf = get_new_leaf_node<int64_t>("short", 5, 2);
+  EXPECT_EQ(ART_LEAF_SIZE_CLASS[leaf->size_class() - 1], 32);
+  EXPECT_EQ(leaf->to_string(), "short");
+  return_art_node(leaf);
+
+  // Keys past the largest class fall back to malloc.
+  std::string big(1000, 'x');
+  leaf = get_new_leaf_node<int64_t>(big.data(), big.size(), 3);
+  EXPECT_TRUE(leaf->is_from_new());
+  EXPECT_EQ(leaf->to_string(), big);
+  EXPECT_EQ(leaf->value, 3);
+  return_art_node(leaf);
+}
+
+// 64 of them fill a block of 16 pages.
+template <int32_t I>
+struct TrimItem {
+  char data[1024];
+};
+
+// Get |n| items of a fresh pool on a thread of their own, touch them and
+// return all but the first of each block in |keep_blocks|.
+template <class Item>
+static std::vector<Item *> get_and_return_items(size_t n,
+                                                 size_t keep_blocks) {
+  std::vector<Item *> kept;
+  std::thread t([&]() {
+    std::vector<Item *> items;
+    for (size_t i = 0; i < n; i++) {
+      items.push_back(get_object<Item>());
+      memset(items.back()->data, 1, sizeof(items.back()->data));
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (i % 64 == 0 && i / 64 < keep_blocks) {
+        kept.push_back(items[i]);
+      } else {
+        return_object(items[i]);
+      }
+    }
+    // the thread's own free items reach the global list as it exits
+  });
+  t.join();
+  return kept;
+}
+
+TEST_F(ArtNodePoolTest, trim) {
+  // released objects are handed out zero filled, not constructed
+  EXPECT_TRUE(::detail::ObjectPoolTrimmable<TrimItem<0>>::value);
+  EXPECT_TRUE(::detail::ObjectPoolTrimmable<ArtNode48>::value);
+  EXPECT_FALSE(::detail::ObjectPoolTrimmable<std::string>::value);
+
+  using Item = TrimItem<0>;
+  const size_t page = sysconf(_SC_PAGESIZE);
+  EXPECT_EQ(trim_objects<Item>(), 0);
+
+  auto kept = get_and_return_items<Item>(64 * 20, 10);
+  EXPECT_EQ(describe_objects<Item>().block_num, 20);
+  // pages around the block edges are kept
+  size_t released = trim_objects<Item>();
+  EXPECT_GE(released, 10 * 14 * page);
+  EXPECT_LE(released, 10 * 16 * page);
+  EXPECT_EQ(trim_objects<Item>(), 0);
+
+  std::thread t([&]() {
+    for (auto item : kept) return_object(item);
+  });
+  t.join();
+  EXPECT_GE(trim_objects<Item>(), 10 * 14 * page);
+
+  // released items are still handed out, zero filled
+  std::thread again([&]() {
+    std::vector<Item *> items;
+    bool zeroed = false;
+    for (size_t i = 0; i < 64 * 20; i++) {
+      items.push_back(get_object<Item>());
+      zeroed |= items.back()->data[100] == 0;
+      memset(items.back()->data, 2, sizeof(items.back()->data));
+    }
+    EXPECT_TRUE(zeroed);
+    for (auto item : items) return_object(item);
+  });
+  again.join();
+  EXPECT_EQ(describe_objects<Item>().block_num, 20);
+}
+
+TEST_F(ArtNodePoolTest, background_trimmer) {
+  using Item = TrimItem<1>;
+  ObjectPoolTrimmer trimmer(trim_objects<Item>, 1);
+  get_and_return_items<Item>(64 * 8, 0);
+  while (trimmer.released_bytes() == 0) std::this_thread::yield();
+  size_t trims = trimmer.trim_num();
+  while (trimmer.trim_num() < trims + 2) std::this_thread::yield();
+  // nothing is left to release
+  EXPECT_LE(trimmer.released_bytes(), 8 * 16 * sysconf(_SC_PAGESIZE));
+}
+
+TEST_F(ArtNodePoolTest, huge_page_blocks) {
+  using Item = TrimItem<2>;
+  using Block = ::detail::ObjectPool<Item>::Block;
+  const size_t region = ::detail::OP_HUGE_PAGE_REGION;
+  const size_t per_region = region / sizeof(Block);
+  set_huge_page_blocks<Item>(true, true);
+  std::thread t([&]() {
+    std::vector<Item *> items;
+    for (size_t i = 0; i < 64 * (per_region + 2); i++) {
+      items.push_back(get_object<Item>());
+      memset(items.back()->data, 3, sizeof(items.back()->data));
+    }
+    // blocks are carved in turn from aligned regions
+    EXPECT_EQ((uintptr_t)items[0] % region, 0);
+    EXPECT_EQ((char *)items[64] - (char *)items[0], sizeof(Block));
+    EXPECT_EQ((uintptr_t)items[64 * per_region] % region, 0);
+    for (auto item : items) return_object(item);
+  });
+  t.join();
+  set_huge_page_blocks<Item>(false);
+  EXPECT_EQ(describe_objects<Item>().block_num, per_region + 2);
+}
+
+TEST_F(ArtNodePoolTest, reserve) {
+  using Item = TrimItem<3>;
+  const size_t thread_cnt = 4;
+  const size_t per_thread = 64 * 2;
+  EXPECT_EQ(reserve_objects<Item>(thread_cnt * per_thread, thread_cnt),
+            thread_cnt * per_thread);
+  EXPECT_EQ(describe_objects<Item>().block_num, 8);
+  EXPECT_EQ(reserve_objects<Item>(thread_cnt * per_thread), 0);
+
+  // each thread takes its share from the global list, no new block
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < thread_cnt; t++) {
+    threads.emplace_back([&]() {
+      std::vector<Item *> items;
+      for (size_t i = 0; i < per_thread; i++) {
+        items.push_back(get_object<Item>());
+        memset(items.back()->data, 4, sizeof(items.back()->data));
+      }
+      for (auto item : items) return_object(item);
+    });
+  }
+  for (auto &t : threads) t.join();
+  EXPECT_EQ(describe_objects<Item>().block_num, 8);
+
+  // returned items count as free again
+  EXPECT_EQ(reserve_objects<Item>(thread_cnt * per_thread), 0);
+  EXPECT_EQ(reserve_objects<Item>(thread_cnt * per_thread + 1), 64);
+  EXPECT_EQ(describe_objects<Item>().block_num, 9);
+}
+
+// Writers allocate nodes and a reclaim thread frees them, so every chunk
+// of free nodes goes through the global free list of the pool.
+TEST(ArtBench, poolProducerConsumer) {
+  const int32_t producer_cnt = 4;
+  const size_t per_producer = 2000000;
+  const size_t batch = 512;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<std::vector<ArtNode4 *>> batches;
+  int32_t producing = producer_cnt;
+
+  TIMER_START(t, "%d producers, 1 consumer, %llu nodes", producer_cnt,
+              producer_cnt * per_producer);
+  std::thread consumer([&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cond.wait(lock, [&]() { return !batches.empty() || !producing; });
+      if (batches.empty()) break;
+      auto nodes = std::move(batches.front());
+      batches.pop_front();
+      lock.unlock();
+      for (auto node : nodes) return_object(node);
+      lock.lock();
+    }
+  });
+  std::vector<std::thread> producers;
+  for (int32_t p = 0; p < producer_cnt; p++) {
+    producers.emplace_back([&]() {
+      std::vector<ArtNode4 *> nodes;
+      for (size_t i = 0; i < per_producer; i++) {
+        nodes.push_back(get_object<ArtNode4>());
+        nodes.back()->childNum = 1;
+        if (nodes.size() == batch) {
+          std::lock_guard<std::mutex> guard(mutex);
+          batches.push_back(std::move(nodes));
+          nodes.clear();
+          cond.notify_one();
+        }
+      }
+      std::lock_guard<std::mutex> guard(mutex);
+      batches.push_back(std::move(nodes));
+      if (--producing == 0) cond.notify_one();
+    });
+  }
+  for (auto &p : producers) p.join();
+  consumer.join();
+}
+
 }  // namespace detail
 }  // namespace art
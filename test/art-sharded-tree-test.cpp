@@ -0,0 +1,146 @@
+#include "art/art-sharded.h"
+
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "art-test-util.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+namespace art {
+
+using Sharded = ShardedArtTree<int64_t>;
+
+static void expect_sharded(const Sharded &tree,
+                           const std::map<std::string, int64_t> &expect) {
+  expect_tree(tree, expect);
+
+  // seeks land on the same key as in the map, also between shards
+  std::mt19937_64 rng(1);
+  for (int32_t i = 0; i < 200; i++) {
+    auto k = std::to_string(rng() % 30000);
+    auto it = tree.lower_bound(k);
+    auto m = expect.lower_bound(k);
+    for (int32_t step = 0; step < 3; step++, it.next(), ++m) {
+      ASSERT_EQ(it.valid(), m != expect.end()) << k;
+      if (!it.valid()) break;
+      EXPECT_EQ(it.key(), m->first);
+    }
+  }
+}
+
+static void random_ops(Sharded &tree, uint64_t seed) {
+  std::map<std::string, int64_t> verify_map;
+  std::mt19937_64 rng(seed);
+  for (int32_t i = 0; i < 50000; i++) {
+    auto k = std::to_string(rng() % 20000);
+    if (rng() % 3 == 0) {
+      auto it = verify_map.find(k);
+      ASSERT_EQ(tree.del(k), it == verify_map.end() ? 0 : it->second) << k;
+      if (it != verify_map.end()) verify_map.erase(it);
+    } else if (rng() % 2 == 0) {
+      tree.upsert(k, [&](int64_t &v, bool) {
+        v += i + 1;
+        return true;
+      });
+      verify_map[k] += i + 1;
+    } else {
+      tree.set(k, i + 1);
+      verify_map[k] = i + 1;
+    }
+  }
+  expect_sharded(tree, verify_map);
+  for (auto &kv : verify_map) ASSERT_EQ(tree.get(kv.first), kv.second);
+}
+
+TEST(ShardedArtTreeTest, hash_shards) {
+  Sharded tree(8);
+  EXPECT_EQ(tree.shard_by(), ArtShardBy::HASH);
+  EXPECT_FALSE(tree.begin().valid());
+  random_ops(tree, 0);
+  // keys spread evenly
+  for (uint32_t i = 0; i < tree.shard_num(); i++) {
+    EXPECT_GT(tree.shard(i).size(), tree.size() / 8 * 3 / 4);
+    EXPECT_LT(tree.shard(i).size(), tree.size() / 8 * 5 / 4);
+  }
+}
+
+TEST(ShardedArtTreeTest, range_shards) {
+  std::vector<std::string> sample;
+  std::mt19937_64 rng(2);
+  for (int32_t i = 0; i < 1000; i++) {
+    sample.push_back(std::to_string(rng() % 20000));
+  }
+  auto bounds = Sharded::split_keys(sample, 8);
+  EXPECT_EQ(bounds.size(), 7);
+  Sharded tree(bounds);
+  EXPECT_EQ(tree.shard_by(), ArtShardBy::RANGE);
+  EXPECT_EQ(tree.shard_num(), 8);
+  random_ops(tree, 3);
+  // shards hold consecutive ranges of about the same size
+  for (uint32_t i = 0; i < tree.shard_num(); i++) {
+    auto &shard = tree.shard(i);
+    EXPECT_GT(shard.size(), tree.size() / 8 / 2);
+    if (i > 0) {
+      EXPECT_GE(shard.begin().key(), bounds[i - 1]);
+    }
+    if (i + 1 < tree.shard_num()) {
+      EXPECT_LT(shard.max().key(), bounds[i]);
+    }
+  }
+
+  uint64_t cnt = tree.scan("1", "2", [](std::string_view k, int64_t) {
+    EXPECT_EQ(k[0], '1');
+    return true;
+  });
+  EXPECT_GT(cnt, 0);
+
+  // even split of the first byte, empty shards are skipped over
+  Sharded bytes(16, ArtShardBy::RANGE);
+  random_ops(bytes, 4);
+
+  // more shards than byte values split the first two bytes
+  Sharded many(1000, ArtShardBy::RANGE);
+  random_ops(many, 5);
+  Sharded binary(1000, ArtShardBy::RANGE);
+  for (int32_t i = 0; i < 50000; i++) {
+    uint64_t v = rng();
+    binary.set(std::string(reinterpret_cast<const char *>(&v), sizeof(v)), 1);
+  }
+  for (uint32_t i = 0; i < binary.shard_num(); i++) {
+    EXPECT_GT(binary.shard(i).size(), 0) << i;
+  }
+}
+
+TEST(ShardedArtTreeTest, concurrent_writers) {
+  const int32_t thread_cnt = 4;
+  const int32_t per_thread = 20000;
+  for (auto by : {ArtShardBy::HASH, ArtShardBy::RANGE}) {
+    Sharded tree(16, by);
+    std::vector<std::thread> threads;
+    for (int32_t t = 0; t < thread_cnt; t++) {
+      threads.emplace_back([&tree, t]() {
+        for (int32_t i = 0; i < per_thread; i++) {
+          auto k = std::to_string(i) + "/" + std::to_string(t);
+          tree.set(k, i + 1);
+          EXPECT_EQ(tree.get(k), i + 1);
+          if (i % 4 == 0) tree.del(k);
+        }
+      });
+    }
+    for (auto &t : threads) t.join();
+    EXPECT_EQ(tree.size(), thread_cnt * (per_thread - per_thread / 4));
+    std::string last;
+    uint64_t cnt = 0;
+    for (auto it = tree.begin(); it.valid(); it.next(), cnt++) {
+      EXPECT_LT(last, it.key());
+      last = it.key();
+    }
+    EXPECT_EQ(cnt, tree.size());
+  }
+}
+
+}  // namespace art
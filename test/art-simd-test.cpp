@@ -0,0 +1,121 @@
+#include "art/art-simd.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+namespace art {
+namespace detail {
+
+// Every kernel must agree with the scalar one.
+class ArtSimdTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    LOG_INFO("simd level %s", art_simd_level_name(g_art_simd_level));
+  }
+
+  bool has_avx2() const { return g_art_simd_level == ART_SIMD_AVX2; }
+
+  std::mt19937_64 rng{0};
+};
+
+TEST_F(ArtSimdTest, find_and_lower_bound) {
+  for (int32_t round = 0; round < 2000; round++) {
+    uint32_t n = rng() % 17;
+    std::vector<uint8_t> all(256);
+    for (int32_t i = 0; i < 256; i++) all[i] = i;
+    std::shuffle(all.begin(), all.end(), rng);
+    alignas(16) uint8_t keys[16] = {0};
+    std::copy(all.begin(), all.begin() + n, keys);
+    std::sort(keys, keys + n);
+
+    for (int32_t b = 0; b <= 255; b++) {
+      int32_t expect = scalar::find_byte(keys, n, b);
+      uint32_t expect_lb = scalar::lower_bound(keys, n, b);
+      if (n <= 4) {
+        EXPECT_EQ(art_n4_find_swar(keys, n, b), expect);
+      }
+#if ART_SIMD_X86
+      EXPECT_EQ(sse2::find_byte(keys, n, b), expect);
+      EXPECT_EQ(sse2::lower_bound(keys, n, b), expect_lb);
+#endif
+      EXPECT_EQ(art_simd_find_n16(keys, n, b), expect);
+      EXPECT_EQ(art_simd_lower_bound(keys, n, b), expect_lb);
+    }
+  }
+}
+
+TEST_F(ArtSimdTest, node48_scan) {
+  for (int32_t round = 0; round < 200; round++) {
+    uint8_t index[256] = {0};
+    uint32_t density = rng() % 64 + 1;
+    for (int32_t i = 0; i < 256; i++) {
+      if (rng() % 256 < density) index[i] = rng() % 48 + 1;
+    }
+
+    for (int32_t from = -1; from <= 256; from++) {
+      if (from >= 0) {
+        int32_t expect = scalar::n48_first_ge(index, from);
+        EXPECT_EQ(art_simd_n48_first_ge(index, from), expect);
+#if ART_SIMD_X86
+        EXPECT_EQ(sse2::n48_first_ge(index, from), expect);
+        if (has_avx2()) {
+          EXPECT_EQ(avx2::n48_first_ge(index, from), expect);
+        }
+#endif
+      }
+      if (from <= 255) {
+        int32_t expect = scalar::n48_last_le(index, from);
+        EXPECT_EQ(art_simd_n48_last_le(index, from), expect);
+#if ART_SIMD_X86
+        EXPECT_EQ(sse2::n48_last_le(index, from), expect);
+        if (has_avx2()) {
+          EXPECT_EQ(avx2::n48_last_le(index, from), expect);
+        }
+#endif
+      }
+    }
+  }
+}
+
+TEST_F(ArtSimdTest, node256_scan) {
+  auto fake = reinterpret_cast<ArtNodeCommon *>(0x1000);
+  // a pointer with one zero half must count as present
+  auto low_zero = reinterpret_cast<ArtNodeCommon *>(0x100000000ULL);
+  for (int32_t round = 0; round < 200; round++) {
+    ArtNodeCommon *children[256] = {nullptr};
+    uint32_t density = rng() % 64 + 1;
+    for (int32_t i = 0; i < 256; i++) {
+      if (rng() % 256 < density) children[i] = rng() % 2 ? fake : low_zero;
+    }
+
+    for (int32_t from = -1; from <= 256; from++) {
+      if (from >= 0) {
+        int32_t expect = scalar::n256_first_ge(children, from);
+        EXPECT_EQ(art_simd_n256_first_ge(children, from), expect);
+#if ART_SIMD_X86
+        EXPECT_EQ(sse2::n256_first_ge(children, from), expect);
+        if (has_avx2()) {
+          EXPECT_EQ(avx2::n256_first_ge(children, from), expect);
+        }
+#endif
+      }
+      if (from <= 255) {
+        int32_t expect = scalar::n256_last_le(children, from);
+        EXPECT_EQ(art_simd_n256_last_le(children, from), expect);
+#if ART_SIMD_X86
+        EXPECT_EQ(sse2::n256_last_le(children, from), expect);
+        if (has_avx2()) {
+          EXPECT_EQ(avx2::n256_last_le(children, from), expect);
+        }
+#endif
+      }
+    }
+  }
+}
+
+}  // namespace detail
+}  // namespace art
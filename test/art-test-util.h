@@ -0,0 +1,22 @@
+#pragma once
+
+#include "gtest/gtest.h"
+
+namespace art {
+
+// Expect |tree| to hold exactly the pairs of the ordered map |expect|, in
+// its order. Works for anything with size() and begin() as ArtTree.
+template <class Tree, class Map>
+static void expect_tree(const Tree &tree, const Map &expect) {
+  EXPECT_EQ(tree.size(), expect.size());
+  auto e = expect.begin();
+  for (auto it = tree.begin(); it.valid(); it.next()) {
+    ASSERT_NE(e, expect.end());
+    EXPECT_EQ(it.key(), e->first);
+    EXPECT_EQ(it.value(), e->second);
+    ++e;
+  }
+  EXPECT_EQ(e, expect.end());
+}
+
+}  // namespace art
@@ -0,0 +1,214 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "art-test-util.h"
+#include "art/art.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+namespace art {
+
+using ArenaTree = ArtTree<int64_t, ArtStringKeyTraits, ArtArenaAlloc>;
+
+static void drain_epoch() {
+  while (epoch_pending()) epoch_reclaim();
+}
+
+TEST(ArtTreeArenaTest, random_ops) {
+  ArenaTree tree;
+  EXPECT_EQ(tree.allocator().used_bytes(), 0);
+  std::map<std::string, int64_t> verify_map;
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 100000; i++) {
+    auto k = std::to_string(rng() % 20000);
+    // long keys take leaves larger than any size class
+    if (i % 7 == 0) k = std::string(rng() % 3000, 'l') + k;
+    if (rng() % 3 == 0) {
+      auto it = verify_map.find(k);
+      ASSERT_EQ(tree.del(k), it == verify_map.end() ? 0 : it->second) << k;
+      if (it != verify_map.end()) verify_map.erase(it);
+    } else {
+      tree.set(k, i + 1);
+      verify_map[k] = i + 1;
+    }
+  }
+  expect_tree(tree, verify_map);
+  EXPECT_GT(tree.allocator().used_bytes(), 0);
+  EXPECT_GE(tree.allocator().bytes(), tree.allocator().used_bytes());
+}
+
+TEST(ArtTreeArenaTest, memory_follows_tree) {
+  ArenaTree tree;
+  for (int32_t i = 0; i < 50000; i++) tree.set(std::to_string(i), i + 1);
+  // nodes replaced by larger ones are freed after readers
+  drain_epoch();
+  size_t used = tree.allocator().used_bytes();
+  size_t bytes = tree.allocator().bytes();
+  EXPECT_GT(used, 50000 * sizeof(ArtLeaf<int64_t>));
+
+  for (int32_t i = 0; i < 50000; i++) tree.del(std::to_string(i));
+  drain_epoch();
+  EXPECT_FALSE(tree.begin().valid());
+  EXPECT_EQ(tree.allocator().used_bytes(), 0);
+  // freed nodes stay with the tree and are reused
+  EXPECT_EQ(tree.allocator().bytes(), bytes);
+  for (int32_t i = 0; i < 50000; i++) tree.set(std::to_string(i), i + 1);
+  drain_epoch();
+  EXPECT_EQ(tree.allocator().used_bytes(), used);
+  EXPECT_EQ(tree.allocator().bytes(), bytes);
+
+  tree.clear();
+  EXPECT_EQ(tree.size(), 0);
+  EXPECT_EQ(tree.get("1"), 0);
+  EXPECT_FALSE(tree.begin().valid());
+  EXPECT_EQ(tree.allocator().bytes(), 0);
+  tree.set("again", 1);
+  EXPECT_EQ(tree.get("again"), 1);
+  EXPECT_EQ(tree.size(), 1);
+}
+
+TEST(ArtTreeArenaTest, values_destroyed) {
+  using Value = std::shared_ptr<int32_t>;
+  auto v = std::make_shared<int32_t>(1);
+  {
+    ArtTree<Value, ArtStringKeyTraits, ArtArenaAlloc> tree;
+    for (int32_t i = 0; i < 1000; i++) tree.set(std::to_string(i), v);
+    tree.del("0");
+    drain_epoch();
+    EXPECT_EQ(v.use_count(), 1000);
+    // values of a cleared tree go after readers, with the old arena
+    tree.clear();
+    drain_epoch();
+    EXPECT_EQ(v.use_count(), 1);
+
+    for (int32_t i = 0; i < 1000; i++) tree.set(std::to_string(i), v);
+    drain_epoch();
+    EXPECT_EQ(v.use_count(), 1001);
+  }
+  EXPECT_EQ(v.use_count(), 1);
+}
+
+TEST(ArtTreeArenaTest, clear_pool_tree) {
+  ArtTree<int64_t> tree;
+  tree.clear();
+  for (int32_t i = 0; i < 10000; i++) tree.set(std::to_string(i), i + 1);
+  tree.clear();
+  EXPECT_EQ(tree.size(), 0);
+  EXPECT_FALSE(tree.begin().valid());
+  tree.set("a", 1);
+  EXPECT_EQ(tree.get("a"), 1);
+}
+
+TEST(ArtTreeArenaTest, snapshot_and_full_prefix) {
+  ArtTree<int64_t, ArtFullPrefixKeyTraits, ArtArenaAlloc> tree;
+  std::map<std::string, int64_t> verify_map;
+  std::string base(100, 'p');
+  for (int32_t i = 0; i < 5000; i++) {
+    tree.set(base + std::to_string(i), i + 1);
+    verify_map[base + std::to_string(i)] = i + 1;
+  }
+  {
+    auto snap = tree.snapshot();
+    auto old = verify_map;
+    for (int32_t i = 0; i < 5000; i += 2) {
+      tree.del(base + std::to_string(i));
+      verify_map.erase(base + std::to_string(i));
+    }
+    for (int32_t i = 0; i < 1000; i++) {
+      tree.set(base + "x" + std::to_string(i), i);
+      verify_map[base + "x" + std::to_string(i)] = i;
+    }
+    expect_tree(snap, old);
+    expect_tree(tree, verify_map);
+  }
+  expect_tree(tree, verify_map);
+  drain_epoch();
+
+  // a saved arena tree loads into a pool tree and back
+  std::string path = ::testing::TempDir() + "art-arena-" +
+                     std::to_string(getpid());
+  ASSERT_TRUE(tree.save(path));
+  ArtTree<int64_t, ArtFullPrefixKeyTraits> pool_tree;
+  ASSERT_TRUE(pool_tree.load(path));
+  expect_tree(pool_tree, verify_map);
+  ArtTree<int64_t, ArtFullPrefixKeyTraits, ArtArenaAlloc> copy;
+  ASSERT_TRUE(copy.load(path));
+  expect_tree(copy, verify_map);
+  EXPECT_GT(copy.allocator().used_bytes(), 0);
+  std::remove(path.c_str());
+}
+
+TEST(ArtTreeArenaTest, concurrent_writers_and_clear) {
+  const int32_t thread_cnt = 4;
+  const int32_t per_thread = 30000;
+  ArenaTree tree;
+  tree.set("base", 1);
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < thread_cnt; t++) {
+    threads.emplace_back([&tree, t]() {
+      for (int32_t i = 0; i < per_thread; i++) {
+        auto k = std::to_string(t) + "/" + std::to_string(i);
+        tree.set(k, i + 1);
+        if (i % 3 == 0) tree.del(k);
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  EXPECT_EQ(tree.size(), thread_cnt * (per_thread - per_thread / 3) + 1);
+  for (int32_t t = 0; t < thread_cnt; t++) {
+    for (int32_t i = 0; i < per_thread; i++) {
+      auto k = std::to_string(t) + "/" + std::to_string(i);
+      ASSERT_EQ(tree.get(k), i % 3 == 0 ? 0 : i + 1) << k;
+    }
+  }
+
+  // readers stay on the nodes of a cleared tree until they are done
+  std::atomic<bool> stop{false};
+  std::thread reader([&]() {
+    while (!stop) {
+      for (auto it = tree.begin(); it.valid(); it.next()) {
+        ASSERT_GT(it.value(), 0);
+      }
+    }
+  });
+  for (int32_t round = 0; round < 20; round++) {
+    tree.clear();
+    for (int32_t i = 0; i < 2000; i++) tree.set(std::to_string(i), i + 1);
+  }
+  stop = true;
+  reader.join();
+  EXPECT_EQ(tree.size(), 2000);
+}
+
+TEST(ArtTreeArenaTest, parallel_bulk_load) {
+  std::vector<std::pair<std::string, int64_t>> kvs;
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 100000; i++) {
+    kvs.emplace_back(std::to_string(rng()), i + 1);
+  }
+  std::map<std::string, int64_t> verify_map;
+  for (auto &kv : kvs) verify_map[kv.first] = kv.second;
+
+  ArenaTree tree;
+  EXPECT_EQ(tree.bulk_load(kvs.begin(), kvs.end(), 4), kvs.size());
+  expect_tree(tree, verify_map);
+  size_t used = tree.allocator().used_bytes();
+  EXPECT_GT(used, kvs.size() * sizeof(ArtLeaf<int64_t>));
+
+  // the same keys set one by one take the same nodes
+  ArenaTree other;
+  for (auto &iter : verify_map) other.set(iter.first, iter.second);
+  drain_epoch();
+  EXPECT_EQ(other.allocator().used_bytes(), used);
+}
+
+}  // namespace art
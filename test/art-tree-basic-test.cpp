@@ -1,5 +1,8 @@
+#include <algorithm>
 #include <random>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "art/art-printer.h"
 #include "art/art.h"
@@ -69,6 +72,17 @@ TEST_F(ArtTreeBasicTest, find_and_delete_not_exist) {
   del("adc");
 }
 
+TEST_F(ArtTreeBasicTest, delete_root_leaf) {
+  // a single key is a leaf right under the root
+  set("a", 1);
+  EXPECT_EQ(tree.size(), 1);
+  del("a");
+  EXPECT_EQ(tree.size(), 0);
+  EXPECT_EQ(tree.get_root_unsafe(), nullptr);
+  set("b", 2);
+  EXPECT_EQ(tree.size(), 1);
+}
+
 TEST_F(ArtTreeBasicTest, delete_a_prefix) {
   set("abcd", 1);
   set("accd", 2);
@@ -78,4 +92,223 @@ TEST_F(ArtTreeBasicTest, delete_a_prefix) {
   del("acddfgh");
 }
 
+TEST_F(ArtTreeBasicTest, conditional_write) {
+  auto decline = [](int64_t &, bool) { return false; };
+  // empty root, leaf split, prefix split and full/non-full inner node
+  for (auto &k : {"abc", "abd", "b", "a", "a0", "a1", "a2", "a3", "a4"}) {
+    tree.upsert(k, decline);
+    EXPECT_EQ(tree.size(), verify_map.size());
+    EXPECT_FALSE(tree.compare_and_set(k, 0, 1));
+    EXPECT_TRUE(tree.insert_if_absent(k, 1));
+    verify_map[k] = 1;
+  }
+
+  int64_t current = 0;
+  EXPECT_FALSE(tree.insert_if_absent("abc", 2, &current));
+  EXPECT_EQ(current, 1);
+  EXPECT_FALSE(tree.compare_and_set("abc", 2, 3));
+  EXPECT_TRUE(tree.compare_and_set("abc", 1, 3));
+  verify_map["abc"] = 3;
+
+  tree.upsert("abd", [](int64_t &v, bool exists) {
+    EXPECT_TRUE(exists);
+    v += 10;
+    return false;
+  });
+  verify_map["abd"] = 11;
+  tree.upsert("new", [](int64_t &v, bool exists) {
+    EXPECT_FALSE(exists);
+    EXPECT_EQ(v, 0);
+    v = 5;
+    return true;
+  });
+  verify_map["new"] = 5;
+  EXPECT_EQ(tree.size(), verify_map.size());
+}
+
+TEST_F(ArtTreeBasicTest, concurrent_upsert_counter) {
+  const int32_t thread_num = 4;
+  const int32_t key_cnt = 1000;
+  const int32_t round = 20;
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < thread_num; t++) {
+    threads.emplace_back([&]() {
+      for (int32_t r = 0; r < round; r++) {
+        for (int32_t i = 0; i < key_cnt; i++) {
+          tree.upsert("counter" + std::to_string(i), [](int64_t &v, bool) {
+            v++;
+            return true;
+          });
+        }
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  for (int32_t i = 0; i < key_cnt; i++) {
+    verify_map["counter" + std::to_string(i)] = thread_num * round;
+  }
+  EXPECT_EQ(tree.size(), key_cnt);
+}
+
+TEST_F(ArtTreeBasicTest, concurrent_writers_disjoint_keys) {
+  // Writers below a Node4/16 slot race with sibling inserts and deletes
+  // that move the slot, no key may land in or vanish from a sibling.
+  const int32_t thread_num = 4;
+  // a multiple of 3, each thread deletes its own keys only
+  const int32_t per_thread = 48000;
+  std::vector<std::string> keys;
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < thread_num * per_thread; i++) {
+    keys.push_back("user/" + std::to_string(rng() % 1000) + "/" +
+                   std::to_string(rng()));
+  }
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < thread_num; t++) {
+    threads.emplace_back([&, t]() {
+      for (int32_t i = t * per_thread; i < (t + 1) * per_thread; i++) {
+        tree.set(keys[i], i + 1);
+        if (i % 3 == 2) tree.del(keys[i - 1]);
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  for (int32_t i = 0; i < thread_num * per_thread; i++) {
+    if (i % 3 != 1) verify_map[keys[i]] = i + 1;
+  }
+  EXPECT_EQ(tree.size(), verify_map.size());
+}
+
+TEST_F(ArtTreeBasicTest, size_modes) {
+  EXPECT_EQ(tree.size_mode(), ArtSizeMode::STRIPED);
+  for (auto mode : {ArtSizeMode::STRIPED, ArtSizeMode::EXACT}) {
+    ArtTree<int64_t> t(mode);
+    EXPECT_EQ(t.size_mode(), mode);
+    // a single key is a leaf right under the root
+    t.set("a", 1);
+    EXPECT_EQ(t.size(), 1);
+    EXPECT_EQ(t.del("a"), 1);
+    EXPECT_EQ(t.size(), 0);
+    EXPECT_EQ(t.del("a"), 0);
+    EXPECT_EQ(t.size(), 0);
+
+    // keys inserted on some threads and deleted on others
+    const int32_t thread_num = 4;
+    const int32_t per_thread = 20000;
+    std::vector<std::thread> threads;
+    for (int32_t r = 0; r < 2; r++) {
+      for (int32_t th = 0; th < thread_num; th++) {
+        threads.emplace_back([&t, r, th]() {
+          for (int32_t i = 0; i < per_thread; i++) {
+            auto k = std::to_string(th) + "/" + std::to_string(i);
+            if (r == 0) {
+              t.set(k, i + 1);
+            } else if (i % 2) {
+              // deletes the keys of the next thread
+              t.del(std::to_string((th + 1) % thread_num) + "/" +
+                    std::to_string(i));
+            }
+          }
+        });
+      }
+      for (auto &th : threads) th.join();
+      threads.clear();
+    }
+    EXPECT_EQ(t.size(), thread_num * per_thread / 2);
+    t.clear();
+    EXPECT_EQ(t.size(), 0);
+  }
+
+  // threads in a row take stripes of their own, as many as there are
+  uint32_t stripe_num = detail::art_stripe_num();
+  EXPECT_GE(stripe_num, std::thread::hardware_concurrency());
+  std::vector<uint32_t> stripes(stripe_num);
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < stripe_num; i++) {
+    threads.emplace_back(
+        [&stripes, i]() { stripes[i] = detail::art_thread_stripe(); });
+    threads.back().join();
+  }
+  std::sort(stripes.begin(), stripes.end());
+  EXPECT_EQ(std::unique(stripes.begin(), stripes.end()), stripes.end());
+
+  // the stripe array comes with the second thread only
+  detail::ArtLazyStripes<std::atomic<int32_t>> lazy;
+  auto count = [&lazy]() {
+    uint32_t n = 0;
+    lazy.for_each([&n](std::atomic<int32_t> &) { n++; });
+    return n;
+  };
+  lazy.local()++;
+  lazy.local()++;
+  EXPECT_EQ(count(), 1);
+  EXPECT_EQ(lazy.first().load(), 2);
+  std::thread([&lazy]() { lazy.local()++; }).join();
+  EXPECT_EQ(count(), 1 + stripe_num);
+  int32_t sum = 0;
+  lazy.for_each([&sum](std::atomic<int32_t> &s) { sum += s.load(); });
+  EXPECT_EQ(sum, 3);
+}
+
+static ArtNodeType root_type_after(const ArtShrinkPolicy &policy,
+                                   int32_t fill, int32_t keep) {
+  ArtTree<int64_t> t(policy);
+  for (int32_t i = 0; i < fill; i++) t.set("k" + std::string(1, i), i + 1);
+  for (int32_t i = keep; i < fill; i++) t.del("k" + std::string(1, i));
+  for (int32_t i = 0; i < keep; i++) {
+    EXPECT_EQ(t.get("k" + std::string(1, i)), i + 1);
+  }
+  return t.get_root_unsafe()->type;
+}
+
+TEST_F(ArtTreeBasicTest, shrink_policy) {
+  auto eager = ArtShrinkPolicy::eager();
+  ArtShrinkPolicy lazy;
+  EXPECT_TRUE(eager.valid());
+  EXPECT_TRUE(lazy.valid());
+  EXPECT_FALSE((ArtShrinkPolicy{1, 12, 37}.valid()));
+  EXPECT_FALSE((ArtShrinkPolicy{3, 17, 37}.valid()));
+
+  // one past each grow boundary, then back to it
+  EXPECT_EQ(root_type_after(eager, 5, 4), ART_NODE_4);
+  EXPECT_EQ(root_type_after(lazy, 5, 4), ART_NODE_16);
+  EXPECT_EQ(root_type_after(lazy, 5, 3), ART_NODE_4);
+  EXPECT_EQ(root_type_after(eager, 17, 16), ART_NODE_16);
+  EXPECT_EQ(root_type_after(lazy, 17, 16), ART_NODE_48);
+  EXPECT_EQ(root_type_after(lazy, 17, 12), ART_NODE_16);
+  EXPECT_EQ(root_type_after(eager, 49, 48), ART_NODE_48);
+  EXPECT_EQ(root_type_after(lazy, 49, 48), ART_NODE_256);
+  EXPECT_EQ(root_type_after(lazy, 49, 37), ART_NODE_48);
+  EXPECT_EQ(root_type_after(lazy, 200, 2), ART_NODE_4);
+}
+
+TEST_F(ArtTreeBasicTest, concurrent_shrink_siblings) {
+  // Each thread grows and shrinks its own subtrees, the replaced nodes all
+  // hang off the same root and are swapped in concurrently.
+  const int32_t thread_num = 4;
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < thread_num; t++) {
+    threads.emplace_back([&, t]() {
+      for (int32_t r = 0; r < 50; r++) {
+        for (int32_t sub = t * 8; sub < t * 8 + 8; sub++) {
+          std::string prefix = "p" + std::string(1, 'a' + sub);
+          int32_t fill = 20 + (r * 7 + sub) % 40;
+          for (int32_t i = 0; i < fill; i++) {
+            tree.set(prefix + std::string(1, i), i + 1);
+          }
+          for (int32_t i = 2; i < fill; i++) {
+            tree.del(prefix + std::string(1, i));
+          }
+        }
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  for (int32_t sub = 0; sub < thread_num * 8; sub++) {
+    std::string prefix = "p" + std::string(1, 'a' + sub);
+    verify_map[prefix + std::string(1, 0)] = 1;
+    verify_map[prefix + std::string(1, 1)] = 2;
+  }
+  EXPECT_EQ(tree.size(), verify_map.size());
+}
+
 }  // namespace art
@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "art/art.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+static const char *bulk_words_data[] = {
+#include "data/words.txt"
+};
+
+static const char *bulk_uuid_data[] = {
+#include "data/uuid.txt"
+};
+
+namespace art {
+
+class ArtTreeBulkLoadTest : public ::testing::Test {
+ public:
+  void TearDown() override {
+    EXPECT_EQ(tree.size(), verify_map.size());
+    for (auto &iter : verify_map) {
+      EXPECT_EQ(tree.get(iter.first), iter.second) << iter.first;
+    }
+    auto expect = verify_map.begin();
+    for (auto it = tree.begin(); it.valid(); it.next()) {
+      ASSERT_NE(expect, verify_map.end());
+      EXPECT_EQ(it.key(), expect->first);
+      ++expect;
+    }
+    EXPECT_EQ(expect, verify_map.end());
+
+    // built tree must stay usable for normal writers
+    for (auto &iter : verify_map) {
+      EXPECT_EQ(tree.del(iter.first), iter.second) << iter.first;
+    }
+    EXPECT_EQ(tree.get_root_unsafe(), nullptr);
+  }
+
+  void load(const std::vector<std::pair<std::string, int64_t>> &pairs) {
+    for (auto &p : pairs) verify_map[p.first] = p.second;
+    EXPECT_EQ(tree.bulk_load(pairs.begin(), pairs.end()), pairs.size());
+  }
+
+  std::map<std::string, int64_t> verify_map;
+  ArtTree<int64_t> tree;
+};
+
+TEST_F(ArtTreeBulkLoadTest, empty_and_single) {
+  load({});
+  EXPECT_EQ(tree.get_root_unsafe(), nullptr);
+  load({{"abc", 1}});
+  EXPECT_EQ(tree.get_root_unsafe()->type, ArtNodeType::ART_NODE_LEAF);
+}
+
+TEST_F(ArtTreeBulkLoadTest, prefix_keys_and_duplicates) {
+  load({{"", 1},
+        {"a", 2},
+        {"ab", 3},
+        {"ab", 4},
+        {"abc", 5},
+        {"abcdefghijklmnop1", 6},
+        {"abcdefghijklmnop2", 7},
+        {"abcdefghijklmnoq", 8},
+        {"b", 9}});
+  verify_map["ab"] = 4;
+}
+
+TEST_F(ArtTreeBulkLoadTest, node_types) {
+  // 3, 10, 40 and 200 children under "k", each child fan out differently
+  std::vector<std::pair<std::string, int64_t>> pairs;
+  for (int32_t fan : {3, 10, 40, 200}) {
+    for (int32_t i = 0; i < fan; i++) {
+      std::string k = "k" + std::to_string(fan);
+      k.push_back('/');
+      k.push_back((char)i);
+      pairs.emplace_back(k, fan * 1000 + i);
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+  load(pairs);
+
+  auto type_at = [&](const std::string &prefix) {
+    ArtNodeCommon *node = tree.get_root_unsafe();
+    uint32_t depth = 0;
+    while (depth + node->keyLen < prefix.size()) {
+      depth += node->keyLen;
+      node = *detail::art_find_child(node, prefix[depth]);
+      depth++;
+    }
+    return node->type;
+  };
+  EXPECT_EQ(type_at("k3/"), ArtNodeType::ART_NODE_4);
+  EXPECT_EQ(type_at("k10/"), ArtNodeType::ART_NODE_16);
+  EXPECT_EQ(type_at("k40/"), ArtNodeType::ART_NODE_48);
+  EXPECT_EQ(type_at("k200/"), ArtNodeType::ART_NODE_256);
+}
+
+TEST_F(ArtTreeBulkLoadTest, real_data) {
+  std::vector<std::pair<std::string, int64_t>> pairs;
+  for (auto w : bulk_words_data) pairs.emplace_back(w, pairs.size() + 1);
+  for (auto u : bulk_uuid_data) pairs.emplace_back(u, pairs.size() + 1);
+  std::sort(pairs.begin(), pairs.end());
+  load(pairs);
+}
+
+TEST_F(ArtTreeBulkLoadTest, random_binary_keys) {
+  std::mt19937_64 rng(0);
+  std::map<std::string, int64_t> sorted;
+  char buf[sizeof(uint64_t)];
+  for (int32_t i = 0; i < 50000; i++) {
+    *reinterpret_cast<uint64_t *>(buf) = rng() & 0xff00ff00ff00ffffULL;
+    sorted[std::string(buf, sizeof(uint64_t))] = i + 1;
+  }
+  load({sorted.begin(), sorted.end()});
+}
+
+TEST_F(ArtTreeBulkLoadTest, unsorted_tail_falls_back) {
+  std::vector<std::pair<std::string, int64_t>> pairs;
+  for (int32_t i = 0; i < 1000; i++) {
+    pairs.emplace_back("key" + std::to_string(i), i + 1);
+  }
+  load(pairs);
+}
+
+TEST_F(ArtTreeBulkLoadTest, non_empty_tree_falls_back) {
+  tree.set("key500", 1);
+  verify_map["key500"] = 1;
+  std::vector<std::pair<std::string, int64_t>> pairs;
+  for (int32_t i = 0; i < 1000; i++) {
+    pairs.emplace_back("key" + std::to_string(i), i + 1);
+  }
+  std::sort(pairs.begin(), pairs.end());
+  load(pairs);
+}
+
+TEST_F(ArtTreeBulkLoadTest, parallel_sorted) {
+  std::vector<std::pair<std::string, int64_t>> pairs;
+  for (auto w : bulk_words_data) pairs.emplace_back(w, pairs.size() + 1);
+  std::sort(pairs.begin(), pairs.end());
+  for (auto &p : pairs) verify_map[p.first] = p.second;
+  EXPECT_EQ(tree.bulk_load(pairs.begin(), pairs.end(), 4), pairs.size());
+}
+
+TEST_F(ArtTreeBulkLoadTest, parallel_unsorted_with_duplicates) {
+  std::mt19937_64 rng(0);
+  std::vector<std::pair<std::string, int64_t>> pairs;
+  for (int32_t i = 0; i < 100000; i++) {
+    // shared prefix, then skewed leading bytes
+    std::string k = "tenant/" + std::to_string(rng() % 3) + "/";
+    k += std::to_string(rng() % 50000);
+    pairs.emplace_back(k, i + 1);
+    verify_map[k] = i + 1;
+  }
+  for (auto u : bulk_uuid_data) {
+    pairs.emplace_back(u, pairs.size() + 1);
+    verify_map[u] = pairs.size();
+  }
+  EXPECT_EQ(tree.bulk_load(pairs.begin(), pairs.end(), 3), pairs.size());
+}
+
+TEST_F(ArtTreeBulkLoadTest, parallel_binary_keys) {
+  std::mt19937_64 rng(0);
+  std::vector<std::pair<std::string, int64_t>> pairs;
+  char buf[sizeof(uint64_t)];
+  for (int32_t i = 0; i < 50000; i++) {
+    *reinterpret_cast<uint64_t *>(buf) = rng() & 0xff00ff00ff00ffffULL;
+    pairs.emplace_back(std::string(buf, sizeof(uint64_t)), i + 1);
+    verify_map[pairs.back().first] = i + 1;
+  }
+  EXPECT_EQ(tree.bulk_load(pairs.begin(), pairs.end(), 2), pairs.size());
+}
+
+TEST_F(ArtTreeBulkLoadTest, parallel_small_and_non_empty) {
+  std::vector<std::pair<std::string, int64_t>> pairs = {
+      {"b", 1}, {"a", 2}, {"c", 3}, {"a", 4}};
+  verify_map = {{"a", 4}, {"b", 1}, {"c", 3}};
+  EXPECT_EQ(tree.bulk_load(pairs.begin(), pairs.end(), 8), pairs.size());
+  EXPECT_EQ(tree.size(), 3);
+
+  pairs = {{"d", 5}, {"a", 6}};
+  verify_map["d"] = 5;
+  verify_map["a"] = 6;
+  EXPECT_EQ(tree.bulk_load(pairs.begin(), pairs.end(), 8), pairs.size());
+}
+
+}  // namespace art
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "art/art.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+namespace art {
+
+static std::string url_key(uint64_t tenant, uint64_t obj) {
+  return "https://storage.example.com/v1/accounts/" + std::to_string(tenant) +
+         "/containers/default/objects/" + std::to_string(obj);
+}
+
+class ArtTreeFullPrefixTest : public ::testing::Test {
+ public:
+  void TearDown() override { verify(); }
+
+  void verify() {
+    EXPECT_EQ(tree.size(), verify_map.size());
+    for (auto &iter : verify_map) {
+      EXPECT_EQ(tree.get(iter.first), iter.second) << iter.first;
+    }
+    auto expect = verify_map.begin();
+    for (auto it = tree.begin(); it.valid(); it.next()) {
+      ASSERT_NE(expect, verify_map.end());
+      EXPECT_EQ(it.key(), expect->first);
+      EXPECT_EQ(it.value(), expect->second);
+      ++expect;
+    }
+    EXPECT_EQ(expect, verify_map.end());
+  }
+
+  void set(const std::string &key, int64_t val) {
+    verify_map[key] = val;
+    tree.set(key, val);
+  }
+
+  void del(const std::string &key) {
+    auto iter = verify_map.find(key);
+    EXPECT_EQ(tree.del(key), iter == verify_map.end() ? 0 : iter->second);
+    if (iter != verify_map.end()) verify_map.erase(iter);
+  }
+
+  std::map<std::string, int64_t> verify_map;
+  ArtTree<int64_t, ArtFullPrefixKeyTraits> tree;
+};
+
+TEST_F(ArtTreeFullPrefixTest, split_and_collapse) {
+  set("abcdefghijklmnop1", 1);
+  set("abcdefghijklmnop2", 2);
+  EXPECT_TRUE(tree.get_root_unsafe()->has_full_prefix());
+  EXPECT_EQ(tree.get_root_unsafe()->to_string(), "abcdefghijklmnop");
+  EXPECT_EQ(tree.get("abcdefghijklmnoz1"), 0);
+  EXPECT_EQ(tree.get("abcdefghijklmno"), 0);
+
+  // split the long prefix near its end, then near its start
+  set("abcdefghijklmnoq", 3);
+  set("abcdefghijklzzzz", 4);
+  set("abzz", 5);
+  verify();
+
+  // removing the splits merges prefixes back into long ones
+  del("abzz");
+  del("abcdefghijklzzzz");
+  verify();
+  del("abcdefghijklmnoq");
+  EXPECT_TRUE(tree.get_root_unsafe()->has_full_prefix());
+  EXPECT_EQ(tree.get_root_unsafe()->to_string(), "abcdefghijklmnop");
+  del("abcdefghijklmnop1");
+  EXPECT_EQ(tree.get("abcdefghijklmnop2"), 2);
+}
+
+TEST_F(ArtTreeFullPrefixTest, long_shared_prefix) {
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 20000; i++) {
+    set(url_key(rng() % 50, rng() % 100000), i + 1);
+  }
+  std::vector<std::string> keys;
+  for (auto &iter : verify_map) keys.push_back(iter.first);
+  std::shuffle(keys.begin(), keys.end(), rng);
+  for (size_t i = 0; i < keys.size(); i += 2) del(keys[i]);
+  for (int32_t i = 0; i < 1000; i++) del(url_key(rng() % 50, rng() % 100000));
+  verify();
+
+  for (int32_t i = 0; i < 1000; i++) {
+    auto k = url_key(rng() % 60, rng() % 100000);
+    auto lb = tree.lower_bound(k);
+    auto expect = verify_map.lower_bound(k);
+    if (expect == verify_map.end()) {
+      EXPECT_FALSE(lb.valid()) << k;
+    } else {
+      ASSERT_TRUE(lb.valid()) << k;
+      EXPECT_EQ(lb.key(), expect->first);
+    }
+  }
+
+  for (uint64_t tenant = 0; tenant < 60; tenant += 7) {
+    std::string prefix = url_key(tenant, 1);
+    uint64_t cnt = tree.scan_prefix(
+        prefix, [](std::string_view, int64_t) { return true; });
+    uint64_t expect = 0;
+    for (auto it = verify_map.lower_bound(prefix);
+         it != verify_map.end() && it->first.rfind(prefix, 0) == 0; ++it) {
+      expect++;
+    }
+    EXPECT_EQ(cnt, expect) << prefix;
+  }
+
+  while (verify_map.size() > 1) del(verify_map.begin()->first);
+  EXPECT_EQ(tree.get_root_unsafe()->type, ArtNodeType::ART_NODE_LEAF);
+}
+
+TEST_F(ArtTreeFullPrefixTest, bulk_load) {
+  std::vector<std::pair<std::string, int64_t>> pairs;
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 20000; i++) {
+    pairs.emplace_back(url_key(rng() % 50, rng() % 100000), i + 1);
+  }
+  for (auto &p : pairs) verify_map[p.first] = p.second;
+  tree.bulk_load(pairs.begin(), pairs.end(), 2);
+  verify();
+
+  for (int32_t i = 0; i < 5000; i++) {
+    del(pairs[rng() % pairs.size()].first);
+    set(url_key(rng() % 50, rng() % 100000), i);
+  }
+}
+
+TEST_F(ArtTreeFullPrefixTest, concurrent_readers) {
+  // Fixed keys stay, the writer keeps splitting and merging their paths.
+  const int32_t key_cnt = 2000;
+  for (int32_t i = 0; i < key_cnt; i++) set(url_key(1, i * 10), i + 1);
+
+  std::atomic<bool> stop{false};
+  std::thread reader([&]() {
+    std::mt19937 rng(0);
+    while (!stop.load()) {
+      int32_t i = rng() % key_cnt;
+      ASSERT_EQ(tree.get(url_key(1, i * 10)), i + 1);
+    }
+  });
+  for (int32_t round = 0; round < 20; round++) {
+    for (int32_t i = 0; i < key_cnt; i += 3) {
+      tree.set(url_key(1, i * 10 + 1), -1);
+      tree.set(url_key(round, 7), -1);
+    }
+    for (int32_t i = 0; i < key_cnt; i += 3) {
+      tree.del(url_key(1, i * 10 + 1));
+      tree.del(url_key(round, 7));
+    }
+  }
+  stop = true;
+  reader.join();
+}
+
+}  // namespace art
@@ -0,0 +1,355 @@
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <thread>
+
+#include "art/art.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+namespace art {
+
+class ArtTreeIteratorTest : public ::testing::Test {
+ public:
+  void set(const std::string& key, int64_t val) {
+    verify_map[key] = val;
+    tree.set(key.c_str(), key.size(), val);
+  }
+
+  void del(const std::string& key) {
+    verify_map.erase(key);
+    tree.del(key.data(), key.size());
+  }
+
+  void verify_forward() {
+    auto expect = verify_map.begin();
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+      ASSERT_NE(expect, verify_map.end());
+      EXPECT_EQ(it.key(), expect->first);
+      EXPECT_EQ(it.value(), expect->second);
+      ++expect;
+    }
+    EXPECT_EQ(expect, verify_map.end());
+  }
+
+  void verify_backward() {
+    auto expect = verify_map.rbegin();
+    for (auto it = tree.max(); it.valid(); it.prev()) {
+      ASSERT_NE(expect, verify_map.rend());
+      EXPECT_EQ(it.key(), expect->first);
+      ++expect;
+    }
+    EXPECT_EQ(expect, verify_map.rend());
+  }
+
+  void verify_bound(const std::string& k) {
+    auto lb = tree.lower_bound(k);
+    auto expect_lb = verify_map.lower_bound(k);
+    if (expect_lb == verify_map.end()) {
+      EXPECT_FALSE(lb.valid()) << k;
+    } else {
+      ASSERT_TRUE(lb.valid()) << k;
+      EXPECT_EQ(lb.key(), expect_lb->first);
+    }
+
+    auto ub = tree.upper_bound(k);
+    auto expect_ub = verify_map.upper_bound(k);
+    if (expect_ub == verify_map.end()) {
+      EXPECT_FALSE(ub.valid()) << k;
+    } else {
+      ASSERT_TRUE(ub.valid()) << k;
+      EXPECT_EQ(ub.key(), expect_ub->first);
+    }
+
+    // last key <= k
+    auto prev = tree.max();
+    prev.seek_for_prev(k.data(), k.size());
+    if (expect_ub == verify_map.begin()) {
+      EXPECT_FALSE(prev.valid()) << k;
+    } else {
+      ASSERT_TRUE(prev.valid()) << k;
+      EXPECT_EQ(prev.key(), std::prev(expect_ub)->first);
+    }
+  }
+
+  std::map<std::string, int64_t> verify_map;
+  using Tree = ArtTree<int64_t>;
+  Tree tree;
+};
+
+TEST_F(ArtTreeIteratorTest, empty) {
+  EXPECT_FALSE(tree.begin().valid());
+  EXPECT_FALSE(tree.max().valid());
+  EXPECT_FALSE(tree.lower_bound("abc").valid());
+  EXPECT_EQ(tree.scan("", "", [](std::string_view, int64_t) { return true; }),
+            0);
+}
+
+TEST_F(ArtTreeIteratorTest, single) {
+  set("abc", 1);
+  verify_forward();
+  verify_backward();
+  verify_bound("ab");
+  verify_bound("abc");
+  verify_bound("abcd");
+}
+
+TEST_F(ArtTreeIteratorTest, prefix_and_long_prefix) {
+  set("a", 1);
+  set("ab", 2);
+  set("abc", 3);
+  set("abcdefghijklmnop1", 4);
+  set("abcdefghijklmnop2", 5);
+  set("abcdefghijklmnoq", 6);
+  set("b", 7);
+  verify_forward();
+  verify_backward();
+
+  for (auto& k :
+       {"", "a", "aa", "ab", "abb", "abcd", "abcdefghijklmnop", "abcdefghijk",
+        "abcdefghijklmnop15", "abcdefghijklmnoz", "abcdefghijklmnoa", "b", "c",
+        "abcdefghiz", "abcdefghia"}) {
+    verify_bound(k);
+  }
+}
+
+TEST_F(ArtTreeIteratorTest, seek_key_ending_at_inner_node) {
+  // the seek key runs out where keys below go on with a zero byte
+  set(std::string("a\0QQx\1", 6), 1);
+  set(std::string("a\0QQy\1", 6), 2);
+  set(std::string("a\5z\1", 4), 3);
+  set(std::string("b\0\0c", 4), 4);
+  set(std::string("b\0\0d", 4), 5);
+  verify_forward();
+  verify_backward();
+
+  for (auto& k : {std::string("a"), std::string("a\0", 2),
+                  std::string("a\0Q", 3), std::string("a\0QQ", 4),
+                  std::string("b"), std::string("b\0", 2),
+                  std::string("b\0\0", 3), std::string("")}) {
+    verify_bound(k);
+    // nothing past the key is read
+    std::unique_ptr<char[]> buf(new char[k.size()]);
+    std::memcpy(buf.get(), k.data(), k.size());
+    auto lb = tree.lower_bound(buf.get(), k.size());
+    auto expect = verify_map.lower_bound(k);
+    ASSERT_EQ(lb.valid(), expect != verify_map.end()) << k;
+    if (lb.valid()) {
+      EXPECT_EQ(lb.key(), expect->first);
+    }
+    auto prev = tree.max();
+    prev.seek_before(buf.get(), k.size());
+    ASSERT_EQ(prev.valid(), expect != verify_map.begin()) << k;
+    if (prev.valid()) {
+      EXPECT_EQ(prev.key(), std::prev(expect)->first);
+    }
+  }
+}
+
+TEST_F(ArtTreeIteratorTest, random) {
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 20000; i++) {
+    set(std::to_string(rng() % 1000000), i);
+  }
+  // dense keys make Node48 and Node256
+  for (int32_t i = 0; i < 256 * 3; i++) {
+    std::string k = "dense";
+    k.push_back((char)(i % 256));
+    k.push_back((char)(i / 256 + 1));
+    set(k, i);
+  }
+  verify_forward();
+  verify_backward();
+  for (int32_t i = 0; i < 2000; i++) {
+    verify_bound(std::to_string(rng() % 1000000));
+  }
+
+  for (int32_t i = 0; i < 2000; i++) {
+    auto start = std::to_string(rng() % 1000000);
+    auto end = std::to_string(rng() % 1000000);
+    std::vector<std::string> got;
+    tree.scan(start, end, [&](std::string_view k, int64_t) {
+      got.emplace_back(k);
+      return got.size() < 100;
+    });
+    std::vector<std::string> expect;
+    for (auto it = verify_map.lower_bound(start);
+         it != verify_map.end() && it->first < end && expect.size() < 100;
+         ++it) {
+      expect.push_back(it->first);
+    }
+    EXPECT_EQ(got, expect);
+  }
+}
+
+TEST_F(ArtTreeIteratorTest, caller_key_buffer) {
+  for (int32_t i = 0; i < 100; i++) set("key" + std::to_string(i), i);
+  std::string buf;
+  int32_t cnt = 0;
+  tree.scan(
+      "key", 3, "", 0,
+      [&](std::string_view k, int64_t) {
+        EXPECT_EQ(k.data(), buf.data());
+        cnt++;
+        return true;
+      },
+      &buf);
+  EXPECT_EQ(cnt, 100);
+}
+
+TEST_F(ArtTreeIteratorTest, scan_prefix) {
+  const char* words[] = {"a",
+                         "app",
+                         "apple",
+                         "applet",
+                         "application",
+                         "apply",
+                         "banana",
+                         "band",
+                         "http://example.com/tenant/1/a",
+                         "http://example.com/tenant/1/b",
+                         "http://example.com/tenant/10/a",
+                         "http://example.com/tenant/2/a",
+                         "http://example.org/x"};
+  for (auto w : words) set(w, 1);
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 5000; i++) {
+    set("http://example.com/tenant/" + std::to_string(rng() % 100) + "/" +
+            std::to_string(rng() % 100),
+        i);
+  }
+
+  auto verify_prefix = [&](const std::string& prefix) {
+    std::vector<std::string> got;
+    tree.scan_prefix(prefix, [&](std::string_view k, int64_t) {
+      got.emplace_back(k);
+      return true;
+    });
+    std::vector<std::string> expect;
+    for (auto it = verify_map.lower_bound(prefix);
+         it != verify_map.end() &&
+         it->first.compare(0, prefix.size(), prefix) == 0;
+         ++it) {
+      expect.push_back(it->first);
+    }
+    EXPECT_EQ(got, expect) << prefix;
+  };
+
+  for (auto& p : {"", "a", "ap", "app", "appl", "apple", "applez", "b", "ban",
+                  "banana", "bananas", "c", "http://", "http://example.com/",
+                  "http://example.com/tenant/1", "http://example.com/tenant/1/",
+                  "http://example.com/tenant/10/", "http://example.org",
+                  "http://example.net", "http://examplf"}) {
+    verify_prefix(p);
+  }
+  for (int32_t i = 0; i < 100; i++) {
+    verify_prefix("http://example.com/tenant/" + std::to_string(i) + "/");
+  }
+}
+
+TEST_F(ArtTreeIteratorTest, copy_and_move) {
+  for (int32_t i = 0; i < 100; i++) set("a" + std::to_string(i), i);
+  for (int32_t i = 0; i < 100; i++) set("b" + std::to_string(i), i);
+  auto count_rest = [](Tree::Iterator it) {
+    int32_t cnt = 0;
+    for (; it.valid(); it.next()) {
+      EXPECT_EQ(it.key()[0], 'a');
+      cnt++;
+    }
+    return cnt;
+  };
+
+  auto it = tree.min();
+  it.seek_prefix("a", 1);
+  it.next();
+  // copies stay within the prefix
+  Tree::Iterator copy(it);
+  EXPECT_EQ(copy.key(), it.key());
+  EXPECT_EQ(count_rest(copy), 99);
+  Tree::Iterator assigned;
+  assigned = it;
+  EXPECT_EQ(count_rest(assigned), 99);
+
+  // moves take the position and a caller key buffer along
+  std::string buf;
+  auto from = tree.lower_bound("a5", 2, &buf);
+  from.seek_prefix("a", 1);
+  from.next();
+  Tree::Iterator moved(std::move(from));
+  EXPECT_FALSE(from.valid());
+  EXPECT_EQ(moved.key().data(), buf.data());
+  Tree::Iterator move_assigned = tree.max();
+  move_assigned = std::move(moved);
+  EXPECT_FALSE(moved.valid());
+  EXPECT_EQ(count_rest(std::move(move_assigned)), 99);
+  EXPECT_EQ(count_rest(it), 99);
+}
+
+TEST_F(ArtTreeIteratorTest, scan_with_concurrent_writer) {
+  // Even keys stay, odd keys are inserted and deleted by writer.
+  const int32_t key_cnt = 20000;
+  auto key_of = [](int32_t i) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "k%08d", i);
+    return std::string(buf);
+  };
+  for (int32_t i = 0; i < key_cnt; i += 2) tree.set(key_of(i), i);
+
+  std::atomic<bool> stop{false};
+  std::thread writer([&]() {
+    while (!stop.load()) {
+      for (int32_t i = 1; i < key_cnt; i += 2) tree.set(key_of(i), i);
+      for (int32_t i = 1; i < key_cnt; i += 2) tree.del(key_of(i));
+    }
+  });
+
+  for (int32_t round = 0; round < 10; round++) {
+    std::string last;
+    int32_t even = 0;
+    for (auto it = tree.begin(); it.valid(); it.next()) {
+      std::string k(it.key());
+      ASSERT_LT(last, k);
+      if (it.value() % 2 == 0) {
+        ASSERT_EQ(k, key_of(even * 2));
+        even++;
+      }
+      last = k;
+    }
+    EXPECT_EQ(even, key_cnt / 2);
+  }
+  stop = true;
+  writer.join();
+}
+
+TEST_F(ArtTreeIteratorTest, scan_with_concurrent_updates) {
+  // Writer only updates values, every scan sees every key once.
+  const int32_t key_cnt = 1000;
+  auto key_of = [](int32_t i) { return "k" + std::to_string(i); };
+  for (int32_t i = 0; i < key_cnt; i++) tree.set(key_of(i), i);
+
+  std::atomic<bool> stop{false};
+  std::thread writer([&]() {
+    int64_t v = 0;
+    while (!stop.load()) {
+      for (int32_t i = 0; i < key_cnt; i++) tree.set(key_of(i), v++);
+    }
+  });
+
+  for (int32_t round = 0; round < 2000; round++) {
+    std::string last;
+    int32_t cnt = 0;
+    for (auto it = tree.begin(); it.valid(); it.next()) {
+      std::string k(it.key());
+      ASSERT_LT(last, k);
+      last = k;
+      cnt++;
+    }
+    ASSERT_EQ(cnt, key_cnt);
+  }
+  stop = true;
+  writer.join();
+}
+
+}  // namespace art
@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "art-test-util.h"
+#include "art/art.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+static const char *lazy_uuid_data[] = {
+#include "data/uuid.txt"
+};
+
+namespace art {
+
+struct LazyRecord {
+  std::string key;
+  int64_t payload;
+};
+
+// Values are pointers to records that carry their key.
+struct LazyRecordKeyTraits : ArtStringKeyTraits {
+  static constexpr bool LAZY_LEAF = true;
+
+  static std::string_view load_key(LazyRecord *const &r, std::string *) {
+    return r->key;
+  }
+};
+
+// Values are the keys themselves, stored big-endian.
+struct LazyU64KeyTraits : ArtU64KeyTraits {
+  static constexpr bool LAZY_LEAF = true;
+
+  static std::string_view load_key(const uint64_t &v, std::string *buf) {
+    buf->resize(sizeof(uint64_t));
+    encode(v, buf->data());
+    return *buf;
+  }
+};
+
+class ArtTreeLazyLeafTest : public ::testing::Test {
+ public:
+  void TearDown() override {
+    EXPECT_EQ(tree.size(), verify_map.size());
+    for (auto &iter : verify_map) {
+      EXPECT_EQ(tree.get(iter.first), iter.second) << iter.first;
+    }
+    auto expect = verify_map.begin();
+    for (auto it = tree.begin(); it.valid(); it.next()) {
+      ASSERT_NE(expect, verify_map.end());
+      EXPECT_EQ(it.key(), expect->first);
+      EXPECT_EQ(it.value(), expect->second);
+      ++expect;
+    }
+    EXPECT_EQ(expect, verify_map.end());
+  }
+
+  LazyRecord *record(const std::string &key) {
+    records.push_back(std::make_unique<LazyRecord>(LazyRecord{key, 0}));
+    return records.back().get();
+  }
+
+  void set(const std::string &key) {
+    auto r = record(key);
+    verify_map[key] = r;
+    tree.set(key, r);
+  }
+
+  void del(const std::string &key) {
+    EXPECT_EQ(tree.del(key), verify_map[key]);
+    verify_map.erase(key);
+  }
+
+  std::vector<std::unique_ptr<LazyRecord>> records;
+  std::map<std::string, LazyRecord *> verify_map;
+  ArtTree<LazyRecord *, LazyRecordKeyTraits> tree;
+};
+
+TEST_F(ArtTreeLazyLeafTest, no_leaf_nodes) {
+  for (auto k : {"abc", "abd", "ab", "a", "abcdefghijklmnop1",
+                 "abcdefghijklmnop2", "abcdefghijklmnoq", "b"}) {
+    set(k);
+  }
+  EXPECT_EQ(tree.get("abcd"), nullptr);
+  EXPECT_EQ(tree.get("abcdefghijklmnop"), nullptr);
+  EXPECT_EQ(tree.del("abcdefghijklmnop3"), nullptr);
+
+  // replace by another record with the same key
+  set("abd");
+  EXPECT_TRUE(detail::art_is_lazy_leaf(
+      *detail::art_find_child(tree.get_root_unsafe(), 'b')));
+  del("abc");
+  del("b");
+}
+
+TEST_F(ArtTreeLazyLeafTest, single_and_empty) {
+  set("only");
+  EXPECT_TRUE(detail::art_is_lazy_leaf(tree.get_root_unsafe()));
+  del("only");
+  EXPECT_EQ(tree.get_root_unsafe(), nullptr);
+  set("again");
+}
+
+TEST_F(ArtTreeLazyLeafTest, uuid_data) {
+  for (auto u : lazy_uuid_data) set(u);
+  for (size_t i = 0; i < verify_map.size(); i += 3) {
+    del(lazy_uuid_data[i]);
+  }
+
+  std::vector<std::string> keys(lazy_uuid_data, lazy_uuid_data + 1000);
+  std::vector<LazyRecord *> out(keys.size());
+  tree.multi_get(keys.data(), keys.size(), out.data());
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto iter = verify_map.find(keys[i]);
+    EXPECT_EQ(out[i], iter == verify_map.end() ? nullptr : iter->second);
+  }
+
+  for (auto prefix : {"0", "1a", "ff", "abc"}) {
+    std::vector<std::string> got;
+    tree.scan_prefix(prefix, [&](std::string_view k, LazyRecord *r) {
+      EXPECT_EQ(k, r->key);
+      got.emplace_back(k);
+      return true;
+    });
+    std::vector<std::string> expect;
+    for (auto it = verify_map.lower_bound(prefix);
+         it != verify_map.end() && it->first.rfind(prefix, 0) == 0; ++it) {
+      expect.push_back(it->first);
+    }
+    EXPECT_EQ(got, expect);
+  }
+}
+
+TEST_F(ArtTreeLazyLeafTest, bulk_load) {
+  std::vector<std::pair<std::string, LazyRecord *>> pairs;
+  for (auto u : lazy_uuid_data) {
+    pairs.emplace_back(u, record(u));
+    verify_map[u] = pairs.back().second;
+  }
+  std::sort(pairs.begin(), pairs.end());
+  tree.bulk_load(pairs.begin(), pairs.end(), 2);
+}
+
+TEST(ArtTreeLazyLeafIntTest, fixed_len_keys) {
+  ArtTree<uint64_t, LazyU64KeyTraits> tree;
+  std::mt19937_64 rng(0);
+  std::map<std::string, uint64_t> verify_map;
+  char buf[sizeof(uint64_t)];
+  for (int32_t i = 0; i < 50000; i++) {
+    uint64_t v = rng() >> 1;  // 63 bits
+    LazyU64KeyTraits::encode(v, buf);
+    std::string k(buf, sizeof(buf));
+    verify_map[k] = v;
+    tree.set(k, v);
+  }
+  EXPECT_EQ(tree.size(), verify_map.size());
+  auto expect = verify_map.begin();
+  for (auto it = tree.begin(); it.valid(); it.next(), ++expect) {
+    ASSERT_EQ(it.key(), expect->first);
+    EXPECT_EQ(tree.del(expect->first), expect->second);
+  }
+  EXPECT_EQ(tree.size(), 0);
+}
+
+TEST(ArtTreeLazyLeafIntTest, values_beyond_63_bits) {
+  EXPECT_TRUE(detail::art_lazy_leaf_fits<uint64_t>((1ull << 63) - 1));
+  EXPECT_FALSE(detail::art_lazy_leaf_fits<uint64_t>((1ull << 63) + 5));
+  EXPECT_TRUE(detail::art_lazy_leaf_fits<int64_t>(-(1ll << 62)));
+  EXPECT_FALSE(detail::art_lazy_leaf_fits<int64_t>(1ll << 62));
+
+  // values a lazy leaf can not hold go to regular leaves
+  std::mt19937_64 rng(0);
+  std::map<std::string, uint64_t> verify_map;
+  char buf[sizeof(uint64_t)];
+  for (int32_t i = 0; i < 20000; i++) {
+    uint64_t v = rng();
+    LazyU64KeyTraits::encode(v, buf);
+    verify_map[std::string(buf, sizeof(buf))] = v;
+  }
+  auto expect_all = [&](ArtTree<uint64_t, LazyU64KeyTraits> &t) {
+    for (auto &iter : verify_map) {
+      EXPECT_EQ(t.get(iter.first), iter.second);
+    }
+    expect_tree(t, verify_map);
+  };
+
+  ArtTree<uint64_t, LazyU64KeyTraits> tree;
+  for (auto &iter : verify_map) tree.set(iter.first, iter.second);
+  expect_all(tree);
+
+  std::string path = ::testing::TempDir() + "art-lazy-beyond-63-bits";
+  ASSERT_TRUE(tree.save(path));
+  ArtTree<uint64_t, LazyU64KeyTraits> loaded;
+  ASSERT_TRUE(loaded.load(path));
+  expect_all(loaded);
+
+  ASSERT_TRUE(tree.freeze(path));
+  FrozenArt<uint64_t> frozen;
+  ASSERT_TRUE(frozen.open(path));
+  std::remove(path.c_str());
+  for (auto &iter : verify_map) {
+    EXPECT_EQ(frozen.get(iter.first), iter.second);
+  }
+  auto expect = verify_map.begin();
+  frozen.scan("", "", [&](std::string_view k, uint64_t v) {
+    EXPECT_EQ(k, expect->first);
+    EXPECT_EQ(v, expect->second);
+    return ++expect != verify_map.end();
+  });
+  EXPECT_EQ(expect, verify_map.end());
+
+  ArtTree<uint64_t, LazyU64KeyTraits> built;
+  std::vector<std::pair<std::string, uint64_t>> pairs(verify_map.begin(),
+                                                      verify_map.end());
+  EXPECT_EQ(built.bulk_load(pairs.begin(), pairs.end()), verify_map.size());
+  expect_all(built);
+
+  for (auto &iter : verify_map) {
+    EXPECT_EQ(tree.del(iter.first), iter.second);
+  }
+  EXPECT_EQ(tree.size(), 0);
+}
+
+TEST_F(ArtTreeLazyLeafTest, concurrent_readers) {
+  const int32_t key_cnt = 5000;
+  std::vector<LazyRecord *> rs;
+  for (int32_t i = 0; i < key_cnt; i++) {
+    rs.push_back(record("key-" + std::to_string(i)));
+  }
+  std::atomic<bool> stop{false};
+  std::thread reader([&]() {
+    std::mt19937 rng(0);
+    while (!stop.load()) {
+      auto r = rs[rng() % key_cnt];
+      auto got = tree.get(r->key);
+      ASSERT_TRUE(got == nullptr || got == r);
+    }
+  });
+  for (int32_t round = 0; round < 10; round++) {
+    for (auto r : rs) tree.set(r->key, r);
+    for (auto r : rs) ASSERT_EQ(tree.del(r->key), r);
+  }
+  stop = true;
+  reader.join();
+}
+
+}  // namespace art
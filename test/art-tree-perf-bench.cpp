@@ -1,14 +1,37 @@
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fstream>
 #include <map>
 #include <memory>
 #include <random>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
+#include "art/art-int-tree.h"
+#include "art/art-sharded.h"
+#include "art/art-wal.h"
 #include "art/art.h"
 #include "common/utils.h"
 #include "gtest/gtest.h"
 
+static const char *bench_uuid_data[] = {
+#include "data/uuid.txt"
+};
+
+static const char *bench_words_data[] = {
+#include "data/words.txt"
+};
+
 namespace art {
 
 const uint64_t n = 10000 * 100 * 16;
@@ -87,4 +110,982 @@ TEST(ArtBench, insertSparse2) {
   //  insertSparseStl2<std::unordered_map<std::string, int64_t>>();
 }
 
+// Keep key count fixed while replacing keys, RSS should stay flat once
+// retired nodes are reused.
+TEST(ArtBench, churnRss) {
+  const uint64_t key_cnt = 10000 * 20;
+  const int32_t round = 10;
+  std::mt19937_64 rng(0);
+  std::vector<std::string> keys(key_cnt);
+  ArtTree<int64_t> tree;
+  for (uint64_t i = 0; i < key_cnt; i++) {
+    keys[i] = std::to_string(rng());
+    tree.set(keys[i], i);
+  }
+
+  uint64_t first_rss = 0;
+  for (int32_t r = 0; r < round; r++) {
+    {
+      TIMER_START(t, "Churn round %d, key count %llu", r, key_cnt);
+      for (uint64_t i = 0; i < key_cnt; i++) {
+        tree.del(keys[i]);
+        keys[i] = std::to_string(rng());
+        tree.set(keys[i], i);
+      }
+    }
+    uint64_t rss = MemUtils::currentRss();
+    if (r == 0) first_rss = rss;
+    LOG_INFO("round %d rss %llu MB", r, rss >> 20);
+  }
+  EXPECT_EQ(tree.size(), key_cnt);
+  // allow some noise from allocator and pool fragmentation
+  EXPECT_LT(MemUtils::currentRss(), first_rss + first_rss / 4);
+}
+
+template <class T>
+static void multiGetBench(const ArtTree<T> &tree,
+                          const std::vector<std::string> &keys) {
+  const int32_t round = 5;
+  std::vector<T> out(keys.size());
+  T sum = 0;
+  {
+    TIMER_START(t, "get, key count %llu", keys.size() * round);
+    for (int32_t r = 0; r < round; r++) {
+      for (size_t i = 0; i < keys.size(); i++) sum += tree.get(keys[i]);
+    }
+  }
+  for (size_t batch : {64, 256}) {
+    TIMER_START(t, "multi_get batch %llu, key count %llu", batch,
+                keys.size() * round);
+    for (int32_t r = 0; r < round; r++) {
+      for (size_t i = 0; i < keys.size(); i += batch) {
+        size_t cnt = std::min(batch, keys.size() - i);
+        tree.multi_get(keys.data() + i, cnt, out.data() + i);
+      }
+    }
+  }
+  for (size_t i = 0; i < keys.size(); i++) EXPECT_EQ(out[i], tree.get(keys[i]));
+  LOG_INFO("checksum %lld", (long long)sum);
+}
+
+TEST(ArtBench, multiGetUuid) {
+  ArtTree<int64_t> tree;
+  std::vector<std::string> keys;
+  for (auto k : bench_uuid_data) {
+    keys.emplace_back(k);
+    tree.set(keys.back(), keys.size());
+  }
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(0));
+  multiGetBench(tree, keys);
+}
+
+TEST(ArtBench, leafFootprint) {
+  ArtTree<int64_t> tree;
+  size_t key_bytes = 0;
+  size_t leaf_bytes = detail::leaf_pool_bytes();
+  for (auto k : bench_uuid_data) {
+    key_bytes += strlen(k);
+    tree.set(k, strlen(k), 1);
+  }
+  leaf_bytes = detail::leaf_pool_bytes() - leaf_bytes;
+  LOG_INFO("uuid leaves: %llu keys, %llu key bytes, %llu leaf bytes, %.1f "
+           "bytes per leaf",
+           tree.size(), key_bytes, leaf_bytes,
+           (double)leaf_bytes / tree.size());
+}
+
+TEST(ArtBench, multiGetRandomInt) {
+  const uint64_t key_cnt = 10000 * 100;
+  std::mt19937_64 rng(0);
+  ArtTree<int64_t> tree;
+  std::vector<std::string> keys;
+  char buf[sizeof(uint64_t)];
+  for (uint64_t i = 0; i < key_cnt; i++) {
+    *reinterpret_cast<uint64_t *>(buf) = rng();
+    keys.emplace_back(buf, sizeof(uint64_t));
+    tree.set(keys.back(), i + 1);
+  }
+  std::shuffle(keys.begin(), keys.end(), rng);
+  multiGetBench(tree, keys);
+}
+
+TEST(ArtBench, bulkLoad) {
+  const uint64_t key_cnt = 10000 * 100 * 4;
+  std::mt19937_64 rng(0);
+  std::vector<std::pair<std::string, int64_t>> pairs(key_cnt);
+  for (uint64_t i = 0; i < key_cnt; i++) {
+    pairs[i] = {std::to_string(rng()), i};
+  }
+  std::sort(pairs.begin(), pairs.end());
+
+  {
+    ArtTree<int64_t> tree;
+    TIMER_START(t, "set sorted, key count %llu", key_cnt);
+    for (auto &p : pairs) tree.set(p.first, p.second);
+  }
+  {
+    ArtTree<int64_t> tree;
+    {
+      TIMER_START(t, "bulk_load sorted, key count %llu", key_cnt);
+      tree.bulk_load(pairs.begin(), pairs.end());
+    }
+    EXPECT_EQ(tree.size(), key_cnt);
+  }
+}
+
+static void parallelBuildScaling(
+    const char *name, std::vector<std::pair<std::string, int64_t>> &pairs) {
+  uint32_t max_thread = std::max(std::thread::hardware_concurrency(), 4u);
+  for (bool sorted : {false, true}) {
+    if (sorted) std::sort(pairs.begin(), pairs.end());
+    for (uint32_t thread_num = 1; thread_num <= max_thread; thread_num *= 2) {
+      ArtTree<int64_t> tree;
+      {
+        TIMER_START(t, "%s %s, threads %u, key count %llu", name,
+                    sorted ? "sorted" : "unsorted", thread_num, pairs.size());
+        tree.bulk_load(pairs.begin(), pairs.end(), thread_num);
+      }
+    }
+  }
+}
+
+TEST(ArtBench, parallelBuildRealData) {
+  std::vector<std::pair<std::string, int64_t>> pairs;
+  for (auto w : bench_words_data) pairs.emplace_back(w, pairs.size());
+  parallelBuildScaling("words", pairs);
+  pairs.clear();
+  for (auto u : bench_uuid_data) pairs.emplace_back(u, pairs.size());
+  parallelBuildScaling("uuid", pairs);
+}
+
+static void parallelBuildRandom(uint64_t key_cnt) {
+  std::mt19937_64 rng(0);
+  std::vector<std::pair<std::string, int64_t>> pairs(key_cnt);
+  char buf[sizeof(uint64_t)];
+  for (uint64_t i = 0; i < key_cnt; i++) {
+    *reinterpret_cast<uint64_t *>(buf) = rng();
+    pairs[i] = {std::string(buf, sizeof(uint64_t)), i};
+  }
+  parallelBuildScaling("random int", pairs);
+}
+
+TEST(ArtBench, parallelBuildRandom) { parallelBuildRandom(10000 * 100 * 4); }
+
+// Needs about 10GB of memory.
+TEST(ArtBench, DISABLED_parallelBuildRandom100M) {
+  parallelBuildRandom(10000 * 10000);
+}
+
+TEST(ArtBench, upsertCounter) {
+  const uint64_t op_cnt = 10000 * 100 * 2;
+  const uint64_t key_cnt = 10000 * 10;
+  std::vector<std::string> keys(key_cnt);
+  for (uint64_t i = 0; i < key_cnt; i++) keys[i] = std::to_string(i * 7919);
+
+  ArtTree<int64_t> get_set_tree;
+  ArtTree<int64_t> upsert_tree;
+  {
+    std::mt19937_64 rng(0);
+    TIMER_START(t, "get then set, op count %llu", op_cnt);
+    for (uint64_t i = 0; i < op_cnt; i++) {
+      auto &k = keys[rng() % key_cnt];
+      get_set_tree.set(k, get_set_tree.get(k) + 1);
+    }
+  }
+  {
+    std::mt19937_64 rng(0);
+    TIMER_START(t, "upsert, op count %llu", op_cnt);
+    for (uint64_t i = 0; i < op_cnt; i++) {
+      upsert_tree.upsert(keys[rng() % key_cnt], [](int64_t &v, bool) {
+        v++;
+        return true;
+      });
+    }
+  }
+  for (auto &k : keys) EXPECT_EQ(upsert_tree.get(k), get_set_tree.get(k));
+}
+
+TEST(ArtBench, intTree) {
+  const uint64_t key_cnt = 10000 * 100 * 2;
+  std::mt19937_64 rng(0);
+  std::vector<uint64_t> keys(key_cnt);
+  for (auto &k : keys) k = rng();
+
+  {
+    ArtTree<int64_t> tree;
+    {
+      TIMER_START(t, "string tree insert uint64, key count %llu", key_cnt);
+      for (uint64_t i = 0; i < key_cnt; i++) {
+        tree.set(reinterpret_cast<const char *>(&keys[i]), sizeof(uint64_t),
+                 i);
+      }
+    }
+    TIMER_START(t, "string tree get uint64, key count %llu", key_cnt);
+    for (uint64_t i = 0; i < key_cnt; i++) {
+      EXPECT_EQ(tree.get(reinterpret_cast<const char *>(&keys[i]),
+                         sizeof(uint64_t)),
+                i);
+    }
+  }
+  {
+    ArtIntTree<int64_t> tree;
+    {
+      TIMER_START(t, "int tree insert, key count %llu", key_cnt);
+      for (uint64_t i = 0; i < key_cnt; i++) tree.set(keys[i], i);
+    }
+    TIMER_START(t, "int tree get, key count %llu", key_cnt);
+    for (uint64_t i = 0; i < key_cnt; i++) EXPECT_EQ(tree.get(keys[i]), i);
+  }
+}
+
+struct BenchRecord {
+  std::string key;
+};
+
+struct BenchRecordKeyTraits : ArtStringKeyTraits {
+  static constexpr bool LAZY_LEAF = true;
+
+  static std::string_view load_key(BenchRecord *const &r, std::string *) {
+    return r->key;
+  }
+};
+
+template <class Tree>
+static void lazyLeafBench(const char *name,
+                          const std::vector<BenchRecord> &records) {
+  Tree tree;
+  size_t leaf_bytes = detail::leaf_pool_bytes();
+  for (auto &r : records) {
+    tree.set(r.key, const_cast<BenchRecord *>(&r));
+  }
+  leaf_bytes = detail::leaf_pool_bytes() - leaf_bytes;
+  LOG_INFO("%s tree allocates %llu KB of leaves", name, leaf_bytes >> 10);
+  TIMER_START(t, "%s get, key count %llu", name, records.size() * 5);
+  for (int32_t round = 0; round < 5; round++) {
+    for (auto &r : records) EXPECT_EQ(tree.get(r.key), &r);
+  }
+}
+
+TEST(ArtBench, lazyLeaf) {
+  std::vector<BenchRecord> records;
+  for (auto u : bench_uuid_data) records.push_back({u});
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 400000; i++) {
+    records.push_back({std::to_string(rng())});
+  }
+  lazyLeafBench<ArtTree<BenchRecord *>>("leaf node", records);
+  lazyLeafBench<ArtTree<BenchRecord *, BenchRecordKeyTraits>>("lazy leaf",
+                                                             records);
+}
+
+template <class Tree>
+static void fullPrefixBench(const char *name,
+                            const std::vector<std::string> &keys) {
+  Tree tree;
+  {
+    TIMER_START(t, "%s insert, key count %llu", name, keys.size());
+    for (size_t i = 0; i < keys.size(); i++) tree.set(keys[i], i + 1);
+  }
+  {
+    TIMER_START(t, "%s get, key count %llu", name, keys.size() * 5);
+    for (int32_t round = 0; round < 5; round++) {
+      for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(tree.get(keys[i]), i + 1);
+      }
+    }
+  }
+  {
+    TIMER_START(t, "%s lower_bound, key count %llu", name, keys.size());
+    for (auto &k : keys) EXPECT_TRUE(tree.lower_bound(k).valid());
+  }
+  TIMER_START(t, "%s delete, key count %llu", name, keys.size());
+  for (size_t i = 0; i < keys.size(); i++) tree.del(keys[i]);
+}
+
+TEST(ArtBench, fullPrefix) {
+  // URL-like keys sharing paths far longer than what a node stores inline.
+  std::vector<std::string> keys;
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 1000000; i++) {
+    keys.push_back("https://storage.example.com/v1/accounts/" +
+                   std::to_string(rng() % 1000) +
+                   "/containers/default/objects/photos/2024/" +
+                   std::to_string(rng() % 1000000));
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  std::shuffle(keys.begin(), keys.end(), rng);
+  fullPrefixBench<ArtTree<int64_t>>("hybrid prefix", keys);
+  fullPrefixBench<ArtTree<int64_t, ArtFullPrefixKeyTraits>>("full prefix",
+                                                            keys);
+}
+
+template <class F>
+static void simdKernelBench(const char *name, F &&fn) {
+  const uint64_t calls = 10000 * 1000;
+  uint64_t sum = 0;
+  {
+    TIMER_START(t, "%s, %llu calls", name, calls);
+    for (uint64_t i = 0; i < calls; i++) sum += fn(i);
+  }
+  LOG_INFO("%s checksum %llu", name, sum);
+}
+
+TEST(ArtBench, simdKernels) {
+  using namespace detail;
+  LOG_INFO("simd level %s", art_simd_level_name(g_art_simd_level));
+  std::mt19937_64 rng(0);
+  std::vector<uint8_t> all(256);
+  for (int32_t i = 0; i < 256; i++) all[i] = i;
+  std::shuffle(all.begin(), all.end(), rng);
+  alignas(16) uint8_t keys[16];
+  std::copy(all.begin(), all.begin() + 16, keys);
+  std::sort(keys, keys + 16);
+  alignas(16) uint8_t keys4[16] = {0};
+  std::copy(keys, keys + 4, keys4);
+
+  // sparse enough that scans cross several chunks
+  uint8_t index[256] = {0};
+  ArtNodeCommon *children[256] = {nullptr};
+  for (int32_t i = 0; i < 20; i++) index[all[i]] = i + 1;
+  for (int32_t i = 0; i < 50; i++) {
+    children[all[i]] = reinterpret_cast<ArtNodeCommon *>(0x1000);
+  }
+
+  simdKernelBench("n4 find scalar", [&](uint64_t i) {
+    return scalar::find_byte(keys4, 4, keys[i & 3]);
+  });
+  simdKernelBench("n4 find swar", [&](uint64_t i) {
+    return art_n4_find_swar(keys4, 4, keys[i & 3]);
+  });
+  simdKernelBench("n16 find scalar", [&](uint64_t i) {
+    return scalar::find_byte(keys, 16, keys[i & 15]);
+  });
+  simdKernelBench("n16 lower_bound scalar",
+                  [&](uint64_t i) { return scalar::lower_bound(keys, 16, i); });
+#if ART_SIMD_X86
+  simdKernelBench("n16 find sse2", [&](uint64_t i) {
+    return sse2::find_byte(keys, 16, keys[i & 15]);
+  });
+  simdKernelBench("n16 lower_bound sse2",
+                  [&](uint64_t i) { return sse2::lower_bound(keys, 16, i); });
+#endif
+
+  simdKernelBench("n48 first_ge scalar", [&](uint64_t i) {
+    return scalar::n48_first_ge(index, i & 255);
+  });
+  simdKernelBench("n48 last_le scalar", [&](uint64_t i) {
+    return scalar::n48_last_le(index, i & 255);
+  });
+  simdKernelBench("n256 first_ge scalar", [&](uint64_t i) {
+    return scalar::n256_first_ge(children, i & 255);
+  });
+#if ART_SIMD_X86
+  simdKernelBench("n48 first_ge sse2", [&](uint64_t i) {
+    return sse2::n48_first_ge(index, i & 255);
+  });
+  simdKernelBench("n48 last_le sse2", [&](uint64_t i) {
+    return sse2::n48_last_le(index, i & 255);
+  });
+  simdKernelBench("n256 first_ge sse2", [&](uint64_t i) {
+    return sse2::n256_first_ge(children, i & 255);
+  });
+  if (g_art_simd_level == ART_SIMD_AVX2) {
+    simdKernelBench("n48 first_ge avx2", [&](uint64_t i) {
+      return avx2::n48_first_ge(index, i & 255);
+    });
+    simdKernelBench("n48 last_le avx2", [&](uint64_t i) {
+      return avx2::n48_last_le(index, i & 255);
+    });
+    simdKernelBench("n256 first_ge avx2", [&](uint64_t i) {
+      return avx2::n256_first_ge(children, i & 255);
+    });
+  }
+#endif
+}
+
+TEST(ArtBench, nodeGrowShrink) {
+  // One node walks Node4 -> Node256 -> Node4 each round, so every add and
+  // delete in between pays for a type change sooner or later.
+  using namespace detail;
+  std::mt19937_64 rng(0);
+  std::vector<uint8_t> bytes(256);
+  for (int32_t i = 0; i < 256; i++) bytes[i] = i;
+  auto leaf = get_new_leaf_node<int64_t>("k", 1, 1);
+  auto node = reinterpret_cast<ArtNodeCommon *>(get_new_art_node<ArtNode4>());
+  for (int32_t i = 0; i < 4; i++) art_add_child_to_node(&node, bytes[i], leaf);
+
+  const int32_t rounds = 20000;
+  {
+    TIMER_START(t, "grow to 256 and shrink to 4, rounds %d", rounds);
+    for (int32_t r = 0; r < rounds; r++) {
+      std::shuffle(bytes.begin() + 4, bytes.end(), rng);
+      for (int32_t i = 4; i < 256; i++) {
+        art_add_child_to_node(&node, bytes[i], leaf);
+      }
+      // keep a different 4 children each round
+      std::shuffle(bytes.begin(), bytes.end(), rng);
+      for (int32_t i = 4; i < 256; i++) {
+        art_delete_from_node(&node, bytes[i], false, ArtShrinkPolicy::eager());
+      }
+    }
+  }
+  EXPECT_EQ(node->type, ART_NODE_4);
+  return_art_node(reinterpret_cast<ArtNode4 *>(node));
+  return_art_node(leaf);
+}
+
+static void shrinkPolicyBench(const char *name, const ArtShrinkPolicy &policy,
+                              int32_t boundary) {
+  // Every inner node sits at |boundary| children, one key per node goes back
+  // and forth across it.
+  const int32_t node_cnt = 1000;
+  const int32_t round = 200;
+  ArtTree<int64_t> tree(policy);
+  auto key_of = [](int32_t node, int32_t b) {
+    return "n" + std::to_string(node) + "/" + std::string(1, 'a' + b);
+  };
+  for (int32_t n = 0; n < node_cnt; n++) {
+    for (int32_t b = 0; b < boundary; b++) tree.set(key_of(n, b), b + 1);
+  }
+  std::vector<std::string> keys;
+  for (int32_t n = 0; n < node_cnt; n++) keys.push_back(key_of(n, boundary));
+
+  TIMER_START(t, "%s, boundary %d, set and del %llu", name, boundary,
+              (uint64_t)node_cnt * round);
+  for (int32_t r = 0; r < round; r++) {
+    for (auto &k : keys) tree.set(k, 1);
+    for (auto &k : keys) tree.del(k);
+  }
+}
+
+TEST(ArtBench, shrinkPolicy) {
+  for (int32_t boundary : {4, 16, 48}) {
+    shrinkPolicyBench("eager", ArtShrinkPolicy::eager(), boundary);
+    shrinkPolicyBench("hysteresis", ArtShrinkPolicy{}, boundary);
+  }
+}
+
+TEST(ArtBench, snapshotScan) {
+  // Full scans while a writer keeps updating random keys, on the live tree
+  // and on snapshots. Snapshot scans never restart, writers pay for copies.
+  const int32_t key_cnt = 1000000;
+  const int32_t scan_cnt = 5;
+  std::vector<std::string> keys;
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < key_cnt; i++) keys.push_back(std::to_string(rng()));
+  ArtTree<int64_t> tree;
+  for (int32_t i = 0; i < key_cnt; i++) tree.set(keys[i], i + 1);
+
+  for (bool use_snapshot : {false, true}) {
+    const char *name = use_snapshot ? "snapshot" : "live";
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> writes{0};
+    std::thread writer([&]() {
+      std::mt19937_64 wrng(1);
+      while (!stop.load()) {
+        tree.set(keys[wrng() % key_cnt], 1);
+        writes.fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+    uint64_t visited = 0;
+    {
+      TIMER_START(t, "%s full scan, scans %d", name, scan_cnt);
+      for (int32_t i = 0; i < scan_cnt; i++) {
+        auto fn = [&](std::string_view, int64_t) {
+          visited++;
+          return true;
+        };
+        if (use_snapshot) {
+          tree.snapshot().scan("", "", fn);
+        } else {
+          tree.scan("", "", fn);
+        }
+      }
+    }
+    stop = true;
+    writer.join();
+    EXPECT_EQ(visited, (uint64_t)key_cnt * scan_cnt);
+    LOG_INFO("%s, writes during scans %llu, retired %llu", name,
+             writes.load(), (uint64_t)tree.snapshot_retired_num());
+  }
+}
+
+TEST(ArtBench, saveLoad) {
+  // Restart paths for 1M keys: per-key set() against load() of a save.
+  const int32_t key_cnt = 1000000;
+  std::vector<std::string> keys;
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < key_cnt; i++) {
+    keys.push_back("user/" + std::to_string(rng() % 1000) + "/" +
+                   std::to_string(rng()));
+  }
+  std::string path = ::testing::TempDir() + "art-bench-save";
+
+  ArtTree<int64_t> tree;
+  {
+    TIMER_START(t, "set, key count %d", key_cnt);
+    for (int32_t i = 0; i < key_cnt; i++) tree.set(keys[i], i + 1);
+  }
+  {
+    TIMER_START(t, "save, key count %d", key_cnt);
+    ASSERT_TRUE(tree.save(path));
+  }
+  ArtTree<int64_t> loaded;
+  {
+    TIMER_START(t, "load, key count %d", key_cnt);
+    ASSERT_TRUE(loaded.load(path));
+  }
+  EXPECT_EQ(loaded.size(), tree.size());
+  std::remove(path.c_str());
+}
+
+TEST(ArtBench, frozenGet) {
+  // Point reads and a full scan on the live tree and on its frozen image.
+  const int32_t key_cnt = 1000000;
+  std::vector<std::string> keys;
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < key_cnt; i++) {
+    keys.push_back("user/" + std::to_string(rng() % 1000) + "/" +
+                   std::to_string(rng()));
+  }
+  ArtTree<int64_t> tree;
+  for (int32_t i = 0; i < key_cnt; i++) tree.set(keys[i], i + 1);
+  std::string path = ::testing::TempDir() + "art-bench-frozen";
+  {
+    TIMER_START(t, "freeze, key count %d", key_cnt);
+    ASSERT_TRUE(tree.freeze(path));
+  }
+  FrozenArt<int64_t> frozen;
+  {
+    TIMER_START(t, "open, key count %d", key_cnt);
+    ASSERT_TRUE(frozen.open(path));
+  }
+  LOG_INFO("image %llu bytes, %.1f per key", (uint64_t)frozen.image_bytes(),
+           (double)frozen.image_bytes() / key_cnt);
+
+  std::shuffle(keys.begin(), keys.end(), rng);
+  int64_t sum = 0;
+  {
+    TIMER_START(t, "tree get, key count %d", key_cnt);
+    for (auto &k : keys) sum += tree.get(k);
+  }
+  {
+    TIMER_START(t, "frozen get, key count %d", key_cnt);
+    for (auto &k : keys) sum -= frozen.get(k);
+  }
+  EXPECT_EQ(sum, 0);
+  auto count = [](std::string_view, int64_t) { return true; };
+  {
+    TIMER_START(t, "tree scan, key count %d", key_cnt);
+    EXPECT_EQ(tree.scan("", "", count), key_cnt);
+  }
+  {
+    TIMER_START(t, "frozen scan, key count %d", key_cnt);
+    EXPECT_EQ(frozen.scan("", "", count), key_cnt);
+  }
+  std::remove(path.c_str());
+}
+
+// Remove |dir| with all files in it.
+static void remove_bench_dir(const std::string &dir) {
+  if (DIR *d = opendir(dir.c_str())) {
+    while (auto entry = readdir(d)) {
+      std::string name = entry->d_name;
+      if (name != "." && name != "..") std::remove((dir + "/" + name).c_str());
+    }
+    closedir(d);
+  }
+  rmdir(dir.c_str());
+}
+
+TEST(ArtBench, walThroughput) {
+  // set() from several threads on the in-memory tree and with the log on,
+  // for each sync policy.
+  const int32_t thread_cnt = 4;
+  const int32_t per_thread = 50000;
+  std::vector<std::string> keys;
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < thread_cnt * per_thread; i++) {
+    keys.push_back("user/" + std::to_string(rng() % 1000) + "/" +
+                   std::to_string(rng()));
+  }
+  auto run = [&](auto &tree) {
+    std::vector<std::thread> threads;
+    for (int32_t t = 0; t < thread_cnt; t++) {
+      threads.emplace_back([&tree, &keys, t]() {
+        for (int32_t i = t * per_thread; i < (t + 1) * per_thread; i++) {
+          tree.set(keys[i], i + 1);
+        }
+      });
+    }
+    for (auto &t : threads) t.join();
+  };
+
+  {
+    ArtTree<int64_t> tree;
+    TIMER_START(t, "in-memory set, %d threads, key count %d", thread_cnt,
+                thread_cnt * per_thread);
+    run(tree);
+  }
+  const char *names[] = {"sync", "periodic", "none"};
+  for (auto sync :
+       {ArtWalSync::SYNC, ArtWalSync::PERIODIC, ArtWalSync::NONE}) {
+    // a log of its own, replay must not see an earlier mode or run
+    std::string dir = ::testing::TempDir() + "art-bench-wal-" +
+                      std::to_string(getpid()) + "-" +
+                      names[static_cast<int32_t>(sync)];
+    remove_bench_dir(dir);
+    ArtWalOptions options;
+    options.sync = sync;
+    uint64_t syncs = 0;
+    {
+      ArtDurableTree<int64_t> tree;
+      ASSERT_TRUE(tree.open(dir, options));
+      {
+        TIMER_START(t, "wal %s set, %d threads, key count %d",
+                    names[static_cast<int32_t>(sync)], thread_cnt,
+                    thread_cnt * per_thread);
+        run(tree);
+      }
+      syncs = tree.wal_sync_num();
+    }
+    LOG_INFO("%llu syncs", (unsigned long long)syncs);
+    {
+      ArtDurableTree<int64_t> tree;
+      TIMER_START(t, "wal replay, key count %d", thread_cnt * per_thread);
+      ASSERT_TRUE(tree.open(dir, options));
+      EXPECT_EQ(tree.size(), thread_cnt * per_thread);
+    }
+    remove_bench_dir(dir);
+  }
+}
+
+TEST(ArtBench, shortLivedTrees) {
+  // Many small trees built, read and dropped by each thread, e.g. one per
+  // request. Pool trees hand every node back one by one, arena trees drop
+  // their slabs at once.
+  const int32_t thread_cnt = 4;
+  const int32_t tree_num = 2000;
+  const int32_t tree_keys = 500;
+  std::vector<std::string> keys;
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < tree_keys; i++) {
+    keys.push_back("field/" + std::to_string(rng() % 100000));
+  }
+  auto run = [&](auto *type) {
+    using Tree = std::remove_pointer_t<decltype(type)>;
+    std::vector<std::thread> threads;
+    for (int32_t t = 0; t < thread_cnt; t++) {
+      threads.emplace_back([&keys]() {
+        int64_t sum = 0;
+        for (int32_t n = 0; n < tree_num; n++) {
+          Tree tree;
+          for (int32_t i = 0; i < tree_keys; i++) tree.set(keys[i], i + 1);
+          for (int32_t i = 0; i < tree_keys; i++) sum += tree.get(keys[i]);
+        }
+        EXPECT_GT(sum, 0);
+      });
+    }
+    for (auto &t : threads) t.join();
+  };
+  {
+    TIMER_START(t, "pool trees, %d threads, %d trees of %d keys each",
+                thread_cnt, tree_num, tree_keys);
+    run(static_cast<ArtTree<int64_t> *>(nullptr));
+  }
+  {
+    TIMER_START(t, "arena trees, %d threads, %d trees of %d keys each",
+                thread_cnt, tree_num, tree_keys);
+    run(static_cast<ArtTree<int64_t, ArtStringKeyTraits, ArtArenaAlloc> *>(
+        nullptr));
+  }
+}
+
+// A spike of keys that goes away again. The pools keep the freed nodes
+// for reuse, RSS drops only once they are trimmed.
+TEST(ArtBench, growShrinkTrim) {
+  const uint64_t key_cnt = 10000 * 100;
+  std::mt19937_64 rng(0);
+  std::vector<std::string> keys(key_cnt);
+  for (auto &k : keys) k = std::to_string(rng());
+  trim_pools();
+  uint64_t base_rss = MemUtils::currentRss();
+  uint64_t peak_rss = 0;
+  for (int32_t r = 0; r < 2; r++) {
+    {
+      ArtTree<int64_t> tree;
+      TIMER_START(t, "round %d grow, key count %llu", r, key_cnt);
+      for (uint64_t i = 0; i < key_cnt; i++) tree.set(keys[i], i + 1);
+      peak_rss = MemUtils::currentRss();
+    }
+    while (epoch_pending()) epoch_reclaim();
+    uint64_t shrunk_rss = MemUtils::currentRss();
+    size_t released = 0;
+    {
+      TIMER_START(t, "round %d trim", r);
+      released = trim_pools();
+    }
+    uint64_t trimmed_rss = MemUtils::currentRss();
+    LOG_INFO("rss MB: base %llu, peak %llu, shrunk %llu, trimmed %llu, "
+             "released %llu MB",
+             base_rss >> 20, peak_rss >> 20, shrunk_rss >> 20,
+             trimmed_rss >> 20, released >> 20);
+    EXPECT_GT(released, 0);
+    EXPECT_LT(trimmed_rss, shrunk_rss);
+  }
+}
+
+// Counts a hardware cache event of the calling thread in user space, if the
+// kernel lets us, e.g. not in VMs without a virtual PMU.
+class CacheEventCounter {
+ public:
+  CacheEventCounter(uint64_t cache, uint64_t op, uint64_t result) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = cache | (op << 8) | (result << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  ~CacheEventCounter() {
+    if (fd_ >= 0) close(fd_);
+  }
+
+  bool valid() const { return fd_ >= 0; }
+
+  void start() {
+    if (fd_ < 0) return;
+    ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  uint64_t stop() {
+    uint64_t cnt = 0;
+    if (fd_ < 0) return cnt;
+    ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd_, &cnt, sizeof(cnt)) != sizeof(cnt)) cnt = 0;
+    return cnt;
+  }
+
+ private:
+  int fd_;
+};
+
+// Anonymous memory of the process backed by transparent huge pages.
+static uint64_t anon_huge_page_kb() {
+  std::ifstream in("/proc/self/smaps_rollup");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.rfind("AnonHugePages:", 0) == 0) {
+      return std::stoull(line.substr(strlen("AnonHugePages:")));
+    }
+  }
+  return 0;
+}
+
+// Random lookups in a tree larger than the TLB reach with small pages, its
+// nodes taken from huge page regions or from the heap.
+TEST(ArtBench, hugePageLookup) {
+  const uint64_t key_cnt = 10000 * 300;
+  const uint64_t lookup_cnt = 10000 * 500;
+  std::mt19937_64 rng(0);
+  std::vector<std::string> keys(key_cnt);
+  for (auto &k : keys) k = std::to_string(rng());
+  std::vector<uint32_t> order(lookup_cnt);
+  for (auto &i : order) i = rng() % key_cnt;
+
+  // Both trees stay alive, so the second one does not reuse nodes of the
+  // first from the pools.
+  std::vector<std::unique_ptr<ArtTree<int64_t>>> trees;
+  for (bool huge : {true, false}) {
+    set_pool_huge_pages(huge, huge);
+    uint64_t huge_kb = anon_huge_page_kb();
+    trees.emplace_back(new ArtTree<int64_t>());
+    auto &tree = *trees.back();
+    for (uint64_t i = 0; i < key_cnt; i++) tree.set(keys[i], i + 1);
+    huge_kb = anon_huge_page_kb() - huge_kb;
+
+    CacheEventCounter misses(PERF_COUNT_HW_CACHE_DTLB,
+                             PERF_COUNT_HW_CACHE_OP_READ,
+                             PERF_COUNT_HW_CACHE_RESULT_MISS);
+    CacheEventCounter loads(PERF_COUNT_HW_CACHE_DTLB,
+                            PERF_COUNT_HW_CACHE_OP_READ,
+                            PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+    int64_t sum = 0;
+    misses.start();
+    loads.start();
+    auto begin = std::chrono::steady_clock::now();
+    for (auto i : order) sum += tree.get(keys[i]);
+    auto end = std::chrono::steady_clock::now();
+    uint64_t miss_cnt = misses.stop();
+    uint64_t load_cnt = loads.stop();
+    EXPECT_GT(sum, 0);
+
+    double sec = std::chrono::duration<double>(end - begin).count();
+    LOG_INFO("%s pages: %llu keys, %.2f M lookups/s, %llu MB in huge pages",
+             huge ? "huge" : "small", (unsigned long long)key_cnt,
+             lookup_cnt / sec / 1e6, (unsigned long long)(huge_kb >> 10));
+    if (misses.valid() && loads.valid() && load_cnt) {
+      LOG_INFO("dTLB load misses %llu of %llu loads, %.3f%%",
+               (unsigned long long)miss_cnt, (unsigned long long)load_cnt,
+               100.0 * miss_cnt / load_cnt);
+    } else {
+      LOG_INFO("dTLB counters unavailable");
+    }
+  }
+  set_pool_huge_pages(false);
+}
+
+// Inserts into a fresh arena tree, its nodes taken and faulted in during
+// the inserts, or up front by reserve(). Slow batches are the ones that
+// take slabs from the system and fault their pages in.
+TEST(ArtBench, reservedInserts) {
+  const uint64_t key_cnt = 10000 * 200;
+  const int32_t thread_cnt = 4;
+  const uint64_t batch = 4096;
+  std::mt19937_64 rng(0);
+  std::vector<std::string> keys(key_cnt);
+  for (auto &k : keys) k = std::to_string(rng() % 10000000000000000);
+  ArtKeyProfile profile;
+  profile.key_len = 16;
+  profile.alphabet = 10;
+  profile.threads = thread_cnt;
+
+  for (bool reserve : {false, true}) {
+    ArtTree<int64_t, ArtStringKeyTraits, ArtArenaAlloc> tree;
+    auto begin = std::chrono::steady_clock::now();
+    if (reserve) tree.reserve(key_cnt, profile);
+    auto reserved = std::chrono::steady_clock::now();
+    size_t bytes = tree.allocator().bytes();
+    std::vector<std::vector<double>> batch_us(thread_cnt);
+    std::vector<std::thread> threads;
+    for (int32_t t = 0; t < thread_cnt; t++) {
+      threads.emplace_back([&, t]() {
+        for (uint64_t i = t * batch; i < key_cnt; i += thread_cnt * batch) {
+          auto b = std::chrono::steady_clock::now();
+          for (uint64_t j = i; j < std::min(i + batch, key_cnt); j++) {
+            tree.set(keys[j], j + 1);
+          }
+          std::chrono::duration<double, std::micro> us =
+              std::chrono::steady_clock::now() - b;
+          batch_us[t].push_back(us.count());
+        }
+      });
+    }
+    for (auto &t : threads) t.join();
+    auto end = std::chrono::steady_clock::now();
+    EXPECT_EQ(tree.size(), key_cnt);
+    std::vector<double> all;
+    for (auto &v : batch_us) all.insert(all.end(), v.begin(), v.end());
+    std::sort(all.begin(), all.end());
+
+    std::chrono::duration<double, std::milli> reserve_ms = reserved - begin;
+    std::chrono::duration<double, std::milli> insert_ms = end - reserved;
+    LOG_INFO(
+        "%s: reserve %.1f ms, %llu inserts on %d threads %.1f ms, p99 "
+        "batch of %llu %.0f us, %llu MB taken during inserts",
+        reserve ? "reserved" : "unreserved", reserve_ms.count(),
+        (unsigned long long)key_cnt, thread_cnt, insert_ms.count(),
+        (unsigned long long)batch,
+        all[all.size() * 99 / 100],
+        (unsigned long long)((tree.allocator().bytes() - bytes) >> 20));
+  }
+}
+
+// 50/50 gets and sets of random keys on 1, 2, 4 ... threads up to the core
+// count, on one tree and on trees sharded by hash.
+TEST(ArtBench, shardedThreadSweep) {
+  const uint64_t key_cnt = 10000 * 100;
+  const uint64_t op_cnt = 10000 * 100 * 2;
+  const uint32_t shard_num = 16;
+  std::mt19937_64 rng(0);
+  std::vector<std::string> keys(key_cnt);
+  for (auto &k : keys) k = std::to_string(rng());
+
+  std::vector<int32_t> sweep;
+  int32_t core_cnt = std::max(1u, std::thread::hardware_concurrency());
+  for (int32_t n = 1; n < core_cnt; n *= 2) sweep.push_back(n);
+  sweep.push_back(core_cnt);
+
+  auto run = [&](auto &tree, int32_t thread_cnt) {
+    std::vector<std::thread> threads;
+    auto begin = std::chrono::steady_clock::now();
+    for (int32_t t = 0; t < thread_cnt; t++) {
+      threads.emplace_back([&tree, &keys, t, thread_cnt, op_cnt]() {
+        std::mt19937_64 rng(t);
+        int64_t sum = 0;
+        for (uint64_t i = 0; i < op_cnt / thread_cnt; i++) {
+          auto &k = keys[rng() % keys.size()];
+          if (i % 2) {
+            tree.set(k, i + 1);
+          } else {
+            sum += tree.get(k);
+          }
+        }
+        EXPECT_GT(sum, 0);
+      });
+    }
+    for (auto &t : threads) t.join();
+    std::chrono::duration<double> sec =
+        std::chrono::steady_clock::now() - begin;
+    return op_cnt / sec.count() / 1e6;
+  };
+
+  ArtTree<int64_t> tree;
+  ShardedArtTree<int64_t> sharded(shard_num);
+  for (uint64_t i = 0; i < key_cnt; i++) {
+    tree.set(keys[i], i + 1);
+    sharded.set(keys[i], i + 1);
+  }
+  for (int32_t thread_cnt : sweep) {
+    double single = run(tree, thread_cnt);
+    double multi = run(sharded, thread_cnt);
+    LOG_INFO("%d threads, %llu keys: one tree %.2f M ops/s, %u shards %.2f "
+             "M ops/s",
+             thread_cnt, (unsigned long long)key_cnt, single, shard_num,
+             multi);
+  }
+}
+
+// Inserts and deletes of keys of each thread's own, counted in stripes of
+// the threads or in one counter all writers update.
+TEST(ArtBench, sizeModes) {
+  const int32_t thread_cnt =
+      std::max(4u, std::thread::hardware_concurrency());
+  const uint64_t op_cnt = 10000 * 100 * 2;
+  const int32_t per_thread_keys = 10000;
+  for (auto mode : {ArtSizeMode::EXACT, ArtSizeMode::STRIPED}) {
+    ArtTree<int64_t> tree(mode);
+    std::vector<std::thread> threads;
+    auto begin = std::chrono::steady_clock::now();
+    for (int32_t t = 0; t < thread_cnt; t++) {
+      threads.emplace_back([&tree, t, thread_cnt, op_cnt]() {
+        std::vector<std::string> keys;
+        for (int32_t i = 0; i < per_thread_keys; i++) {
+          keys.push_back(std::to_string(i) + "/" + std::to_string(t));
+        }
+        for (uint64_t i = 0; i < op_cnt / thread_cnt; i++) {
+          auto &k = keys[i % per_thread_keys];
+          if ((i / per_thread_keys) % 2) {
+            tree.del(k);
+          } else {
+            tree.set(k, i + 1);
+          }
+        }
+      });
+    }
+    for (auto &t : threads) t.join();
+    std::chrono::duration<double> sec =
+        std::chrono::steady_clock::now() - begin;
+    LOG_INFO("%s size, %d threads: %.2f M writes/s, size %llu",
+             mode == ArtSizeMode::EXACT ? "exact" : "striped", thread_cnt,
+             op_cnt / sec.count() / 1e6, (unsigned long long)tree.size());
+  }
+}
+
 }  // namespace art
@@ -1,5 +1,6 @@
 #include <random>
 #include <unordered_map>
+#include <vector>
 
 #include "art/art.h"
 #include "common/logger.h"
@@ -60,4 +61,42 @@ TEST_F(ArtTreeRealDataTest, uuid_data) {
   }
 }
 
+TEST_F(ArtTreeRealDataTest, multi_get) {
+  int len = sizeof(uuid_data) / sizeof(const char *);
+  for (int32_t i = 0; i < len; i++) {
+    set(uuid_data[i], i + 1);
+  }
+  for (int32_t i = 0; i < len; i += 3) {
+    del(uuid_data[i]);
+  }
+
+  // Mix hits, deleted keys and keys that only share a prefix.
+  std::vector<std::string> keys;
+  for (int32_t i = 0; i < len; i++) {
+    keys.emplace_back(uuid_data[i]);
+    if (i % 7 == 0) keys.push_back(keys.back().substr(0, i % 30));
+    if (i % 11 == 0) keys.push_back(keys.back() + "x");
+  }
+  for (size_t n : {0, 1, 5, 16, 17, 64, 1000}) {
+    std::vector<int64_t> out(n, -1);
+    tree.multi_get(keys.data(), n, out.data());
+    for (size_t i = 0; i < n; i++) {
+      EXPECT_EQ(out[i], tree.get(keys[i])) << keys[i];
+    }
+  }
+
+  std::vector<const char *> ptrs;
+  std::vector<uint32_t> lens;
+  for (auto &k : keys) {
+    ptrs.push_back(k.data());
+    lens.push_back(k.size());
+  }
+  std::vector<int64_t> out(keys.size(), -1);
+  tree.multi_get(ptrs.data(), lens.data(), keys.size(), out.data());
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto iter = verify_map.find(keys[i]);
+    EXPECT_EQ(out[i], iter == verify_map.end() ? 0 : iter->second) << keys[i];
+  }
+}
+
 }  // namespace art
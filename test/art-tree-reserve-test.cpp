@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "art/art.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+namespace art {
+
+using detail::ArtNodeCounts;
+
+static void count_nodes(const ArtNodeCommon *node, size_t *inner) {
+  if (!node || node->type == ART_NODE_LEAF) return;
+  inner[node->type - 1]++;
+  switch (node->type) {
+    case ART_NODE_4: {
+      auto n = reinterpret_cast<const ArtNode4 *>(node);
+      for (uint16_t i = 0; i < n->childNum; i++) {
+        count_nodes(n->children[i], inner);
+      }
+    } break;
+    case ART_NODE_16: {
+      auto n = reinterpret_cast<const ArtNode16 *>(node);
+      for (uint16_t i = 0; i < n->childNum; i++) {
+        count_nodes(n->children[i], inner);
+      }
+    } break;
+    case ART_NODE_48: {
+      reinterpret_cast<const ArtNode48 *>(node)->for_each_child(
+          [&](uint8_t, const ArtNodeCommon *c) { count_nodes(c, inner); });
+    } break;
+    case ART_NODE_256: {
+      reinterpret_cast<const ArtNode256 *>(node)->for_each_child(
+          [&](uint8_t, const ArtNodeCommon *c) { count_nodes(c, inner); });
+    } break;
+    default:
+      break;
+  }
+}
+
+static std::string binary_key(uint64_t v) {
+  return std::string(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static std::string decimal_key(uint64_t v) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%016lu", (unsigned long)(v % 10000000000000000));
+  return buf;
+}
+
+template <class KeyOf>
+static void expect_estimate(uint64_t n, const ArtKeyProfile &profile,
+                            KeyOf &&key_of, double tolerance) {
+  ArtTree<int64_t> tree;
+  for (uint64_t i = 0; i < n; i++) tree.set(key_of(i), 1);
+  size_t actual[ART_NODE_256] = {};
+  count_nodes(tree.get_root_unsafe(), actual);
+  ArtNodeCounts est;
+  detail::art_estimate_inner(n, profile, &est);
+  for (uint32_t i = 0; i < ART_NODE_256; i++) {
+    EXPECT_GE(est.inner[i], actual[i] * (1 - tolerance)) << n << " " << i;
+    EXPECT_LE(est.inner[i], actual[i] * (1 + tolerance) + 2) << n << " " << i;
+  }
+}
+
+TEST(ArtTreeReserveTest, estimate_node_mix) {
+  for (uint64_t n : {2000, 200000}) {
+    std::mt19937_64 rng(n);
+    ArtKeyProfile binary;
+    binary.key_len = 8;
+    expect_estimate(n, binary, [&](uint64_t) { return binary_key(rng()); },
+                    n < 10000 ? 0.15 : 0.05);
+
+    ArtKeyProfile decimal;
+    decimal.key_len = 16;
+    decimal.alphabet = 10;
+    expect_estimate(n, decimal, [&](uint64_t) { return decimal_key(rng()); },
+                    n < 10000 ? 0.15 : 0.05);
+
+    // one full Node16 per 10 keys, a few more above them
+    ArtKeyProfile dense = decimal;
+    dense.dense = true;
+    expect_estimate(n, dense, [&](uint64_t i) { return decimal_key(i); },
+                    0.12);
+  }
+}
+
+template <class Item>
+static size_t block_num() {
+  return describe_objects<Item>().block_num;
+}
+
+TEST(ArtTreeReserveTest, inserts_take_no_new_blocks) {
+  const uint64_t n = 300000;
+  ArtKeyProfile profile;
+  profile.key_len = 8;
+  auto counts = detail::art_estimate_nodes<int64_t>(n, profile, false);
+  uint8_t cls =
+      detail::art_leaf_size_class(ArtLeaf<int64_t>::alloc_size(8));
+  EXPECT_EQ(counts.leaf[cls], n + n / 16);
+  // every larger node is counted once more in each smaller type
+  EXPECT_GE(counts.inner[0], counts.inner[1] + counts.inner[2]);
+
+  ArtTree<int64_t> tree;
+  tree.set("base", 1);
+  tree.reserve(n, profile);
+  using Leaf = detail::ArtLeafStorage<detail::ART_LEAF_SIZE_CLASS[0]>;
+  ASSERT_EQ(cls, 1);
+  size_t blocks[] = {block_num<ArtNode4>(), block_num<ArtNode16>(),
+                     block_num<ArtNode48>(), block_num<ArtNode256>(),
+                     block_num<Leaf>()};
+
+  std::mt19937_64 rng(0);
+  std::vector<std::string> keys;
+  for (uint64_t i = 0; i < n; i++) keys.push_back(binary_key(rng()));
+  for (uint64_t i = 0; i < n; i++) tree.set(keys[i], i + 1);
+  EXPECT_EQ(block_num<ArtNode4>(), blocks[0]);
+  EXPECT_EQ(block_num<ArtNode16>(), blocks[1]);
+  EXPECT_EQ(block_num<ArtNode48>(), blocks[2]);
+  EXPECT_EQ(block_num<ArtNode256>(), blocks[3]);
+  EXPECT_EQ(block_num<Leaf>(), blocks[4]);
+  EXPECT_EQ(tree.size(), n + 1);
+  for (uint64_t i = 0; i < n; i += 97) EXPECT_EQ(tree.get(keys[i]), i + 1);
+}
+
+TEST(ArtTreeReserveTest, arena_tree) {
+  const uint64_t n = 200000;
+  ArtKeyProfile profile;
+  profile.key_len = 16;
+  profile.alphabet = 10;
+  profile.threads = 4;
+  ArtTree<int64_t, ArtStringKeyTraits, ArtArenaAlloc> tree;
+  tree.reserve(n, profile);
+  size_t bytes = tree.allocator().bytes();
+  EXPECT_GT(bytes, n * sizeof(ArtLeaf<int64_t>));
+  EXPECT_EQ(tree.allocator().used_bytes(), 0);
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < profile.threads; t++) {
+    threads.emplace_back([&tree, &profile, t]() {
+      std::mt19937_64 rng(t);
+      for (uint64_t i = 0; i < n / profile.threads; i++) {
+        tree.set(decimal_key(rng()), 1);
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  EXPECT_EQ(tree.size(), n);
+  // no slab was taken after reserve()
+  EXPECT_EQ(tree.allocator().bytes(), bytes);
+
+  // a cleared tree starts on a new arena with nothing reserved
+  tree.clear();
+  EXPECT_EQ(tree.allocator().bytes(), 0);
+}
+
+}  // namespace art
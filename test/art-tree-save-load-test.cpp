@@ -0,0 +1,254 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "art-test-util.h"
+#include "art/art-int-tree.h"
+#include "art/art.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+namespace art {
+
+// Values are the keys themselves, stored big-endian.
+struct SavedU64KeyTraits : ArtU64KeyTraits {
+  static constexpr bool LAZY_LEAF = true;
+
+  static std::string_view load_key(const uint64_t &v, std::string *buf) {
+    buf->resize(sizeof(uint64_t));
+    encode(v, buf->data());
+    return *buf;
+  }
+};
+
+template <class Tree, class Map>
+static void expect_loaded(const Tree &tree, const Map &expect) {
+  expect_tree(tree, expect);
+  for (auto &iter : expect) {
+    EXPECT_EQ(tree.get(iter.first), iter.second) << iter.first;
+  }
+}
+
+// Count of inner nodes of each type and of leaves, indexed by ArtNodeType.
+static std::vector<uint64_t> node_types(const ArtNodeCommon *node) {
+  std::vector<uint64_t> cnt(ART_NODE_LEAF + 1);
+  std::vector<const ArtNodeCommon *> stack;
+  if (node) stack.push_back(node);
+  while (!stack.empty()) {
+    node = stack.back();
+    stack.pop_back();
+    if (detail::art_is_lazy_leaf(node)) {
+      cnt[ART_NODE_LEAF]++;
+      continue;
+    }
+    cnt[node->type]++;
+    if (node->type == ART_NODE_LEAF) continue;
+    for (uint32_t b = 0; b < 256; b++) {
+      auto child = detail::art_find_child(const_cast<ArtNodeCommon *>(node),
+                                          static_cast<uint8_t>(b));
+      if (child && *child) stack.push_back(*child);
+    }
+  }
+  return cnt;
+}
+
+class ArtTreeSaveLoadTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    path = ::testing::TempDir() + "art-save-" + std::to_string(getpid());
+  }
+
+  void TearDown() override { std::remove(path.c_str()); }
+
+  void set(const std::string &key, int64_t val) {
+    verify_map[key] = val;
+    tree.set(key, val);
+  }
+
+  void del(const std::string &key) {
+    verify_map.erase(key);
+    tree.del(key);
+  }
+
+  std::string path;
+  std::map<std::string, int64_t> verify_map;
+  ArtTree<int64_t> tree;
+};
+
+TEST_F(ArtTreeSaveLoadTest, round_trip) {
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 50000; i++) {
+    // short and long keys, dense and sparse fanout
+    std::string k = std::to_string(rng() % 100000);
+    if (i % 3 == 0) k = "a-rather-long-common-prefix/" + k;
+    if (i % 7 == 0) k.push_back(static_cast<char>(rng() % 255 + 1));
+    set(k, i + 1);
+  }
+  for (int32_t i = 0; i < 10000; i++) del(std::to_string(rng() % 100000));
+  ASSERT_TRUE(tree.save(path));
+
+  ArtTree<int64_t> loaded;
+  ASSERT_TRUE(loaded.load(path));
+  expect_loaded(loaded, verify_map);
+  // nodes come back with their saved types
+  EXPECT_EQ(node_types(loaded.get_root_unsafe()),
+            node_types(tree.get_root_unsafe()));
+
+  // the loaded tree is an ordinary tree
+  for (int32_t i = 0; i < 10000; i++) {
+    auto k = std::to_string(rng() % 100000);
+    verify_map[k] = -i;
+    loaded.set(k, -i);
+    if (i % 2) {
+      k = std::to_string(rng() % 100000);
+      verify_map.erase(k);
+      loaded.del(k);
+    }
+  }
+  expect_loaded(loaded, verify_map);
+}
+
+TEST_F(ArtTreeSaveLoadTest, empty_and_single) {
+  ASSERT_TRUE(tree.save(path));
+  ArtTree<int64_t> empty;
+  ASSERT_TRUE(empty.load(path));
+  expect_loaded(empty, verify_map);
+
+  set("only", 7);
+  ASSERT_TRUE(tree.save(path));
+  ArtTree<int64_t> single;
+  ASSERT_TRUE(single.load(path));
+  expect_loaded(single, verify_map);
+}
+
+TEST_F(ArtTreeSaveLoadTest, deep_tree) {
+  // "b", "ab", "aab", ... hang one inner node per key below each other
+  for (int32_t i = 0; i < 5000; i++) set(std::string(i, 'a') + "b", i + 1);
+  ASSERT_TRUE(tree.save(path));
+  ArtTree<int64_t> loaded;
+  ASSERT_TRUE(loaded.load(path));
+  expect_loaded(loaded, verify_map);
+}
+
+TEST_F(ArtTreeSaveLoadTest, bad_files) {
+  for (int32_t i = 0; i < 1000; i++) set(std::to_string(i * 13), i);
+  ArtTree<int64_t> other;
+  EXPECT_FALSE(other.load(path + ".missing"));
+
+  ASSERT_TRUE(tree.save(path));
+  std::string data;
+  {
+    std::ifstream in(path, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(in), {});
+  }
+  auto write = [&](const std::string &d) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(d.data(), d.size());
+  };
+
+  // any cut is found, and nothing is left behind
+  for (size_t len : {size_t(0), size_t(10), data.size() / 2, data.size() - 1}) {
+    write(data.substr(0, len));
+    EXPECT_FALSE(other.load(path)) << len;
+    EXPECT_EQ(other.get_root_unsafe(), nullptr);
+  }
+  write(data + "x");
+  EXPECT_FALSE(other.load(path));
+  auto bad_version = data;
+  bad_version[8] = 9;
+  write(bad_version);
+  EXPECT_FALSE(other.load(path));
+
+  // other value type
+  write(data);
+  ArtTree<int32_t> narrow;
+  EXPECT_FALSE(narrow.load(path));
+
+  // a tree with keys is left as it was
+  ASSERT_TRUE(other.load(path));
+  EXPECT_FALSE(tree.load(path));
+  expect_loaded(tree, verify_map);
+  expect_loaded(other, verify_map);
+}
+
+TEST_F(ArtTreeSaveLoadTest, concurrent_writer) {
+  // The saved file holds one window of the keys the writer slides along.
+  const int32_t window = 1000;
+  for (int32_t i = 0; i < window; i++) tree.set(std::to_string(1000000 + i), i);
+  std::atomic<bool> stop{false};
+  std::thread writer([&]() {
+    for (int32_t i = window; !stop.load(); i++) {
+      tree.set(std::to_string(1000000 + i), i);
+      tree.del(std::to_string(1000000 + i - window));
+    }
+  });
+  for (int32_t round = 0; round < 5; round++) {
+    ASSERT_TRUE(tree.save(path));
+    ArtTree<int64_t> loaded;
+    ASSERT_TRUE(loaded.load(path));
+    auto it = loaded.begin();
+    ASSERT_TRUE(it.valid());
+    int64_t first = it.value();
+    uint64_t cnt = 0;
+    for (; it.valid(); it.next(), cnt++) {
+      ASSERT_EQ(it.value(), first + (int64_t)cnt);
+    }
+    EXPECT_GE(cnt, window);
+    EXPECT_LE(cnt, window + 1);
+  }
+  stop = true;
+  writer.join();
+}
+
+TEST_F(ArtTreeSaveLoadTest, full_prefix) {
+  ArtTree<int64_t, ArtFullPrefixKeyTraits> full;
+  std::map<std::string, int64_t> m;
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 20000; i++) {
+    auto k = "https://storage.example.com/v1/accounts/" +
+             std::to_string(rng() % 50) + "/containers/default/objects/" +
+             std::to_string(rng() % 100000);
+    m[k] = i + 1;
+    full.set(k, i + 1);
+  }
+  ASSERT_TRUE(full.save(path));
+  ArtTree<int64_t, ArtFullPrefixKeyTraits> loaded;
+  ASSERT_TRUE(loaded.load(path));
+  expect_loaded(loaded, m);
+  EXPECT_TRUE(loaded.get_root_unsafe()->has_full_prefix());
+
+  // prefixes are whole in the loaded tree, as in the saved one
+  EXPECT_EQ(loaded.get(std::string("https://storage.example.com/v1/accounts/"
+                                   "1/containers/default/objects/")),
+            0);
+}
+
+TEST_F(ArtTreeSaveLoadTest, lazy_leaf) {
+  ArtIntTree<uint64_t> ints;
+  ArtTree<uint64_t, SavedU64KeyTraits> lazy;
+  std::map<std::string, uint64_t> m;
+  std::mt19937_64 rng(0);
+  for (int32_t i = 0; i < 20000; i++) {
+    uint64_t v = rng() >> 1;
+    std::string k(sizeof(uint64_t), '\0');
+    SavedU64KeyTraits::encode(v, k.data());
+    m[k] = v;
+    lazy.set(k, v);
+  }
+  ASSERT_TRUE(lazy.save(path));
+  EXPECT_FALSE(ints.tree().load(path));
+
+  ArtTree<uint64_t, SavedU64KeyTraits> loaded;
+  ASSERT_TRUE(loaded.load(path));
+  expect_loaded(loaded, m);
+  EXPECT_EQ(node_types(loaded.get_root_unsafe())[ART_NODE_LEAF], m.size());
+}
+
+}  // namespace art
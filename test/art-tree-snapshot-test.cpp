@@ -0,0 +1,236 @@
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "art-test-util.h"
+#include "art/art.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+namespace art {
+
+static std::string seq_key(uint64_t i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%012lu", i);
+  return buf;
+}
+
+template <class Snap>
+static void expect_view(const Snap &snap,
+                        const std::map<std::string, int64_t> &expect) {
+  for (auto &iter : expect) {
+    EXPECT_EQ(snap.get(iter.first), iter.second) << iter.first;
+  }
+  expect_tree(snap, expect);
+}
+
+class ArtTreeSnapshotTest : public ::testing::Test {
+ public:
+  void set(const std::string &key, int64_t val) {
+    verify_map[key] = val;
+    tree.set(key, val);
+  }
+
+  void del(const std::string &key) {
+    verify_map.erase(key);
+    tree.del(key);
+  }
+
+  std::map<std::string, int64_t> verify_map;
+  ArtTree<int64_t> tree;
+};
+
+TEST_F(ArtTreeSnapshotTest, empty_tree) {
+  auto snap = tree.snapshot();
+  set("a", 1);
+  EXPECT_EQ(snap.size(), 0);
+  EXPECT_EQ(snap.get("a"), 0);
+  EXPECT_FALSE(snap.begin().valid());
+}
+
+TEST_F(ArtTreeSnapshotTest, old_and_new_view) {
+  for (int32_t i = 0; i < 5000; i++) set(seq_key(i * 3), i + 1);
+  auto old_map = verify_map;
+  auto snap = tree.snapshot();
+
+  std::mt19937 rng(0);
+  for (int32_t i = 0; i < 5000; i++) {
+    set(seq_key(rng() % 15000), -i);
+    del(seq_key(rng() % 15000));
+  }
+  expect_view(snap, old_map);
+  expect_view(tree.snapshot(), verify_map);
+  EXPECT_GT(tree.snapshot_retired_num(), 0);
+
+  // bounded reads see the old view too
+  auto lb = snap.lower_bound(seq_key(3001));
+  ASSERT_TRUE(lb.valid());
+  EXPECT_EQ(lb.key(), seq_key(3003));
+  auto ub = snap.upper_bound(seq_key(3003));
+  ASSERT_TRUE(ub.valid());
+  EXPECT_EQ(ub.key(), seq_key(3006));
+  EXPECT_EQ(snap.max().key(), seq_key(4999 * 3));
+  uint64_t cnt = snap.scan(seq_key(300), seq_key(600),
+                           [](std::string_view, int64_t) { return true; });
+  EXPECT_EQ(cnt, 100);
+  cnt = snap.scan_prefix("key0000000001",
+                         [](std::string_view, int64_t) { return true; });
+  EXPECT_EQ(cnt, 33);
+}
+
+TEST_F(ArtTreeSnapshotTest, many_snapshots) {
+  std::vector<std::optional<ArtTree<int64_t>::Snapshot>> snaps;
+  std::vector<std::map<std::string, int64_t>> maps;
+  std::mt19937 rng(1);
+  for (int32_t round = 0; round < 8; round++) {
+    for (int32_t i = 0; i < 1000; i++) {
+      set(seq_key(rng() % 3000), round * 1000 + i + 1);
+      if (i % 3 == 0) del(seq_key(rng() % 3000));
+    }
+    snaps.emplace_back(tree.snapshot());
+    maps.push_back(verify_map);
+  }
+  // copies share the view
+  auto copy = *snaps[2];
+  for (size_t i = 0; i < snaps.size(); i++) expect_view(*snaps[i], maps[i]);
+
+  // release out of order, the rest keep their views
+  for (size_t i : {3, 0, 6, 2, 7, 1}) {
+    snaps[i].reset();
+    for (int32_t k = 0; k < 300; k++) set(seq_key(rng() % 3000), -k);
+  }
+  expect_view(*snaps[4], maps[4]);
+  expect_view(*snaps[5], maps[5]);
+  expect_view(copy, maps[2]);
+  snaps.clear();
+  EXPECT_GT(tree.snapshot_retired_num(), 0);
+  copy = tree.snapshot();
+  EXPECT_EQ(tree.snapshot_retired_num(), 0);
+  expect_view(copy, verify_map);
+}
+
+TEST_F(ArtTreeSnapshotTest, release_frees_copies) {
+  for (int32_t i = 0; i < 2000; i++) set(seq_key(i), i + 1);
+  {
+    auto snap = tree.snapshot();
+    for (int32_t i = 0; i < 2000; i += 2) del(seq_key(i));
+    for (int32_t i = 0; i < 2000; i += 3) set(seq_key(i), -i);
+    EXPECT_GT(tree.snapshot_retired_num(), 0);
+  }
+  EXPECT_EQ(tree.snapshot_retired_num(), 0);
+
+  // no snapshot, no copies
+  for (int32_t i = 0; i < 2000; i += 5) set(seq_key(i), i);
+  EXPECT_EQ(tree.snapshot_retired_num(), 0);
+  expect_view(tree.snapshot(), verify_map);
+}
+
+TEST(ArtTreeSnapshotFullPrefixTest, split_and_collapse) {
+  ArtTree<int64_t, ArtFullPrefixKeyTraits> tree;
+  std::map<std::string, int64_t> m;
+  std::string base = "https://storage.example.com/v1/accounts/";
+  for (int32_t i = 0; i < 200; i++) {
+    m[base + std::to_string(i * 7)] = i + 1;
+    tree.set(base + std::to_string(i * 7), i + 1);
+  }
+  auto snap = tree.snapshot();
+  // split long prefixes and collapse Node4s the snapshot still reads
+  for (int32_t i = 0; i < 200; i++) {
+    tree.set(base + "x" + std::to_string(i), -1);
+    tree.del(base + std::to_string(i * 7));
+  }
+  expect_view(snap, m);
+  for (int32_t i = 0; i < 200; i++) {
+    EXPECT_EQ(tree.get(base + "x" + std::to_string(i)), -1);
+  }
+}
+
+TEST_F(ArtTreeSnapshotTest, concurrent_writer) {
+  // The writer keeps a sliding window of keys [i - window, i). Any snapshot
+  // must see one contiguous window, taken between two writes.
+  const int32_t window = 100;
+  const int32_t rounds = 20000;
+  for (int32_t i = 0; i < window; i++) tree.set(seq_key(i), i + 1);
+
+  std::atomic<bool> stop{false};
+  std::thread writer([&]() {
+    for (int32_t i = window; i < rounds; i++) {
+      tree.set(seq_key(i), i + 1);
+      tree.del(seq_key(i - window));
+    }
+    stop = true;
+  });
+
+  int32_t checked = 0;
+  while (!stop.load() || checked == 0) {
+    auto snap = tree.snapshot();
+    int64_t first = -1;
+    int64_t last = -1;
+    uint64_t cnt = 0;
+    for (int32_t pass = 0; pass < 2; pass++) {
+      int64_t prev = -1;
+      cnt = 0;
+      for (auto it = snap.begin(); it.valid(); it.next()) {
+        if (prev < 0) {
+          EXPECT_TRUE(first < 0 || first == it.value());
+          first = it.value();
+        } else {
+          ASSERT_EQ(it.value(), prev + 1);
+        }
+        ASSERT_EQ(it.key(), seq_key(it.value() - 1));
+        prev = it.value();
+        cnt++;
+      }
+      EXPECT_TRUE(last < 0 || last == prev);
+      last = prev;
+    }
+    EXPECT_GE(cnt, window);
+    EXPECT_LE(cnt, window + 1);
+    EXPECT_EQ(snap.size(), cnt);
+    checked++;
+  }
+  writer.join();
+  EXPECT_EQ(tree.snapshot_retired_num(), 0);
+}
+
+TEST_F(ArtTreeSnapshotTest, release_with_concurrent_writers) {
+  // Writers decide whether to copy shared nodes as they enter. Releasing the
+  // last snapshot must not let one copy a node another updates in place.
+  const int32_t key_cnt = 64;
+  const int32_t writer_cnt = 4;
+  const int32_t rounds = 5000;
+  for (int32_t i = 0; i < key_cnt; i++) tree.set(seq_key(i), 0);
+
+  std::atomic<bool> stop{false};
+  std::thread releaser([&]() {
+    while (!stop.load()) tree.snapshot();
+  });
+  std::vector<std::thread> writers;
+  for (int32_t w = 0; w < writer_cnt; w++) {
+    writers.emplace_back([&]() {
+      for (int32_t r = 0; r < rounds; r++) {
+        for (int32_t i = 0; i < key_cnt; i++) {
+          tree.upsert(seq_key(i), [](int64_t &value, bool) {
+            value++;
+            return true;
+          });
+        }
+      }
+    });
+  }
+  for (auto &t : writers) t.join();
+  stop = true;
+  releaser.join();
+
+  for (int32_t i = 0; i < key_cnt; i++) {
+    EXPECT_EQ(tree.get(seq_key(i)), writer_cnt * rounds) << i;
+  }
+  EXPECT_EQ(tree.snapshot_retired_num(), 0);
+}
+
+}  // namespace art
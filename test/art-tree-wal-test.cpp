@@ -0,0 +1,216 @@
+#include <dirent.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "art-test-util.h"
+#include "art/art-wal.h"
+#include "common/logger.h"
+#include "gtest/gtest.h"
+
+namespace art {
+
+class ArtTreeWalTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    dir = ::testing::TempDir() + "art-wal-" + std::to_string(getpid());
+    remove_dir();
+  }
+
+  void TearDown() override { remove_dir(); }
+
+  std::vector<std::string> files() const {
+    std::vector<std::string> ret;
+    DIR *d = opendir(dir.c_str());
+    if (!d) return ret;
+    while (auto entry = readdir(d)) {
+      if (entry->d_name[0] != '.') ret.emplace_back(entry->d_name);
+    }
+    closedir(d);
+    std::sort(ret.begin(), ret.end());
+    return ret;
+  }
+
+  void remove_dir() {
+    for (auto &f : files()) std::remove((dir + "/" + f).c_str());
+    rmdir(dir.c_str());
+  }
+
+  void random_writes(ArtDurableTree<int64_t> *tree, int32_t n, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    for (int32_t i = 0; i < n; i++) {
+      auto k = "key/" + std::to_string(rng() % 5000);
+      if (rng() % 4 == 0) {
+        auto it = verify_map.find(k);
+        EXPECT_EQ(tree->del(k), it == verify_map.end() ? 0 : it->second);
+        if (it != verify_map.end()) verify_map.erase(it);
+      } else {
+        int64_t v = rng() >> 1;
+        tree->set(k, v);
+        verify_map[k] = v;
+      }
+    }
+  }
+
+  std::string dir;
+  std::map<std::string, int64_t> verify_map;
+};
+
+TEST_F(ArtTreeWalTest, recover_from_log) {
+  {
+    ArtDurableTree<int64_t> tree;
+    ASSERT_TRUE(tree.open(dir));
+    EXPECT_EQ(tree.size(), 0);
+    random_writes(&tree, 20000, 0);
+    // deleting a missing key logs nothing
+    EXPECT_EQ(tree.del("missing"), 0);
+  }
+  for (int32_t round = 0; round < 3; round++) {
+    ArtDurableTree<int64_t> tree;
+    ASSERT_TRUE(tree.open(dir));
+    expect_tree(tree.tree(), verify_map);
+    random_writes(&tree, 2000, round + 1);
+  }
+  ArtDurableTree<int64_t> tree;
+  ASSERT_TRUE(tree.open(dir));
+  expect_tree(tree.tree(), verify_map);
+}
+
+TEST_F(ArtTreeWalTest, checkpoint) {
+  {
+    ArtDurableTree<int64_t> tree;
+    ASSERT_TRUE(tree.open(dir));
+    random_writes(&tree, 10000, 0);
+    ASSERT_TRUE(tree.checkpoint());
+    random_writes(&tree, 3000, 1);
+    ASSERT_TRUE(tree.checkpoint());
+    // only the newest checkpoint and the log after it are kept
+    random_writes(&tree, 3000, 2);
+  }
+  EXPECT_EQ(files(),
+            (std::vector<std::string>{"checkpoint-3", "wal-3.log"}));
+  {
+    ArtDurableTree<int64_t> tree;
+    ASSERT_TRUE(tree.open(dir));
+    expect_tree(tree.tree(), verify_map);
+    random_writes(&tree, 1000, 3);
+  }
+  EXPECT_EQ(files(), (std::vector<std::string>{"checkpoint-3", "wal-3.log",
+                                               "wal-4.log"}));
+  ArtDurableTree<int64_t> tree;
+  ASSERT_TRUE(tree.open(dir));
+  expect_tree(tree.tree(), verify_map);
+}
+
+TEST_F(ArtTreeWalTest, torn_tail) {
+  {
+    ArtDurableTree<int64_t> tree;
+    ASSERT_TRUE(tree.open(dir));
+    for (int32_t i = 0; i < 100; i++) {
+      tree.set(std::to_string(i), i + 1);
+      verify_map[std::to_string(i)] = i + 1;
+    }
+  }
+  auto path = dir + "/wal-1.log";
+  std::string data;
+  {
+    std::ifstream in(path, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(in), {});
+  }
+  auto write = [&](const std::string &d) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(d.data(), d.size());
+  };
+
+  // the last record "99" is 4 + 1 + 4 + 2 + 8 bytes
+  write(data.substr(0, data.size() - 3));
+  verify_map.erase("99");
+  {
+    ArtDurableTree<int64_t> tree;
+    ASSERT_TRUE(tree.open(dir));
+    expect_tree(tree.tree(), verify_map);
+    tree.set("later", 1);
+    verify_map["later"] = 1;
+  }
+
+  // a bad crc ends the segment too, later segments are still replayed
+  auto bad = data;
+  bad[bad.size() - 19 - 1] ^= 1;
+  write(bad);
+  verify_map.erase("98");
+  ArtDurableTree<int64_t> tree;
+  ASSERT_TRUE(tree.open(dir));
+  expect_tree(tree.tree(), verify_map);
+}
+
+TEST_F(ArtTreeWalTest, concurrent_writers) {
+  const int32_t thread_cnt = 8;
+  const int32_t per_thread = 2000;
+  for (auto sync :
+       {ArtWalSync::SYNC, ArtWalSync::PERIODIC, ArtWalSync::NONE}) {
+    remove_dir();
+    ArtWalOptions options;
+    options.sync = sync;
+    options.sync_interval_ms = 1;
+    {
+      ArtDurableTree<int64_t> tree;
+      ASSERT_TRUE(tree.open(dir, options));
+      std::vector<std::thread> threads;
+      for (int32_t t = 0; t < thread_cnt; t++) {
+        threads.emplace_back([&tree, t]() {
+          for (int32_t i = 0; i < per_thread; i++) {
+            auto k = std::to_string(t) + "/" + std::to_string(i);
+            tree.set(k, i + 1);
+            if (i % 3 == 0) tree.del(k);
+          }
+        });
+      }
+      // checkpoints cut in between writes
+      for (int32_t i = 0; i < 3; i++) EXPECT_TRUE(tree.checkpoint());
+      for (auto &t : threads) t.join();
+      if (sync == ArtWalSync::SYNC) {
+        // writers waiting together share syncs
+        EXPECT_LT(tree.wal_sync_num(), thread_cnt * per_thread);
+      }
+    }
+    ArtDurableTree<int64_t> tree;
+    ASSERT_TRUE(tree.open(dir, options));
+    EXPECT_EQ(tree.size(), thread_cnt * (per_thread - (per_thread + 2) / 3));
+    for (int32_t t = 0; t < thread_cnt; t++) {
+      for (int32_t i = 0; i < per_thread; i++) {
+        auto k = std::to_string(t) + "/" + std::to_string(i);
+        ASSERT_EQ(tree.get(k), i % 3 == 0 ? 0 : i + 1) << k;
+      }
+    }
+  }
+}
+
+TEST_F(ArtTreeWalTest, bad_checkpoint) {
+  {
+    ArtDurableTree<int64_t> tree;
+    ASSERT_TRUE(tree.open(dir));
+    random_writes(&tree, 2000, 0);
+    ASSERT_TRUE(tree.checkpoint());
+    random_writes(&tree, 2000, 1);
+  }
+  // a checkpoint that does not load is passed over, its log is gone
+  // with it, and the tree starts from what is left
+  {
+    std::ofstream out(dir + "/checkpoint-2", std::ios::trunc);
+    out << "junk";
+  }
+  ArtDurableTree<int64_t> tree;
+  ASSERT_TRUE(tree.open(dir));
+  EXPECT_LE(tree.size(), verify_map.size());
+  for (auto it = tree.tree().begin(); it.valid(); it.next()) {
+    EXPECT_EQ(verify_map[std::string(it.key())], it.value());
+  }
+}
+
+}  // namespace art